@@ -0,0 +1,163 @@
+// Measures the throughput of regex_match_batch() on short fields as the number
+// of threads grows from 1 to N, against one regex_match_bytes() call per field
+// and against the interleaved regex_match_many() on one thread.
+//
+// Usage: batch_bench [fields] [max threads] [iterations]
+
+#include <regexp.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FIELD_LEN 32
+#define NUM_KEYWORDS 300
+
+static const char *patterns[] = {
+    "^[a-z0-9.]+@[a-z]+\\.com$",
+    "^\\d\\d\\d\\d-\\d\\d-\\d\\d$",
+    "^[A-F0-9]+-[A-F0-9]+$",
+    NULL,   // NUM_KEYWORDS alternatives, whose DFA table no longer fits in L1
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// word1|word2|... of random 8-letter words
+static char *make_keywords(void) {
+    char *pattern = malloc(NUM_KEYWORDS * 9);
+    if (pattern == NULL) {
+        fprintf(stderr, "batch_bench  Error: failed to allocate pattern\n");
+        exit(1);
+    }
+    unsigned int seed = 99;
+    for (size_t w = 0; w < NUM_KEYWORDS; w++) {
+        for (size_t i = 0; i < 8; i++) {
+            seed = seed * 1103515245 + 12345;
+            pattern[w * 9 + i] = 'a' + (seed >> 16) % 26;
+        }
+        pattern[w * 9 + 8] = w + 1 < NUM_KEYWORDS ? '|' : '\0';
+    }
+    return pattern;
+}
+
+// A mix of emails, dates and IDs, so each pattern matches about a third of them
+static char *make_fields(size_t num_fields, const char **inputs, size_t *lens) {
+    char *storage = malloc(num_fields * FIELD_LEN);
+    if (storage == NULL) {
+        fprintf(stderr, "batch_bench  Error: failed to allocate fields\n");
+        exit(1);
+    }
+    unsigned int seed = 12345;
+    for (size_t i = 0; i < num_fields; i++) {
+        seed = seed * 1103515245 + 12345;
+        unsigned int r = (seed >> 16) & 0x7fff;
+        char *field = storage + i * FIELD_LEN;
+        int n;
+        switch (i % 3) {
+            case 0:
+                n = snprintf(field, FIELD_LEN, "user.%u@example.com", r);
+                break;
+            case 1:
+                n = snprintf(field, FIELD_LEN, "20%02u-%02u-%02u", r % 100, r % 12 + 1, r % 28 + 1);
+                break;
+            default:
+                n = snprintf(field, FIELD_LEN, "%X-%X", r * 2654435761u, r);
+                break;
+        }
+        inputs[i] = field;
+        lens[i] = (size_t)n;
+    }
+    return storage;
+}
+
+int main(int argc, char **argv) {
+    size_t num_fields = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t max_threads = argc > 2 ? strtoul(argv[2], NULL, 10) : (cpus > 0 ? (size_t)cpus : 1);
+    int iterations = argc > 3 ? atoi(argv[3]) : 5;
+
+    const char **inputs = malloc(num_fields * sizeof(char*));
+    size_t *lens = malloc(num_fields * sizeof(size_t));
+    bool *out = malloc(num_fields * sizeof(bool));
+    if (inputs == NULL || lens == NULL || out == NULL) {
+        fprintf(stderr, "batch_bench  Error: failed to allocate batch\n");
+        exit(1);
+    }
+    char *storage = make_fields(num_fields, inputs, lens);
+    char *keywords = make_keywords();
+    patterns[sizeof(patterns) / sizeof(patterns[0]) - 1] = keywords;
+
+    printf("%-28s %8s %10s %14s %8s\n", "pattern", "threads", "matches", "Mfields/s", "speedup");
+    for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+        Regex *re = regex_compile(patterns[p]);
+        if (re == NULL) {
+            fprintf(stderr, "batch_bench  Error: could not compile %s\n", patterns[p]);
+            return 1;
+        }
+
+        size_t expected = 0;
+        double start = now_seconds();
+        for (int it = 0; it < iterations; it++) {
+            expected = 0;
+            for (size_t i = 0; i < num_fields; i++) {
+                expected += regex_match_bytes(re, (const uint8_t*)inputs[i], lens[i]);
+            }
+        }
+        double base = now_seconds() - start;
+        double total = (double)num_fields * iterations / 1e6;
+        printf("%-28.28s %8s %10zu %14.2f %7.1fx\n", patterns[p], "single", expected, total / base, 1.0);
+
+        // Interleaved DFA on the calling thread only
+        const uint8_t **data = (const uint8_t**)inputs;
+        start = now_seconds();
+        for (int it = 0; it < iterations; it++) {
+            regex_match_many(re, data, lens, num_fields, out);
+        }
+        double elapsed = now_seconds() - start;
+        size_t matches = 0;
+        for (size_t i = 0; i < num_fields; i++) {
+            matches += out[i];
+        }
+        if (matches != expected) {
+            fprintf(stderr, "batch_bench  Error: interleaved results differ for %s\n", patterns[p]);
+            return 1;
+        }
+        printf("%-28.28s %8s %10zu %14.2f %7.1fx\n", patterns[p], "many", matches, total / elapsed,
+               base / elapsed);
+
+        for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+            RegexParallelOptions options = regex_parallel_default_options();
+            options.num_threads = threads;
+            start = now_seconds();
+            for (int it = 0; it < iterations; it++) {
+                regex_match_batch_with_options(re, inputs, lens, num_fields, out, &options);
+            }
+            double elapsed = now_seconds() - start;
+
+            size_t matches = 0;
+            for (size_t i = 0; i < num_fields; i++) {
+                matches += out[i];
+            }
+            if (matches != expected) {
+                fprintf(stderr, "batch_bench  Error: results differ for %s\n", patterns[p]);
+                return 1;
+            }
+            printf("%-28.28s %8zu %10zu %14.2f %7.1fx\n", patterns[p], threads, matches, total / elapsed,
+                   base / elapsed);
+        }
+        regex_free(re);
+    }
+
+    free(keywords);
+    free(storage);
+    free(out);
+    free(lens);
+    free(inputs);
+    return 0;
+}
@@ -0,0 +1,88 @@
+// Compares NFA matching with per-byte closure DFS against precomputed closures.
+//
+// Usage: closure_bench [input_bytes] [iterations]
+
+#include <regexp.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char *patterns[] = {
+    "ERROR: (?<code>\\d+)",
+    "(\\w+)@(\\w+)\\.com",
+    "(a|b|c|d|e|f|g|h)*x",
+    "^(\\d+\\.)*\\d+ [^ ]* (GET|POST) /api/(\\w|/)*$",
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static char *make_input(size_t len) {
+    static const char alphabet[] = "abcdefgh ijklmnop.qrstuvwxyz0123456789/";
+    char *input = malloc(len + 1);
+    if (input == NULL) {
+        fprintf(stderr, "closure_bench  Error: failed to allocate input\n");
+        exit(1);
+    }
+    unsigned int seed = 12345;
+    for (size_t i = 0; i < len; i++) {
+        seed = seed * 1103515245 + 12345;
+        input[i] = alphabet[(seed >> 16) % (sizeof(alphabet) - 1)];
+    }
+    input[len] = '\0';
+    return input;
+}
+
+// Returns the throughput in MB/s
+static double run(const Program *prog, const char *input, size_t len, int iterations, bool *result) {
+    MatchScratch *scratch = match_scratch_new(prog);
+    double start = now_seconds();
+    for (int i = 0; i < iterations; i++) {
+        *result = program_match_with_scratch(prog, scratch, input);
+    }
+    double elapsed = now_seconds() - start;
+    match_scratch_free(scratch);
+    return (double)len * iterations / elapsed / 1e6;
+}
+
+int main(int argc, char **argv) {
+    size_t len = argc > 1 ? strtoul(argv[1], NULL, 10) : 64 * 1024;
+    int iterations = argc > 2 ? atoi(argv[2]) : 20;
+    char *input = make_input(len);
+
+    printf("%-50s %12s %12s %8s\n", "pattern", "dfs MB/s", "closure MB/s", "speedup");
+    for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+        AstNode *tree = parse(patterns[p]);
+        NfaFragment nfa = compile_ast(tree);
+
+        ProgramOptions options = program_default_options();
+        Program *dfs = compile_program_with_options(nfa, &options);
+        options.precompute_closures = true;
+        Program *closures = compile_program_with_options(nfa, &options);
+
+        bool dfs_result = false;
+        bool closure_result = false;
+        double dfs_rate = run(dfs, input, len, iterations, &dfs_result);
+        double closure_rate = run(closures, input, len, iterations, &closure_result);
+        if (dfs_result != closure_result) {
+            fprintf(stderr, "closure_bench  Error: results differ for %s\n", patterns[p]);
+            return 1;
+        }
+
+        printf("%-50s %12.1f %12.1f %7.2fx%s\n", patterns[p], dfs_rate, closure_rate, closure_rate / dfs_rate,
+               closures->closure_start == NULL ? " (closures over limit)" : "");
+
+        free_program(closures);
+        free_program(dfs);
+        free_nfa(nfa.start);
+        free_ast(tree);
+    }
+
+    free(input);
+    return 0;
+}
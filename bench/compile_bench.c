@@ -0,0 +1,51 @@
+// Measures how fast ad-hoc patterns are compiled and freed, the cost paid by
+// callers that build a Regex per user query.
+//
+// Usage: compile_bench [rounds]
+
+#include <regexp.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static const char *patterns[] = {
+    "error",
+    "user_id=\\d+",
+    "^GET /api/\\w+ HTTP/1\\.[01]$",
+    "(?<year>\\d{4})-(?<month>\\d\\d)-(?<day>\\d\\d)",
+    "[a-z0-9._]+@[a-z0-9]+\\.(com|org|net)",
+    "(foo|bar|baz|qux|quux|corge|grault|garply)+",
+    "timed? ?out after \\d+ ?ms",
+    "[^\\s]+\\.(jpg|jpeg|png|gif)",
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    size_t rounds = argc > 1 ? strtoul(argv[1], NULL, 10) : 2000;
+    size_t num_patterns = sizeof(patterns) / sizeof(patterns[0]);
+
+    printf("%-44s %14s\n", "pattern", "compiles/s");
+    double total = 0;
+    for (size_t p = 0; p < num_patterns; p++) {
+        double start = now_seconds();
+        for (size_t r = 0; r < rounds; r++) {
+            Regex *re = regex_compile(patterns[p]);
+            if (re == NULL) {
+                fprintf(stderr, "compile_bench  Error: could not compile %s\n", patterns[p]);
+                return 1;
+            }
+            regex_free(re);
+        }
+        double elapsed = now_seconds() - start;
+        total += elapsed;
+        printf("%-44s %14.0f\n", patterns[p], rounds / elapsed);
+    }
+    printf("%-44s %14.0f\n", "all", rounds * num_patterns / total);
+    return 0;
+}
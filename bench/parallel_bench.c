@@ -0,0 +1,102 @@
+// Measures how a chunked parallel scan of one large log buffer scales with the
+// number of threads, against a sequential regex_find_all() walk.
+//
+// Usage: parallel_bench [megabytes] [max threads]
+
+#include <regexp.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *patterns[] = {
+    "ERROR: \\d+",
+    "user_id=\\d+",
+    "\\d+\\.\\d+\\.\\d+\\.\\d+",
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Log lines of about 100 bytes; one in 20 is an error
+static char *make_log(size_t len) {
+    static const char *lines[] = {
+        "2024-05-01T12:00:00 INFO  GET /api/users user_id=42 from 10.0.0.17 took 12ms\n",
+        "2024-05-01T12:00:01 DEBUG cache hit for key session:8f2e, refreshed at 1714564801\n",
+        "2024-05-01T12:00:02 INFO  POST /api/orders accepted, queue depth now 3\n",
+    };
+    static const char error_line[] = "2024-05-01T12:00:03 ERROR: 503 upstream timed out after 30000ms\n";
+
+    char *buf = malloc(len);
+    if (buf == NULL) {
+        fprintf(stderr, "parallel_bench  Error: failed to allocate buffer\n");
+        exit(1);
+    }
+    size_t pos = 0;
+    for (size_t l = 0; pos < len; l++) {
+        const char *line = l % 20 == 19 ? error_line : lines[l % 3];
+        size_t n = strlen(line);
+        if (n > len - pos) {
+            n = len - pos;
+        }
+        memcpy(buf + pos, line, n);
+        pos += n;
+    }
+    return buf;
+}
+
+static void count_match(size_t start, size_t end, void *user_data) {
+    (void)start;
+    (void)end;
+    (*(size_t*)user_data)++;
+}
+
+int main(int argc, char **argv) {
+    size_t megabytes = argc > 1 ? strtoul(argv[1], NULL, 10) : 256;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t max_threads = argc > 2 ? strtoul(argv[2], NULL, 10) : (cpus > 0 ? (size_t)cpus : 1);
+    size_t len = megabytes * 1024 * 1024;
+    char *buf = make_log(len);
+
+    printf("%-28s %8s %10s %12s %8s\n", "pattern", "threads", "matches", "MB/s", "speedup");
+    for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+        Regex *re = regex_compile(patterns[p]);
+        if (re == NULL) {
+            fprintf(stderr, "parallel_bench  Error: could not compile %s\n", patterns[p]);
+            return 1;
+        }
+
+        size_t expected = 0;
+        double start = now_seconds();
+        RegexFindIter iter = regex_find_all(re, buf, len);
+        while (regex_find_next(&iter, NULL, NULL)) {
+            expected++;
+        }
+        double base = now_seconds() - start;
+        printf("%-28s %8s %10zu %12.1f %7.1fx\n", patterns[p], "seq", expected, megabytes / base, 1.0);
+
+        for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+            RegexParallelOptions options = regex_parallel_default_options();
+            options.num_threads = threads;
+            size_t matches = 0;
+            start = now_seconds();
+            regex_find_all_parallel(re, buf, len, &options, count_match, &matches);
+            double elapsed = now_seconds() - start;
+            if (matches != expected) {
+                fprintf(stderr, "parallel_bench  Error: results differ for %s\n", patterns[p]);
+                return 1;
+            }
+            printf("%-28s %8zu %10zu %12.1f %7.1fx\n", patterns[p], threads, matches, megabytes / elapsed,
+                   base / elapsed);
+        }
+        regex_free(re);
+    }
+
+    free(buf);
+    return 0;
+}
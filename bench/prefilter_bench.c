@@ -0,0 +1,115 @@
+// Compares the lazy DFA with and without literal prefix skip-ahead on 4 KB lines
+// where only a few lines contain the prefix.
+//
+// Usage: prefilter_bench [lines] [iterations]
+
+#include <regexp.h>
+#include <engine_internal.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LINE_LEN 4096
+
+static const char *patterns[] = {
+    "ERROR: (?<code>\\d+)",
+    "GET /api/\\w+",
+    "user_id=\\d+",
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// One line in 50 carries each pattern's literal near its end
+static char **make_lines(size_t num_lines) {
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789 =:/.-";
+    char **lines = malloc(num_lines * sizeof(char*));
+    if (lines == NULL) {
+        fprintf(stderr, "prefilter_bench  Error: failed to allocate lines\n");
+        exit(1);
+    }
+    unsigned int seed = 12345;
+    for (size_t l = 0; l < num_lines; l++) {
+        lines[l] = malloc(LINE_LEN + 1);
+        if (lines[l] == NULL) {
+            fprintf(stderr, "prefilter_bench  Error: failed to allocate line\n");
+            exit(1);
+        }
+        for (size_t i = 0; i < LINE_LEN; i++) {
+            seed = seed * 1103515245 + 12345;
+            lines[l][i] = alphabet[(seed >> 16) % (sizeof(alphabet) - 1)];
+        }
+        lines[l][LINE_LEN] = '\0';
+        if (l % 50 == 0) {
+            memcpy(lines[l] + LINE_LEN - 100, "ERROR: 503 GET /api/users user_id=42", 37);
+        }
+    }
+    return lines;
+}
+
+typedef bool (*MatchFn)(const Regex *re, RegexScratch *scratch, const char *input);
+
+static bool match_dfa(const Regex *re, RegexScratch *scratch, const char *input) {
+    (void)re;
+    return lazy_dfa_match(scratch->dfa, input);
+}
+
+static bool match_prefix(const Regex *re, RegexScratch *scratch, const char *input) {
+    return lazy_dfa_match_prefix(scratch->dfa, input, &re->prefix);
+}
+
+// Returns the throughput in MB/s and the number of matching lines
+static double run(const Regex *re, RegexScratch *scratch, MatchFn fn, char **lines, size_t num_lines, int iterations, size_t *matches) {
+    *matches = 0;
+    double start = now_seconds();
+    for (int it = 0; it < iterations; it++) {
+        for (size_t l = 0; l < num_lines; l++) {
+            if (fn(re, scratch, lines[l])) {
+                (*matches)++;
+            }
+        }
+    }
+    double elapsed = now_seconds() - start;
+    return (double)LINE_LEN * num_lines * iterations / elapsed / 1e6;
+}
+
+int main(int argc, char **argv) {
+    size_t num_lines = argc > 1 ? strtoul(argv[1], NULL, 10) : 2000;
+    int iterations = argc > 2 ? atoi(argv[2]) : 5;
+    char **lines = make_lines(num_lines);
+
+    printf("%-24s %10s %12s %12s %8s\n", "pattern", "prefix", "dfa MB/s", "skip MB/s", "speedup");
+    for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+        Regex *re = regex_compile(patterns[p]);
+        RegexScratch *scratch = regex_scratch_new(re);
+        if (re == NULL || scratch->dfa == NULL) {
+            fprintf(stderr, "prefilter_bench  Error: could not compile %s\n", patterns[p]);
+            return 1;
+        }
+
+        size_t dfa_matches = 0;
+        size_t skip_matches = 0;
+        double dfa_rate = run(re, scratch, match_dfa, lines, num_lines, iterations, &dfa_matches);
+        double skip_rate = run(re, scratch, match_prefix, lines, num_lines, iterations, &skip_matches);
+        if (dfa_matches != skip_matches) {
+            fprintf(stderr, "prefilter_bench  Error: results differ for %s\n", patterns[p]);
+            return 1;
+        }
+
+        printf("%-24s %10.*s %12.1f %12.1f %7.1fx\n", patterns[p], (int)re->prefix.len, re->prefix.bytes,
+               dfa_rate, skip_rate, skip_rate / dfa_rate);
+        regex_scratch_free(scratch);
+        regex_free(re);
+    }
+
+    for (size_t l = 0; l < num_lines; l++) {
+        free(lines[l]);
+    }
+    free(lines);
+    return 0;
+}
@@ -0,0 +1,121 @@
+// Compares grep-style scanning of a log file: splitting it into lines and
+// calling regex_match() on each, against regex_scan_file() searching the
+// whole mapping and locating lines only for the matches.
+//
+// Usage: scan_bench [megabytes]
+
+#include <regexp.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *patterns[] = {
+    "ERROR: \\d+",
+    "user_id=\\d+",
+    "timed out",
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Writes a log of about megabytes MB to a temporary file and returns its path
+static char *make_log_file(size_t megabytes) {
+    static const char *lines[] = {
+        "2024-05-01T12:00:00 INFO  GET /api/users user_id=42 from 10.0.0.17 took 12ms\n",
+        "2024-05-01T12:00:01 DEBUG cache hit for key session:8f2e, refreshed at 1714564801\n",
+        "2024-05-01T12:00:02 INFO  POST /api/orders accepted, queue depth now 3\n",
+    };
+    static const char error_line[] = "2024-05-01T12:00:03 ERROR: 503 upstream timed out after 30000ms\n";
+
+    char *path = strdup("/tmp/scan_benchXXXXXX");
+    int fd = path != NULL ? mkstemp(path) : -1;
+    FILE *file = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (file == NULL) {
+        fprintf(stderr, "scan_bench  Error: failed to create log file\n");
+        exit(1);
+    }
+    size_t written = 0;
+    for (size_t l = 0; written < megabytes * 1024 * 1024; l++) {
+        const char *line = l % 200 == 199 ? error_line : lines[l % 3];
+        fputs(line, file);
+        written += strlen(line);
+    }
+    fclose(file);
+    return path;
+}
+
+static bool count_line(const RegexLineMatch *match, void *user_data) {
+    // Count each matching line once, like grep -c
+    uint64_t *last_line = user_data;
+    if (match->line_number != last_line[0]) {
+        last_line[0] = match->line_number;
+        last_line[1]++;
+    }
+    return true;
+}
+
+// Reads the file line by line and matches each line on its own
+static size_t split_and_match(Regex *re, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "scan_bench  Error: failed to open %s\n", path);
+        exit(1);
+    }
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t len;
+    size_t matches = 0;
+    while ((len = getline(&line, &capacity, file)) >= 0) {
+        if (len > 0 && line[len - 1] == '\n') {
+            line[len - 1] = '\0';
+        }
+        matches += regex_match(re, line);
+    }
+    free(line);
+    fclose(file);
+    return matches;
+}
+
+int main(int argc, char **argv) {
+    size_t megabytes = argc > 1 ? strtoul(argv[1], NULL, 10) : 128;
+    char *path = make_log_file(megabytes);
+
+    printf("%-16s %10s %14s %14s %8s\n", "pattern", "lines", "split MB/s", "scan MB/s", "speedup");
+    for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+        Regex *re = regex_compile(patterns[p]);
+        if (re == NULL) {
+            fprintf(stderr, "scan_bench  Error: could not compile %s\n", patterns[p]);
+            return 1;
+        }
+
+        double start = now_seconds();
+        size_t split_lines = split_and_match(re, path);
+        double split = now_seconds() - start;
+
+        uint64_t counts[2] = {0, 0};
+        start = now_seconds();
+        if (!regex_scan_file(re, path, count_line, counts)) {
+            fprintf(stderr, "scan_bench  Error: failed to scan %s\n", path);
+            return 1;
+        }
+        double scan = now_seconds() - start;
+        if (counts[1] != split_lines) {
+            fprintf(stderr, "scan_bench  Error: results differ for %s\n", patterns[p]);
+            return 1;
+        }
+
+        printf("%-16s %10zu %14.1f %14.1f %7.1fx\n", patterns[p], split_lines, megabytes / split,
+               megabytes / scan, split / scan);
+        regex_free(re);
+    }
+
+    unlink(path);
+    free(path);
+    return 0;
+}
@@ -0,0 +1,170 @@
+// Measures regex_match_bytes() on one Regex shared by 1 to N threads, each
+// matching its own share of short fields. Every call takes a scratch from the
+// Regex's pool and returns it, so this shows what the pool costs against a
+// scratch held by the thread, and whether throughput grows with the threads. Each
+// thread count starts on a fresh Regex, and the size its lazy DFA cache ends up
+// at shows that the threads build the states once between them.
+//
+// Usage: shared_bench [fields] [max threads] [iterations]
+
+#include <regexp.h>
+#include <engine_internal.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FIELD_LEN 32
+
+static const char *patterns[] = {
+    "^[a-z0-9.]+@[a-z]+\\.com$",
+    "\\d\\d\\d\\d-\\d\\d-\\d\\d",
+    "(?<key>\\w+)=(?<value>\\d+)",
+};
+
+typedef struct {
+    const Regex *re;
+    const char **inputs;
+    const size_t *lens;
+    size_t begin;
+    size_t end;
+    int iterations;
+    bool pooled;    // Match through the pool rather than with a scratch of its own
+    size_t matches;
+} Worker;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Emails, dates and key=value pairs in turn
+static char *make_fields(size_t num_fields, const char **inputs, size_t *lens) {
+    char *storage = malloc(num_fields * FIELD_LEN);
+    if (storage == NULL) {
+        fprintf(stderr, "shared_bench  Error: failed to allocate fields\n");
+        exit(1);
+    }
+    unsigned int seed = 12345;
+    for (size_t i = 0; i < num_fields; i++) {
+        seed = seed * 1103515245 + 12345;
+        unsigned int r = (seed >> 16) & 0x7fff;
+        char *field = storage + i * FIELD_LEN;
+        int n;
+        switch (i % 3) {
+            case 0:
+                n = snprintf(field, FIELD_LEN, "user.%u@example.com", r);
+                break;
+            case 1:
+                n = snprintf(field, FIELD_LEN, "on 20%02u-%02u-%02u", r % 100, r % 12 + 1, r % 28 + 1);
+                break;
+            default:
+                n = snprintf(field, FIELD_LEN, "retry_%u=%u", r % 50, r);
+                break;
+        }
+        inputs[i] = field;
+        lens[i] = (size_t)n;
+    }
+    return storage;
+}
+
+static void *run_worker(void *arg) {
+    Worker *worker = arg;
+    RegexScratch *scratch = worker->pooled ? NULL : regex_scratch_new(worker->re);
+    worker->matches = 0;
+    for (int it = 0; it < worker->iterations; it++) {
+        for (size_t i = worker->begin; i < worker->end; i++) {
+            const uint8_t *data = (const uint8_t*)worker->inputs[i];
+            worker->matches += worker->pooled
+                ? regex_match_bytes(worker->re, data, worker->lens[i])
+                : regex_match_with_scratch_bytes(worker->re, scratch, data, worker->lens[i]);
+        }
+    }
+    regex_scratch_free(scratch);
+    return NULL;
+}
+
+// Returns the elapsed seconds and the number of matches in one iteration
+static double run(const Regex *re, const char **inputs, const size_t *lens, size_t num_fields, size_t threads,
+                  int iterations, bool pooled, size_t *matches) {
+    Worker *workers = malloc(threads * sizeof(Worker));
+    pthread_t *ids = malloc(threads * sizeof(pthread_t));
+    if (workers == NULL || ids == NULL) {
+        fprintf(stderr, "shared_bench  Error: failed to allocate workers\n");
+        exit(1);
+    }
+    double start = now_seconds();
+    for (size_t t = 0; t < threads; t++) {
+        Worker worker = {re, inputs, lens, num_fields * t / threads, num_fields * (t + 1) / threads,
+                         iterations, pooled, 0};
+        workers[t] = worker;
+        if (pthread_create(&ids[t], NULL, run_worker, &workers[t]) != 0) {
+            fprintf(stderr, "shared_bench  Error: failed to start worker thread\n");
+            exit(1);
+        }
+    }
+    *matches = 0;
+    for (size_t t = 0; t < threads; t++) {
+        pthread_join(ids[t], NULL);
+        *matches += workers[t].matches / iterations;
+    }
+    double elapsed = now_seconds() - start;
+    free(ids);
+    free(workers);
+    return elapsed;
+}
+
+int main(int argc, char **argv) {
+    size_t num_fields = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t max_threads = argc > 2 ? strtoul(argv[2], NULL, 10) : (cpus > 0 ? (size_t)cpus : 1);
+    int iterations = argc > 3 ? atoi(argv[3]) : 5;
+
+    const char **inputs = malloc(num_fields * sizeof(char*));
+    size_t *lens = malloc(num_fields * sizeof(size_t));
+    if (inputs == NULL || lens == NULL) {
+        fprintf(stderr, "shared_bench  Error: failed to allocate fields\n");
+        exit(1);
+    }
+    char *storage = make_fields(num_fields, inputs, lens);
+    double total = (double)num_fields * iterations / 1e6;
+
+    printf("%-28s %8s %10s %14s %14s %8s %8s\n", "pattern", "threads", "matches", "own Mcalls/s", "pool Mcalls/s",
+           "scaling", "DFA KB");
+    for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+        double single = 0;
+        for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+            Regex *re = regex_compile(patterns[p]);
+            if (re == NULL) {
+                fprintf(stderr, "shared_bench  Error: could not compile %s\n", patterns[p]);
+                return 1;
+            }
+            size_t own_matches;
+            size_t pool_matches;
+            double own = run(re, inputs, lens, num_fields, threads, iterations, false, &own_matches);
+            double pool = run(re, inputs, lens, num_fields, threads, iterations, true, &pool_matches);
+            if (own_matches != pool_matches) {
+                fprintf(stderr, "shared_bench  Error: results differ for %s\n", patterns[p]);
+                return 1;
+            }
+            if (threads == 1) {
+                single = pool;
+            }
+            RegexScratch *scratch = regex_scratch_acquire(re);
+            size_t cache_bytes = lazy_dfa_stats(scratch->dfa).cache_bytes;
+            regex_scratch_release(scratch);
+            printf("%-28.28s %8zu %10zu %14.2f %14.2f %7.1fx %8.1f\n", patterns[p], threads, pool_matches,
+                   total / own, total / pool, single / pool, cache_bytes / 1024.0);
+            regex_free(re);
+        }
+    }
+
+    free(storage);
+    free(lens);
+    free(inputs);
+    return 0;
+}
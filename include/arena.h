@@ -0,0 +1,33 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator for the parts of a compiled pattern: AST nodes, NFA states and
+// transitions, classes and names. Objects are carved out of a few large blocks in
+// the order they are made and are all freed together, never one by one.
+typedef struct Arena Arena;
+
+// Size of an arena's first block, which is allocated together with the arena.
+// Later blocks double in size up to ARENA_MAX_BLOCK.
+#define ARENA_FIRST_BLOCK 4096
+#define ARENA_MAX_BLOCK (64 * 1024)
+
+Arena *arena_new(void);
+
+// Memory aligned for any type. Never returns NULL.
+void *arena_alloc(Arena *arena, size_t size);
+
+// A NUL-terminated copy of the first len bytes of str
+char *arena_strndup(Arena *arena, const char *str, size_t len);
+
+// Bytes reserved from malloc, counting blocks not yet filled
+size_t arena_bytes(const Arena *arena);
+
+// Frees everything allocated from the arena but keeps its first block, so the
+// arena can be reused without going back to malloc
+void arena_reset(Arena *arena);
+
+void arena_free(Arena *arena);
+
+#endif //ARENA_H
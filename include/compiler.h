@@ -6,6 +6,9 @@
 #define COMPILER_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
 #include "parser.h"
 
 
@@ -20,7 +23,7 @@ typedef struct Transition {
     char symbol;
     struct NfaState *to;
     // For character classes: if symbol == CHAR_CLASS, use these fields
-    bool *char_class_set;     // Pointer to the character set bitmap
+    uint64_t *char_class_set; // 256-bit set: bit c is set for each byte c in the class
     bool char_class_negated;  // Whether the class is negated
     // For capture groups: if symbol == CAPTURE_START or CAPTURE_END
     char *capture_name;       // Name of the capture group
@@ -33,6 +36,7 @@ typedef struct NfaState {
 
     Transition *out1;
     Transition *out2;
+    Arena *arena;    // Set on the start state of compile_ast() results, which own their arena
 } NfaState;
 
 typedef struct NfaFragment {
@@ -40,26 +44,37 @@ typedef struct NfaFragment {
     NfaState *accept;
 } NfaFragment;
 
-NfaFragment create_literal_fragment(char c, unsigned long *next_state_id);
+NfaFragment create_literal_fragment(Arena *arena, char c, unsigned long *next_state_id);
 
-NfaFragment create_wildcard_fragment(unsigned long *next_state_id);
+NfaFragment create_wildcard_fragment(Arena *arena, unsigned long *next_state_id);
 
-NfaFragment create_char_class_fragment(bool negated, bool char_set[256], unsigned long *next_state_id);
+NfaFragment create_char_class_fragment(Arena *arena, bool negated, const uint64_t char_set[4], unsigned long *next_state_id);
 
-NfaFragment create_capture_group_fragment(const char *name, int capture_id, NfaFragment child_frag, unsigned long *next_state_id);
+NfaFragment create_capture_group_fragment(Arena *arena, const char *name, int capture_id, NfaFragment child_frag, unsigned long *next_state_id);
 
-NfaFragment create_concat_fragment(NfaFragment frag1, NfaFragment frag2);
+NfaFragment create_concat_fragment(Arena *arena, NfaFragment frag1, NfaFragment frag2);
 
-NfaFragment create_alternation_fragment(NfaFragment frag1, NfaFragment frag2, unsigned long *next_state_id);
+NfaFragment create_alternation_fragment(Arena *arena, NfaFragment frag1, NfaFragment frag2, unsigned long *next_state_id);
 
-NfaFragment create_start_fragment(NfaFragment frag, unsigned long *next_state_id);
+NfaFragment create_star_fragment(Arena *arena, NfaFragment frag, unsigned long *next_state_id);
 
-NfaFragment create_plus_fragment(NfaFragment frag, unsigned long *next_state_id);
+NfaFragment create_plus_fragment(Arena *arena, NfaFragment frag, unsigned long *next_state_id);
 
-NfaFragment create_option_fragment(NfaFragment frag, unsigned long *next_state_id);
+NfaFragment create_option_fragment(Arena *arena, NfaFragment frag, unsigned long *next_state_id);
 
+// Compiles into an arena of its own, which free_nfa() releases
 NfaFragment compile_ast(AstNode* node);
 
+// Compiles the NFA of the reversed language: it accepts exactly the reversals of
+// the strings the pattern accepts. Capture groups are compiled without saves.
+NfaFragment compile_ast_reverse(AstNode* node);
+
+// The same, allocating from the caller's arena. Several NFAs can share one
+// arena; they live until arena_free(), and free_nfa() leaves them alone.
+NfaFragment compile_ast_into(Arena *arena, AstNode* node);
+NfaFragment compile_ast_reverse_into(Arena *arena, AstNode* node);
+
+// Frees an NFA from compile_ast() or compile_ast_reverse() in one step
 void free_nfa(NfaState *start);
 
 void print_nfa(NfaState *start_state);
@@ -0,0 +1,186 @@
+#ifndef DFA_H
+#define DFA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "prefilter.h"
+#include "program.h"
+
+// Default memory budget for a lazy DFA's state cache (transition tables + state sets)
+#define LAZY_DFA_DEFAULT_CACHE_SIZE (2 * 1024 * 1024)
+
+// A DFA built on demand from the NFA while matching. States are subsets of NFA
+// states and are cached together with their transitions; once the cache would
+// exceed its budget it is flushed and rebuilt from the current position. If
+// flushing keeps happening the matcher finishes the input on the NFA instead.
+// A LazyDfa is a handle on the cache: one thread at a time matches through it,
+// but handles from lazy_dfa_share() let several threads use one cache.
+typedef struct LazyDfa LazyDfa;
+
+typedef struct {
+    size_t states_built;   // DFA states created since lazy_dfa_new()
+    size_t cache_flushes;  // Times the state cache was cleared to stay in budget
+    size_t nfa_fallbacks;  // Matches that gave up on the cache and finished on the NFA
+    size_t cache_bytes;    // Memory the cached states take up now
+} LazyDfaStats;
+
+// The program must outlive the returned LazyDfa. Returns NULL if cache_size is too
+// small to hold a working set of states. cache_size bounds the cache as a whole,
+// shared or not; see lazy_dfa_share().
+LazyDfa *lazy_dfa_new(const Program *prog, size_t cache_size);
+
+// Another handle on dfa's cache, with working memory of its own, for another
+// thread to match with while dfa is in use. The threads build each state once
+// between them and the budget covers them all. Cached transitions are followed
+// with a plain load, without locks or atomic read-modify-writes; a new state is
+// added under one of a few locks picked by its NFA set, so threads building
+// different states seldom wait for each other. A full cache is flushed in place
+// if no other handle is in a call; otherwise the flush goes to a second set of
+// states while the other threads finish their calls in the old one. Once the
+// cache is shared, each set gets half the budget, so the two stay within it
+// together; states built before that which don't fit in half are flushed. Works
+// with every kind of lazy DFA below. The first call must be made before dfa is
+// used by a second thread.
+// Handles are freed with lazy_dfa_free() in any order; the cache goes with the
+// last.
+LazyDfa *lazy_dfa_share(LazyDfa *dfa);
+
+// Like the matcher, every entry point has a _bytes variant that matches exactly
+// len bytes, NULs included, instead of a NUL-terminated string
+bool lazy_dfa_match(LazyDfa *dfa, const char *input);
+bool lazy_dfa_match_bytes(LazyDfa *dfa, const uint8_t *data, size_t len);
+
+// Like lazy_dfa_match(), but uses the pattern's literal prefix to skip input:
+// whenever the DFA is back in its start state it jumps to the next occurrence
+// of the prefix, and once a pattern ending in .* has matched it stops reading.
+// prefix must come from the AST the program was compiled from.
+bool lazy_dfa_match_prefix(LazyDfa *dfa, const char *input, const LiteralPrefix *prefix);
+bool lazy_dfa_match_prefix_bytes(LazyDfa *dfa, const uint8_t *data, size_t len, const LiteralPrefix *prefix);
+
+// Number of inputs lazy_dfa_match_many() steps through the table side by side
+#define LAZY_DFA_LANES 8
+
+// Sets out[i] to whether inputs[i] (lens[i] bytes) matches, like
+// lazy_dfa_match_bytes(). Up to LAZY_DFA_LANES inputs advance together one byte
+// per round, so the table lookup for one input overlaps the others' instead of
+// waiting for it. This pays off once the cached states no longer fit in L1;
+// below that the extra bookkeeping costs more than the overlap saves.
+void lazy_dfa_match_many(LazyDfa *dfa, const uint8_t *const *inputs, const size_t *lens, size_t n, bool *out);
+
+// For programs from compile_program_set(): sets bit i of matched (PATTERN_SET_WORDS
+// words) for every pattern i that matches. Returns whether any pattern matched.
+bool lazy_dfa_match_set(LazyDfa *dfa, const char *input, uint64_t *matched);
+bool lazy_dfa_match_set_bytes(LazyDfa *dfa, const uint8_t *data, size_t len, uint64_t *matched);
+
+// A lazy DFA for finding match spans. Its states follow leftmost-first
+// priority, so a scan stops once the preferred match can no longer grow. Unless
+// anchored, a match may begin at any position of the scan.
+LazyDfa *lazy_dfa_new_search(const Program *prog, size_t cache_size, bool anchored);
+
+typedef enum {
+    LAZY_DFA_NO_MATCH,
+    LAZY_DFA_MATCH,
+    LAZY_DFA_GAVE_UP   // The cache was thrashing; the caller should use the NFA
+} LazyDfaResult;
+
+// With a DFA from lazy_dfa_new_search(), scans input[from .. len) and stores the
+// end offset of the leftmost-first match in *end
+LazyDfaResult lazy_dfa_find_end(LazyDfa *dfa, const char *input, size_t len, size_t from, size_t *end);
+
+// Like lazy_dfa_find_end(), but only for a match that begins at or before
+// max_start. The match itself may run on past it.
+LazyDfaResult lazy_dfa_find_end_bounded(LazyDfa *dfa, const char *input, size_t len, size_t from, size_t max_start,
+                                        size_t *end);
+
+// Like lazy_dfa_find_end_bounded(), for input that goes on past len: sets
+// *at_limit if threads were still running when the scan reached len, in which
+// case the bytes after it could change the result
+LazyDfaResult lazy_dfa_find_end_limited(LazyDfa *dfa, const char *input, size_t len, size_t from, size_t max_start,
+                                        size_t *end, bool *at_limit);
+
+// With a DFA over a reversed program (compile_ast_reverse()), scans backward from
+// end towards from and stores in *start the smallest offset at which a match
+// ending at end can begin
+LazyDfaResult lazy_dfa_find_start(LazyDfa *dfa, const char *input, size_t from, size_t end, size_t *start);
+
+// A lazy DFA that reports every offset where a match ends. States keep all NFA
+// threads, and unless anchored a match may begin at any position. Used with a
+// cursor to scan a stream.
+LazyDfa *lazy_dfa_new_all_matches(const Program *prog, size_t cache_size, bool anchored);
+
+// Where a scan fed in pieces has got to. The size depends only on the program,
+// not on how much input has been fed. The state's NFA set is kept alongside its
+// id, so a cursor survives cache flushes caused by other scans on the same DFA.
+typedef struct {
+    uint32_t state;    // DFA state id; stale once epoch differs from the DFA's
+    uint64_t epoch;
+    uint32_t *set;     // NFA states of the current DFA state
+    uint32_t count;
+    uint64_t offset;   // Bytes fed so far
+    bool dead;         // No match can end at or after offset
+} LazyDfaCursor;
+
+typedef void (*LazyDfaMatchFn)(uint64_t end, void *user_data);
+
+void lazy_dfa_cursor_init(LazyDfa *dfa, LazyDfaCursor *cursor);
+
+// Moves the cursor back to the start of a new stream without allocating
+void lazy_dfa_cursor_reset(LazyDfa *dfa, LazyDfaCursor *cursor);
+void lazy_dfa_cursor_free(LazyDfaCursor *cursor);
+
+// Scans the next len bytes of the stream, calling on_match (if not NULL) with the
+// absolute end offset of every match that ends within them. Returns false once
+// no further match is possible.
+bool lazy_dfa_feed(LazyDfa *dfa, LazyDfaCursor *cursor, const uint8_t *data, size_t len,
+                   LazyDfaMatchFn on_match, void *user_data);
+
+// A cursor can be parked in caller-owned, 8-byte aligned memory of
+// lazy_dfa_cursor_state_size() bytes: the DFA state id plus a bitset of its NFA
+// states, so it can be resumed even if the cache has been flushed since, or on
+// another such DFA of the same program. Only for lazy_dfa_new_all_matches().
+size_t lazy_dfa_cursor_state_size(const LazyDfa *dfa);
+void lazy_dfa_cursor_save(const LazyDfa *dfa, const LazyDfaCursor *cursor, void *buf);
+void lazy_dfa_cursor_restore(const LazyDfa *dfa, LazyDfaCursor *cursor, const void *buf);
+
+// Whether a match ends at the cursor's current offset
+bool lazy_dfa_cursor_is_match(const LazyDfa *dfa, const LazyDfaCursor *cursor);
+
+// For the cache, whichever handle it is asked through
+LazyDfaStats lazy_dfa_stats(const LazyDfa *dfa);
+
+// The cache_bytes of lazy_dfa_stats(), without taking the cache's lock. During a
+// flush it may report either table.
+size_t lazy_dfa_cache_bytes(const LazyDfa *dfa);
+
+void lazy_dfa_free(LazyDfa *dfa);
+
+// Default limit on the number of states subset construction may create
+#define DFA_DEFAULT_MAX_STATES 10000
+
+// The dead state; every transition out of it leads back to it
+#define DFA_DEAD_STATE 0
+
+// A minimal DFA compiled ahead of time. table holds num_classes entries per
+// state, indexed by state * num_classes + byte_classes[byte].
+typedef struct {
+    uint32_t num_states;
+    uint32_t start;
+    uint32_t num_classes;
+    uint8_t byte_classes[256];
+    uint32_t *table;
+    bool *accepting;
+} Dfa;
+
+// Runs subset construction over the NFA and minimizes the result. Returns NULL
+// if construction needs more than max_states states, so callers can fall back
+// to the NFA matcher.
+Dfa *compile_dfa(const Program *prog, size_t max_states);
+
+bool dfa_match(const Dfa *dfa, const char *input);
+bool dfa_match_bytes(const Dfa *dfa, const uint8_t *data, size_t len);
+
+void free_dfa(Dfa *dfa);
+
+#endif //DFA_H
@@ -0,0 +1,222 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "compiler.h"
+#include "dfa.h"
+#include "matcher.h"
+#include "parser.h"
+#include "prefilter.h"
+#include "program.h"
+
+// A pattern compiled once for repeated matching: the parsed pattern, its
+// programs, the prefilters drawn from it and the lazy DFA caches all its
+// scratches share. The handle is opaque; the calls below report what callers
+// may need to know about it. Only the DFA caches change after regex_compile()
+// returns, and any thread may add states to them, so any number of threads may
+// match with one Regex at the same time, warming its DFAs once between them.
+typedef struct Regex Regex;
+
+// The working memory one thread needs to match one Regex: handles on its DFA
+// caches, state sets and Pike VM threads. Created once and reused, a scratch
+// lets a thread match any number of times without touching the heap once the
+// DFA caches have warmed up. One scratch serves one match at a time.
+typedef struct RegexScratch RegexScratch;
+
+// Returns NULL if the pattern does not parse
+Regex *regex_compile(const char *pattern);
+
+RegexScratch *regex_scratch_new(const Regex *re);
+void regex_scratch_free(RegexScratch *scratch);
+
+// Slots in the scratch pool of each Regex
+#define REGEX_POOL_SLOTS 64
+
+// Takes a scratch from the pool the Regex keeps, or creates one if the pool has
+// none to spare. The pool never takes a lock. While no more than
+// REGEX_POOL_SLOTS threads that have used a pool are alive, each owns a slot,
+// where it keeps a scratch that it takes and returns without any atomic
+// read-modify-write, so threads matching at once do not share cache lines. When
+// a thread exits, its slot and the scratch in it pass to the next new thread.
+RegexScratch *regex_scratch_acquire(const Regex *re);
+
+// Returns a scratch to its Regex's pool, or frees it if the pool is full. Any
+// scratch made for the Regex may be returned, from any thread.
+void regex_scratch_release(RegexScratch *scratch);
+
+// The pattern as passed to regex_compile()
+const char *regex_pattern(const Regex *re);
+
+// Instructions in the program regex_match() runs
+size_t regex_num_states(const Regex *re);
+
+// Capture groups reported by regex_find_with_captures(), counting group 0, the
+// whole match
+size_t regex_num_captures(const Regex *re);
+
+// The literal every match starts with; len is 0 if there is none
+const LiteralPrefix *regex_literal_prefix(const Regex *re);
+
+// Every call below without a scratch argument acquires a scratch for the call
+// and releases it afterwards. The _with_scratch variants use the scratch given,
+// which must have been created for the same Regex and not be in use by any other
+// call, and skip the pool.
+
+// The _bytes variants match exactly len bytes, NULs included, so slices of
+// larger buffers can be matched in place
+bool regex_match(const Regex *re, const char *input);
+bool regex_match_bytes(const Regex *re, const uint8_t *data, size_t len);
+bool regex_match_with_scratch(const Regex *re, RegexScratch *scratch, const char *input);
+bool regex_match_with_scratch_bytes(const Regex *re, RegexScratch *scratch, const uint8_t *data, size_t len);
+
+// Inputs regex_match_many() prefilters at a time
+#define REGEX_MATCH_MANY_GROUP 64
+
+// Lazy DFA cache size from which regex_match_many() interleaves inputs
+#define REGEX_INTERLEAVE_MIN_CACHE (32 * 1024)
+
+// Sets out[i] to regex_match_bytes(re, inputs[i], lens[i]). Once the DFA's
+// cached states outgrow L1, inputs that pass the prefilters run through it side
+// by side (see lazy_dfa_match_many()); until then one at a time.
+void regex_match_many(const Regex *re, const uint8_t *const *inputs, const size_t *lens, size_t n, bool *out);
+void regex_match_many_with_scratch(const Regex *re, RegexScratch *scratch, const uint8_t *const *inputs,
+                                   const size_t *lens, size_t n, bool *out);
+
+MatchResult regex_match_with_captures(const Regex *re, const char *input);
+MatchResult regex_match_with_captures_bytes(const Regex *re, const uint8_t *data, size_t len);
+
+// Finds the leftmost-first match in buf[0 .. len), which need not be
+// NUL-terminated, and stores its span as [*start, *end)
+bool regex_find(const Regex *re, const char *buf, size_t len, size_t *start, size_t *end);
+
+// Like regex_find(), but searches from `from` and only for a match that begins
+// at or before max_start. The match may extend past max_start up to len.
+bool regex_find_bounded(const Regex *re, const char *buf, size_t len, size_t from, size_t max_start,
+                        size_t *start, size_t *end);
+bool regex_find_with_scratch(const Regex *re, RegexScratch *scratch, const char *buf, size_t len,
+                             size_t *start, size_t *end);
+bool regex_find_bounded_with_scratch(const Regex *re, RegexScratch *scratch, const char *buf, size_t len,
+                                     size_t from, size_t max_start, size_t *start, size_t *end);
+
+// Finds the leftmost-first match like regex_find(), then extracts its capture
+// groups by walking only the matched span. Group 0 is the whole match.
+MatchResult regex_find_with_captures(const Regex *re, const char *buf, size_t len);
+
+// A group's place in the input, or REGEX_UNSET for both if it took no part
+#define REGEX_UNSET SIZE_MAX
+typedef struct {
+    size_t start;
+    size_t end;
+} RegexSpan;
+
+// Finds the leftmost-first match like regex_find_with_captures(), but writes
+// the group spans to spans[0 .. num_spans) instead of allocating a MatchResult.
+// Groups beyond regex_num_captures() are unset.
+bool regex_find_spans_with_scratch(const Regex *re, RegexScratch *scratch, const char *buf, size_t len,
+                                   RegexSpan *spans, size_t num_spans);
+
+// Walks the successive non-overlapping matches in a buffer. An empty match
+// moves the next search one byte further so iteration always advances. An
+// iterator from regex_find_all() acquires a scratch for each search.
+typedef struct {
+    const Regex *re;
+    RegexScratch *scratch;   // NULL to use the pool
+    const char *buf;
+    size_t len;
+    size_t pos;      // Where the next search starts
+    bool done;
+} RegexFindIter;
+
+RegexFindIter regex_find_all(const Regex *re, const char *buf, size_t len);
+RegexFindIter regex_find_all_with_scratch(const Regex *re, RegexScratch *scratch, const char *buf, size_t len);
+
+// Returns false once there are no more matches
+bool regex_find_next(RegexFindIter *iter, size_t *start, size_t *end);
+
+// Called with the absolute offset one past the last byte of each match
+typedef void (*RegexStreamCallback)(uint64_t end, void *user_data);
+
+// Matches input that arrives in chunks without reassembling it. Every offset at
+// which a match ends is reported, counted from the start of the stream. Only the
+// automaton's current state is kept between chunks, so a stream's size does not
+// grow with its input. A stream holds a scratch from its Regex's pool until it
+// is closed.
+typedef struct {
+    const Regex *re;
+    RegexScratch *scratch;
+    LazyDfaCursor cursor;
+    RegexStreamCallback on_match;
+    void *user_data;
+} RegexStream;
+
+// Returns NULL if re is NULL or could not be compiled for searching
+RegexStream *regex_stream_open(const Regex *re, RegexStreamCallback on_match, void *user_data);
+
+// Returns false once no match can end in any later chunk
+bool regex_stream_feed(RegexStream *stream, const uint8_t *chunk, size_t len);
+
+// Ends the stream. A pattern ending in $ can only match here, at the final offset.
+void regex_stream_close(RegexStream *stream);
+
+// Many flows can share one RegexStream by parking their state in caller-owned
+// memory between chunks: restore a flow, feed it, and save it back. A saved state
+// is regex_stream_state_size() bytes, must be 8-byte aligned, and depends only on
+// the pattern. None of these calls allocate.
+size_t regex_stream_state_size(const Regex *re);
+void regex_stream_save(const RegexStream *stream, void *state);
+void regex_stream_restore(RegexStream *stream, const void *state);
+
+// Starts a new flow on the stream, e.g. to save its initial state
+void regex_stream_reset(RegexStream *stream);
+
+// Reports a match ending at the end of the flow, like regex_stream_close(), but
+// leaves the stream open for the next flow
+void regex_stream_finish(RegexStream *stream);
+
+// The literals regex_match() requires an input to contain before running any
+// automaton; count is 0 if there are none
+const RequiredFactors *regex_required_factors(const Regex *re);
+
+// Frees the Regex and the scratches in its pool. No other thread may still be
+// using it, and scratches made for it must be freed or released first.
+void regex_free(Regex *re);
+
+// A handle on a RegexSet's DFA cache plus NFA state sets, laid out in engine.c
+typedef struct RegexSetScratch RegexSetScratch;
+
+// Several patterns matched together in one pass over the input. Like a Regex, a
+// set may be matched by any number of threads at once: each match takes a
+// scratch from the set's list, or makes one, and puts it back when it is done.
+typedef struct {
+    size_t num_patterns;
+    Arena *arena;             // Holds every pattern's AST and NFA
+    AstNode **asts;
+    NfaFragment *nfas;
+    Program *prog;            // Joined program; OP_MATCH args are pattern indexes
+
+    // Holds the state cache every scratch shares and is only ever handed out
+    // through lazy_dfa_share(). NULL if the DFA could not be created.
+    LazyDfa *dfa;
+    pthread_mutex_t lock;     // Held only to take or put back a scratch
+    RegexSetScratch *scratches;
+} RegexSet;
+
+// Returns NULL if any pattern does not parse
+RegexSet *regex_set_compile(const char **patterns, size_t num_patterns);
+
+// Sets bit i of matched for every pattern i that matches the input. matched must
+// hold PATTERN_SET_WORDS(num_patterns) words. Returns whether any pattern matched.
+bool regex_set_match(RegexSet *set, const char *input, uint64_t *matched);
+bool regex_set_match_bytes(RegexSet *set, const uint8_t *data, size_t len, uint64_t *matched);
+
+// The same, on the NFA simulation instead of the lazy DFA
+bool regex_set_match_nfa(RegexSet *set, const char *input, uint64_t *matched);
+bool regex_set_match_nfa_bytes(RegexSet *set, const uint8_t *data, size_t len, uint64_t *matched);
+
+// Frees the set and its scratches. No other thread may still be matching with it.
+void regex_set_free(RegexSet *set);
+
+#endif //ENGINE_H
@@ -0,0 +1,77 @@
+#ifndef ENGINE_INTERNAL_H
+#define ENGINE_INTERNAL_H
+
+// The layout behind the Regex and RegexScratch handles, for the library's own
+// modules, its tests and its benchmarks. Not part of the API: regexp.h does not
+// include it, and fields may change.
+
+#include "engine.h"
+
+// One slot of the pool, laid out in engine.c
+typedef struct RegexPoolSlot RegexPoolSlot;
+
+// Everything one thread needs to match with. A scratch belongs to one Regex;
+// its DFAs are handles on the Regex's, through which every thread adds to the
+// same caches.
+struct RegexScratch {
+    const Regex *re;
+    LazyDfa *dfa;             // Boolean matching; NULL if the DFA could not be created
+    MatchScratch *match;      // Captures and NFA matching on prog
+
+    // Span finding at DFA speed: the forward DFA finds where the match ends and
+    // the DFA over the reversed pattern walks back from there to where it starts.
+    // Either may be NULL, in which case spans come from the Pike VM.
+    MatchScratch *search;     // Pike VM on search_prog
+    LazyDfa *search_dfa;
+    LazyDfa *reverse_dfa;
+
+    LazyDfa *stream_dfa;      // Reports every match end, for streams
+};
+
+// Compiled once and only read afterwards
+struct Regex {
+    char *pattern;            // As passed to regex_compile()
+    Arena *arena;             // Holds both ASTs and all three NFAs
+    AstNode *ast;
+    NfaFragment nfa;
+    Program *prog;
+    LiteralPrefix prefix;
+    RequiredFactors factors;
+
+    // The pattern as written, for finding match spans without the .*?( ).* rewrite
+    AstNode *search_ast;
+    NfaFragment search_nfa;
+    Program *search_prog;     // NULL if the pattern cannot be searched
+    LiteralPrefix search_prefix;
+    bool anchored_start;      // Pattern began with ^
+    bool anchored_end;        // Pattern ended with $
+
+    NfaFragment reverse_nfa;  // Accepts the reversed pattern, for finding where matches start
+    Program *reverse_prog;
+
+    // The only parts written after compiling, reached through pointers so that a
+    // const Regex can still take scratches from its pool and grow its DFA caches.
+    // The DFAs hold the state caches all scratches share and are only ever handed
+    // out through lazy_dfa_share(). Any of them may be NULL, like the scratch's.
+    RegexPoolSlot *pool;
+    LazyDfa *dfa;
+    LazyDfa *search_dfa;
+    LazyDfa *reverse_dfa;
+    LazyDfa *stream_dfa;
+
+    // Set once, atomically, by regex_lines(); NULL until then
+    Regex *lines;
+};
+
+// Like regex_find_bounded_with_scratch(), for a buffer that goes on past len:
+// sets *at_limit if the bytes after len could change the result, so that a
+// worker can search its own chunk of a larger buffer without reading past it
+bool regex_find_limited_with_scratch(const Regex *re, RegexScratch *scratch, const char *buf, size_t len,
+                                     size_t from, size_t max_start, size_t *start, size_t *end, bool *at_limit);
+
+// The same pattern compiled so that no match takes in a line break (see
+// parse_lines_into()), which regex_scan_file() and friends search with. Compiled
+// the first time it is asked for, and freed with re.
+const Regex *regex_lines(const Regex *re);
+
+#endif //ENGINE_INTERNAL_H
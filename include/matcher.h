@@ -7,32 +7,103 @@
 
 
 #include <stddef.h> // For size_t
+#include <stdint.h>
 
 #include "compiler.h" // Your NfaState definition
+#include "program.h"
 
 
+// Sparse set of instruction ids with O(1) add, membership test and clear. The
+// universe is fixed at init time, normally the program's instruction count.
 typedef struct {
-    NfaState **states; // Dynamically allocated array of state pointers
+    uint32_t *states;  // Members in insertion order (the dense array)
+    uint32_t *sparse;  // sparse[id] indexes states[] when id is a member
     size_t count;      // Number of states currently in the set
-    size_t capacity;   // Allocated size of the states array
+    size_t capacity;   // Number of distinct ids the set can hold
 } NfaStateSet;
 
 // Function prototypes for set operations
-void init_set(NfaStateSet *set);
-void add_state(NfaStateSet *set, NfaState *state);
+void init_set(NfaStateSet *set, size_t capacity);
+void add_state(NfaStateSet *set, uint32_t state); // Ignores states already present
+bool contains_state(const NfaStateSet *set, uint32_t state);
 void free_set(NfaStateSet *set);
 void clear_set(NfaStateSet *set); // Resets count to 0 but keeps allocation
 
-void epsilon_closure(NfaStateSet *initial_set, NfaStateSet *closure_set);
+void epsilon_closure(const Program *prog, NfaStateSet *initial_set, NfaStateSet *closure_set);
 
+// Work buffers for matching one program: state sets and Pike VM thread lists,
+// sized from the program once so repeated matches do not allocate
+typedef struct MatchScratch MatchScratch;
+
+MatchScratch *match_scratch_new(const Program *prog);
+void match_scratch_free(MatchScratch *scratch);
+
+// Every matching entry point takes a NUL-terminated string and has a _bytes
+// variant that takes a pointer and a length instead. The _bytes variants read
+// exactly len bytes, which may include NULs, so they can match sub-ranges of
+// larger buffers in place.
+
+// Compiles the fragment to a Program for the duration of the call. The NFA is
+// only read, so any number of threads may match one NFA at once.
 bool match(NfaFragment fragment, const char *input);
+bool match_bytes(NfaFragment fragment, const uint8_t *data, size_t len);
+
+// A fragment compiled once for repeated matching, with the working memory of
+// one match, so the match_ex() calls allocate nothing. It belongs to the caller:
+// one match at a time, so each thread needs its own. The NFA is not referenced
+// after nfa_matcher_new() returns.
+typedef struct {
+    Program *prog;
+    MatchScratch *scratch;
+} NfaMatcher;
+
+// Returns NULL for an empty fragment
+NfaMatcher *nfa_matcher_new(NfaFragment fragment);
+void nfa_matcher_free(NfaMatcher *matcher);
+
+bool match_ex(NfaMatcher *matcher, const char *input);
+bool match_ex_bytes(NfaMatcher *matcher, const uint8_t *data, size_t len);
+
+// Allocates scratch for the duration of the call
+bool program_match(const Program *prog, const char *input);
+bool program_match_bytes(const Program *prog, const uint8_t *data, size_t len);
+
+// The scratch must have been created for prog and may only be used by one match at a time
+bool program_match_with_scratch(const Program *prog, MatchScratch *scratch, const char *input);
+bool program_match_with_scratch_bytes(const Program *prog, MatchScratch *scratch, const uint8_t *data, size_t len);
+
+// For programs from compile_program_set(): sets bit i of matched (PATTERN_SET_WORDS
+// words) for every pattern i that matches. Returns whether any pattern matched.
+bool program_match_set(const Program *prog, MatchScratch *scratch, const char *input, uint64_t *matched);
+bool program_match_set_bytes(const Program *prog, MatchScratch *scratch, const uint8_t *data, size_t len,
+                             uint64_t *matched);
+
+// Leftmost-first search for a match in input[from .. len), which need not be
+// NUL-terminated. The program must come from a parse_search() AST, whose group 0
+// spans the match. With anchored_start the match must begin at from, with
+// anchored_end it must end at len. On success the match covers
+// [*match_start, *match_end).
+bool program_find(const Program *prog, MatchScratch *scratch, const char *input, size_t len, size_t from,
+                  bool anchored_start, bool anchored_end, size_t *match_start, size_t *match_end);
+
+// Like program_find(), but only for a match that begins at or before max_start;
+// the match may still run on past it
+bool program_find_bounded(const Program *prog, MatchScratch *scratch, const char *input, size_t len, size_t from,
+                          size_t max_start, bool anchored_end, size_t *match_start, size_t *match_end);
+
+// Like program_find_bounded(), for input that goes on past len: sets *at_limit
+// if a thread was waiting for the byte after len, in which case the bytes after
+// it could change the result
+bool program_find_limited(const Program *prog, MatchScratch *scratch, const char *input, size_t len, size_t from,
+                          size_t max_start, bool anchored_end, size_t *match_start, size_t *match_end,
+                          bool *at_limit);
 
 // Capture group support
 typedef struct {
     char *name;          // Group name (NULL for numbered groups in future)
     char *value;         // Matched text
-    int start;           // Start position in input
-    int end;             // End position in input
+    size_t start;        // Start position in input
+    size_t end;          // End position in input
 } CaptureGroup;
 
 typedef struct {
@@ -42,6 +113,26 @@ typedef struct {
 } MatchResult;
 
 MatchResult match_with_captures(NfaFragment fragment, const char *input);
+MatchResult match_with_captures_bytes(NfaFragment fragment, const uint8_t *data, size_t len);
+MatchResult match_with_captures_ex(NfaMatcher *matcher, const char *input);
+MatchResult match_with_captures_ex_bytes(NfaMatcher *matcher, const uint8_t *data, size_t len);
+MatchResult program_match_with_captures(const Program *prog, const char *input);
+MatchResult program_match_with_captures_bytes(const Program *prog, const uint8_t *data, size_t len);
+MatchResult program_match_with_captures_scratch(const Program *prog, MatchScratch *scratch, const char *input);
+MatchResult program_match_with_captures_scratch_bytes(const Program *prog, MatchScratch *scratch,
+                                                      const uint8_t *data, size_t len);
+
+// Extracts the captures of a match already known to span input[start .. end),
+// without looking at the rest of the input. Offsets are relative to input.
+MatchResult program_find_with_captures(const Program *prog, MatchScratch *scratch, const char *input,
+                                       size_t start, size_t end);
+
+// The same without allocating: returns the program's 2 * num_captures slots,
+// start and end of each group in turn and -1 for groups that took no part, or
+// NULL if the span does not match. The slots live in the scratch and are
+// overwritten by its next use.
+const ptrdiff_t *program_find_slots(const Program *prog, MatchScratch *scratch, const char *input,
+                              size_t start, size_t end);
 void free_match_result(MatchResult *result);
 
 #endif //MATCHER_H
@@ -0,0 +1,53 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "engine.h"
+
+// Default number of bytes each worker scans at a time
+#define REGEX_PARALLEL_DEFAULT_CHUNK_SIZE (1024 * 1024)
+
+typedef struct {
+    size_t num_threads;  // 0 for one per online CPU
+    size_t chunk_size;   // 0 for REGEX_PARALLEL_DEFAULT_CHUNK_SIZE
+} RegexParallelOptions;
+
+RegexParallelOptions regex_parallel_default_options(void);
+
+// Called with the span [start, end) of each match
+typedef void (*RegexMatchCallback)(size_t start, size_t end, void *user_data);
+
+// Finds the same matches as iterating with regex_find_all(), but splits the
+// buffer into chunks that a pool of threads searches at once. Each chunk is
+// searched speculatively, as if no earlier match reached into it, and without
+// reading past the chunk; where an earlier match does reach in, the chunk is
+// searched again from the end of that match until its matches line up with the
+// speculative ones, and a match the worker could not finish inside its chunk is
+// searched for in the whole buffer. on_match is called on the calling thread,
+// in order. Every worker matches with re itself, using a scratch from
+// its pool. options may be NULL for the defaults. Returns the number of matches.
+size_t regex_find_all_parallel(const Regex *re, const char *buf, size_t len,
+                               const RegexParallelOptions *options, RegexMatchCallback on_match, void *user_data);
+
+// Threads in the pool behind regex_find_all_parallel() and regex_match_batch().
+// The pool starts threads as calls first need them and keeps them for later
+// calls, which share them.
+size_t regex_parallel_pool_threads(void);
+
+// Inputs a worker claims at a time in regex_match_batch()
+#define REGEX_BATCH_BLOCK 64
+
+// Matches many inputs against one pattern, setting out[i] to whether inputs[i]
+// matches like regex_match_bytes(). lens[i] is the length of inputs[i], or lens
+// may be NULL for NUL-terminated inputs. The batch is split evenly between the
+// calling thread and a set of workers, which all share re and each acquire a
+// scratch from it, and a worker that runs out of inputs takes blocks from the
+// others. Each block goes through regex_match_many_with_scratch(). options may be
+// NULL for the defaults; chunk_size is not used.
+void regex_match_batch(const Regex *re, const char **inputs, const size_t *lens, size_t n, bool *out);
+void regex_match_batch_with_options(const Regex *re, const char **inputs, const size_t *lens, size_t n,
+                                    bool *out, const RegexParallelOptions *options);
+
+#endif //PARALLEL_H
@@ -2,6 +2,9 @@
 #define REGEX_PARSER_H
 
 #include <stdbool.h>
+#include <stdint.h>
+
+#include "arena.h"
 
 typedef enum {
     NODE_LITERAL,
@@ -15,6 +18,7 @@ typedef enum {
 
 typedef struct AstNode {
     NodeType type;
+    Arena *arena;    // Set on the root returned by parse() or parse_search(), which owns its arena
 } AstNode;
 
 typedef struct {
@@ -37,6 +41,7 @@ typedef struct {
 typedef struct {
     AstNode base;
     char quantifier;
+    bool lazy;       // Prefers fewer repetitions, written with a trailing '?'
     AstNode *child;
 } QuantifierNode;
 
@@ -47,35 +52,69 @@ typedef struct {
 typedef struct {
     AstNode base;
     bool negated;           // true if this is a negated class [^...]
-    bool char_set[256];     // bitmap of characters in the class
+    uint64_t char_set[4];   // 256-bit set: bit c is set for each byte c in the class
 } CharClassNode;
 
+// Whether c was listed in the class, before any negation
+static inline bool char_class_contains(const CharClassNode *node, unsigned char c) {
+    return (node->char_set[c >> 6] >> (c & 63)) & 1;
+}
+
 typedef struct {
     AstNode base;
     char *name;             // Group name (NULL for numbered groups)
     AstNode *child;         // The expression to capture
 } CaptureGroupNode;
 
-LiteralNode* create_literal_node(char value);
-AlternationNode* create_alternation_node(AstNode *left, AstNode *right);
-ConcatNode* create_concat_node(AstNode *left, AstNode *right);
-QuantifierNode* create_quantifier_node(AstNode *child, char quantifier);
-WildcardNode* create_wildcard_node();
-CharClassNode* create_char_class_node(bool negated);
-CaptureGroupNode* create_capture_group_node(const char *name, AstNode *child);
+LiteralNode* create_literal_node(Arena *arena, char value);
+AlternationNode* create_alternation_node(Arena *arena, AstNode *left, AstNode *right);
+ConcatNode* create_concat_node(Arena *arena, AstNode *left, AstNode *right);
+QuantifierNode* create_quantifier_node(Arena *arena, AstNode *child, char quantifier);
+WildcardNode* create_wildcard_node(Arena *arena);
+CharClassNode* create_char_class_node(Arena *arena, bool negated);
+CaptureGroupNode* create_capture_group_node(Arena *arena, const char *name, size_t name_len, AstNode *child);
 
 
+// Reads input[0 .. length) in place; the pattern is never copied
 typedef struct {
     const char *input;
     int index;
+    int length;
+    Arena *arena;    // Where nodes are allocated
+    bool single_line;  // No atom may match '\n'
 } ParserState;
 
+// Each returns NULL, after printing why to stderr, if the pattern does not parse
 AstNode* parse_atom(ParserState *state);
 AstNode* parse_alternation(ParserState *state);
 AstNode* parse_concatenation(ParserState *state);
 AstNode* parse_quantifier(ParserState *state);
+// Parses the pattern for whole-input matching, as .*?(pattern).*. A leading ^
+// drops the .*? and a trailing $ the .*, so the anchors mean the same as they
+// do for parse_search(). The tree is allocated in an arena of its own, which
+// free_ast() releases. Returns NULL if the pattern does not parse.
 AstNode* parse(const char *input);
 
+// Parses the pattern as written, without the .*?( ).* rewrite parse() applies,
+// for engines that search natively. A leading ^ and a trailing $ are reported
+// through the anchor flags, and the pattern is wrapped in an unnamed group so
+// that group 0 spans the whole match.
+AstNode* parse_search(const char *input, bool *anchored_start, bool *anchored_end);
+
+// The same, allocating every node from the caller's arena, so parsing makes no
+// call to malloc while the arena has room. The tree lives until the arena is
+// reset or freed, and free_ast() leaves it alone. On a parse error the arena
+// may hold nodes of the partial tree.
+AstNode* parse_into(Arena *arena, const char *input);
+AstNode* parse_search_into(Arena *arena, const char *input, bool *anchored_start, bool *anchored_end);
+
+// Like parse_into() and parse_search_into(), for matching within lines: ., every
+// class and a literal line break leave '\n' out, so no match takes one in. The
+// .*? and .* that parse_into() wraps the pattern in still match anything.
+AstNode* parse_lines_into(Arena *arena, const char *input);
+AstNode* parse_search_lines_into(Arena *arena, const char *input, bool *anchored_start, bool *anchored_end);
+
+// Frees a tree from parse() or parse_search() in one step
 void free_ast(AstNode *node);
 
 void print_ast(AstNode *node);
@@ -0,0 +1,51 @@
+#ifndef PREFILTER_H
+#define PREFILTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "parser.h"
+
+// Longest literal prefix extracted
+#define PREFILTER_MAX_PREFIX 64
+
+// A literal that every match must start with, plus the shape of the pattern
+// around it. parse() turns unanchored patterns into .*?(...).*, so a leading
+// wildcard loop means the prefix may occur anywhere in the input.
+typedef struct {
+    char bytes[PREFILTER_MAX_PREFIX];
+    size_t len;               // 0 if the pattern has no literal prefix
+    bool unanchored_start;    // Pattern starts with .* (the prefix is searched for)
+    bool unanchored_end;      // Pattern ends with .* (any match may stop early)
+} LiteralPrefix;
+
+LiteralPrefix extract_literal_prefix(const AstNode *root);
+
+// Limits on the required-factor analysis
+#define PREFILTER_MAX_FACTORS 16
+#define PREFILTER_MAX_FACTOR_LEN 64
+
+// Literals of which every match contains at least one. count is 0 when the
+// analysis found nothing worth checking.
+typedef struct {
+    size_t count;
+    char *factors[PREFILTER_MAX_FACTORS];
+    size_t lens[PREFILTER_MAX_FACTORS];
+} RequiredFactors;
+
+// Combines what each node must start with, end with and contain through
+// concatenation, alternation and quantifiers, and keeps the most selective set
+RequiredFactors extract_required_factors(const AstNode *root);
+
+// Returns false if the input contains none of the factors, so cannot match
+bool contains_required_factor(const RequiredFactors *factors, const char *input, size_t len);
+
+void free_required_factors(RequiredFactors *factors);
+
+void print_required_factors(const RequiredFactors *factors);
+
+// Returns the offset of the first occurrence of needle in haystack at or after
+// from, or len if there is none
+size_t find_literal(const char *haystack, size_t len, size_t from, const char *needle, size_t needle_len);
+
+#endif //PREFILTER_H
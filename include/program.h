@@ -0,0 +1,94 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "compiler.h"
+
+// Instruction opcodes. Each NFA state becomes exactly one instruction, so an
+// instruction's index doubles as its 32-bit state id.
+typedef enum {
+    OP_CHAR,   // Consume `byte`, continue at out
+    OP_ANY,    // Consume any byte, continue at out
+    OP_CLASS,  // Consume a byte in classes[arg], continue at out
+    OP_SPLIT,  // Continue at both out and out1; out has priority
+    OP_JMP,    // Continue at out
+    OP_SAVE,   // Record the current position in capture slot arg, continue at out
+    OP_MATCH   // Accept; arg is the pattern id in a program set
+} Opcode;
+
+typedef struct {
+    uint8_t opcode;
+    uint8_t byte;   // OP_CHAR
+    uint32_t arg;   // OP_CLASS: class index, OP_SAVE: slot, OP_MATCH: pattern id
+    uint32_t out;
+    uint32_t out1;  // OP_SPLIT
+} Instruction;
+
+// A 256-bit byte set with any negation already applied
+typedef struct {
+    uint64_t bits[4];
+} ByteSet;
+
+static inline bool byte_set_contains(const ByteSet *set, unsigned char c) {
+    return (set->bits[c >> 6] >> (c & 63)) & 1;
+}
+
+// A compiled NFA laid out as one contiguous instruction array. Capture group i
+// records its start in slot 2 * i and its end in slot 2 * i + 1.
+typedef struct {
+    Instruction *insts;
+    uint32_t count;
+    uint32_t start;
+
+    ByteSet *classes;       // Distinct character classes referenced by OP_CLASS
+    uint32_t num_classes;
+
+    // Bytes that no instruction tells apart share an equivalence class, numbered
+    // 0 .. num_byte_classes - 1. Table-driven engines index by class, not by byte.
+    uint8_t byte_classes[256];
+    uint32_t num_byte_classes;
+
+    uint32_t num_captures;
+    char **capture_names;   // One per capture group, NULL for unnamed groups
+
+    uint32_t num_patterns;  // 1, or the number of patterns joined by compile_program_set()
+
+    // Optional precomputed epsilon closures, in priority order and holding only
+    // consuming and accepting instructions. The closure of pc is
+    // closures[closure_start[pc]] .. closures[closure_start[pc + 1] - 1]. Only the
+    // start and the targets of consuming instructions have one; NULL if not computed.
+    uint32_t *closure_start;
+    uint32_t *closures;
+} Program;
+
+// Number of 64-bit words in a bitset with one bit per pattern
+#define PATTERN_SET_WORDS(num_patterns) (((size_t)(num_patterns) + 63) / 64)
+
+// Default cap on the total size of precomputed closures, in entries
+#define PROGRAM_DEFAULT_MAX_CLOSURE_ENTRIES (1024 * 1024)
+
+typedef struct {
+    bool precompute_closures;    // Store each state's epsilon closure with the program
+    size_t max_closure_entries;  // Skip precomputing if the closures would be larger
+} ProgramOptions;
+
+ProgramOptions program_default_options(void);
+
+Program *compile_program(NfaFragment fragment);
+
+// options may be NULL for the defaults
+Program *compile_program_with_options(NfaFragment fragment, const ProgramOptions *options);
+
+// Joins several patterns into one program whose start state branches into each
+// of them. Pattern i accepts with an OP_MATCH whose arg is i; capture groups
+// are dropped. options may be NULL for the defaults.
+Program *compile_program_set(const NfaFragment *fragments, size_t count, const ProgramOptions *options);
+
+void free_program(Program *prog);
+
+void print_program(const Program *prog);
+
+#endif //PROGRAM_H
@@ -4,8 +4,15 @@
 // Unified header for the regex library
 // Include this single header to access all regex functionality
 
+#include "arena.h"
 #include "parser.h"
 #include "compiler.h"
+#include "program.h"
 #include "matcher.h"
+#include "dfa.h"
+#include "prefilter.h"
+#include "engine.h"
+#include "parallel.h"
+#include "scan.h"
 
 #endif // REGEXP_H
@@ -0,0 +1,42 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "engine.h"
+
+// Bytes read at a time from inputs that cannot be mapped, such as pipes
+#define REGEX_SCAN_READ_SIZE (1024 * 1024)
+
+// A match together with the lines it lies on. Offsets count from the start of
+// the file.
+typedef struct {
+    uint64_t start;        // The match is [start, end)
+    uint64_t end;
+    uint64_t line_number;  // 1-based line the match starts on
+    uint64_t line_start;   // First byte of that line
+    uint64_t line_end;     // The '\n' ending that line, or the end of the input
+    const char *line;      // The bytes [line_start, line_end); only valid during the callback
+} RegexLineMatch;
+
+// Return false to stop the scan
+typedef bool (*RegexLineCallback)(const RegexLineMatch *match, void *user_data);
+
+// Reports every match in the file, in order, like regex_find_all(), except that
+// matches stay within a line, as in grep: ., classes such as [^x] or \s and a
+// literal line break never match '\n'. The file is memory-mapped and searched as
+// one buffer, so lines are only located for the matches found. ^ and $ apply to
+// each line, not to the whole file. Returns false if the file could not be
+// opened or read, with errno set.
+bool regex_scan_file(const Regex *re, const char *path, RegexLineCallback on_match, void *user_data);
+
+// The same for an open descriptor. Anything that cannot be mapped, such as a
+// pipe, is read in blocks of whole lines.
+bool regex_scan_fd(const Regex *re, int fd, RegexLineCallback on_match, void *user_data);
+
+// The same for a buffer already in memory
+void regex_scan_buffer(const Regex *re, const char *buf, size_t len, RegexLineCallback on_match, void *user_data);
+
+#endif //SCAN_H
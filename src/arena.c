@@ -0,0 +1,124 @@
+#include "arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;   // The block filled before this one
+    size_t size;
+    size_t used;
+    _Alignas(max_align_t) unsigned char data[];
+} ArenaBlock;
+
+struct Arena {
+    ArenaBlock *blocks;      // Newest first
+    ArenaBlock *first;       // Lives in the same allocation as the arena
+    size_t next_size;        // Size of the next block
+    size_t bytes;
+};
+
+// Offset of the first block from the start of the arena's allocation
+#define FIRST_BLOCK_OFFSET ((sizeof(Arena) + _Alignof(ArenaBlock) - 1) & ~(_Alignof(ArenaBlock) - 1))
+
+static ArenaBlock *new_block(size_t size) {
+    ArenaBlock *block = malloc(sizeof(ArenaBlock) + size);
+    if (block == NULL) {
+        fprintf(stderr, "arena_alloc  Error: failed to allocate arena block\n");
+        exit(1);
+    }
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+Arena *arena_new(void) {
+    size_t total = FIRST_BLOCK_OFFSET + sizeof(ArenaBlock) + ARENA_FIRST_BLOCK;
+    Arena *arena = malloc(total);
+    if (arena == NULL) {
+        fprintf(stderr, "arena_new  Error: failed to allocate Arena\n");
+        exit(1);
+    }
+    arena->blocks = NULL;
+    arena->first = (ArenaBlock*)((unsigned char*)arena + FIRST_BLOCK_OFFSET);
+    arena->first->size = ARENA_FIRST_BLOCK;
+    arena->bytes = total;
+    arena_reset(arena);
+    return arena;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    size_t align = _Alignof(max_align_t);
+    size = (size + align - 1) & ~(align - 1);
+
+    ArenaBlock *block = arena->blocks;
+    if (block->size - block->used < size) {
+        size_t block_size = arena->next_size;
+        if (arena->next_size < ARENA_MAX_BLOCK) {
+            arena->next_size *= 2;
+        }
+        if (block_size < size) {
+            block_size = size;
+        }
+        ArenaBlock *fresh = new_block(block_size);
+        arena->bytes += sizeof(ArenaBlock) + block_size;
+        if (size == block_size && block->size - block->used > 0) {
+            // An oversized request gets a block to itself, behind the one still being filled
+            fresh->next = block->next;
+            block->next = fresh;
+            fresh->used = size;
+            return fresh->data;
+        }
+        fresh->next = block;
+        arena->blocks = fresh;
+        block = fresh;
+    }
+    void *ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+char *arena_strndup(Arena *arena, const char *str, size_t len) {
+    char *copy = arena_alloc(arena, len + 1);
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+size_t arena_bytes(const Arena *arena) {
+    return arena != NULL ? arena->bytes : 0;
+}
+
+static void free_blocks(Arena *arena) {
+    ArenaBlock *block = arena->blocks;
+    while (block != NULL) {
+        ArenaBlock *next = block->next;
+        if (block != arena->first) {
+            free(block);
+        }
+        block = next;
+    }
+}
+
+void arena_reset(Arena *arena) {
+    if (arena == NULL) {
+        return;
+    }
+    if (arena->blocks != NULL) {
+        free_blocks(arena);
+    }
+    arena->first->next = NULL;
+    arena->first->used = 0;
+    arena->blocks = arena->first;
+    arena->next_size = ARENA_FIRST_BLOCK * 2;
+    arena->bytes = FIRST_BLOCK_OFFSET + sizeof(ArenaBlock) + ARENA_FIRST_BLOCK;
+}
+
+void arena_free(Arena *arena) {
+    if (arena == NULL) {
+        return;
+    }
+    free_blocks(arena);
+    free(arena);
+}
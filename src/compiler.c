@@ -8,26 +8,19 @@
 
 #include <stdio.h>
 
-static NfaState* create_state(bool is_accepting, unsigned long *next_state_id) {
-    NfaState *state = malloc(sizeof(NfaState));
-    if(state == NULL) {
-        fprintf(stderr, "create_state  Error: failed to allocate NfaState\n");
-        exit(1);
-    }
+static NfaState* create_state(Arena *arena, bool is_accepting, unsigned long *next_state_id) {
+    NfaState *state = arena_alloc(arena, sizeof(NfaState));
     state->id = (*next_state_id)++;
     state->is_accepting = is_accepting;
     state->out1 = NULL;
     state->out2 = NULL;
+    state->arena = NULL;
 
     return state;
 }
 
-static Transition* create_transition(char symbol, NfaState *to) {
-    Transition *trans = malloc(sizeof(Transition));
-    if(trans == NULL) {
-        fprintf(stderr, "create_transition  Error: failed to allocate Transition\n");
-        exit(1);
-    }
+static Transition* create_transition(Arena *arena, char symbol, NfaState *to) {
+    Transition *trans = arena_alloc(arena, sizeof(Transition));
     trans->symbol = symbol;
     trans->to = to;
     trans->char_class_set = NULL;
@@ -37,11 +30,11 @@ static Transition* create_transition(char symbol, NfaState *to) {
     return trans;
 }
 
-NfaFragment create_literal_fragment(char symbol, unsigned long *next_state_id) {
-    NfaState *accept_state = create_state(true, next_state_id);
-    NfaState *start_state = create_state(false, next_state_id);
+NfaFragment create_literal_fragment(Arena *arena, char symbol, unsigned long *next_state_id) {
+    NfaState *accept_state = create_state(arena, true, next_state_id);
+    NfaState *start_state = create_state(arena, false, next_state_id);
 
-    start_state->out1 = create_transition(symbol, accept_state);
+    start_state->out1 = create_transition(arena, symbol, accept_state);
 
     NfaFragment fragment;
     fragment.start = start_state;
@@ -50,11 +43,11 @@ NfaFragment create_literal_fragment(char symbol, unsigned long *next_state_id) {
     return fragment;
 }
 
-NfaFragment create_wildcard_fragment(unsigned long *next_state_id) {
-    NfaState *accept_state = create_state(true, next_state_id);
-    NfaState *start_state = create_state(false, next_state_id);
+NfaFragment create_wildcard_fragment(Arena *arena, unsigned long *next_state_id) {
+    NfaState *accept_state = create_state(arena, true, next_state_id);
+    NfaState *start_state = create_state(arena, false, next_state_id);
 
-    start_state->out1 = create_transition(ANY_CHAR, accept_state);
+    start_state->out1 = create_transition(arena, ANY_CHAR, accept_state);
 
     NfaFragment fragment;
     fragment.start = start_state;
@@ -63,22 +56,14 @@ NfaFragment create_wildcard_fragment(unsigned long *next_state_id) {
     return fragment;
 }
 
-NfaFragment create_char_class_fragment(bool negated, bool char_set[256], unsigned long *next_state_id) {
-    NfaState *accept_state = create_state(true, next_state_id);
-    NfaState *start_state = create_state(false, next_state_id);
+NfaFragment create_char_class_fragment(Arena *arena, bool negated, const uint64_t char_set[4], unsigned long *next_state_id) {
+    NfaState *accept_state = create_state(arena, true, next_state_id);
+    NfaState *start_state = create_state(arena, false, next_state_id);
 
-    Transition *trans = create_transition(CHAR_CLASS, accept_state);
-    
-    // Allocate and copy the character set
-    trans->char_class_set = malloc(256 * sizeof(bool));
-    if (trans->char_class_set == NULL) {
-        fprintf(stderr, "create_char_class_fragment  Error: failed to allocate char_class_set\n");
-        exit(1);
-    }
+    Transition *trans = create_transition(arena, CHAR_CLASS, accept_state);
     
-    for (int i = 0; i < 256; i++) {
-        trans->char_class_set[i] = char_set[i];
-    }
+    trans->char_class_set = arena_alloc(arena, 4 * sizeof(uint64_t));
+    memcpy(trans->char_class_set, char_set, 4 * sizeof(uint64_t));
     trans->char_class_negated = negated;
     
     start_state->out1 = trans;
@@ -90,24 +75,24 @@ NfaFragment create_char_class_fragment(bool negated, bool char_set[256], unsigne
     return fragment;
 }
 
-NfaFragment create_capture_group_fragment(const char *name, int capture_id, NfaFragment child_frag, unsigned long *next_state_id) {
+NfaFragment create_capture_group_fragment(Arena *arena, const char *name, int capture_id, NfaFragment child_frag, unsigned long *next_state_id) {
     // Create start and end markers for the capture group
-    NfaState *start_state = create_state(false, next_state_id);
-    NfaState *end_state = create_state(true, next_state_id);
+    NfaState *start_state = create_state(arena, false, next_state_id);
+    NfaState *end_state = create_state(arena, true, next_state_id);
     
     // Create CAPTURE_START transition
-    Transition *start_trans = create_transition(CAPTURE_START, child_frag.start);
+    Transition *start_trans = create_transition(arena, CAPTURE_START, child_frag.start);
     if (name != NULL) {
-        start_trans->capture_name = strdup(name);
+        start_trans->capture_name = arena_strndup(arena, name, strlen(name));
     }
     start_trans->capture_id = capture_id;
     start_state->out1 = start_trans;
     
     // Create CAPTURE_END transition
     child_frag.accept->is_accepting = false;
-    Transition *end_trans = create_transition(CAPTURE_END, end_state);
+    Transition *end_trans = create_transition(arena, CAPTURE_END, end_state);
     if (name != NULL) {
-        end_trans->capture_name = strdup(name);
+        end_trans->capture_name = arena_strndup(arena, name, strlen(name));
     }
     end_trans->capture_id = capture_id;
     child_frag.accept->out1 = end_trans;
@@ -119,9 +104,9 @@ NfaFragment create_capture_group_fragment(const char *name, int capture_id, NfaF
     return fragment;
 }
 
-NfaFragment create_concat_fragment(NfaFragment frag1, NfaFragment frag2) {
+NfaFragment create_concat_fragment(Arena *arena, NfaFragment frag1, NfaFragment frag2) {
     frag1.accept->is_accepting = false;
-    frag1.accept->out1 = create_transition(EPSILON, frag2.start);
+    frag1.accept->out1 = create_transition(arena, EPSILON, frag2.start);
 
     NfaFragment fragment;
     fragment.start = frag1.start;
@@ -130,18 +115,18 @@ NfaFragment create_concat_fragment(NfaFragment frag1, NfaFragment frag2) {
     return fragment;
 }
 
-NfaFragment create_alternation_fragment(NfaFragment frag1, NfaFragment frag2, unsigned long *next_state_id) {
-    NfaState *start_state = create_state(false, next_state_id);
-    NfaState *accept_state = create_state(true, next_state_id);
+NfaFragment create_alternation_fragment(Arena *arena, NfaFragment frag1, NfaFragment frag2, unsigned long *next_state_id) {
+    NfaState *start_state = create_state(arena, false, next_state_id);
+    NfaState *accept_state = create_state(arena, true, next_state_id);
 
-    start_state->out1 = create_transition(EPSILON, frag1.start);
-    start_state->out2 = create_transition(EPSILON, frag2.start);
+    start_state->out1 = create_transition(arena, EPSILON, frag1.start);
+    start_state->out2 = create_transition(arena, EPSILON, frag2.start);
 
     frag1.accept->is_accepting = false;
     frag2.accept->is_accepting = false;
 
-    frag1.accept->out1 = create_transition(EPSILON, accept_state);
-    frag2.accept->out1 = create_transition(EPSILON, accept_state);
+    frag1.accept->out1 = create_transition(arena, EPSILON, accept_state);
+    frag2.accept->out1 = create_transition(arena, EPSILON, accept_state);
 
     NfaFragment fragment;
     fragment.start = start_state;
@@ -150,17 +135,18 @@ NfaFragment create_alternation_fragment(NfaFragment frag1, NfaFragment frag2, un
     return fragment;
 }
 
-NfaFragment create_star_fragment(NfaFragment frag, unsigned long *next_state_id) {
-    NfaState *start_state = create_state(false, next_state_id);
-    NfaState *accept_state = create_state(true, next_state_id);
+NfaFragment create_star_fragment(Arena *arena, NfaFragment frag, unsigned long *next_state_id) {
+    NfaState *start_state = create_state(arena, false, next_state_id);
+    NfaState *accept_state = create_state(arena, true, next_state_id);
 
     frag.accept->is_accepting = false;
 
-    start_state->out1 = create_transition(EPSILON, accept_state);
-    start_state->out2 = create_transition(EPSILON, frag.start);
+    // out1 is the preferred branch: enter the loop before skipping it
+    start_state->out1 = create_transition(arena, EPSILON, frag.start);
+    start_state->out2 = create_transition(arena, EPSILON, accept_state);
 
-    frag.accept->out1 = create_transition(EPSILON, frag.start);
-    frag.accept->out2 = create_transition(EPSILON, accept_state);
+    frag.accept->out1 = create_transition(arena, EPSILON, frag.start);
+    frag.accept->out2 = create_transition(arena, EPSILON, accept_state);
 
     NfaFragment fragment;
     fragment.start = start_state;
@@ -169,16 +155,16 @@ NfaFragment create_star_fragment(NfaFragment frag, unsigned long *next_state_id)
     return fragment;
 }
 
-NfaFragment create_plus_fragment(NfaFragment frag, unsigned long *next_state_id) {
-    NfaState *start_state = create_state(false, next_state_id);
-    NfaState *accept_state = create_state(true, next_state_id);
+NfaFragment create_plus_fragment(Arena *arena, NfaFragment frag, unsigned long *next_state_id) {
+    NfaState *start_state = create_state(arena, false, next_state_id);
+    NfaState *accept_state = create_state(arena, true, next_state_id);
 
     frag.accept->is_accepting = false;
 
-    start_state->out1 = create_transition(EPSILON, frag.start);
+    start_state->out1 = create_transition(arena, EPSILON, frag.start);
 
-    frag.accept->out1 = create_transition(EPSILON, frag.start);
-    frag.accept->out2 = create_transition(EPSILON, accept_state);
+    frag.accept->out1 = create_transition(arena, EPSILON, frag.start);
+    frag.accept->out2 = create_transition(arena, EPSILON, accept_state);
 
     NfaFragment fragment;
     fragment.start = start_state;
@@ -187,16 +173,17 @@ NfaFragment create_plus_fragment(NfaFragment frag, unsigned long *next_state_id)
     return fragment;
 }
 
-NfaFragment create_option_fragment(NfaFragment frag, unsigned long *next_state_id) {
-    NfaState *start_state = create_state(false, next_state_id);
-    NfaState *accept_state = create_state(true, next_state_id);
+NfaFragment create_option_fragment(Arena *arena, NfaFragment frag, unsigned long *next_state_id) {
+    NfaState *start_state = create_state(arena, false, next_state_id);
+    NfaState *accept_state = create_state(arena, true, next_state_id);
 
     frag.accept->is_accepting = false;
 
-    start_state->out1 = create_transition(EPSILON, accept_state);
-    start_state->out2 = create_transition(EPSILON, frag.start);
+    // out1 is the preferred branch: try the child before skipping it
+    start_state->out1 = create_transition(arena, EPSILON, frag.start);
+    start_state->out2 = create_transition(arena, EPSILON, accept_state);
 
-    frag.accept->out1 = create_transition(EPSILON, accept_state);
+    frag.accept->out1 = create_transition(arena, EPSILON, accept_state);
 
     NfaFragment fragment;
     fragment.start = start_state;
@@ -205,7 +192,14 @@ NfaFragment create_option_fragment(NfaFragment frag, unsigned long *next_state_i
     return fragment;
 }
 
-static NfaFragment recursive_compile_ast(AstNode *node, unsigned long *next_state_id) {
+// Lazy quantifiers prefer the branch that leaves the loop
+static void swap_priority(NfaState *state) {
+    Transition *tmp = state->out1;
+    state->out1 = state->out2;
+    state->out2 = tmp;
+}
+
+static NfaFragment recursive_compile_ast(Arena *arena, AstNode *node, unsigned long *next_state_id, int *next_capture_id, bool reverse) {
     if(node == NULL) {
         fprintf(stderr, "compile_ast  Error: NULL AST node\n");
         exit(1);
@@ -216,35 +210,45 @@ static NfaFragment recursive_compile_ast(AstNode *node, unsigned long *next_stat
     switch(node->type) {
         case NODE_LITERAL: {
             LiteralNode *literal_node = (LiteralNode *)node;
-            frag = create_literal_fragment(literal_node->value, next_state_id);
+            frag = create_literal_fragment(arena, literal_node->value, next_state_id);
             break;
         }
         case NODE_CONCAT: {
             ConcatNode *concat_node = (ConcatNode *)node;
-            NfaFragment left_frag = recursive_compile_ast(concat_node->left, next_state_id);
-            NfaFragment right_frag = recursive_compile_ast(concat_node->right, next_state_id);
-            frag = create_concat_fragment(left_frag, right_frag);
+            NfaFragment left_frag = recursive_compile_ast(arena, concat_node->left, next_state_id, next_capture_id, reverse);
+            NfaFragment right_frag = recursive_compile_ast(arena, concat_node->right, next_state_id, next_capture_id, reverse);
+            frag = reverse ? create_concat_fragment(arena, right_frag, left_frag) : create_concat_fragment(arena, left_frag, right_frag);
             break;
         }
         case NODE_ALTERNATION: {
             AlternationNode *alt_node = (AlternationNode *)node;
-            NfaFragment left_frag = recursive_compile_ast(alt_node->left, next_state_id);
-            NfaFragment right_frag = recursive_compile_ast(alt_node->right, next_state_id);
-            frag = create_alternation_fragment(left_frag, right_frag, next_state_id);
+            NfaFragment left_frag = recursive_compile_ast(arena, alt_node->left, next_state_id, next_capture_id, reverse);
+            NfaFragment right_frag = recursive_compile_ast(arena, alt_node->right, next_state_id, next_capture_id, reverse);
+            frag = create_alternation_fragment(arena, left_frag, right_frag, next_state_id);
             break;
         }
         case NODE_QUANTIFIER: {
             QuantifierNode *quant_node = (QuantifierNode *)node;
-            NfaFragment child_frag = recursive_compile_ast(quant_node->child, next_state_id);
+            NfaFragment child_frag = recursive_compile_ast(arena, quant_node->child, next_state_id, next_capture_id, reverse);
             switch(quant_node->quantifier) {
                 case '*':
-                    frag = create_star_fragment(child_frag, next_state_id);
+                    frag = create_star_fragment(arena, child_frag, next_state_id);
+                    if (quant_node->lazy) {
+                        swap_priority(frag.start);
+                        swap_priority(child_frag.accept);
+                    }
                     break;
                 case '+':
-                    frag = create_plus_fragment(child_frag, next_state_id);
+                    frag = create_plus_fragment(arena, child_frag, next_state_id);
+                    if (quant_node->lazy) {
+                        swap_priority(child_frag.accept);
+                    }
                     break;
                 case '?':
-                    frag = create_option_fragment(child_frag, next_state_id);
+                    frag = create_option_fragment(arena, child_frag, next_state_id);
+                    if (quant_node->lazy) {
+                        swap_priority(frag.start);
+                    }
                     break;
                 default:
                     fprintf(stderr, "compile_ast  Error: unknown quantifier '%c'\n", quant_node->quantifier);
@@ -254,127 +258,62 @@ static NfaFragment recursive_compile_ast(AstNode *node, unsigned long *next_stat
             break;
         }
         case NODE_WILDCARD: {
-            frag = create_wildcard_fragment(next_state_id);
+            frag = create_wildcard_fragment(arena, next_state_id);
             break;
         }
         case NODE_CHAR_CLASS: {
             CharClassNode *cc_node = (CharClassNode *)node;
-            frag = create_char_class_fragment(cc_node->negated, cc_node->char_set, next_state_id);
+            frag = create_char_class_fragment(arena, cc_node->negated, cc_node->char_set, next_state_id);
             break;
         }
         case NODE_CAPTURE_GROUP: {
             CaptureGroupNode *cg_node = (CaptureGroupNode *)node;
-            NfaFragment child_frag = recursive_compile_ast(cg_node->child, next_state_id);
-            // Use next_state_id as a unique capture ID
-            int capture_id = (int)(*next_state_id);
-            (*next_state_id)++;
-            frag = create_capture_group_fragment(cg_node->name, capture_id, child_frag, next_state_id);
+            // Groups are numbered by their opening parenthesis, so number before the child
+            int capture_id = (*next_capture_id)++;
+            NfaFragment child_frag = recursive_compile_ast(arena, cg_node->child, next_state_id, next_capture_id, reverse);
+            // Positions recorded right to left would be meaningless, so reversed groups only group
+            frag = reverse ? child_frag : create_capture_group_fragment(arena, cg_node->name, capture_id, child_frag, next_state_id);
             break;
         }
         default:
-            frag = create_literal_fragment('\0', next_state_id);
+            frag = create_literal_fragment(arena, '\0', next_state_id);
             break;
     }
 
     return frag;
 }
 
-NfaFragment compile_ast(AstNode *node) {
+NfaFragment compile_ast_into(Arena *arena, AstNode *node) {
     unsigned long next_state_id = 0;
-    return recursive_compile_ast(node, &next_state_id);
+    int next_capture_id = 0;
+    return recursive_compile_ast(arena, node, &next_state_id, &next_capture_id, false);
 }
 
-void free_nfa(NfaState *start) {
-    if (start == NULL) {
-        return;
-    }
-
-    // Use a simple stack for DFS traversal
-    NfaState **stack = malloc(1024 * sizeof(NfaState*));
-    if (stack == NULL) {
-        return;
-    }
-    int stack_size = 0;
-
-    // Use a dynamically allocated visited array to track visited states
-    size_t visited_capacity = 1024;
-    bool *visited = calloc(visited_capacity, sizeof(bool));
-    if (visited == NULL) {
-        free(stack);
-        return;
-    }
-
-    stack[stack_size++] = start;
-
-    while (stack_size > 0) {
-        NfaState *state = stack[--stack_size];
-
-        if (state == NULL) {
-            continue;
-        }
-
-        // Expand visited array if needed
-        if (state->id >= visited_capacity) {
-            size_t new_capacity = visited_capacity * 2;
-            while (state->id >= new_capacity) {
-                new_capacity *= 2;
-            }
-            bool *new_visited = realloc(visited, new_capacity * sizeof(bool));
-            if (new_visited == NULL) {
-                free(visited);
-                free(stack);
-                return;
-            }
-            // Initialize new portion to false
-            for (size_t i = visited_capacity; i < new_capacity; i++) {
-                new_visited[i] = false;
-            }
-            visited = new_visited;
-            visited_capacity = new_capacity;
-        }
+NfaFragment compile_ast_reverse_into(Arena *arena, AstNode *node) {
+    unsigned long next_state_id = 0;
+    int next_capture_id = 0;
+    return recursive_compile_ast(arena, node, &next_state_id, &next_capture_id, true);
+}
 
-        if (visited[state->id]) {
-            continue;
-        }
-        visited[state->id] = true;
+NfaFragment compile_ast(AstNode *node) {
+    Arena *arena = arena_new();
+    NfaFragment frag = compile_ast_into(arena, node);
+    frag.start->arena = arena;
+    return frag;
+}
 
-        // Push successor states before freeing transitions
-        if (state->out1 != NULL) {
-            if (state->out1->to != NULL) {
-                stack[stack_size++] = state->out1->to;
-            }
-            // Free character class set if it exists
-            if (state->out1->symbol == CHAR_CLASS && state->out1->char_class_set != NULL) {
-                free(state->out1->char_class_set);
-            }
-            // Free capture name if it exists
-            if ((state->out1->symbol == CAPTURE_START || state->out1->symbol == CAPTURE_END) 
-                && state->out1->capture_name != NULL) {
-                free(state->out1->capture_name);
-            }
-            free(state->out1);
-        }
-        if (state->out2 != NULL) {
-            if (state->out2->to != NULL) {
-                stack[stack_size++] = state->out2->to;
-            }
-            // Free character class set if it exists
-            if (state->out2->symbol == CHAR_CLASS && state->out2->char_class_set != NULL) {
-                free(state->out2->char_class_set);
-            }
-            // Free capture name if it exists
-            if ((state->out2->symbol == CAPTURE_START || state->out2->symbol == CAPTURE_END) 
-                && state->out2->capture_name != NULL) {
-                free(state->out2->capture_name);
-            }
-            free(state->out2);
-        }
+NfaFragment compile_ast_reverse(AstNode *node) {
+    Arena *arena = arena_new();
+    NfaFragment frag = compile_ast_reverse_into(arena, node);
+    frag.start->arena = arena;
+    return frag;
+}
 
-        free(state);
+void free_nfa(NfaState *start) {
+    // Every state and transition lives in the arena, so no walk is needed
+    if (start != NULL) {
+        arena_free(start->arena);
     }
-
-    free(visited);
-    free(stack);
 }
 
 static void print_nfa_recursive(NfaState *state, bool **visited_ptr, size_t *allocated_size) {
@@ -442,7 +381,7 @@ static void print_nfa_recursive(NfaState *state, bool **visited_ptr, size_t *all
             printf("[%s", state->out1->char_class_negated ? "^" : "");
             bool first = true;
             for (int i = 0; i < 256; i++) {
-                if (state->out1->char_class_set[i]) {
+                if ((state->out1->char_class_set[i >> 6] >> (i & 63)) & 1) {
                     if (!first) printf(",");
                     if (i >= 32 && i < 127) {
                         printf("%c", i);
@@ -477,7 +416,7 @@ static void print_nfa_recursive(NfaState *state, bool **visited_ptr, size_t *all
             printf("[%s", state->out2->char_class_negated ? "^" : "");
             bool first = true;
             for (int i = 0; i < 256; i++) {
-                if (state->out2->char_class_set[i]) {
+                if ((state->out2->char_class_set[i >> 6] >> (i & 63)) & 1) {
                     if (!first) printf(",");
                     if (i >= 32 && i < 127) {
                         printf("%c", i);
@@ -0,0 +1,1743 @@
+#include "dfa.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_STATE UINT32_MAX
+
+// Transition table entries. Real DFA states start at LAZY_FIRST_STATE.
+#define LAZY_UNKNOWN 0
+#define LAZY_DEAD 1
+#define LAZY_FIRST_STATE 2
+
+// The cache is considered to be thrashing once it has been flushed this many
+// times during a single match while producing fewer than LAZY_MIN_BYTES_PER_STATE
+// bytes of progress for every state it built.
+#define LAZY_MIN_FLUSHES 3
+#define LAZY_MIN_BYTES_PER_STATE 10
+
+// Room for the start state, the current state and the one being built.
+#define LAZY_MIN_STATES 4
+
+// Working memory for computing epsilon closures over a program
+typedef struct {
+    const Program *prog;
+    uint32_t *stack;
+    uint32_t *seen;
+    uint32_t generation;
+} SubsetBuilder;
+
+typedef struct {
+    uint32_t offset;  // Offset of the members in SetTable.pool
+    uint32_t len;
+    uint32_t hash;
+} SetEntry;
+
+// Interned NFA state sets. A set's index in entries is the id of the DFA state it
+// represents.
+typedef struct {
+    SetEntry *entries;
+    uint32_t count;
+    uint32_t capacity;
+
+    uint32_t *pool;
+    size_t pool_len;
+    size_t pool_capacity;
+
+    uint32_t *buckets;  // Open-addressed hash of id + 1, 0 = empty
+    size_t bucket_count;
+} SetTable;
+
+// New states are added under one of LAZY_SHARDS locks, picked by the top bits of
+// their set's hash, so threads building different states rarely wait on each other
+#define LAZY_SHARD_BITS 4
+#define LAZY_SHARDS (1 << LAZY_SHARD_BITS)
+
+// The ids of the cached states whose sets hash to one shard
+typedef struct {
+    pthread_mutex_t lock;
+    uint32_t *buckets;  // Open-addressed hash of id + 1, 0 = empty
+    size_t bucket_count;
+    uint32_t count;
+} StateShard;
+
+// One generation of a lazy DFA's states. The arrays hold as many states as the
+// budget can pay for and never move, so a thread follows a cached transition
+// with one load while others add states. A state's set, match flag and row of
+// transitions are written before any transition to it is stored with release
+// order, so a thread that loads the id with acquire order finds the state
+// complete. Pages of the arrays are only touched once states reach them.
+typedef struct {
+    // Indexed by state id
+    SetEntry *entries;
+    _Atomic(uint32_t) *trans;
+    bool *is_match;
+
+    uint32_t *pool;         // Members of every state's set
+
+    atomic_uint next_id;
+    atomic_size_t pool_len;
+    atomic_size_t used;     // Bytes of the budget taken by states
+    StateShard shards[LAZY_SHARDS];
+
+    uint32_t start_id;
+
+    // Renewed by every flush, so cursors can tell their state id is stale. Epochs
+    // are never reused, even across DFAs, so a cursor saved on one DFA of a
+    // program can be restored on another.
+    uint64_t epoch;
+} LazyTable;
+
+// The states of a lazy DFA, shared by every handle on it. Matches start in the
+// current table. A full table is flushed in place if no other handle is in it;
+// otherwise the flush goes to the cache's second table, which is only allocated
+// the first time that happens, and the threads still in the old table finish
+// their calls there.
+typedef struct {
+    const Program *prog;
+    uint32_t stride;        // Transitions per state, one per byte class
+    size_t cache_size;
+    // What states may take up in one table: all of cache_size until the cache is
+    // shared, then half of it, so the two tables together stay within it
+    atomic_size_t table_budget;
+
+    // Search mode: states keep only the threads ahead of the first accepting one,
+    // and seed (if not NO_STATE) is a set member standing for the unanchored loop
+    // that restarts the program at every position, with the lowest priority
+    bool leftmost_first;
+    uint32_t seed;
+
+    uint32_t max_states;
+    size_t pool_capacity;
+
+    // NULL while a flush decides which table to reset
+    _Atomic(LazyTable*) current;
+    LazyTable *tables[2];
+
+    pthread_mutex_t lock;   // Held by flushes and while handles come and go
+    LazyDfa *handle_list;
+    atomic_uint handles;
+
+    atomic_size_t states_built;
+    atomic_size_t cache_flushes;
+    atomic_size_t nfa_fallbacks;
+} LazyCache;
+
+// A handle on a cache, with the working memory one thread needs to build states
+struct LazyDfa {
+    LazyCache *cache;
+    // The table this handle's call is in, or NULL between calls. Flushes leave
+    // it alone.
+    _Atomic(LazyTable*) table;
+    LazyDfa *next_handle;
+    SubsetBuilder nfa;
+    uint32_t *work_set;
+    uint32_t *fallback_set;
+};
+
+static void *checked_realloc(void *ptr, size_t size, const char *what) {
+    void *new_ptr = realloc(ptr, size);
+    if (new_ptr == NULL) {
+        fprintf(stderr, "dfa  Error: failed to allocate %s\n", what);
+        exit(1);
+    }
+    return new_ptr;
+}
+
+static void init_subset_builder(SubsetBuilder *nfa, const Program *prog) {
+    nfa->prog = prog;
+    // Closures push each state at most once per incoming epsilon edge
+    nfa->stack = checked_realloc(NULL, (2 * (size_t)prog->count + 1) * sizeof(uint32_t), "closure stack");
+    nfa->seen = calloc(prog->count, sizeof(uint32_t));
+    if (nfa->seen == NULL) {
+        fprintf(stderr, "init_subset_builder  Error: failed to allocate seen array\n");
+        exit(1);
+    }
+    nfa->generation = 0;
+}
+
+static void free_subset_builder(SubsetBuilder *nfa) {
+    free(nfa->stack);
+    free(nfa->seen);
+}
+
+static bool inst_matches(const Program *prog, const Instruction *inst, unsigned char c) {
+    switch (inst->opcode) {
+        case OP_CHAR:
+            return inst->byte == c;
+        case OP_ANY:
+            return true;
+        case OP_CLASS:
+            return byte_set_contains(&prog->classes[inst->arg], c);
+        default:
+            return false;
+    }
+}
+
+// Appends the epsilon closure of `from` to set in priority order (out before out1),
+// skipping states already seen in the current generation.
+static void add_closure(SubsetBuilder *nfa, uint32_t from, uint32_t *set, uint32_t *count) {
+    uint32_t stack_size = 0;
+    nfa->stack[stack_size++] = from;
+
+    while (stack_size > 0) {
+        uint32_t pc = nfa->stack[--stack_size];
+        if (nfa->seen[pc] == nfa->generation) {
+            continue;
+        }
+        nfa->seen[pc] = nfa->generation;
+
+        const Instruction *inst = &nfa->prog->insts[pc];
+        switch (inst->opcode) {
+            case OP_SPLIT:
+                if (nfa->seen[inst->out1] != nfa->generation) {
+                    nfa->stack[stack_size++] = inst->out1;
+                }
+                if (nfa->seen[inst->out] != nfa->generation) {
+                    nfa->stack[stack_size++] = inst->out;
+                }
+                break;
+            case OP_JMP:
+            case OP_SAVE:
+                if (nfa->seen[inst->out] != nfa->generation) {
+                    nfa->stack[stack_size++] = inst->out;
+                }
+                break;
+            default:
+                // Only consuming and accepting states are kept; epsilon states are
+                // fully described by what they lead to
+                set[(*count)++] = pc;
+                break;
+        }
+    }
+}
+
+static void next_generation(SubsetBuilder *nfa) {
+    nfa->generation++;
+    if (nfa->generation == 0) {
+        memset(nfa->seen, 0, nfa->prog->count * sizeof(uint32_t));
+        nfa->generation = 1;
+    }
+}
+
+static uint32_t start_set(SubsetBuilder *nfa, uint32_t *out) {
+    uint32_t count = 0;
+    next_generation(nfa);
+    add_closure(nfa, nfa->prog->start, out, &count);
+    return count;
+}
+
+// Computes the set reached from `set` on byte c, returning its size
+static uint32_t step_set(SubsetBuilder *nfa, const uint32_t *set, uint32_t count, unsigned char c, uint32_t *out) {
+    uint32_t out_count = 0;
+    next_generation(nfa);
+    for (uint32_t i = 0; i < count; i++) {
+        const Instruction *inst = &nfa->prog->insts[set[i]];
+        if (inst_matches(nfa->prog, inst, c)) {
+            add_closure(nfa, inst->out, out, &out_count);
+        }
+    }
+    return out_count;
+}
+
+static bool set_is_match(const Program *prog, const uint32_t *set, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (set[i] < prog->count && prog->insts[set[i]].opcode == OP_MATCH) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Sets the bit of every pattern accepted in the set
+static void collect_matches(const SubsetBuilder *nfa, const uint32_t *set, uint32_t count, uint64_t *matched) {
+    for (uint32_t i = 0; i < count; i++) {
+        const Instruction *inst = &nfa->prog->insts[set[i]];
+        if (inst->opcode == OP_MATCH) {
+            matched[inst->arg / 64] |= (uint64_t)1 << (inst->arg % 64);
+        }
+    }
+}
+
+// Drops the threads behind the first accepting one, which leftmost-first
+// matching would never prefer
+static uint32_t cut_after_match(const SubsetBuilder *nfa, const uint32_t *set, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (set[i] < nfa->prog->count && nfa->prog->insts[set[i]].opcode == OP_MATCH) {
+            return i + 1;
+        }
+    }
+    return count;
+}
+
+static uint32_t hash_set(const uint32_t *set, uint32_t count) {
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < count; i++) {
+        hash = (hash ^ set[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void init_set_table(SetTable *table) {
+    table->capacity = 16;
+    table->count = 0;
+    table->entries = checked_realloc(NULL, table->capacity * sizeof(SetEntry), "state set entries");
+    table->pool_capacity = 64;
+    table->pool_len = 0;
+    table->pool = checked_realloc(NULL, table->pool_capacity * sizeof(uint32_t), "state set pool");
+    table->bucket_count = 64;
+    table->buckets = calloc(table->bucket_count, sizeof(uint32_t));
+    if (table->buckets == NULL) {
+        fprintf(stderr, "init_set_table  Error: failed to allocate buckets\n");
+        exit(1);
+    }
+}
+
+// Forgets every set with an id of `keep` or above
+static void truncate_set_table(SetTable *table, uint32_t keep) {
+    table->count = keep;
+    table->pool_len = keep > 0 ? table->entries[keep - 1].offset + table->entries[keep - 1].len : 0;
+    memset(table->buckets, 0, table->bucket_count * sizeof(uint32_t));
+    for (uint32_t id = 0; id < keep; id++) {
+        size_t mask = table->bucket_count - 1;
+        size_t b = table->entries[id].hash & mask;
+        while (table->buckets[b] != 0) {
+            b = (b + 1) & mask;
+        }
+        table->buckets[b] = id + 1;
+    }
+}
+
+static void free_set_table(SetTable *table) {
+    free(table->entries);
+    free(table->pool);
+    free(table->buckets);
+}
+
+static const uint32_t *set_members(const SetTable *table, uint32_t id) {
+    return table->pool + table->entries[id].offset;
+}
+
+static uint32_t find_set(const SetTable *table, const uint32_t *set, uint32_t count, uint32_t hash) {
+    size_t mask = table->bucket_count - 1;
+    for (size_t b = hash & mask; table->buckets[b] != 0; b = (b + 1) & mask) {
+        const SetEntry *entry = &table->entries[table->buckets[b] - 1];
+        if (entry->hash == hash && entry->len == count &&
+            memcmp(table->pool + entry->offset, set, count * sizeof(uint32_t)) == 0) {
+            return table->buckets[b] - 1;
+        }
+    }
+    return NO_STATE;
+}
+
+// Adds a set that find_set() did not find and returns its id
+static uint32_t intern_set(SetTable *table, const uint32_t *set, uint32_t count, uint32_t hash) {
+    if (table->count == table->capacity) {
+        table->capacity *= 2;
+        table->entries = checked_realloc(table->entries, table->capacity * sizeof(SetEntry), "state set entries");
+    }
+    if ((size_t)(table->count + 1) * 2 > table->bucket_count) {
+        free(table->buckets);
+        table->bucket_count *= 2;
+        table->buckets = calloc(table->bucket_count, sizeof(uint32_t));
+        if (table->buckets == NULL) {
+            fprintf(stderr, "intern_set  Error: failed to allocate buckets\n");
+            exit(1);
+        }
+        truncate_set_table(table, table->count);
+    }
+    if (table->pool_len + count > table->pool_capacity) {
+        while (table->pool_len + count > table->pool_capacity) {
+            table->pool_capacity *= 2;
+        }
+        table->pool = checked_realloc(table->pool, table->pool_capacity * sizeof(uint32_t), "state set pool");
+    }
+
+    uint32_t id = table->count++;
+    SetEntry *entry = &table->entries[id];
+    entry->offset = (uint32_t)table->pool_len;
+    entry->len = count;
+    entry->hash = hash;
+    if (count > 0) {
+        memcpy(table->pool + table->pool_len, set, count * sizeof(uint32_t));
+    }
+    table->pool_len += count;
+
+    size_t mask = table->bucket_count - 1;
+    size_t b = hash & mask;
+    while (table->buckets[b] != 0) {
+        b = (b + 1) & mask;
+    }
+    table->buckets[b] = id + 1;
+    return id;
+}
+
+static size_t state_cost(uint32_t stride, uint32_t set_len) {
+    return sizeof(SetEntry) + stride * sizeof(uint32_t) + sizeof(bool) + 2 * sizeof(uint32_t) +
+           set_len * sizeof(uint32_t);
+}
+
+static atomic_uint_fast64_t last_epoch;
+
+static uint64_t new_epoch(void) {
+    return atomic_fetch_add_explicit(&last_epoch, 1, memory_order_relaxed) + 1;
+}
+
+static const uint32_t *state_set(const LazyTable *table, uint32_t id) {
+    return table->pool + table->entries[id].offset;
+}
+
+// The table the handle's call is in
+static inline LazyTable *table_of(const LazyDfa *dfa) {
+    return atomic_load_explicit(&dfa->table, memory_order_relaxed);
+}
+
+static StateShard *shard_of(LazyTable *table, uint32_t hash) {
+    return &table->shards[hash >> (32 - LAZY_SHARD_BITS)];
+}
+
+static void insert_bucket(uint32_t *buckets, size_t bucket_count, uint32_t id, uint32_t hash) {
+    size_t mask = bucket_count - 1;
+    size_t b = hash & mask;
+    while (buckets[b] != 0) {
+        b = (b + 1) & mask;
+    }
+    buckets[b] = id + 1;
+}
+
+// Looks the set up among the states of its shard. The caller holds the shard's lock.
+static uint32_t find_state(const LazyTable *table, const StateShard *shard, const uint32_t *set, uint32_t count,
+                           uint32_t hash) {
+    size_t mask = shard->bucket_count - 1;
+    for (size_t b = hash & mask; shard->buckets[b] != 0; b = (b + 1) & mask) {
+        const SetEntry *entry = &table->entries[shard->buckets[b] - 1];
+        if (entry->hash == hash && entry->len == count &&
+            memcmp(table->pool + entry->offset, set, count * sizeof(uint32_t)) == 0) {
+            return shard->buckets[b] - 1;
+        }
+    }
+    return NO_STATE;
+}
+
+// Takes room for a state of count members from the budget, if there is enough
+static bool reserve_state(LazyCache *cache, LazyTable *table, uint32_t count) {
+    size_t cost = state_cost(cache->stride, count);
+    size_t budget = atomic_load_explicit(&cache->table_budget, memory_order_relaxed);
+    size_t used = atomic_load_explicit(&table->used, memory_order_relaxed);
+    do {
+        if (used + cost > budget) {
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&table->used, &used, used + cost, memory_order_relaxed,
+                                                    memory_order_relaxed));
+    return true;
+}
+
+// Adds a state that find_state() did not find to the handle's table, once its
+// room has been paid for. The caller holds the shard's lock. The state is
+// complete when its id is returned, so transitions to it may be stored right away.
+static uint32_t add_state(LazyDfa *dfa, StateShard *shard, const uint32_t *set, uint32_t count, uint32_t hash) {
+    LazyCache *cache = dfa->cache;
+    LazyTable *table = table_of(dfa);
+    if ((size_t)(shard->count + 1) * 2 > shard->bucket_count) {
+        size_t bucket_count = shard->bucket_count * 2;
+        uint32_t *buckets = calloc(bucket_count, sizeof(uint32_t));
+        if (buckets == NULL) {
+            fprintf(stderr, "add_state  Error: failed to allocate buckets\n");
+            exit(1);
+        }
+        for (size_t b = 0; b < shard->bucket_count; b++) {
+            if (shard->buckets[b] != 0) {
+                uint32_t id = shard->buckets[b] - 1;
+                insert_bucket(buckets, bucket_count, id, table->entries[id].hash);
+            }
+        }
+        free(shard->buckets);
+        shard->buckets = buckets;
+        shard->bucket_count = bucket_count;
+    }
+
+    uint32_t id = atomic_fetch_add_explicit(&table->next_id, 1, memory_order_relaxed);
+    size_t offset = atomic_fetch_add_explicit(&table->pool_len, count, memory_order_relaxed);
+    SetEntry *entry = &table->entries[id];
+    entry->offset = (uint32_t)offset;
+    entry->len = count;
+    entry->hash = hash;
+    if (count > 0) {
+        memcpy(table->pool + offset, set, count * sizeof(uint32_t));
+    }
+    table->is_match[id] = set_is_match(cache->prog, set, count);
+    memset((void*)(table->trans + (size_t)id * cache->stride), 0, cache->stride * sizeof(uint32_t));
+
+    insert_bucket(shard->buckets, shard->bucket_count, id, hash);
+    shard->count++;
+    atomic_fetch_add_explicit(&cache->states_built, 1, memory_order_relaxed);
+    return id;
+}
+
+// The id of the state for set in the handle's table, which is added if the
+// budget has room for it, counting it in *built if that is given. Returns
+// NO_STATE if the table is full.
+static uint32_t cached_state(LazyDfa *dfa, const uint32_t *set, uint32_t count, uint32_t hash, size_t *built) {
+    LazyTable *table = table_of(dfa);
+    StateShard *shard = shard_of(table, hash);
+    pthread_mutex_lock(&shard->lock);
+    uint32_t id = find_state(table, shard, set, count, hash);
+    if (id == NO_STATE && reserve_state(dfa->cache, table, count)) {
+        id = add_state(dfa, shard, set, count, hash);
+        if (built != NULL) {
+            (*built)++;
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return id;
+}
+
+// Computes the start state's set into work_set, returning its size
+static uint32_t initial_set(LazyDfa *dfa) {
+    uint32_t count = start_set(&dfa->nfa, dfa->work_set);
+    if (dfa->cache->seed != NO_STATE) {
+        dfa->work_set[count++] = dfa->cache->seed;
+    }
+    return dfa->cache->leftmost_first ? cut_after_match(&dfa->nfa, dfa->work_set, count) : count;
+}
+
+// Computes the set reached from `set` on byte c into out, returning its size
+static uint32_t step_members(LazyDfa *dfa, const uint32_t *set, uint32_t count, unsigned char c, uint32_t *out) {
+    uint32_t seed = dfa->cache->seed;
+    if (!dfa->cache->leftmost_first && seed == NO_STATE) {
+        return step_set(&dfa->nfa, set, count, c, out);
+    }
+
+    uint32_t out_count = 0;
+    next_generation(&dfa->nfa);
+    for (uint32_t i = 0; i < count; i++) {
+        if (set[i] == seed) {
+            // The loop consumes any byte and restarts the program after it
+            add_closure(&dfa->nfa, dfa->nfa.prog->start, out, &out_count);
+            out[out_count++] = seed;
+            continue;
+        }
+        const Instruction *inst = &dfa->nfa.prog->insts[set[i]];
+        if (inst_matches(dfa->nfa.prog, inst, c)) {
+            add_closure(&dfa->nfa, inst->out, out, &out_count);
+        }
+    }
+    return dfa->cache->leftmost_first ? cut_after_match(&dfa->nfa, out, out_count) : out_count;
+}
+
+// Computes the set reached from state current on byte c into work_set,
+// returning its size
+static uint32_t next_set(LazyDfa *dfa, uint32_t current, unsigned char c) {
+    const LazyTable *table = table_of(dfa);
+    return step_members(dfa, state_set(table, current), table->entries[current].len, c, dfa->work_set);
+}
+
+// Drops every state of the handle's table and re-seeds it with the start state.
+// No other handle may be in the table.
+static void reset_table(LazyDfa *dfa) {
+    LazyCache *cache = dfa->cache;
+    LazyTable *table = table_of(dfa);
+    for (size_t s = 0; s < LAZY_SHARDS; s++) {
+        memset(table->shards[s].buckets, 0, table->shards[s].bucket_count * sizeof(uint32_t));
+        table->shards[s].count = 0;
+    }
+    atomic_store_explicit(&table->next_id, LAZY_FIRST_STATE, memory_order_relaxed);
+    atomic_store_explicit(&table->pool_len, 0, memory_order_relaxed);
+    atomic_store_explicit(&table->used, LAZY_FIRST_STATE * state_cost(cache->stride, 0), memory_order_relaxed);
+    table->epoch = new_epoch();
+
+    // The start state is kept even if it alone is over budget
+    uint32_t count = initial_set(dfa);
+    uint32_t hash = hash_set(dfa->work_set, count);
+    atomic_fetch_add_explicit(&table->used, state_cost(cache->stride, count), memory_order_relaxed);
+    table->start_id = add_state(dfa, shard_of(table, hash), dfa->work_set, count, hash);
+}
+
+static LazyTable *new_table(const LazyCache *cache) {
+    LazyTable *table = calloc(1, sizeof(LazyTable));
+    if (table == NULL) {
+        fprintf(stderr, "lazy_dfa_new  Error: failed to allocate state table\n");
+        exit(1);
+    }
+    table->entries = checked_realloc(NULL, cache->max_states * sizeof(SetEntry), "state set entries");
+    table->trans = checked_realloc(NULL, (size_t)cache->max_states * cache->stride * sizeof(uint32_t),
+                                   "DFA transitions");
+    table->is_match = checked_realloc(NULL, cache->max_states * sizeof(bool), "DFA match flags");
+    table->pool = checked_realloc(NULL, cache->pool_capacity * sizeof(uint32_t), "state set pool");
+
+    for (size_t s = 0; s < LAZY_SHARDS; s++) {
+        StateShard *shard = &table->shards[s];
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->bucket_count = 16;
+        shard->buckets = calloc(shard->bucket_count, sizeof(uint32_t));
+        if (shard->buckets == NULL) {
+            fprintf(stderr, "lazy_dfa_new  Error: failed to allocate buckets\n");
+            exit(1);
+        }
+    }
+    atomic_init(&table->next_id, LAZY_FIRST_STATE);
+    atomic_init(&table->pool_len, 0);
+    atomic_init(&table->used, 0);
+
+    // Reserve ids for the "unknown" marker and the dead state. The dead state loops
+    // to itself so it never needs to be computed; its empty set is never looked up
+    // because empty steps are caught before interning.
+    for (uint32_t id = 0; id < LAZY_FIRST_STATE; id++) {
+        SetEntry empty = {0, 0, 0};
+        table->entries[id] = empty;
+        table->is_match[id] = false;
+        for (uint32_t k = 0; k < cache->stride; k++) {
+            atomic_init(&table->trans[(size_t)id * cache->stride + k], id == LAZY_DEAD ? LAZY_DEAD : LAZY_UNKNOWN);
+        }
+    }
+    return table;
+}
+
+static void free_table(LazyTable *table) {
+    if (table == NULL) {
+        return;
+    }
+    for (size_t s = 0; s < LAZY_SHARDS; s++) {
+        pthread_mutex_destroy(&table->shards[s].lock);
+        free(table->shards[s].buckets);
+    }
+    free(table->entries);
+    free(table->trans);
+    free(table->is_match);
+    free(table->pool);
+    free(table);
+}
+
+// Enters the current table for one call. The handle publishes its table before
+// it checks the current one again, and a flush clears the current table before
+// it looks at the handles, so either the flush sees the handle in the table or
+// the handle sees the flush and waits for it.
+static LazyTable *enter_table(LazyDfa *dfa) {
+    LazyCache *cache = dfa->cache;
+    for (;;) {
+        LazyTable *table = atomic_load(&cache->current);
+        if (table != NULL) {
+            atomic_store(&dfa->table, table);
+            if (atomic_load(&cache->current) == table) {
+                return table;
+            }
+            atomic_store_explicit(&dfa->table, NULL, memory_order_relaxed);
+        }
+        pthread_mutex_lock(&cache->lock);
+        pthread_mutex_unlock(&cache->lock);
+    }
+}
+
+// Ends the call, so flushes may reset the table
+static void leave_table(LazyDfa *dfa) {
+    atomic_store_explicit(&dfa->table, NULL, memory_order_release);
+}
+
+// Whether a handle other than dfa has a call in the table. The caller holds the
+// cache's lock.
+static bool table_in_use(const LazyDfa *dfa, const LazyTable *table) {
+    for (const LazyDfa *handle = dfa->cache->handle_list; handle != NULL; handle = handle->next_handle) {
+        if (handle != dfa && atomic_load(&handle->table) == table) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Moves the handle on from its full table to an empty one: the same table if no
+// other handle is in it, else the cache's other table. If another handle has
+// already flushed the cache, this one joins it in the current table. Returns
+// false if both tables are in use, leaving the handle where it was.
+static bool renew_table(LazyDfa *dfa) {
+    LazyCache *cache = dfa->cache;
+    LazyTable *table = table_of(dfa);
+    pthread_mutex_lock(&cache->lock);
+    LazyTable *current = atomic_load_explicit(&cache->current, memory_order_relaxed);
+    if (current != table) {
+        atomic_store(&dfa->table, current);
+        pthread_mutex_unlock(&cache->lock);
+        return true;
+    }
+
+    // Calls that start from here on wait for the lock
+    atomic_store(&cache->current, NULL);
+    LazyTable *target = table;
+    if (table_in_use(dfa, table)) {
+        target = cache->tables[cache->tables[0] == table ? 1 : 0];
+        if (target == NULL) {
+            target = cache->tables[1] = new_table(cache);
+        } else if (table_in_use(dfa, target)) {
+            target = NULL;
+        }
+    }
+    if (target != NULL) {
+        atomic_store(&dfa->table, target);
+        reset_table(dfa);
+        atomic_fetch_add_explicit(&cache->cache_flushes, 1, memory_order_relaxed);
+    }
+    atomic_store(&cache->current, target != NULL ? target : table);
+    pthread_mutex_unlock(&cache->lock);
+    return target != NULL;
+}
+
+// Counts the cache flushes of one scan to tell when the cache is thrashing.
+// built only counts the states this scan added since its last flush, as other
+// handles on the cache add states to the same table.
+typedef struct {
+    size_t flushes;
+    size_t last_flush_pos;
+    size_t built;
+} FlushTracker;
+
+// Builds the transition out of current on byte c, `pos` bytes into the scan, and
+// caches it. Returns the next state or LAZY_DEAD. If the table is full it is
+// flushed, which may move the handle to another table, so callers look up the
+// handle's table again afterwards. If the cache is thrashing or can't be
+// flushed, returns NO_STATE and leaves the next set in work_set with its size in
+// *count.
+static uint32_t lazy_step(LazyDfa *dfa, uint32_t current, unsigned char c, size_t pos, FlushTracker *tracker,
+                          uint32_t *count) {
+    LazyCache *cache = dfa->cache;
+    LazyTable *table = table_of(dfa);
+    size_t slot = (size_t)current * cache->stride + cache->prog->byte_classes[c];
+
+    // Any byte of the class leads to the same set, so the actual byte will do
+    *count = next_set(dfa, current, c);
+    if (*count == 0) {
+        atomic_store_explicit(&table->trans[slot], LAZY_DEAD, memory_order_release);
+        return LAZY_DEAD;
+    }
+
+    uint32_t hash = hash_set(dfa->work_set, *count);
+    uint32_t next = cached_state(dfa, dfa->work_set, *count, hash, &tracker->built);
+    if (next == NO_STATE) {
+        tracker->flushes++;
+        if (tracker->flushes >= LAZY_MIN_FLUSHES &&
+            pos - tracker->last_flush_pos < LAZY_MIN_BYTES_PER_STATE * tracker->built) {
+            atomic_fetch_add_explicit(&cache->nfa_fallbacks, 1, memory_order_relaxed);
+            return NO_STATE;
+        }
+        tracker->last_flush_pos = pos;
+        tracker->built = 0;
+
+        // reset_table() rebuilds the start state through work_set, so keep our set aside
+        memcpy(dfa->fallback_set, dfa->work_set, *count * sizeof(uint32_t));
+        next = renew_table(dfa) ? cached_state(dfa, dfa->fallback_set, *count, hash, &tracker->built) : NO_STATE;
+        if (next == NO_STATE) {
+            // Both tables are in use, or the set is too big to share one with the
+            // start state
+            memcpy(dfa->work_set, dfa->fallback_set, *count * sizeof(uint32_t));
+            atomic_fetch_add_explicit(&cache->nfa_fallbacks, 1, memory_order_relaxed);
+        }
+        return next;
+    }
+    atomic_store_explicit(&table->trans[slot], next, memory_order_release);
+    return next;
+}
+
+// Transitions are loaded with acquire order; see LazyTable
+static inline uint32_t load_trans(const _Atomic(uint32_t) *trans, size_t slot) {
+    return atomic_load_explicit(&trans[slot], memory_order_acquire);
+}
+
+static LazyDfa *new_handle(LazyCache *cache) {
+    LazyDfa *dfa = calloc(1, sizeof(LazyDfa));
+    if (dfa == NULL) {
+        fprintf(stderr, "lazy_dfa_new  Error: failed to allocate LazyDfa\n");
+        exit(1);
+    }
+    dfa->cache = cache;
+    atomic_init(&dfa->table, NULL);
+    init_subset_builder(&dfa->nfa, cache->prog);
+    // One extra slot for the seed
+    dfa->work_set = checked_realloc(NULL, ((size_t)cache->prog->count + 1) * sizeof(uint32_t), "work set");
+    dfa->fallback_set = checked_realloc(NULL, ((size_t)cache->prog->count + 1) * sizeof(uint32_t), "fallback set");
+
+    pthread_mutex_lock(&cache->lock);
+    dfa->next_handle = cache->handle_list;
+    cache->handle_list = dfa;
+    pthread_mutex_unlock(&cache->lock);
+    return dfa;
+}
+
+static LazyDfa *create_lazy_dfa(const Program *prog, size_t cache_size, bool leftmost_first, bool anchored) {
+    if (prog == NULL) {
+        return NULL;
+    }
+    if (cache_size < LAZY_MIN_STATES * state_cost(prog->num_byte_classes, 0)) {
+        fprintf(stderr, "lazy_dfa_new  Error: cache size %zu is too small\n", cache_size);
+        return NULL;
+    }
+
+    LazyCache *cache = calloc(1, sizeof(LazyCache));
+    if (cache == NULL) {
+        fprintf(stderr, "lazy_dfa_new  Error: failed to allocate state cache\n");
+        exit(1);
+    }
+    cache->prog = prog;
+    cache->stride = prog->num_byte_classes;
+    cache->cache_size = cache_size;
+    atomic_init(&cache->table_budget, cache_size);
+    cache->leftmost_first = leftmost_first;
+    cache->seed = anchored ? NO_STATE : prog->count;
+
+    // Every state the budget can pay for, plus the two reserved ids and a start
+    // state that may be over budget on its own
+    cache->max_states = (uint32_t)(cache_size / state_cost(cache->stride, 0)) + LAZY_FIRST_STATE + 1;
+    cache->pool_capacity = cache_size / sizeof(uint32_t) + (size_t)prog->count + 1;
+    cache->tables[0] = new_table(cache);
+    atomic_init(&cache->current, cache->tables[0]);
+    pthread_mutex_init(&cache->lock, NULL);
+    atomic_init(&cache->handles, 1);
+    atomic_init(&cache->states_built, 0);
+    atomic_init(&cache->cache_flushes, 0);
+    atomic_init(&cache->nfa_fallbacks, 0);
+
+    LazyDfa *dfa = new_handle(cache);
+    enter_table(dfa);
+    reset_table(dfa);
+    leave_table(dfa);
+    return dfa;
+}
+
+LazyDfa *lazy_dfa_new(const Program *prog, size_t cache_size) {
+    return create_lazy_dfa(prog, cache_size, false, true);
+}
+
+LazyDfa *lazy_dfa_new_search(const Program *prog, size_t cache_size, bool anchored) {
+    return create_lazy_dfa(prog, cache_size, true, anchored);
+}
+
+LazyDfa *lazy_dfa_new_all_matches(const Program *prog, size_t cache_size, bool anchored) {
+    return create_lazy_dfa(prog, cache_size, false, anchored);
+}
+
+// Halves the budget of each table the first time the cache is shared. A table
+// filled past the new budget before that is reset through the new handle, unless
+// a call is in it.
+static void split_budget(LazyDfa *dfa) {
+    LazyCache *cache = dfa->cache;
+    size_t budget = cache->cache_size / 2;
+    pthread_mutex_lock(&cache->lock);
+    if (atomic_load_explicit(&cache->table_budget, memory_order_relaxed) != budget) {
+        atomic_store_explicit(&cache->table_budget, budget, memory_order_relaxed);
+        LazyTable *table = atomic_load_explicit(&cache->current, memory_order_relaxed);
+        if (atomic_load_explicit(&table->used, memory_order_relaxed) > budget) {
+            // Calls that start from here on wait for the lock
+            atomic_store(&cache->current, NULL);
+            if (!table_in_use(dfa, table)) {
+                atomic_store(&dfa->table, table);
+                reset_table(dfa);
+                leave_table(dfa);
+                atomic_fetch_add_explicit(&cache->cache_flushes, 1, memory_order_relaxed);
+            }
+            atomic_store(&cache->current, table);
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+LazyDfa *lazy_dfa_share(LazyDfa *dfa) {
+    if (dfa == NULL) {
+        return NULL;
+    }
+    atomic_fetch_add_explicit(&dfa->cache->handles, 1, memory_order_relaxed);
+    LazyDfa *handle = new_handle(dfa->cache);
+    split_budget(handle);
+    return handle;
+}
+
+// Finishes a match on the NFA, starting from the given set after `pos` bytes
+static bool finish_on_nfa(LazyDfa *dfa, const uint32_t *set, uint32_t count, const uint8_t *data, size_t len,
+                          size_t pos, uint64_t *matched) {
+    uint32_t *current = dfa->fallback_set;
+    uint32_t *next = dfa->work_set;
+    memmove(current, set, count * sizeof(uint32_t));
+
+    for (size_t i = pos; i < len && count > 0; i++) {
+        count = step_set(&dfa->nfa, current, count, data[i], next);
+        uint32_t *swap = current;
+        current = next;
+        next = swap;
+    }
+    if (matched != NULL) {
+        collect_matches(&dfa->nfa, current, count, matched);
+    }
+    return set_is_match(dfa->nfa.prog, current, count);
+}
+
+bool lazy_dfa_match(LazyDfa *dfa, const char *input) {
+    return lazy_dfa_match_prefix(dfa, input, NULL);
+}
+
+bool lazy_dfa_match_bytes(LazyDfa *dfa, const uint8_t *data, size_t len) {
+    return lazy_dfa_match_prefix_bytes(dfa, data, len, NULL);
+}
+
+// Matches data, optionally skipping ahead with prefix. If matched is given, the
+// patterns accepted by the final state are added to it. The handle must be in a
+// table.
+static bool lazy_dfa_run(LazyDfa *dfa, const uint8_t *bytes, size_t len, const LiteralPrefix *prefix,
+                         uint64_t *matched) {
+    const LazyTable *table = table_of(dfa);
+    const uint8_t *byte_classes = dfa->cache->prog->byte_classes;
+    const _Atomic(uint32_t) *trans = table->trans;
+    const bool *is_match = table->is_match;
+    uint32_t stride = dfa->cache->stride;
+    uint32_t current = table->start_id;
+    FlushTracker tracker = {0, 0, 0};
+
+    bool skip = prefix != NULL && prefix->len > 0 && prefix->unanchored_start;
+    bool stop_early = prefix != NULL && prefix->unanchored_end;
+    if (prefix != NULL && prefix->len > 0 && !prefix->unanchored_start &&
+        (len < prefix->len || memcmp(bytes, prefix->bytes, prefix->len) != 0)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        if (stop_early && is_match[current]) {
+            // The trailing .* accepts whatever is left
+            return true;
+        }
+        if (skip && current == table->start_id) {
+            // Nothing is in flight, so no match can start before the next prefix
+            i = find_literal((const char*)bytes, len, i, prefix->bytes, prefix->len);
+            if (i == len) {
+                break;
+            }
+        }
+
+        uint32_t next = load_trans(trans, (size_t)current * stride + byte_classes[bytes[i]]);
+        if (next > LAZY_DEAD) {
+            current = next;
+            continue;
+        }
+        if (next == LAZY_UNKNOWN) {
+            // Transition not cached yet: build it from the NFA
+            uint32_t count;
+            next = lazy_step(dfa, current, bytes[i], i, &tracker, &count);
+            if (next == NO_STATE) {
+                return finish_on_nfa(dfa, dfa->work_set, count, bytes, len, i + 1, matched);
+            }
+            table = table_of(dfa);
+            trans = table->trans;
+            is_match = table->is_match;
+        }
+        if (next == LAZY_DEAD) {
+            return false;
+        }
+        current = next;
+    }
+
+    if (matched != NULL) {
+        collect_matches(&dfa->nfa, state_set(table, current), table->entries[current].len, matched);
+    }
+    return is_match[current];
+}
+
+// lazy_dfa_run() as a call of its own
+static bool run_call(LazyDfa *dfa, const uint8_t *bytes, size_t len, const LiteralPrefix *prefix, uint64_t *matched) {
+    enter_table(dfa);
+    bool result = lazy_dfa_run(dfa, bytes, len, prefix, matched);
+    leave_table(dfa);
+    return result;
+}
+
+bool lazy_dfa_match_prefix(LazyDfa *dfa, const char *input, const LiteralPrefix *prefix) {
+    if (dfa == NULL || input == NULL) {
+        return false;
+    }
+    return run_call(dfa, (const uint8_t*)input, strlen(input), prefix, NULL);
+}
+
+bool lazy_dfa_match_prefix_bytes(LazyDfa *dfa, const uint8_t *data, size_t len, const LiteralPrefix *prefix) {
+    if (dfa == NULL || data == NULL) {
+        return false;
+    }
+    return run_call(dfa, data, len, prefix, NULL);
+}
+
+// Inputs in flight in lazy_dfa_match_many(), one lane each
+typedef struct {
+    const uint8_t *next[LAZY_DFA_LANES];  // The lane's next byte
+    const uint8_t *end[LAZY_DFA_LANES];
+    uint32_t state[LAZY_DFA_LANES];
+    size_t index[LAZY_DFA_LANES];         // Where the lane's result goes in out
+    size_t active;
+} Lanes;
+
+// Loads the next input into lane l. Returns false once every input has been taken.
+static bool start_lane(LazyDfa *dfa, Lanes *lanes, size_t l, const uint8_t *const *inputs, const size_t *lens,
+                       size_t n, size_t *next_input, bool *out) {
+    while (*next_input < n) {
+        size_t i = (*next_input)++;
+        if (inputs[i] == NULL) {
+            out[i] = false;
+            continue;
+        }
+        lanes->next[l] = inputs[i];
+        lanes->end[l] = inputs[i] + lens[i];
+        lanes->state[l] = table_of(dfa)->start_id;
+        lanes->index[l] = i;
+        return true;
+    }
+    return false;
+}
+
+// Reports lane l's result and loads the next input into it, or drops the lane
+static void finish_lane(LazyDfa *dfa, Lanes *lanes, size_t l, bool matched, const uint8_t *const *inputs,
+                        const size_t *lens, size_t n, size_t *next_input, bool *out) {
+    out[lanes->index[l]] = matched;
+    if (!start_lane(dfa, lanes, l, inputs, lens, n, next_input, out)) {
+        lanes->active--;
+        lanes->next[l] = lanes->next[lanes->active];
+        lanes->end[l] = lanes->end[lanes->active];
+        lanes->state[l] = lanes->state[lanes->active];
+        lanes->index[l] = lanes->index[lanes->active];
+    }
+}
+
+static void fill_lanes(LazyDfa *dfa, Lanes *lanes, const uint8_t *const *inputs, const size_t *lens, size_t n,
+                       size_t *next_input, bool *out) {
+    while (lanes->active < LAZY_DFA_LANES &&
+           start_lane(dfa, lanes, lanes->active, inputs, lens, n, next_input, out)) {
+        lanes->active++;
+    }
+}
+
+void lazy_dfa_match_many(LazyDfa *dfa, const uint8_t *const *inputs, const size_t *lens, size_t n, bool *out) {
+    if (dfa == NULL || inputs == NULL || lens == NULL || out == NULL) {
+        return;
+    }
+
+    const LazyTable *table = enter_table(dfa);
+    const uint8_t *byte_classes = dfa->cache->prog->byte_classes;
+    const _Atomic(uint32_t) *trans = table->trans;
+    uint32_t stride = dfa->cache->stride;
+    Lanes lanes;
+    lanes.active = 0;
+    size_t next_input = 0;
+    fill_lanes(dfa, &lanes, inputs, lens, n, &next_input, out);
+
+    while (lanes.active > 0) {
+        // Move every lane one byte per round for as long as the shortest has
+        // input left. The table loads of different lanes don't depend on each
+        // other, so they can be in flight together.
+        size_t rounds = SIZE_MAX;
+        for (size_t l = 0; l < lanes.active; l++) {
+            size_t left = (size_t)(lanes.end[l] - lanes.next[l]);
+            rounds = left < rounds ? left : rounds;
+        }
+        size_t stalled = LAZY_DFA_LANES;
+        for (size_t r = 0; r < rounds && stalled == LAZY_DFA_LANES; r++) {
+            for (size_t l = 0; l < lanes.active; l++) {
+                uint32_t next = load_trans(trans, (size_t)lanes.state[l] * stride + byte_classes[*lanes.next[l]]);
+                if (next <= LAZY_DEAD) {
+                    stalled = l;
+                    break;
+                }
+                lanes.state[l] = next;
+                lanes.next[l]++;
+            }
+        }
+
+        if (stalled != LAZY_DFA_LANES) {
+            // A dead end or a transition that has not been built yet
+            size_t l = stalled;
+            unsigned char c = *lanes.next[l];
+            uint32_t next = load_trans(trans, (size_t)lanes.state[l] * stride + byte_classes[c]);
+            if (next == LAZY_UNKNOWN) {
+                uint64_t epoch = table->epoch;
+                FlushTracker tracker = {0, 0, 0};
+                uint32_t count;
+                next = lazy_step(dfa, lanes.state[l], c, 0, &tracker, &count);
+                if (next == NO_STATE || table_of(dfa)->epoch != epoch) {
+                    // A flush left the lanes holding stale ids, or the cache is
+                    // full, so match each input in flight again on its own
+                    for (size_t k = 0; k < lanes.active; k++) {
+                        const uint8_t *data = inputs[lanes.index[k]];
+                        out[lanes.index[k]] = lazy_dfa_run(dfa, data, lens[lanes.index[k]], NULL, NULL);
+                    }
+                    table = table_of(dfa);
+                    trans = table->trans;
+                    lanes.active = 0;
+                    fill_lanes(dfa, &lanes, inputs, lens, n, &next_input, out);
+                    continue;
+                }
+            }
+            if (next == LAZY_DEAD) {
+                finish_lane(dfa, &lanes, l, false, inputs, lens, n, &next_input, out);
+            } else {
+                lanes.state[l] = next;
+                lanes.next[l]++;
+            }
+            continue;
+        }
+
+        for (size_t l = 0; l < lanes.active; ) {
+            if (lanes.next[l] == lanes.end[l]) {
+                // finish_lane() may move another lane into l
+                finish_lane(dfa, &lanes, l, table->is_match[lanes.state[l]], inputs, lens, n, &next_input, out);
+            } else {
+                l++;
+            }
+        }
+    }
+    leave_table(dfa);
+}
+
+bool lazy_dfa_match_set(LazyDfa *dfa, const char *input, uint64_t *matched) {
+    if (input == NULL) {
+        return false;
+    }
+    return lazy_dfa_match_set_bytes(dfa, (const uint8_t*)input, strlen(input), matched);
+}
+
+bool lazy_dfa_match_set_bytes(LazyDfa *dfa, const uint8_t *data, size_t len, uint64_t *matched) {
+    if (dfa == NULL || data == NULL || matched == NULL) {
+        return false;
+    }
+    memset(matched, 0, PATTERN_SET_WORDS(dfa->nfa.prog->num_patterns) * sizeof(uint64_t));
+    return run_call(dfa, data, len, NULL, matched);
+}
+
+// The state `current` without its seed, so no thread starts after this
+// position. Returns LAZY_DEAD if nothing is left, or NO_STATE if it does not fit.
+static uint32_t stop_seeding(LazyDfa *dfa, uint32_t current) {
+    const LazyTable *table = table_of(dfa);
+    const uint32_t *set = state_set(table, current);
+    uint32_t len = table->entries[current].len;
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        if (set[i] != dfa->cache->seed) {
+            dfa->work_set[count++] = set[i];
+        }
+    }
+    if (count == len) {
+        return current;
+    }
+    if (count == 0) {
+        return LAZY_DEAD;
+    }
+    return cached_state(dfa, dfa->work_set, count, hash_set(dfa->work_set, count), NULL);
+}
+
+LazyDfaResult lazy_dfa_find_end(LazyDfa *dfa, const char *input, size_t len, size_t from, size_t *end) {
+    return lazy_dfa_find_end_bounded(dfa, input, len, from, len, end);
+}
+
+LazyDfaResult lazy_dfa_find_end_bounded(LazyDfa *dfa, const char *input, size_t len, size_t from, size_t max_start,
+                                        size_t *end) {
+    return lazy_dfa_find_end_limited(dfa, input, len, from, max_start, end, NULL);
+}
+
+// lazy_dfa_find_end_limited() once the handle is in a table
+static LazyDfaResult find_end(LazyDfa *dfa, const char *input, size_t len, size_t from, size_t max_start,
+                              size_t *end, bool *at_limit) {
+    const LazyTable *table = table_of(dfa);
+    const unsigned char *bytes = (const unsigned char*)input;
+    const uint8_t *byte_classes = dfa->cache->prog->byte_classes;
+    uint32_t stride = dfa->cache->stride;
+    uint32_t current = table->start_id;
+    FlushTracker tracker = {0, 0, 0};
+    bool found = table->is_match[current];
+    size_t last_end = from;
+    bool running = true;
+
+    // Keep going after a match: threads ahead of it may still find a preferred,
+    // longer one. The scan ends once every thread has died.
+    for (size_t i = from; i < len; i++) {
+        if (i == max_start) {
+            // Threads already running may go on, but none may start past here
+            uint32_t unseeded = stop_seeding(dfa, current);
+            if (unseeded == NO_STATE) {
+                return LAZY_DFA_GAVE_UP;
+            }
+            if (unseeded == LAZY_DEAD) {
+                running = false;
+                break;
+            }
+            current = unseeded;
+        }
+        uint32_t next = load_trans(table->trans, (size_t)current * stride + byte_classes[bytes[i]]);
+        if (next == LAZY_UNKNOWN) {
+            uint32_t count;
+            next = lazy_step(dfa, current, bytes[i], i - from, &tracker, &count);
+            if (next == NO_STATE) {
+                return LAZY_DFA_GAVE_UP;
+            }
+            table = table_of(dfa);
+        }
+        if (next == LAZY_DEAD) {
+            running = false;
+            break;
+        }
+        current = next;
+        if (table->is_match[current]) {
+            found = true;
+            last_end = i + 1;
+        }
+    }
+
+    if (at_limit != NULL) {
+        *at_limit = running;
+    }
+    if (found && end != NULL) {
+        *end = last_end;
+    }
+    return found ? LAZY_DFA_MATCH : LAZY_DFA_NO_MATCH;
+}
+
+LazyDfaResult lazy_dfa_find_end_limited(LazyDfa *dfa, const char *input, size_t len, size_t from, size_t max_start,
+                                        size_t *end, bool *at_limit) {
+    if (at_limit != NULL) {
+        *at_limit = false;
+    }
+    if (dfa == NULL || input == NULL || from > len || from > max_start) {
+        return LAZY_DFA_NO_MATCH;
+    }
+    enter_table(dfa);
+    LazyDfaResult result = find_end(dfa, input, len, from, max_start, end, at_limit);
+    leave_table(dfa);
+    return result;
+}
+
+// lazy_dfa_find_start() once the handle is in a table
+static LazyDfaResult find_start(LazyDfa *dfa, const char *input, size_t from, size_t end, size_t *start) {
+    const LazyTable *table = table_of(dfa);
+    const unsigned char *bytes = (const unsigned char*)input;
+    const uint8_t *byte_classes = dfa->cache->prog->byte_classes;
+    uint32_t stride = dfa->cache->stride;
+    uint32_t current = table->start_id;
+    FlushTracker tracker = {0, 0, 0};
+    bool found = table->is_match[current];
+    size_t first_start = end;
+
+    for (size_t i = end; i > from; i--) {
+        uint32_t next = load_trans(table->trans, (size_t)current * stride + byte_classes[bytes[i - 1]]);
+        if (next == LAZY_UNKNOWN) {
+            uint32_t count;
+            next = lazy_step(dfa, current, bytes[i - 1], end - i, &tracker, &count);
+            if (next == NO_STATE) {
+                return LAZY_DFA_GAVE_UP;
+            }
+            table = table_of(dfa);
+        }
+        if (next == LAZY_DEAD) {
+            break;
+        }
+        current = next;
+        if (table->is_match[current]) {
+            found = true;
+            first_start = i - 1;
+        }
+    }
+
+    if (found && start != NULL) {
+        *start = first_start;
+    }
+    return found ? LAZY_DFA_MATCH : LAZY_DFA_NO_MATCH;
+}
+
+LazyDfaResult lazy_dfa_find_start(LazyDfa *dfa, const char *input, size_t from, size_t end, size_t *start) {
+    if (dfa == NULL || input == NULL || from > end) {
+        return LAZY_DFA_NO_MATCH;
+    }
+    enter_table(dfa);
+    LazyDfaResult result = find_start(dfa, input, from, end, start);
+    leave_table(dfa);
+    return result;
+}
+
+void lazy_dfa_cursor_init(LazyDfa *dfa, LazyDfaCursor *cursor) {
+    cursor->set = checked_realloc(NULL, ((size_t)dfa->nfa.prog->count + 1) * sizeof(uint32_t), "cursor set");
+    lazy_dfa_cursor_reset(dfa, cursor);
+}
+
+void lazy_dfa_cursor_reset(LazyDfa *dfa, LazyDfaCursor *cursor) {
+    const LazyTable *table = enter_table(dfa);
+    const SetEntry *start = &table->entries[table->start_id];
+    memcpy(cursor->set, state_set(table, table->start_id), start->len * sizeof(uint32_t));
+    cursor->count = start->len;
+    cursor->state = table->start_id;
+    cursor->epoch = table->epoch;
+    cursor->offset = 0;
+    cursor->dead = false;
+    leave_table(dfa);
+}
+
+void lazy_dfa_cursor_free(LazyDfaCursor *cursor) {
+    free(cursor->set);
+    cursor->set = NULL;
+}
+
+// Finds the cursor's state in the handle's table, adding it back if a flush
+// removed it. Returns NO_STATE if it does not fit.
+static uint32_t resume_state(LazyDfa *dfa, LazyDfaCursor *cursor) {
+    if (cursor->state != NO_STATE && cursor->epoch == table_of(dfa)->epoch) {
+        return cursor->state;
+    }
+    return cached_state(dfa, cursor->set, cursor->count, hash_set(cursor->set, cursor->count), NULL);
+}
+
+// Remembers where the scan stopped so the next feed can pick it up
+static void save_state(LazyDfa *dfa, LazyDfaCursor *cursor, uint32_t state) {
+    const LazyTable *table = table_of(dfa);
+    cursor->state = state;
+    cursor->epoch = table->epoch;
+    cursor->count = table->entries[state].len;
+    memcpy(cursor->set, state_set(table, state), cursor->count * sizeof(uint32_t));
+}
+
+// lazy_dfa_feed() once the handle is in a table
+static bool feed(LazyDfa *dfa, LazyDfaCursor *cursor, const uint8_t *data, size_t len, LazyDfaMatchFn on_match,
+                 void *user_data) {
+    const Program *prog = dfa->nfa.prog;
+    // An empty match at the very start is reported with the first bytes
+    if (cursor->offset == 0 && len > 0 && on_match != NULL && set_is_match(prog, cursor->set, cursor->count)) {
+        on_match(0, user_data);
+    }
+
+    const LazyTable *table = table_of(dfa);
+    const uint8_t *byte_classes = prog->byte_classes;
+    uint32_t stride = dfa->cache->stride;
+    FlushTracker tracker = {0, 0, 0};
+    uint32_t current = resume_state(dfa, cursor);
+    size_t i = 0;
+
+    while (i < len && current != NO_STATE) {
+        uint32_t next = load_trans(table->trans, (size_t)current * stride + byte_classes[data[i]]);
+        if (next == LAZY_UNKNOWN) {
+            uint32_t count;
+            next = lazy_step(dfa, current, data[i], i, &tracker, &count);
+            if (next == NO_STATE) {
+                // Keep the set and finish this chunk on the NFA
+                memcpy(cursor->set, dfa->work_set, count * sizeof(uint32_t));
+                cursor->count = count;
+                cursor->state = NO_STATE;
+                current = NO_STATE;
+                i++;
+                if (on_match != NULL && set_is_match(prog, cursor->set, cursor->count)) {
+                    on_match(cursor->offset + i, user_data);
+                }
+                break;
+            }
+            table = table_of(dfa);
+        }
+        if (next == LAZY_DEAD) {
+            cursor->dead = true;
+            cursor->count = 0;
+            cursor->offset += len;
+            return false;
+        }
+        current = next;
+        i++;
+        if (on_match != NULL && table->is_match[current]) {
+            on_match(cursor->offset + i, user_data);
+        }
+    }
+
+    if (current != NO_STATE) {
+        save_state(dfa, cursor, current);
+    } else {
+        for (; i < len && cursor->count > 0; i++) {
+            cursor->count = step_members(dfa, cursor->set, cursor->count, data[i], dfa->work_set);
+            memcpy(cursor->set, dfa->work_set, cursor->count * sizeof(uint32_t));
+            if (on_match != NULL && set_is_match(prog, cursor->set, cursor->count)) {
+                on_match(cursor->offset + i + 1, user_data);
+            }
+        }
+        cursor->state = NO_STATE;
+        cursor->dead = cursor->count == 0;
+    }
+    cursor->offset += len;
+    return !cursor->dead;
+}
+
+bool lazy_dfa_feed(LazyDfa *dfa, LazyDfaCursor *cursor, const uint8_t *data, size_t len,
+                   LazyDfaMatchFn on_match, void *user_data) {
+    if (dfa == NULL || cursor == NULL || cursor->dead) {
+        return false;
+    }
+    enter_table(dfa);
+    bool alive = feed(dfa, cursor, data, len, on_match, user_data);
+    leave_table(dfa);
+    return alive;
+}
+
+// Layout of a saved cursor: a fixed header followed by one bit per NFA state
+// (plus the seed) of the current set
+typedef struct {
+    uint64_t offset;
+    uint64_t epoch;
+    uint32_t state;
+    uint32_t dead;
+    uint64_t active[];
+} SavedCursor;
+
+size_t lazy_dfa_cursor_state_size(const LazyDfa *dfa) {
+    return sizeof(SavedCursor) + PATTERN_SET_WORDS((size_t)dfa->nfa.prog->count + 1) * sizeof(uint64_t);
+}
+
+void lazy_dfa_cursor_save(const LazyDfa *dfa, const LazyDfaCursor *cursor, void *buf) {
+    SavedCursor *saved = buf;
+    saved->offset = cursor->offset;
+    saved->epoch = cursor->epoch;
+    saved->state = cursor->state;
+    saved->dead = cursor->dead;
+    memset(saved->active, 0, PATTERN_SET_WORDS((size_t)dfa->nfa.prog->count + 1) * sizeof(uint64_t));
+    for (uint32_t i = 0; i < cursor->count; i++) {
+        saved->active[cursor->set[i] / 64] |= (uint64_t)1 << (cursor->set[i] % 64);
+    }
+}
+
+void lazy_dfa_cursor_restore(const LazyDfa *dfa, LazyDfaCursor *cursor, const void *buf) {
+    const SavedCursor *saved = buf;
+    cursor->offset = saved->offset;
+    cursor->epoch = saved->epoch;
+    cursor->dead = saved->dead != 0;
+
+    // The set comes back in state order rather than priority order, which is
+    // the same DFA state for a DFA that keeps every thread
+    cursor->count = 0;
+    size_t words = PATTERN_SET_WORDS((size_t)dfa->nfa.prog->count + 1);
+    for (size_t w = 0; w < words; w++) {
+        for (uint64_t bits = saved->active[w]; bits != 0; bits &= bits - 1) {
+            cursor->set[cursor->count++] = (uint32_t)(w * 64 + (size_t)__builtin_ctzll(bits));
+        }
+    }
+    // A state id from before a flush may since name a different set, so the next
+    // feed only uses it if the epoch is still that of its table
+    cursor->state = saved->state;
+}
+
+bool lazy_dfa_cursor_is_match(const LazyDfa *dfa, const LazyDfaCursor *cursor) {
+    return dfa != NULL && cursor != NULL && set_is_match(dfa->nfa.prog, cursor->set, cursor->count);
+}
+
+LazyDfaStats lazy_dfa_stats(const LazyDfa *dfa) {
+    LazyCache *cache = dfa->cache;
+    LazyDfaStats stats;
+    stats.states_built = atomic_load_explicit(&cache->states_built, memory_order_relaxed);
+    stats.cache_flushes = atomic_load_explicit(&cache->cache_flushes, memory_order_relaxed);
+    stats.nfa_fallbacks = atomic_load_explicit(&cache->nfa_fallbacks, memory_order_relaxed);
+    // The current table is only unset while a flush holds the lock
+    pthread_mutex_lock(&cache->lock);
+    stats.cache_bytes = atomic_load_explicit(&atomic_load(&cache->current)->used, memory_order_relaxed);
+    pthread_mutex_unlock(&cache->lock);
+    return stats;
+}
+
+size_t lazy_dfa_cache_bytes(const LazyDfa *dfa) {
+    LazyCache *cache = dfa->cache;
+    // Tables live as long as the cache, and the first is never replaced, so
+    // whichever one is read here stays valid
+    LazyTable *table = atomic_load_explicit(&cache->current, memory_order_acquire);
+    if (table == NULL) {
+        table = cache->tables[0];
+    }
+    return atomic_load_explicit(&table->used, memory_order_acquire);
+}
+
+void lazy_dfa_free(LazyDfa *dfa) {
+    if (dfa == NULL) {
+        return;
+    }
+    LazyCache *cache = dfa->cache;
+    pthread_mutex_lock(&cache->lock);
+    LazyDfa **link = &cache->handle_list;
+    while (*link != dfa) {
+        link = &(*link)->next_handle;
+    }
+    *link = dfa->next_handle;
+    pthread_mutex_unlock(&cache->lock);
+    free_subset_builder(&dfa->nfa);
+    free(dfa->work_set);
+    free(dfa->fallback_set);
+    free(dfa);
+
+    // The last handle takes the cache with it
+    if (atomic_fetch_sub_explicit(&cache->handles, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+    free_table(cache->tables[0]);
+    free_table(cache->tables[1]);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+// Hopcroft's partition refinement. Starts from {accepting, non-accepting} and splits
+// blocks until no symbol separates two states of the same block.
+static Dfa *minimize_dfa(const uint32_t *table, const bool *accepting, uint32_t n, uint32_t k, uint32_t start) {
+    // Predecessor lists grouped by (byte class, target)
+    uint32_t *inv_offsets = calloc((size_t)k * n + 1, sizeof(uint32_t));
+    uint32_t *inv_sources = checked_realloc(NULL, (size_t)k * n * sizeof(uint32_t), "inverse transitions");
+    if (inv_offsets == NULL) {
+        fprintf(stderr, "minimize_dfa  Error: failed to allocate inverse transitions\n");
+        exit(1);
+    }
+    for (uint32_t s = 0; s < n; s++) {
+        for (uint32_t c = 0; c < k; c++) {
+            inv_offsets[(size_t)c * n + table[(size_t)s * k + c] + 1]++;
+        }
+    }
+    for (size_t i = 1; i <= (size_t)k * n; i++) {
+        inv_offsets[i] += inv_offsets[i - 1];
+    }
+    uint32_t *fill = checked_realloc(NULL, (size_t)k * n * sizeof(uint32_t), "inverse fill");
+    memcpy(fill, inv_offsets, (size_t)k * n * sizeof(uint32_t));
+    for (uint32_t s = 0; s < n; s++) {
+        for (uint32_t c = 0; c < k; c++) {
+            inv_sources[fill[(size_t)c * n + table[(size_t)s * k + c]]++] = s;
+        }
+    }
+    free(fill);
+
+    // Blocks are contiguous ranges of elems; the first `marked` elements of a block
+    // are the ones hit by the current splitter.
+    uint32_t *elems = checked_realloc(NULL, n * sizeof(uint32_t), "partition");
+    uint32_t *pos = checked_realloc(NULL, n * sizeof(uint32_t), "partition positions");
+    uint32_t *block_of = checked_realloc(NULL, n * sizeof(uint32_t), "partition blocks");
+    uint32_t *block_start = checked_realloc(NULL, n * sizeof(uint32_t), "block starts");
+    uint32_t *block_end = checked_realloc(NULL, n * sizeof(uint32_t), "block ends");
+    uint32_t *marked = calloc(n, sizeof(uint32_t));
+    bool *in_work = calloc(n, sizeof(bool));
+    uint32_t *work = checked_realloc(NULL, n * sizeof(uint32_t), "worklist");
+    uint32_t *touched = checked_realloc(NULL, n * sizeof(uint32_t), "touched blocks");
+    uint32_t *splitter = checked_realloc(NULL, n * sizeof(uint32_t), "splitter");
+    if (marked == NULL || in_work == NULL) {
+        fprintf(stderr, "minimize_dfa  Error: failed to allocate partition\n");
+        exit(1);
+    }
+
+    uint32_t num_blocks = 0;
+    uint32_t work_size = 0;
+    uint32_t next_pos = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        uint32_t first = next_pos;
+        for (uint32_t s = 0; s < n; s++) {
+            if (accepting[s] == (pass == 0)) {
+                elems[next_pos] = s;
+                pos[s] = next_pos++;
+                block_of[s] = num_blocks;
+            }
+        }
+        if (next_pos > first) {
+            block_start[num_blocks] = first;
+            block_end[num_blocks] = next_pos;
+            in_work[num_blocks] = true;
+            work[work_size++] = num_blocks++;
+        }
+    }
+
+    while (work_size > 0) {
+        uint32_t a = work[--work_size];
+        in_work[a] = false;
+        uint32_t splitter_len = block_end[a] - block_start[a];
+        memcpy(splitter, elems + block_start[a], splitter_len * sizeof(uint32_t));
+
+        for (uint32_t c = 0; c < k; c++) {
+            uint32_t num_touched = 0;
+            for (uint32_t i = 0; i < splitter_len; i++) {
+                size_t key = (size_t)c * n + splitter[i];
+                for (uint32_t e = inv_offsets[key]; e < inv_offsets[key + 1]; e++) {
+                    uint32_t p = inv_sources[e];
+                    uint32_t b = block_of[p];
+                    uint32_t boundary = block_start[b] + marked[b];
+                    if (pos[p] < boundary) {
+                        continue;
+                    }
+                    if (marked[b] == 0) {
+                        touched[num_touched++] = b;
+                    }
+                    uint32_t q = elems[boundary];
+                    elems[pos[p]] = q;
+                    pos[q] = pos[p];
+                    elems[boundary] = p;
+                    pos[p] = boundary;
+                    marked[b]++;
+                }
+            }
+
+            for (uint32_t t = 0; t < num_touched; t++) {
+                uint32_t b = touched[t];
+                uint32_t split_at = block_start[b] + marked[b];
+                marked[b] = 0;
+                if (split_at == block_end[b]) {
+                    continue;
+                }
+
+                uint32_t nb = num_blocks++;
+                block_start[nb] = block_start[b];
+                block_end[nb] = split_at;
+                block_start[b] = split_at;
+                for (uint32_t i = block_start[nb]; i < block_end[nb]; i++) {
+                    block_of[elems[i]] = nb;
+                }
+
+                if (in_work[b]) {
+                    in_work[nb] = true;
+                    work[work_size++] = nb;
+                } else {
+                    uint32_t smaller = (block_end[nb] - block_start[nb] <= block_end[b] - block_start[b]) ? nb : b;
+                    in_work[smaller] = true;
+                    work[work_size++] = smaller;
+                }
+            }
+        }
+    }
+
+    // Renumber blocks so the dead state's block is DFA_DEAD_STATE
+    uint32_t *new_id = checked_realloc(NULL, num_blocks * sizeof(uint32_t), "block ids");
+    for (uint32_t b = 0; b < num_blocks; b++) {
+        new_id[b] = NO_STATE;
+    }
+    uint32_t next_id = 0;
+    new_id[block_of[DFA_DEAD_STATE]] = next_id++;
+    for (uint32_t b = 0; b < num_blocks; b++) {
+        if (new_id[b] == NO_STATE) {
+            new_id[b] = next_id++;
+        }
+    }
+
+    Dfa *dfa = malloc(sizeof(Dfa));
+    if (dfa == NULL) {
+        fprintf(stderr, "minimize_dfa  Error: failed to allocate Dfa\n");
+        exit(1);
+    }
+    dfa->num_states = num_blocks;
+    dfa->num_classes = k;
+    dfa->start = new_id[block_of[start]];
+    dfa->table = checked_realloc(NULL, (size_t)num_blocks * k * sizeof(uint32_t), "DFA table");
+    dfa->accepting = checked_realloc(NULL, num_blocks * sizeof(bool), "DFA accepting states");
+    for (uint32_t b = 0; b < num_blocks; b++) {
+        uint32_t rep = elems[block_start[b]];
+        uint32_t id = new_id[b];
+        dfa->accepting[id] = accepting[rep];
+        for (uint32_t c = 0; c < k; c++) {
+            dfa->table[(size_t)id * k + c] = new_id[block_of[table[(size_t)rep * k + c]]];
+        }
+    }
+
+    free(new_id);
+    free(splitter);
+    free(touched);
+    free(work);
+    free(in_work);
+    free(marked);
+    free(block_end);
+    free(block_start);
+    free(block_of);
+    free(pos);
+    free(elems);
+    free(inv_sources);
+    free(inv_offsets);
+    return dfa;
+}
+
+Dfa *compile_dfa(const Program *prog, size_t max_states) {
+    if (prog == NULL) {
+        return NULL;
+    }
+
+    SubsetBuilder nfa;
+    init_subset_builder(&nfa, prog);
+    SetTable sets;
+    init_set_table(&sets);
+    uint32_t *work_set = checked_realloc(NULL, prog->count * sizeof(uint32_t), "work set");
+
+    // The empty set is the dead state, so it gets id DFA_DEAD_STATE
+    intern_set(&sets, NULL, 0, hash_set(NULL, 0));
+    uint32_t count = start_set(&nfa, work_set);
+    uint32_t hash = hash_set(work_set, count);
+    uint32_t start = find_set(&sets, work_set, count, hash);
+    if (start == NO_STATE) {
+        start = intern_set(&sets, work_set, count, hash);
+    }
+
+    // One column per byte class, stepped with the first byte of the class
+    uint32_t k = prog->num_byte_classes;
+    unsigned char representative[256];
+    for (int c = 255; c >= 0; c--) {
+        representative[prog->byte_classes[c]] = (unsigned char)c;
+    }
+
+    size_t table_capacity = 16;
+    uint32_t *table = checked_realloc(NULL, table_capacity * k * sizeof(uint32_t), "DFA table");
+    bool failed = false;
+
+    // Sets are interned in discovery order, so walking ids is a breadth-first worklist
+    for (uint32_t id = 0; id < sets.count && !failed; id++) {
+        if (id >= table_capacity) {
+            table_capacity *= 2;
+            table = checked_realloc(table, table_capacity * k * sizeof(uint32_t), "DFA table");
+        }
+        for (uint32_t c = 0; c < k; c++) {
+            count = step_set(&nfa, set_members(&sets, id), sets.entries[id].len, representative[c], work_set);
+            hash = hash_set(work_set, count);
+            uint32_t target = find_set(&sets, work_set, count, hash);
+            if (target == NO_STATE) {
+                // The dead state does not count against the limit
+                if (sets.count - 1 >= max_states) {
+                    failed = true;
+                    break;
+                }
+                target = intern_set(&sets, work_set, count, hash);
+            }
+            table[(size_t)id * k + c] = target;
+        }
+    }
+
+    Dfa *dfa = NULL;
+    if (!failed) {
+        bool *accepting = checked_realloc(NULL, sets.count * sizeof(bool), "accepting states");
+        for (uint32_t id = 0; id < sets.count; id++) {
+            accepting[id] = set_is_match(nfa.prog, set_members(&sets, id), sets.entries[id].len);
+        }
+        dfa = minimize_dfa(table, accepting, sets.count, k, start);
+        memcpy(dfa->byte_classes, prog->byte_classes, sizeof(dfa->byte_classes));
+        free(accepting);
+    }
+
+    free(table);
+    free(work_set);
+    free_set_table(&sets);
+    free_subset_builder(&nfa);
+    return dfa;
+}
+
+bool dfa_match(const Dfa *dfa, const char *input) {
+    if (input == NULL) {
+        return false;
+    }
+    return dfa_match_bytes(dfa, (const uint8_t*)input, strlen(input));
+}
+
+bool dfa_match_bytes(const Dfa *dfa, const uint8_t *bytes, size_t len) {
+    if (dfa == NULL || bytes == NULL) {
+        return false;
+    }
+
+    uint32_t state = dfa->start;
+    for (size_t i = 0; i < len; i++) {
+        state = dfa->table[(size_t)state * dfa->num_classes + dfa->byte_classes[bytes[i]]];
+        if (state == DFA_DEAD_STATE) {
+            return false;
+        }
+    }
+    return dfa->accepting[state];
+}
+
+void free_dfa(Dfa *dfa) {
+    if (dfa == NULL) {
+        return;
+    }
+    free(dfa->table);
+    free(dfa->accepting);
+    free(dfa);
+}
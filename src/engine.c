@@ -0,0 +1,816 @@
+#include "engine.h"
+#include "engine_internal.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A slot belongs to the first thread that looks for a scratch there, and after
+// it exits to whichever thread takes over its number. Only the owner touches
+// `owned`, so it takes and returns its scratch with plain loads and
+// stores. Spares are taken with an atomic exchange and put back with a
+// compare-and-swap, so no thread ever waits and no scratch is handed out twice.
+// Each slot has a cache line to itself.
+struct RegexPoolSlot {
+    _Alignas(64) atomic_uint_fast64_t owner;  // Thread id, 0 while unclaimed
+    RegexScratch *owned;                      // NULL while the owner is using it
+    _Atomic(RegexScratch*) spare;
+};
+
+// Compiles the pattern, for matching within lines if single_line is set
+static Regex *compile_regex(const char *pattern, bool single_line) {
+    if (pattern == NULL) {
+        return NULL;
+    }
+    Arena *arena = arena_new();
+    AstNode *ast = single_line ? parse_lines_into(arena, pattern) : parse_into(arena, pattern);
+    if (ast == NULL) {
+        arena_free(arena);
+        return NULL;
+    }
+
+    Regex *re = calloc(1, sizeof(Regex));
+    if (re == NULL) {
+        fprintf(stderr, "regex_compile  Error: failed to allocate Regex\n");
+        exit(1);
+    }
+    re->arena = arena;
+    re->ast = ast;
+    re->pattern = strdup(pattern);
+    if (re->pattern == NULL) {
+        fprintf(stderr, "regex_compile  Error: failed to copy pattern\n");
+        exit(1);
+    }
+    re->nfa = compile_ast_into(arena, ast);
+    re->prog = compile_program(re->nfa);
+    re->prefix = extract_literal_prefix(ast);
+    re->factors = extract_required_factors(ast);
+    // The prefix search already rejects inputs without the prefix
+    if (re->factors.count == 1 && re->prefix.unanchored_start && re->factors.lens[0] == re->prefix.len &&
+        memcmp(re->factors.factors[0], re->prefix.bytes, re->prefix.len) == 0) {
+        free_required_factors(&re->factors);
+    }
+
+    re->search_ast = single_line ? parse_search_lines_into(arena, pattern, &re->anchored_start, &re->anchored_end)
+                                 : parse_search_into(arena, pattern, &re->anchored_start, &re->anchored_end);
+    if (re->search_ast != NULL) {
+        re->search_nfa = compile_ast_into(arena, re->search_ast);
+        re->search_prog = compile_program(re->search_nfa);
+        re->search_prefix = extract_literal_prefix(re->search_ast);
+
+        re->reverse_nfa = compile_ast_reverse_into(arena, re->search_ast);
+        re->reverse_prog = compile_program(re->reverse_nfa);
+    }
+
+    re->dfa = lazy_dfa_new(re->prog, LAZY_DFA_DEFAULT_CACHE_SIZE);
+    if (re->search_prog != NULL) {
+        re->search_dfa = lazy_dfa_new_search(re->search_prog, LAZY_DFA_DEFAULT_CACHE_SIZE, re->anchored_start);
+        re->reverse_dfa = lazy_dfa_new(re->reverse_prog, LAZY_DFA_DEFAULT_CACHE_SIZE);
+        re->stream_dfa = lazy_dfa_new_all_matches(re->search_prog, LAZY_DFA_DEFAULT_CACHE_SIZE, re->anchored_start);
+    }
+    re->pool = aligned_alloc(_Alignof(RegexPoolSlot), REGEX_POOL_SLOTS * sizeof(RegexPoolSlot));
+    if (re->pool == NULL) {
+        fprintf(stderr, "regex_compile  Error: failed to allocate scratch pool\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < REGEX_POOL_SLOTS; i++) {
+        atomic_init(&re->pool[i].owner, 0);
+        re->pool[i].owned = NULL;
+        atomic_init(&re->pool[i].spare, NULL);
+    }
+    // A single-line Regex is its own single-line form
+    re->lines = single_line ? re : NULL;
+    return re;
+}
+
+Regex *regex_compile(const char *pattern) {
+    return compile_regex(pattern, false);
+}
+
+const Regex *regex_lines(const Regex *re) {
+    Regex *lines = __atomic_load_n(&re->lines, __ATOMIC_ACQUIRE);
+    if (lines != NULL) {
+        return lines;
+    }
+    // Threads that get here together each compile it, and all but the first
+    // to store theirs free them
+    Regex *compiled = compile_regex(re->pattern, true);
+    if (!__atomic_compare_exchange_n(&((Regex*)re)->lines, &lines, compiled, false, __ATOMIC_ACQ_REL,
+                                     __ATOMIC_ACQUIRE)) {
+        regex_free(compiled);
+        return lines;
+    }
+    return compiled;
+}
+
+RegexScratch *regex_scratch_new(const Regex *re) {
+    if (re == NULL) {
+        return NULL;
+    }
+    RegexScratch *scratch = calloc(1, sizeof(RegexScratch));
+    if (scratch == NULL) {
+        fprintf(stderr, "regex_scratch_new  Error: failed to allocate RegexScratch\n");
+        exit(1);
+    }
+    scratch->re = re;
+    // The Regex's DFAs are never matched with directly, so sharing them is safe
+    // however many threads create scratches at once
+    scratch->dfa = lazy_dfa_share(re->dfa);
+    scratch->match = match_scratch_new(re->prog);
+    if (re->search_prog != NULL) {
+        scratch->search = match_scratch_new(re->search_prog);
+        scratch->search_dfa = lazy_dfa_share(re->search_dfa);
+        scratch->reverse_dfa = lazy_dfa_share(re->reverse_dfa);
+        scratch->stream_dfa = lazy_dfa_share(re->stream_dfa);
+    }
+    return scratch;
+}
+
+void regex_scratch_free(RegexScratch *scratch) {
+    if (scratch == NULL) {
+        return;
+    }
+    lazy_dfa_free(scratch->stream_dfa);
+    lazy_dfa_free(scratch->reverse_dfa);
+    lazy_dfa_free(scratch->search_dfa);
+    match_scratch_free(scratch->search);
+    match_scratch_free(scratch->match);
+    lazy_dfa_free(scratch->dfa);
+    free(scratch);
+}
+
+// Threads are numbered from 1 in the order they first use a pool, and a thread's
+// number goes back to a free list when it exits, for the next new thread to
+// take. Numbers stay as small as the count of live threads, so up to
+// REGEX_POOL_SLOTS threads each own a slot and never write to another thread's
+// cache line, and a thread that takes over a number takes over the home slot,
+// and the scratch kept there, in every pool.
+static _Thread_local uint64_t thread_id;
+
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_key;    // Set to the thread's number, to free it on exit
+static pthread_mutex_t thread_ids_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t last_thread_id;
+static uint64_t *free_thread_ids;
+static size_t num_free_thread_ids;
+static size_t free_thread_ids_capacity;
+
+static void free_thread_id(void *value) {
+    uint64_t id = (uint64_t)(uintptr_t)value;
+    pthread_mutex_lock(&thread_ids_lock);
+    if (num_free_thread_ids == free_thread_ids_capacity) {
+        size_t capacity = free_thread_ids_capacity ? free_thread_ids_capacity * 2 : REGEX_POOL_SLOTS;
+        uint64_t *ids = realloc(free_thread_ids, capacity * sizeof(uint64_t));
+        if (ids == NULL) {
+            // The number is never reused; its slots go to spares
+            pthread_mutex_unlock(&thread_ids_lock);
+            return;
+        }
+        free_thread_ids = ids;
+        free_thread_ids_capacity = capacity;
+    }
+    free_thread_ids[num_free_thread_ids++] = id;
+    pthread_mutex_unlock(&thread_ids_lock);
+}
+
+static void create_thread_key(void) {
+    if (pthread_key_create(&thread_key, free_thread_id) != 0) {
+        fprintf(stderr, "regex_scratch_acquire  Error: failed to create thread key\n");
+        exit(1);
+    }
+}
+
+static uint64_t current_thread_id(void) {
+    if (thread_id == 0) {
+        pthread_once(&thread_key_once, create_thread_key);
+        pthread_mutex_lock(&thread_ids_lock);
+        uint64_t id = num_free_thread_ids > 0 ? free_thread_ids[--num_free_thread_ids] : ++last_thread_id;
+        pthread_mutex_unlock(&thread_ids_lock);
+        pthread_setspecific(thread_key, (void*)(uintptr_t)id);
+        thread_id = id;
+    }
+    return thread_id;
+}
+
+// The calling thread's home slot, claimed for it if no thread owns the slot yet
+static RegexPoolSlot *home_slot(const Regex *re, uint64_t id, bool *owned) {
+    RegexPoolSlot *slot = &re->pool[(id - 1) % REGEX_POOL_SLOTS];
+    uint_fast64_t owner = atomic_load_explicit(&slot->owner, memory_order_relaxed);
+    if (owner == 0) {
+        uint_fast64_t unclaimed = 0;
+        owner = atomic_compare_exchange_strong_explicit(&slot->owner, &unclaimed, id, memory_order_relaxed,
+                                                        memory_order_relaxed) ? id : unclaimed;
+    }
+    *owned = owner == id;
+    return slot;
+}
+
+RegexScratch *regex_scratch_acquire(const Regex *re) {
+    if (re == NULL) {
+        return NULL;
+    }
+    uint64_t id = current_thread_id();
+    bool owned;
+    RegexPoolSlot *home = home_slot(re, id, &owned);
+    if (owned && home->owned != NULL) {
+        RegexScratch *scratch = home->owned;
+        home->owned = NULL;
+        return scratch;
+    }
+
+    // The owner's scratch is in use, or the slot is another thread's
+    size_t first = (size_t)(home - re->pool);
+    for (size_t k = 0; k < REGEX_POOL_SLOTS; k++) {
+        RegexPoolSlot *slot = &re->pool[(first + k) % REGEX_POOL_SLOTS];
+        // Empty slots are only read, so their lines stay shared between threads
+        if (atomic_load_explicit(&slot->spare, memory_order_relaxed) == NULL) {
+            continue;
+        }
+        RegexScratch *scratch = atomic_exchange_explicit(&slot->spare, NULL, memory_order_acquire);
+        if (scratch != NULL) {
+            return scratch;
+        }
+    }
+    return regex_scratch_new(re);
+}
+
+void regex_scratch_release(RegexScratch *scratch) {
+    if (scratch == NULL) {
+        return;
+    }
+    const Regex *re = scratch->re;
+    uint64_t id = current_thread_id();
+    bool owned;
+    RegexPoolSlot *home = home_slot(re, id, &owned);
+    if (owned && home->owned == NULL) {
+        home->owned = scratch;
+        return;
+    }
+
+    size_t first = (size_t)(home - re->pool);
+    for (size_t k = 0; k < REGEX_POOL_SLOTS; k++) {
+        RegexPoolSlot *slot = &re->pool[(first + k) % REGEX_POOL_SLOTS];
+        RegexScratch *empty = NULL;
+        if (atomic_load_explicit(&slot->spare, memory_order_relaxed) == NULL &&
+            atomic_compare_exchange_strong_explicit(&slot->spare, &empty, scratch, memory_order_release,
+                                                    memory_order_relaxed)) {
+            return;
+        }
+    }
+    regex_scratch_free(scratch);
+}
+
+// Whether scratch can be used to match re
+static bool scratch_fits(const Regex *re, const RegexScratch *scratch) {
+    return re != NULL && scratch != NULL && scratch->re == re;
+}
+
+const char *regex_pattern(const Regex *re) {
+    return re != NULL ? re->pattern : NULL;
+}
+
+size_t regex_num_states(const Regex *re) {
+    return re != NULL ? re->prog->count : 0;
+}
+
+size_t regex_num_captures(const Regex *re) {
+    return re != NULL && re->search_prog != NULL ? re->search_prog->num_captures : 0;
+}
+
+const LiteralPrefix *regex_literal_prefix(const Regex *re) {
+    return re != NULL ? &re->prefix : NULL;
+}
+
+bool regex_match(const Regex *re, const char *input) {
+    if (input == NULL) {
+        return false;
+    }
+    return regex_match_bytes(re, (const uint8_t*)input, strlen(input));
+}
+
+bool regex_match_bytes(const Regex *re, const uint8_t *data, size_t len) {
+    if (re == NULL || data == NULL) {
+        return false;
+    }
+    RegexScratch *scratch = regex_scratch_acquire(re);
+    bool matched = regex_match_with_scratch_bytes(re, scratch, data, len);
+    regex_scratch_release(scratch);
+    return matched;
+}
+
+bool regex_match_with_scratch(const Regex *re, RegexScratch *scratch, const char *input) {
+    if (input == NULL) {
+        return false;
+    }
+    return regex_match_with_scratch_bytes(re, scratch, (const uint8_t*)input, strlen(input));
+}
+
+bool regex_match_with_scratch_bytes(const Regex *re, RegexScratch *scratch, const uint8_t *data, size_t len) {
+    if (!scratch_fits(re, scratch) || data == NULL) {
+        return false;
+    }
+    if (re->factors.count > 0 && !contains_required_factor(&re->factors, (const char*)data, len)) {
+        return false;
+    }
+    if (scratch->dfa != NULL) {
+        return lazy_dfa_match_prefix_bytes(scratch->dfa, data, len, &re->prefix);
+    }
+    return program_match_with_scratch_bytes(re->prog, scratch->match, data, len);
+}
+
+// Whether regex_match_bytes() can reject data without running an automaton
+static bool rejected_by_prefilter(const Regex *re, const uint8_t *data, size_t len) {
+    if (re->prefix.len > 0 && !re->prefix.unanchored_start &&
+        (len < re->prefix.len || memcmp(data, re->prefix.bytes, re->prefix.len) != 0)) {
+        return true;
+    }
+    return re->factors.count > 0 && !contains_required_factor(&re->factors, (const char*)data, len);
+}
+
+void regex_match_many(const Regex *re, const uint8_t *const *inputs, const size_t *lens, size_t n, bool *out) {
+    RegexScratch *scratch = regex_scratch_acquire(re);
+    regex_match_many_with_scratch(re, scratch, inputs, lens, n, out);
+    regex_scratch_release(scratch);
+}
+
+void regex_match_many_with_scratch(const Regex *re, RegexScratch *scratch, const uint8_t *const *inputs,
+                                   const size_t *lens, size_t n, bool *out) {
+    if (inputs == NULL || lens == NULL || out == NULL) {
+        return;
+    }
+    if (!scratch_fits(re, scratch) || scratch->dfa == NULL ||
+        lazy_dfa_cache_bytes(scratch->dfa) < REGEX_INTERLEAVE_MIN_CACHE) {
+        // A small table is in L1 anyway, so there is no latency to hide
+        for (size_t i = 0; i < n; i++) {
+            out[i] = regex_match_with_scratch_bytes(re, scratch, inputs[i], lens[i]);
+        }
+        return;
+    }
+    bool anchored_prefix = re->prefix.len > 0 && !re->prefix.unanchored_start;
+    if (!anchored_prefix && re->factors.count == 0) {
+        lazy_dfa_match_many(scratch->dfa, inputs, lens, n, out);
+        return;
+    }
+
+    // Only inputs the prefilters let through go to the DFA
+    const uint8_t *survivors[REGEX_MATCH_MANY_GROUP];
+    size_t survivor_lens[REGEX_MATCH_MANY_GROUP];
+    size_t survivor_index[REGEX_MATCH_MANY_GROUP];
+    bool survivor_out[REGEX_MATCH_MANY_GROUP];
+    for (size_t first = 0; first < n; first += REGEX_MATCH_MANY_GROUP) {
+        size_t last = n - first > REGEX_MATCH_MANY_GROUP ? first + REGEX_MATCH_MANY_GROUP : n;
+        size_t count = 0;
+        for (size_t i = first; i < last; i++) {
+            out[i] = false;
+            if (inputs[i] != NULL && !rejected_by_prefilter(re, inputs[i], lens[i])) {
+                survivors[count] = inputs[i];
+                survivor_lens[count] = lens[i];
+                survivor_index[count] = i;
+                count++;
+            }
+        }
+        lazy_dfa_match_many(scratch->dfa, survivors, survivor_lens, count, survivor_out);
+        for (size_t k = 0; k < count; k++) {
+            out[survivor_index[k]] = survivor_out[k];
+        }
+    }
+}
+
+// A result for a failed match
+static MatchResult no_match(void) {
+    MatchResult result;
+    result.matched = false;
+    result.num_groups = 0;
+    result.groups = NULL;
+    return result;
+}
+
+MatchResult regex_match_with_captures(const Regex *re, const char *input) {
+    if (input == NULL) {
+        return regex_match_with_captures_bytes(re, NULL, 0);
+    }
+    return regex_match_with_captures_bytes(re, (const uint8_t*)input, strlen(input));
+}
+
+MatchResult regex_match_with_captures_bytes(const Regex *re, const uint8_t *data, size_t len) {
+    if (re == NULL || data == NULL) {
+        return no_match();
+    }
+    RegexScratch *scratch = regex_scratch_acquire(re);
+    MatchResult result = program_match_with_captures_scratch_bytes(re->prog, scratch->match, data, len);
+    regex_scratch_release(scratch);
+    return result;
+}
+
+bool regex_find_bounded(const Regex *re, const char *buf, size_t len, size_t from, size_t max_start,
+                        size_t *start, size_t *end) {
+    if (re == NULL || buf == NULL) {
+        return false;
+    }
+    RegexScratch *scratch = regex_scratch_acquire(re);
+    bool found = regex_find_bounded_with_scratch(re, scratch, buf, len, from, max_start, start, end);
+    regex_scratch_release(scratch);
+    return found;
+}
+
+bool regex_find_bounded_with_scratch(const Regex *re, RegexScratch *scratch, const char *buf, size_t len,
+                                     size_t from, size_t max_start, size_t *start, size_t *end) {
+    return regex_find_limited_with_scratch(re, scratch, buf, len, from, max_start, start, end, NULL);
+}
+
+bool regex_find_limited_with_scratch(const Regex *re, RegexScratch *scratch, const char *buf, size_t len,
+                                     size_t from, size_t max_start, size_t *start, size_t *end, bool *at_limit) {
+    if (at_limit != NULL) {
+        *at_limit = false;
+    }
+    if (!scratch_fits(re, scratch) || buf == NULL || re->search_prog == NULL || from > len || from > max_start ||
+        (re->anchored_start && from > 0)) {
+        return false;
+    }
+    // No match can begin before the first occurrence of the literal prefix, and
+    // an occurrence past max_start is of no use
+    if (!re->anchored_start && !re->search_prefix.unanchored_start && re->search_prefix.len > 0) {
+        size_t window = max_start < len ? max_start + re->search_prefix.len : len;
+        if (window > len) {
+            // An occurrence may begin by max_start and end past len
+            if (at_limit != NULL) {
+                *at_limit = true;
+            }
+            window = len;
+        }
+        from = find_literal(buf, window, from, re->search_prefix.bytes, re->search_prefix.len);
+        if (from == window) {
+            return false;
+        }
+    }
+
+    if (scratch->search_dfa != NULL && scratch->reverse_dfa != NULL) {
+        // A $ pins the end, so only the backward scan is needed
+        size_t match_end = len;
+        LazyDfaResult found = LAZY_DFA_MATCH;
+        if (!re->anchored_end) {
+            found = lazy_dfa_find_end_limited(scratch->search_dfa, buf, len, from, max_start, &match_end, at_limit);
+        } else if (at_limit != NULL) {
+            *at_limit = true;
+        }
+        size_t match_start = from;
+        if (found == LAZY_DFA_MATCH) {
+            found = lazy_dfa_find_start(scratch->reverse_dfa, buf, from, match_end, &match_start);
+        }
+        if (found == LAZY_DFA_MATCH && (re->anchored_start ? match_start != from : match_start > max_start)) {
+            found = LAZY_DFA_NO_MATCH;
+        }
+        if (found != LAZY_DFA_GAVE_UP) {
+            if (found == LAZY_DFA_MATCH) {
+                if (start) {
+                    *start = match_start;
+                }
+                if (end) {
+                    *end = match_end;
+                }
+            }
+            return found == LAZY_DFA_MATCH;
+        }
+    }
+    bool found = program_find_limited(re->search_prog, scratch->search, buf, len, from,
+                                      re->anchored_start ? from : max_start, re->anchored_end, start, end, at_limit);
+    if (re->anchored_end && at_limit != NULL) {
+        *at_limit = true;
+    }
+    return found;
+}
+
+bool regex_find(const Regex *re, const char *buf, size_t len, size_t *start, size_t *end) {
+    if (re == NULL || buf == NULL) {
+        return false;
+    }
+    return regex_find_bounded(re, buf, len, 0, len, start, end);
+}
+
+bool regex_find_with_scratch(const Regex *re, RegexScratch *scratch, const char *buf, size_t len,
+                             size_t *start, size_t *end) {
+    return regex_find_bounded_with_scratch(re, scratch, buf, len, 0, len, start, end);
+}
+
+MatchResult regex_find_with_captures(const Regex *re, const char *buf, size_t len) {
+    if (re == NULL || buf == NULL) {
+        return no_match();
+    }
+    RegexScratch *scratch = regex_scratch_acquire(re);
+    size_t start;
+    size_t end;
+    MatchResult result = no_match();
+    if (regex_find_bounded_with_scratch(re, scratch, buf, len, 0, len, &start, &end)) {
+        result = program_find_with_captures(re->search_prog, scratch->search, buf, start, end);
+    }
+    regex_scratch_release(scratch);
+    return result;
+}
+
+bool regex_find_spans_with_scratch(const Regex *re, RegexScratch *scratch, const char *buf, size_t len,
+                                   RegexSpan *spans, size_t num_spans) {
+    size_t start;
+    size_t end;
+    if (spans == NULL || !regex_find_bounded_with_scratch(re, scratch, buf, len, 0, len, &start, &end)) {
+        return false;
+    }
+    const ptrdiff_t *slots = program_find_slots(re->search_prog, scratch->search, buf, start, end);
+    if (slots == NULL) {
+        return false;
+    }
+    for (size_t g = 0; g < num_spans; g++) {
+        bool set = g < re->search_prog->num_captures && slots[2 * g] >= 0 && slots[2 * g + 1] >= 0;
+        spans[g].start = set ? (size_t)slots[2 * g] : REGEX_UNSET;
+        spans[g].end = set ? (size_t)slots[2 * g + 1] : REGEX_UNSET;
+    }
+    return true;
+}
+
+RegexFindIter regex_find_all(const Regex *re, const char *buf, size_t len) {
+    RegexFindIter iter;
+    iter.re = re;
+    iter.scratch = NULL;
+    iter.buf = buf;
+    iter.len = len;
+    iter.pos = 0;
+    iter.done = re == NULL || buf == NULL;
+    return iter;
+}
+
+RegexFindIter regex_find_all_with_scratch(const Regex *re, RegexScratch *scratch, const char *buf, size_t len) {
+    RegexFindIter iter = regex_find_all(re, buf, len);
+    iter.scratch = scratch;
+    iter.done = iter.done || !scratch_fits(re, scratch);
+    return iter;
+}
+
+bool regex_find_next(RegexFindIter *iter, size_t *start, size_t *end) {
+    if (iter == NULL || iter->done || iter->pos > iter->len) {
+        return false;
+    }
+
+    size_t match_start;
+    size_t match_end;
+    bool found;
+    if (iter->scratch != NULL) {
+        found = regex_find_bounded_with_scratch(iter->re, iter->scratch, iter->buf, iter->len, iter->pos,
+                                                iter->len, &match_start, &match_end);
+    } else {
+        found = regex_find_bounded(iter->re, iter->buf, iter->len, iter->pos, iter->len, &match_start, &match_end);
+    }
+    if (!found) {
+        iter->done = true;
+        return false;
+    }
+    iter->pos = match_end > match_start ? match_end : match_end + 1;
+
+    if (start) {
+        *start = match_start;
+    }
+    if (end) {
+        *end = match_end;
+    }
+    return true;
+}
+
+RegexStream *regex_stream_open(const Regex *re, RegexStreamCallback on_match, void *user_data) {
+    if (re == NULL || re->search_prog == NULL) {
+        return NULL;
+    }
+    RegexScratch *scratch = regex_scratch_acquire(re);
+    if (scratch->stream_dfa == NULL) {
+        regex_scratch_release(scratch);
+        return NULL;
+    }
+
+    RegexStream *stream = malloc(sizeof(RegexStream));
+    if (stream == NULL) {
+        fprintf(stderr, "regex_stream_open  Error: failed to allocate RegexStream\n");
+        exit(1);
+    }
+    stream->re = re;
+    stream->scratch = scratch;
+    stream->on_match = on_match;
+    stream->user_data = user_data;
+    lazy_dfa_cursor_init(stream->scratch->stream_dfa, &stream->cursor);
+    return stream;
+}
+
+bool regex_stream_feed(RegexStream *stream, const uint8_t *chunk, size_t len) {
+    if (stream == NULL || (chunk == NULL && len > 0)) {
+        return false;
+    }
+    // With $, a match can only end at the end of the stream, which is not known yet
+    LazyDfaMatchFn on_match = stream->re->anchored_end ? NULL : stream->on_match;
+    return lazy_dfa_feed(stream->scratch->stream_dfa, &stream->cursor, chunk, len, on_match, stream->user_data);
+}
+
+void regex_stream_finish(RegexStream *stream) {
+    if (stream == NULL) {
+        return;
+    }
+    // Feeding reports an empty match at offset 0 only along with the first bytes
+    bool pending = stream->re->anchored_end || stream->cursor.offset == 0;
+    if (pending && stream->on_match != NULL &&
+        lazy_dfa_cursor_is_match(stream->scratch->stream_dfa, &stream->cursor)) {
+        stream->on_match(stream->cursor.offset, stream->user_data);
+    }
+}
+
+void regex_stream_close(RegexStream *stream) {
+    if (stream == NULL) {
+        return;
+    }
+    regex_stream_finish(stream);
+    lazy_dfa_cursor_free(&stream->cursor);
+    regex_scratch_release(stream->scratch);
+    free(stream);
+}
+
+size_t regex_stream_state_size(const Regex *re) {
+    if (re == NULL || re->search_prog == NULL) {
+        return 0;
+    }
+    RegexScratch *scratch = regex_scratch_acquire(re);
+    size_t size = scratch->stream_dfa != NULL ? lazy_dfa_cursor_state_size(scratch->stream_dfa) : 0;
+    regex_scratch_release(scratch);
+    return size;
+}
+
+void regex_stream_save(const RegexStream *stream, void *state) {
+    if (stream == NULL || state == NULL) {
+        return;
+    }
+    lazy_dfa_cursor_save(stream->scratch->stream_dfa, &stream->cursor, state);
+}
+
+void regex_stream_restore(RegexStream *stream, const void *state) {
+    if (stream == NULL || state == NULL) {
+        return;
+    }
+    lazy_dfa_cursor_restore(stream->scratch->stream_dfa, &stream->cursor, state);
+}
+
+void regex_stream_reset(RegexStream *stream) {
+    if (stream == NULL) {
+        return;
+    }
+    lazy_dfa_cursor_reset(stream->scratch->stream_dfa, &stream->cursor);
+}
+
+const RequiredFactors *regex_required_factors(const Regex *re) {
+    return re != NULL ? &re->factors : NULL;
+}
+
+void regex_free(Regex *re) {
+    if (re == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < REGEX_POOL_SLOTS; i++) {
+        regex_scratch_free(re->pool[i].owned);
+        regex_scratch_free(atomic_load_explicit(&re->pool[i].spare, memory_order_acquire));
+    }
+    free(re->pool);
+    Regex *lines = __atomic_load_n(&re->lines, __ATOMIC_ACQUIRE);
+    if (lines != re) {
+        regex_free(lines);
+    }
+    lazy_dfa_free(re->stream_dfa);
+    lazy_dfa_free(re->reverse_dfa);
+    lazy_dfa_free(re->search_dfa);
+    lazy_dfa_free(re->dfa);
+    free_program(re->reverse_prog);
+    free_program(re->search_prog);
+    free_required_factors(&re->factors);
+    free_program(re->prog);
+    arena_free(re->arena);
+    free(re->pattern);
+    free(re);
+}
+
+RegexSet *regex_set_compile(const char **patterns, size_t num_patterns) {
+    if (patterns == NULL || num_patterns == 0) {
+        return NULL;
+    }
+
+    RegexSet *set = calloc(1, sizeof(RegexSet));
+    if (set == NULL) {
+        fprintf(stderr, "regex_set_compile  Error: failed to allocate RegexSet\n");
+        exit(1);
+    }
+    set->asts = calloc(num_patterns, sizeof(AstNode*));
+    set->nfas = calloc(num_patterns, sizeof(NfaFragment));
+    if (set->asts == NULL || set->nfas == NULL) {
+        fprintf(stderr, "regex_set_compile  Error: failed to allocate patterns\n");
+        exit(1);
+    }
+    set->arena = arena_new();
+    pthread_mutex_init(&set->lock, NULL);
+
+    for (size_t i = 0; i < num_patterns; i++) {
+        set->asts[i] = parse_into(set->arena, patterns[i]);
+        if (set->asts[i] == NULL) {
+            regex_set_free(set);
+            return NULL;
+        }
+        set->num_patterns++;
+        set->nfas[i] = compile_ast_into(set->arena, set->asts[i]);
+    }
+
+    set->prog = compile_program_set(set->nfas, num_patterns, NULL);
+    set->dfa = lazy_dfa_new(set->prog, LAZY_DFA_DEFAULT_CACHE_SIZE);
+    return set;
+}
+
+// A set's scratches are kept on a list under a lock, which is only held to pop
+// or push one, rather than in a pool like a Regex's
+struct RegexSetScratch {
+    LazyDfa *dfa;             // NULL if the set has no DFA
+    MatchScratch *match;
+    RegexSetScratch *next;
+};
+
+static RegexSetScratch *set_scratch_acquire(RegexSet *set) {
+    pthread_mutex_lock(&set->lock);
+    RegexSetScratch *scratch = set->scratches;
+    if (scratch != NULL) {
+        set->scratches = scratch->next;
+    }
+    pthread_mutex_unlock(&set->lock);
+    if (scratch != NULL) {
+        return scratch;
+    }
+
+    scratch = calloc(1, sizeof(RegexSetScratch));
+    if (scratch == NULL) {
+        fprintf(stderr, "regex_set_match  Error: failed to allocate RegexSetScratch\n");
+        exit(1);
+    }
+    scratch->dfa = lazy_dfa_share(set->dfa);
+    scratch->match = match_scratch_new(set->prog);
+    return scratch;
+}
+
+static void set_scratch_release(RegexSet *set, RegexSetScratch *scratch) {
+    pthread_mutex_lock(&set->lock);
+    scratch->next = set->scratches;
+    set->scratches = scratch;
+    pthread_mutex_unlock(&set->lock);
+}
+
+bool regex_set_match(RegexSet *set, const char *input, uint64_t *matched) {
+    if (input == NULL) {
+        return false;
+    }
+    return regex_set_match_bytes(set, (const uint8_t*)input, strlen(input), matched);
+}
+
+bool regex_set_match_bytes(RegexSet *set, const uint8_t *data, size_t len, uint64_t *matched) {
+    if (set == NULL || data == NULL || matched == NULL) {
+        return false;
+    }
+    RegexSetScratch *scratch = set_scratch_acquire(set);
+    bool found = scratch->dfa != NULL ? lazy_dfa_match_set_bytes(scratch->dfa, data, len, matched)
+                                      : program_match_set_bytes(set->prog, scratch->match, data, len, matched);
+    set_scratch_release(set, scratch);
+    return found;
+}
+
+bool regex_set_match_nfa(RegexSet *set, const char *input, uint64_t *matched) {
+    if (input == NULL) {
+        return false;
+    }
+    return regex_set_match_nfa_bytes(set, (const uint8_t*)input, strlen(input), matched);
+}
+
+bool regex_set_match_nfa_bytes(RegexSet *set, const uint8_t *data, size_t len, uint64_t *matched) {
+    if (set == NULL || data == NULL || matched == NULL) {
+        return false;
+    }
+    RegexSetScratch *scratch = set_scratch_acquire(set);
+    bool found = program_match_set_bytes(set->prog, scratch->match, data, len, matched);
+    set_scratch_release(set, scratch);
+    return found;
+}
+
+void regex_set_free(RegexSet *set) {
+    if (set == NULL) {
+        return;
+    }
+    while (set->scratches != NULL) {
+        RegexSetScratch *next = set->scratches->next;
+        lazy_dfa_free(set->scratches->dfa);
+        match_scratch_free(set->scratches->match);
+        free(set->scratches);
+        set->scratches = next;
+    }
+    pthread_mutex_destroy(&set->lock);
+    lazy_dfa_free(set->dfa);
+    free_program(set->prog);
+    arena_free(set->arena);
+    free(set->nfas);
+    free(set->asts);
+    free(set);
+}
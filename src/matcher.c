@@ -8,565 +8,686 @@
 #include <stdio.h>
 #include <string.h>
 
-void init_set(NfaStateSet *set) {
-    set->states = NULL;
+void init_set(NfaStateSet *set, size_t capacity) {
+    set->states = malloc((capacity + 1) * sizeof(uint32_t));
+    // Zeroed so membership tests never read uninitialized memory
+    set->sparse = calloc(capacity + 1, sizeof(uint32_t));
+    if (!set->states || !set->sparse) {
+        perror("Failed to allocate NfaStateSet");
+        exit(EXIT_FAILURE);
+    }
     set->count = 0;
-    set->capacity = 0;
+    set->capacity = capacity;
 }
 
-// Adds a state if not already present (simple linear scan for duplicates)
-void add_state(NfaStateSet *set, NfaState *state) {
-    if (state == NULL) return;
+bool contains_state(const NfaStateSet *set, uint32_t state) {
+    uint32_t index = set->sparse[state];
+    return index < set->count && set->states[index] == state;
+}
 
-    // Check for duplicates (simple, could be faster with sorting/hashing)
-    for (size_t i = 0; i < set->count; ++i) {
-        if (set->states[i] == state) {
-            return; // Already in the set
-        }
+void add_state(NfaStateSet *set, uint32_t state) {
+    if (state >= set->capacity) {
+        fprintf(stderr, "add_state  Error: state %u outside set of %zu states\n", state, set->capacity);
+        exit(1);
     }
-
-    // Resize if necessary
-    if (set->count >= set->capacity) {
-        size_t new_capacity = (set->capacity == 0) ? 16 : set->capacity * 2;
-        NfaState **new_states = (NfaState**)realloc(set->states, new_capacity * sizeof(NfaState*));
-        if (!new_states) {
-            perror("Failed to realloc NfaStateSet");
-            // In a real library, handle this more gracefully (e.g., return error)
-            exit(EXIT_FAILURE);
-        }
-        set->states = new_states;
-        set->capacity = new_capacity;
+    if (contains_state(set, state)) {
+        return; // Already in the set
     }
-
-    // Add the new state
+    set->sparse[state] = (uint32_t)set->count;
     set->states[set->count++] = state;
 }
 
 void free_set(NfaStateSet *set) {
     free(set->states);
+    free(set->sparse);
     set->states = NULL;
+    set->sparse = NULL;
     set->count = 0;
     set->capacity = 0;
 }
 
 void clear_set(NfaStateSet *set) {
-    set->count = 0; // Keep allocated memory for reuse
+    set->count = 0; // Stale sparse entries fail the membership check
 }
 
-static bool contains_state(const NfaStateSet *set, const NfaState *state) {
-    if (!state) return false;
-    for (size_t i = 0; i < set->count; ++i) {
-        if (set->states[i] == state) {
+// Returns whether the instruction consumes byte c
+static bool inst_matches(const Program *prog, const Instruction *inst, unsigned char c) {
+    switch (inst->opcode) {
+        case OP_CHAR:
+            return inst->byte == c;
+        case OP_ANY:
             return true;
-        }
+        case OP_CLASS:
+            return byte_set_contains(&prog->classes[inst->arg], c);
+        default:
+            return false;
     }
-    return false;
 }
 
-static void process_epsilon_neighbor(NfaState *next, NfaStateSet *closure_set, NfaStateSet *stack) {
-    // Use the file-scope helper function
-    if (next && !contains_state(closure_set, next)) {
-        add_state(closure_set, next); // Add to final closure
-        add_state(stack, next); // Add to stack to explore its neighbors
+// Extends set with everything reachable over non-consuming edges (including
+// capture markers). The set doubles as the worklist: members are appended once
+// and visited in insertion order, so no separate stack is needed.
+static void expand_closure(const Program *prog, NfaStateSet *set) {
+    for (size_t i = 0; i < set->count; ++i) {
+        const Instruction *inst = &prog->insts[set->states[i]];
+        switch (inst->opcode) {
+            case OP_SPLIT:
+                add_state(set, inst->out);
+                add_state(set, inst->out1);
+                break;
+            case OP_JMP:
+            case OP_SAVE:
+                add_state(set, inst->out);
+                break;
+            default:
+                break;
+        }
     }
 }
 
-void epsilon_closure(NfaStateSet *initial_set, NfaStateSet *closure_set) {
-    NfaStateSet stack; // Stack for DFS
-    init_set(&stack);
+// Adds the precomputed closure of pc, which only holds consuming and accepting states
+static void add_precomputed_closure(const Program *prog, NfaStateSet *set, uint32_t pc) {
+    for (uint32_t k = prog->closure_start[pc]; k < prog->closure_start[pc + 1]; k++) {
+        add_state(set, prog->closures[k]);
+    }
+}
 
-    // Initialize stack and closure with initial states
+void epsilon_closure(const Program *prog, NfaStateSet *initial_set, NfaStateSet *closure_set) {
     clear_set(closure_set); // Ensure closure set starts empty
     for (size_t i = 0; i < initial_set->count; ++i) {
-        NfaState *s = initial_set->states[i];
-        if (s) {
-            // Use the file-scope helper function
-            if (!contains_state(closure_set, s)) {
-                add_state(closure_set, s);
-                add_state(&stack, s); // Add to stack for processing
+        add_state(closure_set, initial_set->states[i]);
+    }
+    expand_closure(prog, closure_set);
+}
+
+// Pike VM: every thread carries its own capture slots, so threads that reach the
+// same instruction along different paths cannot overwrite each other's groups.
+// Threads are kept in priority order and a state already on a list is never
+// added again, which keeps the whole match linear in the input.
+typedef struct {
+    uint32_t *pcs;    // Thread instructions, highest priority first
+    ptrdiff_t *slots; // num_slots capture positions per thread
+    uint32_t count;
+} ThreadList;
+
+typedef struct {
+    uint32_t pc;
+    int restore_slot;   // >= 0: undo a SAVE on the way back instead of visiting pc
+    ptrdiff_t restore_value;
+} PikeFrame;
+
+typedef struct {
+    const Program *prog;
+    size_t num_slots;
+    ThreadList lists[2];
+    uint32_t *on_list;    // Generation in which each instruction was last added
+    uint32_t generation;
+    PikeFrame *stack;
+    ptrdiff_t *caps;      // Slots of the thread being expanded
+} PikeVm;
+
+static void init_pike_vm(PikeVm *vm, const Program *prog) {
+    vm->prog = prog;
+    vm->num_slots = 2 * (size_t)prog->num_captures;
+    for (int i = 0; i < 2; i++) {
+        vm->lists[i].pcs = malloc(prog->count * sizeof(uint32_t));
+        vm->lists[i].slots = malloc((prog->count * vm->num_slots + 1) * sizeof(ptrdiff_t));
+        vm->lists[i].count = 0;
+    }
+    vm->on_list = calloc(prog->count, sizeof(uint32_t));
+    vm->generation = 0;
+    // Each instruction is expanded once per list and pushes at most two frames
+    vm->stack = malloc((2 * (size_t)prog->count + 1) * sizeof(PikeFrame));
+    vm->caps = malloc((vm->num_slots + 1) * sizeof(ptrdiff_t));
+    if (!vm->lists[0].pcs || !vm->lists[0].slots || !vm->lists[1].pcs || !vm->lists[1].slots ||
+        !vm->on_list || !vm->stack || !vm->caps) {
+        fprintf(stderr, "init_pike_vm  Error: failed to allocate thread lists\n");
+        exit(1);
+    }
+}
+
+static void free_pike_vm(PikeVm *vm) {
+    for (int i = 0; i < 2; i++) {
+        free(vm->lists[i].pcs);
+        free(vm->lists[i].slots);
+    }
+    free(vm->on_list);
+    free(vm->stack);
+    free(vm->caps);
+}
+
+static void next_list(PikeVm *vm, ThreadList *list) {
+    list->count = 0;
+    vm->generation++;
+    if (vm->generation == 0) {
+        memset(vm->on_list, 0, vm->prog->count * sizeof(uint32_t));
+        vm->generation = 1;
+    }
+}
+
+// Follows epsilon edges from pc in priority order with vm->caps as the thread's
+// slots, appending each consuming or accepting instruction reached to the list
+static void add_thread(PikeVm *vm, ThreadList *list, uint32_t pc, size_t pos) {
+    size_t stack_size = 0;
+    vm->stack[stack_size++] = (PikeFrame){pc, -1, 0};
+
+    while (stack_size > 0) {
+        PikeFrame frame = vm->stack[--stack_size];
+        if (frame.restore_slot >= 0) {
+            vm->caps[frame.restore_slot] = frame.restore_value;
+            continue;
+        }
+        if (vm->on_list[frame.pc] == vm->generation) {
+            continue;
+        }
+        vm->on_list[frame.pc] = vm->generation;
+
+        const Instruction *inst = &vm->prog->insts[frame.pc];
+        switch (inst->opcode) {
+            case OP_JMP:
+                vm->stack[stack_size++] = (PikeFrame){inst->out, -1, 0};
+                break;
+            case OP_SPLIT:
+                // Push the lower priority branch first so out is explored first
+                vm->stack[stack_size++] = (PikeFrame){inst->out1, -1, 0};
+                vm->stack[stack_size++] = (PikeFrame){inst->out, -1, 0};
+                break;
+            case OP_SAVE:
+                vm->stack[stack_size++] = (PikeFrame){0, (int)inst->arg, vm->caps[inst->arg]};
+                vm->caps[inst->arg] = (ptrdiff_t)pos;
+                vm->stack[stack_size++] = (PikeFrame){inst->out, -1, 0};
+                break;
+            default:
+                list->pcs[list->count] = frame.pc;
+                memcpy(&list->slots[list->count * vm->num_slots], vm->caps, vm->num_slots * sizeof(ptrdiff_t));
+                list->count++;
+                break;
+        }
+    }
+}
+
+// Runs the whole input through the VM. On a match, slots receives the capture
+// positions of the highest priority accepting thread (-1 for unset slots).
+static bool pike_vm_run(PikeVm *vm, const uint8_t *data, size_t len, ptrdiff_t *slots) {
+    const Program *prog = vm->prog;
+    ThreadList *clist = &vm->lists[0];
+    ThreadList *nlist = &vm->lists[1];
+
+    next_list(vm, clist);
+    for (size_t k = 0; k < vm->num_slots; k++) {
+        vm->caps[k] = -1;
+    }
+    add_thread(vm, clist, prog->start, 0);
+
+    for (size_t i = 0; i < len && clist->count > 0; ++i) {
+        unsigned char current_char = data[i];
+        next_list(vm, nlist);
+
+        for (uint32_t t = 0; t < clist->count; t++) {
+            const Instruction *inst = &prog->insts[clist->pcs[t]];
+            if (inst_matches(prog, inst, current_char)) {
+                memcpy(vm->caps, &clist->slots[t * vm->num_slots], vm->num_slots * sizeof(ptrdiff_t));
+                add_thread(vm, nlist, inst->out, i + 1);
             }
         }
+
+        ThreadList *temp_swap = clist;
+        clist = nlist;
+        nlist = temp_swap;
     }
 
-    // Perform DFS
-    while (stack.count > 0) {
-        NfaState *current_state = stack.states[--stack.count]; // Pop
-        
-        // Skip NULL states (shouldn't happen, but be defensive)
-        if (!current_state) {
-            continue;
+    for (uint32_t t = 0; t < clist->count; t++) {
+        if (prog->insts[clist->pcs[t]].opcode == OP_MATCH) {
+            memcpy(slots, &clist->slots[t * vm->num_slots], vm->num_slots * sizeof(ptrdiff_t));
+            return true;
         }
+    }
+    return false;
+}
 
-        // Helper lambda/function to process neighbors via epsilon
+// Leftmost-first search over input[from .. len). A thread for the start is
+// seeded at each position up to max_start behind the threads already running,
+// so earlier starts keep priority; once a thread matches, lower priority threads
+// and further seeds are dropped, and the search ends when no thread is left.
+// at_limit, if not NULL, is set when a thread that outranks any match was left
+// waiting for a byte past len.
+static bool pike_vm_search(PikeVm *vm, const char *input, size_t len, size_t from,
+                           size_t max_start, bool anchored_end, ptrdiff_t *slots, bool *at_limit) {
+    const Program *prog = vm->prog;
+    ThreadList *clist = &vm->lists[0];
+    ThreadList *nlist = &vm->lists[1];
+    bool matched = false;
+    bool waiting = false;
+
+    next_list(vm, clist);
+    for (size_t i = from; ; ++i) {
+        if (!matched && i <= max_start) {
+            for (size_t k = 0; k < vm->num_slots; k++) {
+                vm->caps[k] = -1;
+            }
+            add_thread(vm, clist, prog->start, i);
+        }
+        if (clist->count == 0) {
+            break;
+        }
 
-        // Explore epsilon transitions (including CAPTURE_START and CAPTURE_END which don't consume input)
-        if (current_state->out1 && (current_state->out1->symbol == EPSILON || 
-                                     current_state->out1->symbol == CAPTURE_START ||
-                                     current_state->out1->symbol == CAPTURE_END)) {
-            process_epsilon_neighbor(current_state->out1->to, closure_set, &stack);
+        next_list(vm, nlist);
+        for (uint32_t t = 0; t < clist->count; t++) {
+            const Instruction *inst = &prog->insts[clist->pcs[t]];
+            if (inst->opcode == OP_MATCH) {
+                if (!anchored_end || i == len) {
+                    memcpy(slots, &clist->slots[t * vm->num_slots], vm->num_slots * sizeof(ptrdiff_t));
+                    matched = true;
+                    break;
+                }
+                continue;
+            }
+            if (i == len) {
+                waiting = true;
+            } else if (inst_matches(prog, inst, (unsigned char)input[i])) {
+                memcpy(vm->caps, &clist->slots[t * vm->num_slots], vm->num_slots * sizeof(ptrdiff_t));
+                add_thread(vm, nlist, inst->out, i + 1);
+            }
         }
-        if (current_state->out2 && (current_state->out2->symbol == EPSILON ||
-                                     current_state->out2->symbol == CAPTURE_START ||
-                                     current_state->out2->symbol == CAPTURE_END)) {
-            process_epsilon_neighbor(current_state->out2->to, closure_set, &stack);
+        if (i == len) {
+            break;
         }
+
+        ThreadList *temp_swap = clist;
+        clist = nlist;
+        nlist = temp_swap;
+    }
+    if (at_limit != NULL) {
+        *at_limit = waiting || (!matched && max_start > len);
     }
+    return matched;
+}
 
-    free_set(&stack); // Free the stack's internal array
+struct MatchScratch {
+    const Program *prog;
+    NfaStateSet current_states;
+    NfaStateSet next_states;
+    PikeVm vm;
+    ptrdiff_t *slots;
+};
+
+MatchScratch *match_scratch_new(const Program *prog) {
+    if (!prog) {
+        return NULL;
+    }
+    MatchScratch *scratch = malloc(sizeof(MatchScratch));
+    if (!scratch) {
+        fprintf(stderr, "match_scratch_new  Error: failed to allocate scratch\n");
+        exit(1);
+    }
+    scratch->prog = prog;
+    init_set(&scratch->current_states, prog->count);
+    init_set(&scratch->next_states, prog->count);
+    init_pike_vm(&scratch->vm, prog);
+    scratch->slots = malloc((scratch->vm.num_slots + 1) * sizeof(ptrdiff_t));
+    if (!scratch->slots) {
+        fprintf(stderr, "match_scratch_new  Error: failed to allocate slots\n");
+        exit(1);
+    }
+    return scratch;
+}
+
+void match_scratch_free(MatchScratch *scratch) {
+    if (!scratch) {
+        return;
+    }
+    free_set(&scratch->current_states);
+    free_set(&scratch->next_states);
+    free_pike_vm(&scratch->vm);
+    free(scratch->slots);
+    free(scratch);
 }
 
 bool match(NfaFragment fragment, const char *input) {
-    NfaState *start_state = fragment.start;
-    if (!start_state || !input) {
+    if (!input) {
         return false;
     }
+    return match_bytes(fragment, (const uint8_t*)input, strlen(input));
+}
 
-    NfaStateSet current_states, next_states, temp_reachable;
-    init_set(&current_states);
-    init_set(&next_states);
-    init_set(&temp_reachable);
+bool match_bytes(NfaFragment fragment, const uint8_t *data, size_t len) {
+    if (!fragment.start || !data) {
+        return false;
+    }
+
+    Program *prog = compile_program(fragment);
+    bool is_match = program_match_bytes(prog, data, len);
+    free_program(prog);
+    return is_match;
+}
+
+NfaMatcher *nfa_matcher_new(NfaFragment fragment) {
+    if (!fragment.start) {
+        return NULL;
+    }
+    NfaMatcher *matcher = malloc(sizeof(NfaMatcher));
+    if (!matcher) {
+        fprintf(stderr, "nfa_matcher_new  Error: failed to allocate matcher\n");
+        exit(1);
+    }
+    matcher->prog = compile_program(fragment);
+    matcher->scratch = match_scratch_new(matcher->prog);
+    return matcher;
+}
+
+void nfa_matcher_free(NfaMatcher *matcher) {
+    if (!matcher) {
+        return;
+    }
+    match_scratch_free(matcher->scratch);
+    free_program(matcher->prog);
+    free(matcher);
+}
+
+bool match_ex(NfaMatcher *matcher, const char *input) {
+    if (!input) {
+        return false;
+    }
+    return match_ex_bytes(matcher, (const uint8_t*)input, strlen(input));
+}
+
+bool match_ex_bytes(NfaMatcher *matcher, const uint8_t *data, size_t len) {
+    if (!matcher || !data) {
+        return false;
+    }
+    return program_match_with_scratch_bytes(matcher->prog, matcher->scratch, data, len);
+}
+
+bool program_match(const Program *prog, const char *input) {
+    if (!input) {
+        return false;
+    }
+    return program_match_bytes(prog, (const uint8_t*)input, strlen(input));
+}
+
+bool program_match_bytes(const Program *prog, const uint8_t *data, size_t len) {
+    if (!prog || !data) {
+        return false;
+    }
+
+    MatchScratch *scratch = match_scratch_new(prog);
+    bool is_match = program_match_with_scratch_bytes(prog, scratch, data, len);
+    match_scratch_free(scratch);
+    return is_match;
+}
+
+// Runs the NFA over the whole input and returns the final state set
+static const NfaStateSet *run_nfa(const Program *prog, MatchScratch *scratch, const uint8_t *data, size_t len) {
+    NfaStateSet *current_states = &scratch->current_states;
+    NfaStateSet *next_states = &scratch->next_states;
+    bool precomputed = prog->closure_start != NULL;
 
     // 1. Initial state: epsilon closure of the start state
-    NfaStateSet initial_single;
-    init_set(&initial_single);
-    add_state(&initial_single, start_state);
-    epsilon_closure(&initial_single, &current_states); // Call new version
-    free_set(&initial_single);
+    clear_set(current_states);
+    if (precomputed) {
+        add_precomputed_closure(prog, current_states, prog->start);
+    } else {
+        add_state(current_states, prog->start);
+        expand_closure(prog, current_states);
+    }
 
     // 2. Process each character in the input string
-    for (size_t i = 0; input[i] != '\0'; ++i) {
-        char current_char = input[i];
-        clear_set(&temp_reachable);
-
-        // Find states directly reachable on the current character
-        for (size_t j = 0; j < current_states.count; ++j) {
-            NfaState *s = current_states.states[j];
-            
-            // Check out1 transition
-            if (s->out1) {
-                bool matches = false;
-                if (s->out1->symbol == current_char) {
-                    matches = true;
-                } else if (s->out1->symbol == ANY_CHAR) {
-                    matches = true;
-                } else if (s->out1->symbol == CHAR_CLASS && s->out1->char_class_set != NULL) {
-                    // Check if current_char is in the character class
-                    bool in_set = s->out1->char_class_set[(unsigned char)current_char];
-                    // If negated, invert the match
-                    matches = s->out1->char_class_negated ? !in_set : in_set;
-                }
-                
-                if (matches && s->out1->to) {
-                    add_state(&temp_reachable, s->out1->to);
-                }
-            }
-            
-            // Check out2 transition
-            if (s->out2) {
-                bool matches = false;
-                if (s->out2->symbol == current_char) {
-                    matches = true;
-                } else if (s->out2->symbol == ANY_CHAR) {
-                    matches = true;
-                } else if (s->out2->symbol == CHAR_CLASS && s->out2->char_class_set != NULL) {
-                    // Check if current_char is in the character class
-                    bool in_set = s->out2->char_class_set[(unsigned char)current_char];
-                    // If negated, invert the match
-                    matches = s->out2->char_class_negated ? !in_set : in_set;
-                }
-                
-                if (matches && s->out2->to) {
-                    add_state(&temp_reachable, s->out2->to);
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char current_char = data[i];
+
+        // Seed the next set with the states reachable on this character, then close it
+        clear_set(next_states);
+        for (size_t j = 0; j < current_states->count; ++j) {
+            const Instruction *inst = &prog->insts[current_states->states[j]];
+            if (inst_matches(prog, inst, current_char)) {
+                if (precomputed) {
+                    add_precomputed_closure(prog, next_states, inst->out);
+                } else {
+                    add_state(next_states, inst->out);
                 }
             }
         }
-
-        // Compute the epsilon closure of the reachable states
-        clear_set(&next_states);
-        epsilon_closure(&temp_reachable, &next_states); // Call new version
+        if (!precomputed) {
+            expand_closure(prog, next_states);
+        }
 
         // Update current states for the next iteration (swap pointers)
-        NfaStateSet temp_swap = current_states;
+        NfaStateSet *temp_swap = current_states;
         current_states = next_states;
         next_states = temp_swap;
 
         // If no states are reachable after this character, fail early
-        if (current_states.count == 0) {
+        if (current_states->count == 0) {
             break; // No further match possible
         }
     }
 
-    // 3. Final check: Is any state in the final set an accepting state?
-    bool is_match = false;
-    for (size_t i = 0; i < current_states.count; ++i) {
-        if (current_states.states[i]->is_accepting) {
-            is_match = true;
-            break;
-        }
+    return current_states;
+}
+
+bool program_match_with_scratch(const Program *prog, MatchScratch *scratch, const char *input) {
+    if (!input) {
+        return false;
     }
+    return program_match_with_scratch_bytes(prog, scratch, (const uint8_t*)input, strlen(input));
+}
 
-    // Cleanup
-    free_set(&current_states);
-    free_set(&next_states);
-    free_set(&temp_reachable);
+bool program_match_with_scratch_bytes(const Program *prog, MatchScratch *scratch, const uint8_t *data, size_t len) {
+    if (!prog || !scratch || !data || scratch->prog != prog) {
+        return false;
+    }
 
-    return is_match;
+    const NfaStateSet *final_states = run_nfa(prog, scratch, data, len);
+
+    // Final check: Is any state in the final set an accepting state?
+    for (size_t i = 0; i < final_states->count; ++i) {
+        if (prog->insts[final_states->states[i]].opcode == OP_MATCH) {
+            return true;
+        }
+    }
+    return false;
 }
 
-// Structure to track active capture groups during matching
-typedef struct {
-    int capture_id;
-    char *name;
-    size_t start_pos;
-} ActiveCapture;
+bool program_match_set(const Program *prog, MatchScratch *scratch, const char *input, uint64_t *matched) {
+    if (!input) {
+        return false;
+    }
+    return program_match_set_bytes(prog, scratch, (const uint8_t*)input, strlen(input), matched);
+}
 
-typedef struct {
-    ActiveCapture *captures;
-    size_t count;
-    size_t capacity;
-} ActiveCaptureStack;
-
-static void init_capture_stack(ActiveCaptureStack *stack) {
-    stack->captures = NULL;
-    stack->count = 0;
-    stack->capacity = 0;
-}
-
-static void push_capture(ActiveCaptureStack *stack, int capture_id, const char *name, size_t start_pos) {
-    if (stack->count >= stack->capacity) {
-        size_t new_capacity = (stack->capacity == 0) ? 8 : stack->capacity * 2;
-        ActiveCapture *new_captures = (ActiveCapture*)realloc(stack->captures, new_capacity * sizeof(ActiveCapture));
-        if (!new_captures) {
-            perror("Failed to realloc ActiveCaptureStack");
-            exit(EXIT_FAILURE);
+bool program_match_set_bytes(const Program *prog, MatchScratch *scratch, const uint8_t *data, size_t len,
+                             uint64_t *matched) {
+    if (!prog || !scratch || !data || !matched || scratch->prog != prog) {
+        return false;
+    }
+
+    memset(matched, 0, PATTERN_SET_WORDS(prog->num_patterns) * sizeof(uint64_t));
+    const NfaStateSet *final_states = run_nfa(prog, scratch, data, len);
+
+    bool any = false;
+    for (size_t i = 0; i < final_states->count; ++i) {
+        const Instruction *inst = &prog->insts[final_states->states[i]];
+        if (inst->opcode == OP_MATCH) {
+            matched[inst->arg / 64] |= (uint64_t)1 << (inst->arg % 64);
+            any = true;
         }
-        stack->captures = new_captures;
-        stack->capacity = new_capacity;
     }
-    
-    ActiveCapture *cap = &stack->captures[stack->count++];
-    cap->capture_id = capture_id;
-    cap->name = name ? strdup(name) : NULL;
-    cap->start_pos = start_pos;
+    return any;
 }
 
-static ActiveCapture* find_active_capture(ActiveCaptureStack *stack, int capture_id) {
-    // Search from end (most recent) to beginning
-    for (int i = (int)stack->count - 1; i >= 0; i--) {
-        if (stack->captures[i].capture_id == capture_id) {
-            return &stack->captures[i];
-        }
+bool program_find(const Program *prog, MatchScratch *scratch, const char *input, size_t len, size_t from,
+                  bool anchored_start, bool anchored_end, size_t *match_start, size_t *match_end) {
+    return program_find_bounded(prog, scratch, input, len, from, anchored_start ? from : len, anchored_end,
+                                match_start, match_end);
+}
+
+bool program_find_bounded(const Program *prog, MatchScratch *scratch, const char *input, size_t len, size_t from,
+                          size_t max_start, bool anchored_end, size_t *match_start, size_t *match_end) {
+    return program_find_limited(prog, scratch, input, len, from, max_start, anchored_end, match_start, match_end,
+                                NULL);
+}
+
+bool program_find_limited(const Program *prog, MatchScratch *scratch, const char *input, size_t len, size_t from,
+                          size_t max_start, bool anchored_end, size_t *match_start, size_t *match_end,
+                          bool *at_limit) {
+    if (at_limit) {
+        *at_limit = false;
     }
-    return NULL;
+    if (!prog || !scratch || !input || scratch->prog != prog || prog->num_captures == 0 || from > len) {
+        return false;
+    }
+
+    ptrdiff_t *slots = scratch->slots;
+    if (!pike_vm_search(&scratch->vm, input, len, from, max_start, anchored_end, slots, at_limit)) {
+        return false;
+    }
+    if (match_start) {
+        *match_start = (size_t)slots[0];
+    }
+    if (match_end) {
+        *match_end = (size_t)slots[1];
+    }
+    return true;
 }
 
-static void free_capture_stack(ActiveCaptureStack *stack) {
-    for (size_t i = 0; i < stack->count; i++) {
-        free(stack->captures[i].name);
+// Reports the groups that took part in the match, in group order
+static void fill_groups(const Program *prog, const ptrdiff_t *slots, const char *input, MatchResult *result) {
+    if (prog->num_captures == 0) {
+        return;
+    }
+    result->groups = malloc(prog->num_captures * sizeof(CaptureGroup));
+    if (!result->groups) {
+        fprintf(stderr, "fill_groups  Error: failed to allocate groups\n");
+        exit(1);
+    }
+    for (uint32_t g = 0; g < prog->num_captures; g++) {
+        ptrdiff_t start = slots[2 * g];
+        ptrdiff_t end = slots[2 * g + 1];
+        if (start < 0 || end < 0) {
+            continue;
+        }
+
+        CaptureGroup *group = &result->groups[result->num_groups++];
+        group->name = prog->capture_names[g] ? strdup(prog->capture_names[g]) : NULL;
+        group->start = (size_t)start;
+        group->end = (size_t)end;
+
+        // Extract the captured substring
+        size_t len = (size_t)(end - start);
+        group->value = (char*)malloc(len + 1);
+        if (group->value) {
+            memcpy(group->value, input + start, len);
+            group->value[len] = '\0';
+        }
     }
-    free(stack->captures);
-    stack->captures = NULL;
-    stack->count = 0;
-    stack->capacity = 0;
 }
 
-MatchResult match_with_captures(NfaFragment fragment, const char *input) {
+// A result for a failed match
+static MatchResult no_match(void) {
     MatchResult result;
     result.matched = false;
     result.num_groups = 0;
     result.groups = NULL;
-    
-    NfaState *start_state = fragment.start;
-    if (!start_state || !input) {
-        return result;
+    return result;
+}
+
+MatchResult match_with_captures(NfaFragment fragment, const char *input) {
+    if (!input) {
+        return no_match();
     }
+    return match_with_captures_bytes(fragment, (const uint8_t*)input, strlen(input));
+}
 
-    NfaStateSet current_states, next_states, temp_reachable;
-    init_set(&current_states);
-    init_set(&next_states);
-    init_set(&temp_reachable);
-    
-    ActiveCaptureStack capture_stack;
-    init_capture_stack(&capture_stack);
-    
-    // Track completed captures
-    CaptureGroup *completed_captures = NULL;
-    size_t completed_count = 0;
-    size_t completed_capacity = 0;
+MatchResult match_with_captures_bytes(NfaFragment fragment, const uint8_t *data, size_t len) {
+    if (!fragment.start || !data) {
+        return no_match();
+    }
 
-    // 1. Initial state: epsilon closure of the start state
-    NfaStateSet initial_single;
-    init_set(&initial_single);
-    add_state(&initial_single, start_state);
-    
-    // Process initial epsilon closure and capture any CAPTURE_START markers
-    clear_set(&current_states);
-    NfaStateSet stack;
-    init_set(&stack);
-    
-    for (size_t i = 0; i < initial_single.count; ++i) {
-        NfaState *s = initial_single.states[i];
-        if (s && !contains_state(&current_states, s)) {
-            add_state(&current_states, s);
-            add_state(&stack, s);
-        }
+    Program *prog = compile_program(fragment);
+    MatchResult result = program_match_with_captures_bytes(prog, data, len);
+    free_program(prog);
+    return result;
+}
+
+MatchResult match_with_captures_ex(NfaMatcher *matcher, const char *input) {
+    if (!input) {
+        return no_match();
     }
-    
-    while (stack.count > 0) {
-        NfaState *s = stack.states[--stack.count];
-        
-        if (s->out1) {
-            if (s->out1->symbol == CAPTURE_START) {
-                push_capture(&capture_stack, s->out1->capture_id, s->out1->capture_name, 0);
-            }
-            
-            if (s->out1->symbol == EPSILON || s->out1->symbol == CAPTURE_START || s->out1->symbol == CAPTURE_END) {
-                process_epsilon_neighbor(s->out1->to, &current_states, &stack);
-            }
-        }
-        
-        if (s->out2) {
-            if (s->out2->symbol == CAPTURE_START) {
-                push_capture(&capture_stack, s->out2->capture_id, s->out2->capture_name, 0);
-            }
-            
-            if (s->out2->symbol == EPSILON || s->out2->symbol == CAPTURE_START || s->out2->symbol == CAPTURE_END) {
-                process_epsilon_neighbor(s->out2->to, &current_states, &stack);
-            }
-        }
+    return match_with_captures_ex_bytes(matcher, (const uint8_t*)input, strlen(input));
+}
+
+MatchResult match_with_captures_ex_bytes(NfaMatcher *matcher, const uint8_t *data, size_t len) {
+    if (!matcher || !data) {
+        return no_match();
     }
-    
-    free_set(&stack);
-    free_set(&initial_single);
+    return program_match_with_captures_scratch_bytes(matcher->prog, matcher->scratch, data, len);
+}
 
-    // 2. Process each character in the input string
-    for (size_t i = 0; input[i] != '\0'; ++i) {
-        char current_char = input[i];
-        clear_set(&temp_reachable);
-
-        // Find states directly reachable on the current character
-        for (size_t j = 0; j < current_states.count; ++j) {
-            NfaState *s = current_states.states[j];
-            
-            // Check out1 transition
-            if (s->out1) {
-                bool matches = false;
-                if (s->out1->symbol == current_char) {
-                    matches = true;
-                } else if (s->out1->symbol == ANY_CHAR) {
-                    matches = true;
-                } else if (s->out1->symbol == CHAR_CLASS && s->out1->char_class_set != NULL) {
-                    bool in_set = s->out1->char_class_set[(unsigned char)current_char];
-                    matches = s->out1->char_class_negated ? !in_set : in_set;
-                }
-                
-                if (matches) {
-                    add_state(&temp_reachable, s->out1->to);
-                }
-            }
-            
-            // Check out2 transition
-            if (s->out2) {
-                bool matches = false;
-                if (s->out2->symbol == current_char) {
-                    matches = true;
-                } else if (s->out2->symbol == ANY_CHAR) {
-                    matches = true;
-                } else if (s->out2->symbol == CHAR_CLASS && s->out2->char_class_set != NULL) {
-                    bool in_set = s->out2->char_class_set[(unsigned char)current_char];
-                    matches = s->out2->char_class_negated ? !in_set : in_set;
-                }
-                
-                if (matches) {
-                    add_state(&temp_reachable, s->out2->to);
-                }
-            }
-        }
+MatchResult program_match_with_captures(const Program *prog, const char *input) {
+    if (!input) {
+        return no_match();
+    }
+    return program_match_with_captures_bytes(prog, (const uint8_t*)input, strlen(input));
+}
 
-        // Compute the epsilon closure and track capture markers
-        clear_set(&next_states);
-        init_set(&stack);
-        
-        for (size_t j = 0; j < temp_reachable.count; ++j) {
-            NfaState *s = temp_reachable.states[j];
-            if (s && !contains_state(&next_states, s)) {
-                add_state(&next_states, s);
-                add_state(&stack, s);
-            }
-        }
-        
-        while (stack.count > 0) {
-            NfaState *s = stack.states[--stack.count];
-            
-            if (s->out1) {
-                if (s->out1->symbol == CAPTURE_START) {
-                    push_capture(&capture_stack, s->out1->capture_id, s->out1->capture_name, i + 1);
-                } else if (s->out1->symbol == CAPTURE_END) {
-                    ActiveCapture *active = find_active_capture(&capture_stack, s->out1->capture_id);
-                    if (active) {
-                        // Check if we already have a capture for this ID (update it)
-                        CaptureGroup *existing = NULL;
-                        for (size_t k = 0; k < completed_count; k++) {
-                            if (completed_captures[k].name && active->name && 
-                                strcmp(completed_captures[k].name, active->name) == 0) {
-                                existing = &completed_captures[k];
-                                break;
-                            }
-                        }
-                        
-                        if (existing) {
-                            // Update existing capture
-                            free(existing->value);
-                            existing->start = active->start_pos;
-                            existing->end = i + 1;
-                            size_t len = existing->end - existing->start;
-                            existing->value = (char*)malloc(len + 1);
-                            if (existing->value) {
-                                strncpy(existing->value, input + existing->start, len);
-                                existing->value[len] = '\0';
-                            }
-                        } else {
-                            // Create new completed capture
-                            if (completed_count >= completed_capacity) {
-                                size_t new_capacity = (completed_capacity == 0) ? 4 : completed_capacity * 2;
-                                CaptureGroup *new_groups = (CaptureGroup*)realloc(completed_captures, new_capacity * sizeof(CaptureGroup));
-                                if (!new_groups) {
-                                    perror("Failed to realloc completed captures");
-                                    exit(EXIT_FAILURE);
-                                }
-                                completed_captures = new_groups;
-                                completed_capacity = new_capacity;
-                            }
-                            
-                            CaptureGroup *group = &completed_captures[completed_count++];
-                            group->name = active->name ? strdup(active->name) : NULL;
-                            group->start = active->start_pos;
-                            group->end = i + 1;
-                            
-                            // Extract the captured substring
-                            size_t len = group->end - group->start;
-                            group->value = (char*)malloc(len + 1);
-                            if (group->value) {
-                                strncpy(group->value, input + group->start, len);
-                                group->value[len] = '\0';
-                            }
-                        }
-                    }
-                }
-                
-                if (s->out1->symbol == EPSILON || s->out1->symbol == CAPTURE_START || s->out1->symbol == CAPTURE_END) {
-                    process_epsilon_neighbor(s->out1->to, &next_states, &stack);
-                }
-            }
-            
-            if (s->out2) {
-                if (s->out2->symbol == CAPTURE_START) {
-                    push_capture(&capture_stack, s->out2->capture_id, s->out2->capture_name, i + 1);
-                } else if (s->out2->symbol == CAPTURE_END) {
-                    ActiveCapture *active = find_active_capture(&capture_stack, s->out2->capture_id);
-                    if (active) {
-                        // Check if we already have a capture for this ID (update it)
-                        CaptureGroup *existing = NULL;
-                        for (size_t k = 0; k < completed_count; k++) {
-                            if (completed_captures[k].name && active->name && 
-                                strcmp(completed_captures[k].name, active->name) == 0) {
-                                existing = &completed_captures[k];
-                                break;
-                            }
-                        }
-                        
-                        if (existing) {
-                            // Update existing capture
-                            free(existing->value);
-                            existing->start = active->start_pos;
-                            existing->end = i + 1;
-                            size_t len = existing->end - existing->start;
-                            existing->value = (char*)malloc(len + 1);
-                            if (existing->value) {
-                                strncpy(existing->value, input + existing->start, len);
-                                existing->value[len] = '\0';
-                            }
-                        } else {
-                            // Create new completed capture
-                            if (completed_count >= completed_capacity) {
-                                size_t new_capacity = (completed_capacity == 0) ? 4 : completed_capacity * 2;
-                                CaptureGroup *new_groups = (CaptureGroup*)realloc(completed_captures, new_capacity * sizeof(CaptureGroup));
-                                if (!new_groups) {
-                                    perror("Failed to realloc completed captures");
-                                    exit(EXIT_FAILURE);
-                                }
-                                completed_captures = new_groups;
-                                completed_capacity = new_capacity;
-                            }
-                            
-                            CaptureGroup *group = &completed_captures[completed_count++];
-                            group->name = active->name ? strdup(active->name) : NULL;
-                            group->start = active->start_pos;
-                            group->end = i + 1;
-                            
-                            // Extract the captured substring
-                            size_t len = group->end - group->start;
-                            group->value = (char*)malloc(len + 1);
-                            if (group->value) {
-                                strncpy(group->value, input + group->start, len);
-                                group->value[len] = '\0';
-                            }
-                        }
-                    }
-                }
-                
-                if (s->out2->symbol == EPSILON || s->out2->symbol == CAPTURE_START || s->out2->symbol == CAPTURE_END) {
-                    process_epsilon_neighbor(s->out2->to, &next_states, &stack);
-                }
-            }
-        }
-        
-        free_set(&stack);
+MatchResult program_match_with_captures_bytes(const Program *prog, const uint8_t *data, size_t len) {
+    if (!prog || !data) {
+        return no_match();
+    }
 
-        // Update current states for the next iteration
-        NfaStateSet temp_swap = current_states;
-        current_states = next_states;
-        next_states = temp_swap;
+    MatchScratch *scratch = match_scratch_new(prog);
+    MatchResult result = program_match_with_captures_scratch_bytes(prog, scratch, data, len);
+    match_scratch_free(scratch);
+    return result;
+}
 
-        // If no states are reachable after this character, fail early
-        if (current_states.count == 0) {
-            break;
-        }
+MatchResult program_match_with_captures_scratch(const Program *prog, MatchScratch *scratch, const char *input) {
+    if (!input) {
+        return no_match();
     }
+    return program_match_with_captures_scratch_bytes(prog, scratch, (const uint8_t*)input, strlen(input));
+}
 
-    // 3. Final check: Is any state in the final set an accepting state?
-    for (size_t i = 0; i < current_states.count; ++i) {
-        if (current_states.states[i]->is_accepting) {
-            result.matched = true;
-            break;
-        }
+MatchResult program_match_with_captures_scratch_bytes(const Program *prog, MatchScratch *scratch,
+                                                      const uint8_t *data, size_t len) {
+    MatchResult result = no_match();
+    if (!prog || !scratch || !data || scratch->prog != prog) {
+        return result;
     }
-    
-    // Set the results
+
+    result.matched = pike_vm_run(&scratch->vm, data, len, scratch->slots);
     if (result.matched) {
-        result.num_groups = completed_count;
-        result.groups = completed_captures;
-    } else {
-        // Free completed captures if match failed
-        for (size_t i = 0; i < completed_count; i++) {
-            free(completed_captures[i].name);
-            free(completed_captures[i].value);
-        }
-        free(completed_captures);
+        fill_groups(prog, scratch->slots, (const char*)data, &result);
     }
+    return result;
+}
 
-    // Cleanup
-    free_set(&current_states);
-    free_set(&next_states);
-    free_set(&temp_reachable);
-    free_capture_stack(&capture_stack);
+const ptrdiff_t *program_find_slots(const Program *prog, MatchScratch *scratch, const char *input,
+                              size_t start, size_t end) {
+    if (!prog || !scratch || !input || scratch->prog != prog || start > end) {
+        return NULL;
+    }
+    // Only the span is walked; it must match exactly, from its first byte to its last
+    if (!pike_vm_search(&scratch->vm, input, end, start, start, true, scratch->slots, NULL)) {
+        return NULL;
+    }
+    return scratch->slots;
+}
 
+MatchResult program_find_with_captures(const Program *prog, MatchScratch *scratch, const char *input,
+                                       size_t start, size_t end) {
+    MatchResult result = no_match();
+    const ptrdiff_t *slots = program_find_slots(prog, scratch, input, start, end);
+    if (slots != NULL) {
+        result.matched = true;
+        fill_groups(prog, slots, input, &result);
+    }
     return result;
 }
 
 void free_match_result(MatchResult *result) {
     if (result && result->groups) {
-        for (size_t i = 0; i < result->num_groups; i++) {
+        for (int i = 0; i < result->num_groups; i++) {
             free(result->groups[i].name);
             free(result->groups[i].value);
         }
@@ -0,0 +1,454 @@
+#include "parallel.h"
+#include "engine_internal.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+    size_t start;
+    size_t end;
+} Span;
+
+// One slice of the buffer and the matches a worker found in it, assuming the
+// search resumed exactly at its beginning. The worker reads no further than the
+// start of the next chunk: once a search would need the bytes there, it leaves
+// the rest of the chunk open for the calling thread to search while stitching.
+typedef struct {
+    size_t begin;
+    size_t max_start;   // Last offset at which a match of this chunk may begin
+    size_t limit;       // Where the worker stops reading
+    Span *spans;
+    size_t count;
+    size_t capacity;
+    bool open;          // Matches after the last span are still to be found
+    bool done;
+} Chunk;
+
+typedef struct {
+    const Regex *re;
+    const char *buf;
+    size_t len;
+    Chunk *chunks;
+    size_t num_chunks;
+
+    pthread_mutex_t lock;
+    pthread_cond_t chunk_done;
+    size_t next_chunk;  // The next chunk a worker should take
+} ParallelScan;
+
+// A worker's share of a batch. Its owner and any thief claim blocks from the
+// front with one atomic add, so claiming never takes a lock.
+typedef struct {
+    _Alignas(64) atomic_size_t next;
+    size_t end;
+} WorkRange;
+
+typedef struct {
+    const Regex *re;
+    const char **inputs;
+    const size_t *lens;
+    bool *out;
+    WorkRange *ranges;
+    size_t num_workers;
+} BatchMatch;
+
+// A call's share of work for the worker pool: num_tasks calls of run, each
+// handed to the first idle thread
+typedef struct PoolJob {
+    void (*run)(void *arg, size_t task);
+    void *arg;
+    size_t num_tasks;
+    size_t next_task;       // The next task a thread should take
+    size_t unfinished;
+    struct PoolJob *next;   // Queued after this one
+} PoolJob;
+
+// Threads are started as calls first need them and then wait for the next job,
+// for the life of the process, so a call pays for no thread start-up of its own
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t queued;     // A job has tasks to take
+    pthread_cond_t finished;   // A job's last task has finished
+    PoolJob *head;
+    PoolJob *tail;
+    size_t num_threads;
+} pool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, 0};
+
+RegexParallelOptions regex_parallel_default_options(void) {
+    RegexParallelOptions options;
+    options.num_threads = 0;
+    options.chunk_size = REGEX_PARALLEL_DEFAULT_CHUNK_SIZE;
+    return options;
+}
+
+// Where the search after a match resumes; an empty match skips a byte
+static size_t next_position(size_t start, size_t end) {
+    return end > start ? end : end + 1;
+}
+
+static void add_span(Chunk *chunk, size_t start, size_t end) {
+    if (chunk->count == chunk->capacity) {
+        chunk->capacity = chunk->capacity ? chunk->capacity * 2 : 16;
+        chunk->spans = realloc(chunk->spans, chunk->capacity * sizeof(Span));
+        if (chunk->spans == NULL) {
+            fprintf(stderr, "add_span  Error: failed to allocate match spans\n");
+            exit(1);
+        }
+    }
+    chunk->spans[chunk->count].start = start;
+    chunk->spans[chunk->count].end = end;
+    chunk->count++;
+}
+
+static size_t default_num_threads(const RegexParallelOptions *options) {
+    if (options->num_threads > 0) {
+        return options->num_threads;
+    }
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (size_t)cpus : 1;
+}
+
+static void *pool_thread(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        while (pool.head == NULL) {
+            pthread_cond_wait(&pool.queued, &pool.lock);
+        }
+        PoolJob *job = pool.head;
+        size_t task = job->next_task++;
+        if (job->next_task == job->num_tasks) {
+            pool.head = job->next;
+            if (pool.head == NULL) {
+                pool.tail = NULL;
+            }
+        }
+        pthread_mutex_unlock(&pool.lock);
+
+        job->run(job->arg, task);
+
+        pthread_mutex_lock(&pool.lock);
+        if (--job->unfinished == 0) {
+            pthread_cond_broadcast(&pool.finished);
+        }
+    }
+    return NULL;
+}
+
+// Queues the job's tasks, starting threads until the pool has one per task
+static void pool_start(PoolJob *job) {
+    job->next_task = 0;
+    job->unfinished = job->num_tasks;
+    job->next = NULL;
+    if (job->num_tasks == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    while (pool.num_threads < job->num_tasks) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, pool_thread, NULL) != 0) {
+            fprintf(stderr, "regex_parallel  Error: failed to start worker thread\n");
+            exit(1);
+        }
+        pthread_detach(thread);
+        pool.num_threads++;
+    }
+    if (pool.tail != NULL) {
+        pool.tail->next = job;
+    } else {
+        pool.head = job;
+    }
+    pool.tail = job;
+    pthread_cond_broadcast(&pool.queued);
+    pthread_mutex_unlock(&pool.lock);
+}
+
+static void pool_wait(PoolJob *job) {
+    pthread_mutex_lock(&pool.lock);
+    while (job->unfinished > 0) {
+        pthread_cond_wait(&pool.finished, &pool.lock);
+    }
+    pthread_mutex_unlock(&pool.lock);
+}
+
+size_t regex_parallel_pool_threads(void) {
+    pthread_mutex_lock(&pool.lock);
+    size_t num_threads = pool.num_threads;
+    pthread_mutex_unlock(&pool.lock);
+    return num_threads;
+}
+
+static void scan_worker(void *arg, size_t task) {
+    (void)task;
+    ParallelScan *scan = arg;
+    RegexScratch *scratch = regex_scratch_acquire(scan->re);
+
+    for (;;) {
+        pthread_mutex_lock(&scan->lock);
+        size_t k = scan->next_chunk++;
+        pthread_mutex_unlock(&scan->lock);
+        if (k >= scan->num_chunks) {
+            break;
+        }
+
+        Chunk *chunk = &scan->chunks[k];
+        size_t pos = chunk->begin;
+        size_t start;
+        size_t end;
+        bool at_limit;
+        while (regex_find_limited_with_scratch(scan->re, scratch, scan->buf, chunk->limit, pos, chunk->max_start,
+                                               &start, &end, &at_limit) && !at_limit) {
+            add_span(chunk, start, end);
+            pos = next_position(start, end);
+        }
+        chunk->open = at_limit;
+
+        pthread_mutex_lock(&scan->lock);
+        chunk->done = true;
+        pthread_cond_broadcast(&scan->chunk_done);
+        pthread_mutex_unlock(&scan->lock);
+    }
+
+    regex_scratch_release(scratch);
+}
+
+// Reports every match that begins in the chunk from pos on, searching the
+// whole buffer. Returns where the search resumes after them.
+static size_t find_rest(const Regex *re, RegexScratch *scratch, const char *buf, size_t len, const Chunk *chunk,
+                        size_t pos, RegexMatchCallback on_match, void *user_data, size_t *found) {
+    size_t start;
+    size_t end;
+    while (regex_find_bounded_with_scratch(re, scratch, buf, len, pos, chunk->max_start, &start, &end)) {
+        if (on_match != NULL) {
+            on_match(start, end, user_data);
+        }
+        (*found)++;
+        pos = next_position(start, end);
+    }
+    return pos;
+}
+
+// Reports the true matches of a chunk, given where the search really resumes.
+// Returns where it resumes after them.
+static size_t stitch_chunk(const Regex *re, RegexScratch *scratch, const char *buf, size_t len,
+                           const Chunk *chunk, size_t pos, RegexMatchCallback on_match, void *user_data,
+                           size_t *found) {
+    size_t i = 0;
+    if (pos > chunk->begin) {
+        // A match ran into this chunk, so its speculative matches may be wrong.
+        // Once a true match is one of them, the rest follow from it.
+        size_t start;
+        size_t end;
+        for (;;) {
+            if (!regex_find_bounded_with_scratch(re, scratch, buf, len, pos, chunk->max_start, &start, &end)) {
+                return pos;
+            }
+            while (i < chunk->count && chunk->spans[i].start < start) {
+                i++;
+            }
+            if (i < chunk->count && chunk->spans[i].start == start && chunk->spans[i].end == end) {
+                break;
+            }
+            if (on_match != NULL) {
+                on_match(start, end, user_data);
+            }
+            (*found)++;
+            pos = next_position(start, end);
+        }
+    }
+
+    for (; i < chunk->count; i++) {
+        if (on_match != NULL) {
+            on_match(chunk->spans[i].start, chunk->spans[i].end, user_data);
+        }
+        (*found)++;
+        pos = next_position(chunk->spans[i].start, chunk->spans[i].end);
+    }
+    if (chunk->open) {
+        pos = find_rest(re, scratch, buf, len, chunk, pos, on_match, user_data, found);
+    }
+    return pos;
+}
+
+static size_t find_all_sequential(const Regex *re, const char *buf, size_t len, RegexMatchCallback on_match,
+                                  void *user_data) {
+    size_t found = 0;
+    size_t start;
+    size_t end;
+    RegexFindIter iter = regex_find_all(re, buf, len);
+    while (regex_find_next(&iter, &start, &end)) {
+        if (on_match != NULL) {
+            on_match(start, end, user_data);
+        }
+        found++;
+    }
+    return found;
+}
+
+size_t regex_find_all_parallel(const Regex *re, const char *buf, size_t len,
+                               const RegexParallelOptions *options, RegexMatchCallback on_match, void *user_data) {
+    if (re == NULL || buf == NULL || re->search_prog == NULL) {
+        return 0;
+    }
+
+    RegexParallelOptions defaults = regex_parallel_default_options();
+    if (options == NULL) {
+        options = &defaults;
+    }
+    size_t chunk_size = options->chunk_size ? options->chunk_size : REGEX_PARALLEL_DEFAULT_CHUNK_SIZE;
+    size_t num_threads = default_num_threads(options);
+    size_t num_chunks = len / chunk_size + (len % chunk_size != 0);
+    if (num_threads > num_chunks) {
+        num_threads = num_chunks;
+    }
+
+    // With ^ or $ there are at most two matches, found by one short search
+    if (num_threads <= 1 || re->anchored_start || re->anchored_end) {
+        return find_all_sequential(re, buf, len, on_match, user_data);
+    }
+
+    ParallelScan scan;
+    scan.re = re;
+    scan.buf = buf;
+    scan.len = len;
+    scan.num_chunks = num_chunks;
+    scan.next_chunk = 0;
+    scan.chunks = calloc(num_chunks, sizeof(Chunk));
+    if (scan.chunks == NULL) {
+        fprintf(stderr, "regex_find_all_parallel  Error: failed to allocate chunks\n");
+        exit(1);
+    }
+    for (size_t k = 0; k < num_chunks; k++) {
+        scan.chunks[k].begin = k * chunk_size;
+        // The last chunk also owns an empty match at the very end
+        scan.chunks[k].max_start = k + 1 < num_chunks ? (k + 1) * chunk_size - 1 : len;
+        scan.chunks[k].limit = k + 1 < num_chunks ? (k + 1) * chunk_size : len;
+    }
+    pthread_mutex_init(&scan.lock, NULL);
+    pthread_cond_init(&scan.chunk_done, NULL);
+
+    PoolJob job;
+    job.run = scan_worker;
+    job.arg = &scan;
+    job.num_tasks = num_threads;
+    pool_start(&job);
+
+    // Stitch chunks in order as they complete, while later ones are still running
+    RegexScratch *scratch = regex_scratch_acquire(re);
+    size_t found = 0;
+    size_t pos = 0;
+    for (size_t k = 0; k < num_chunks; k++) {
+        Chunk *chunk = &scan.chunks[k];
+        pthread_mutex_lock(&scan.lock);
+        while (!chunk->done) {
+            pthread_cond_wait(&scan.chunk_done, &scan.lock);
+        }
+        pthread_mutex_unlock(&scan.lock);
+
+        pos = stitch_chunk(re, scratch, buf, len, chunk, pos, on_match, user_data, &found);
+        free(chunk->spans);
+        chunk->spans = NULL;
+    }
+
+    regex_scratch_release(scratch);
+
+    pool_wait(&job);
+    pthread_cond_destroy(&scan.chunk_done);
+    pthread_mutex_destroy(&scan.lock);
+    free(scan.chunks);
+    return found;
+}
+
+static bool claim_block(WorkRange *range, size_t *begin, size_t *end) {
+    size_t first = atomic_fetch_add_explicit(&range->next, REGEX_BATCH_BLOCK, memory_order_relaxed);
+    if (first >= range->end) {
+        return false;
+    }
+    *begin = first;
+    *end = range->end - first > REGEX_BATCH_BLOCK ? first + REGEX_BATCH_BLOCK : range->end;
+    return true;
+}
+
+// Works through worker id's own range, then steals from the others in turn
+static void run_batch(BatchMatch *batch, size_t id) {
+    RegexScratch *scratch = regex_scratch_acquire(batch->re);
+    size_t block_lens[REGEX_BATCH_BLOCK];
+    for (size_t k = 0; k < batch->num_workers; k++) {
+        WorkRange *range = &batch->ranges[(id + k) % batch->num_workers];
+        size_t begin;
+        size_t end;
+        while (claim_block(range, &begin, &end)) {
+            const size_t *lens = batch->lens != NULL ? batch->lens + begin : block_lens;
+            if (batch->lens == NULL) {
+                for (size_t i = begin; i < end; i++) {
+                    block_lens[i - begin] = batch->inputs[i] != NULL ? strlen(batch->inputs[i]) : 0;
+                }
+            }
+            regex_match_many_with_scratch(batch->re, scratch, (const uint8_t *const*)(batch->inputs + begin), lens,
+                                          end - begin, batch->out + begin);
+        }
+    }
+    regex_scratch_release(scratch);
+}
+
+// The calling thread is worker 0, so pool task t is worker t + 1
+static void batch_worker(void *arg, size_t task) {
+    run_batch(arg, task + 1);
+}
+
+void regex_match_batch(const Regex *re, const char **inputs, const size_t *lens, size_t n, bool *out) {
+    regex_match_batch_with_options(re, inputs, lens, n, out, NULL);
+}
+
+void regex_match_batch_with_options(const Regex *re, const char **inputs, const size_t *lens, size_t n,
+                                    bool *out, const RegexParallelOptions *options) {
+    if (inputs == NULL || out == NULL || n == 0) {
+        return;
+    }
+    if (re == NULL) {
+        memset(out, 0, n * sizeof(bool));
+        return;
+    }
+
+    RegexParallelOptions defaults = regex_parallel_default_options();
+    if (options == NULL) {
+        options = &defaults;
+    }
+    // Every worker should get at least a block
+    size_t num_workers = default_num_threads(options);
+    size_t num_blocks = n / REGEX_BATCH_BLOCK + (n % REGEX_BATCH_BLOCK != 0);
+    if (num_workers > num_blocks) {
+        num_workers = num_blocks;
+    }
+
+    BatchMatch batch;
+    batch.re = re;
+    batch.inputs = inputs;
+    batch.lens = lens;
+    batch.out = out;
+    batch.num_workers = num_workers;
+    batch.ranges = aligned_alloc(_Alignof(WorkRange), num_workers * sizeof(WorkRange));
+    if (batch.ranges == NULL) {
+        fprintf(stderr, "regex_match_batch  Error: failed to allocate workers\n");
+        exit(1);
+    }
+    for (size_t w = 0; w < num_workers; w++) {
+        atomic_init(&batch.ranges[w].next, n * w / num_workers);
+        batch.ranges[w].end = n * (w + 1) / num_workers;
+    }
+
+    PoolJob job;
+    job.run = batch_worker;
+    job.arg = &batch;
+    job.num_tasks = num_workers - 1;
+    pool_start(&job);
+    run_batch(&batch, 0);
+    pool_wait(&job);
+
+    free(batch.ranges);
+}
@@ -6,60 +6,74 @@
 #include <string.h>
 
 
-LiteralNode* create_literal_node(char value) {
-    LiteralNode* node = malloc(sizeof(LiteralNode));
-    node->base.type = NODE_LITERAL;
+// The character offset bytes ahead, or '\0' past the end of the pattern
+static char peek(const ParserState *state, int offset) {
+    int index = state->index + offset;
+    return index < state->length ? state->input[index] : '\0';
+}
+
+static void *new_node(Arena *arena, size_t size, NodeType type) {
+    AstNode *node = arena_alloc(arena, size);
+    node->type = type;
+    node->arena = NULL;
+    return node;
+}
+
+static void add_to_class(CharClassNode *node, unsigned char c) {
+    node->char_set[c >> 6] |= (uint64_t)1 << (c & 63);
+}
+
+static void add_range_to_class(CharClassNode *node, unsigned char first, unsigned char last) {
+    for (int c = first; c <= last; c++) {
+        add_to_class(node, (unsigned char)c);
+    }
+}
+
+LiteralNode* create_literal_node(Arena *arena, char value) {
+    LiteralNode* node = new_node(arena, sizeof(LiteralNode), NODE_LITERAL);
     node->value = value;
     return node;
 }
 
-AlternationNode* create_alternation_node(AstNode *left, AstNode *right) {
-    AlternationNode* node = malloc(sizeof(AlternationNode));
-    node->base.type = NODE_ALTERNATION;
+AlternationNode* create_alternation_node(Arena *arena, AstNode *left, AstNode *right) {
+    AlternationNode* node = new_node(arena, sizeof(AlternationNode), NODE_ALTERNATION);
     node->left = left;
     node->right = right;
     return node;
 }
 
-ConcatNode* create_concat_node(AstNode *left, AstNode *right) {
-    ConcatNode* node = malloc(sizeof(ConcatNode));
-    node->base.type = NODE_CONCAT;
+ConcatNode* create_concat_node(Arena *arena, AstNode *left, AstNode *right) {
+    ConcatNode* node = new_node(arena, sizeof(ConcatNode), NODE_CONCAT);
     node->left = left;
     node->right = right;
     return node;
 }
 
-QuantifierNode* create_quantifier_node(AstNode *child, char quantifier) {
-    QuantifierNode* node = malloc(sizeof(QuantifierNode));
-    node->base.type = NODE_QUANTIFIER;
+QuantifierNode* create_quantifier_node(Arena *arena, AstNode *child, char quantifier) {
+    QuantifierNode* node = new_node(arena, sizeof(QuantifierNode), NODE_QUANTIFIER);
     node->quantifier = quantifier;
+    node->lazy = false;
     node->child = child;
     return node;
 }
 
-WildcardNode* create_wildcard_node() {
-    WildcardNode* node = malloc(sizeof(WildcardNode));
-    node->base.type = NODE_WILDCARD;
-    return node;
+WildcardNode* create_wildcard_node(Arena *arena) {
+    return new_node(arena, sizeof(WildcardNode), NODE_WILDCARD);
 }
 
-CharClassNode* create_char_class_node(bool negated) {
-    CharClassNode* node = malloc(sizeof(CharClassNode));
-    node->base.type = NODE_CHAR_CLASS;
+CharClassNode* create_char_class_node(Arena *arena, bool negated) {
+    CharClassNode* node = new_node(arena, sizeof(CharClassNode), NODE_CHAR_CLASS);
     node->negated = negated;
     // Initialize all characters to false (not in set)
-    for (int i = 0; i < 256; i++) {
-        node->char_set[i] = false;
-    }
+    memset(node->char_set, 0, sizeof(node->char_set));
     return node;
 }
 
-CaptureGroupNode* create_capture_group_node(const char *name, AstNode *child) {
-    CaptureGroupNode* node = malloc(sizeof(CaptureGroupNode));
-    node->base.type = NODE_CAPTURE_GROUP;
+CaptureGroupNode* create_capture_group_node(Arena *arena, const char *name, size_t name_len, AstNode *child) {
+    CaptureGroupNode* node = new_node(arena, sizeof(CaptureGroupNode), NODE_CAPTURE_GROUP);
     node->child = child;
     if (name != NULL) {
-        node->name = strdup(name);
+        node->name = arena_strndup(arena, name, name_len);
     } else {
         node->name = NULL;
     }
@@ -68,13 +82,19 @@ CaptureGroupNode* create_capture_group_node(const char *name, AstNode *child) {
 
 AstNode* parse_alternation(ParserState *state) {
     AstNode *left = parse_concatenation(state);
+    if (left == NULL) {
+        return NULL;
+    }
 
-    if (state->input[state->index] == '|') {
+    if (peek(state, 0) == '|') {
         state->index++; // consume '|'
 
         AstNode *right = parse_alternation(state);
+        if (right == NULL) {
+            return NULL;
+        }
 
-        AlternationNode *node = create_alternation_node(left, right);
+        AlternationNode *node = create_alternation_node(state->arena, left, right);
         return (AstNode*)node;
     }
 
@@ -83,11 +103,17 @@ AstNode* parse_alternation(ParserState *state) {
 
 AstNode* parse_concatenation(ParserState *state) {
     AstNode *left = parse_quantifier(state);
+    if (left == NULL) {
+        return NULL;
+    }
 
-    while(state->input[state->index] != '\0' && state->input[state->index] != '|' && state->input[state->index] != ')') {
+    while(peek(state, 0) != '\0' && peek(state, 0) != '|' && peek(state, 0) != ')') {
         AstNode *right = parse_quantifier(state);
+        if (right == NULL) {
+            return NULL;
+        }
 
-        left = (AstNode*) create_concat_node(left, right);
+        left = (AstNode*) create_concat_node(state->arena, left, right);
     }
 
     return left;
@@ -95,12 +121,19 @@ AstNode* parse_concatenation(ParserState *state) {
 
 AstNode* parse_quantifier(ParserState *state) {
     AstNode *child = parse_atom(state);
+    if (child == NULL) {
+        return NULL;
+    }
 
-    char q = state->input[state->index];
+    char q = peek(state, 0);
     if (q == '*' || q == '+' || q == '?') {
         state->index++; // consume quantifier
 
-        QuantifierNode *node = create_quantifier_node(child, q);
+        QuantifierNode *node = create_quantifier_node(state->arena, child, q);
+        if (peek(state, 0) == '?') {
+            state->index++; // consume lazy marker
+            node->lazy = true;
+        }
         return (AstNode*)node;
     }
 
@@ -112,65 +145,60 @@ AstNode* parse_char_class(ParserState *state) {
     state->index++; // consume '['
     
     bool negated = false;
-    if (state->input[state->index] == '^') {
+    if (peek(state, 0) == '^') {
         negated = true;
         state->index++; // consume '^'
     }
     
-    CharClassNode* node = create_char_class_node(negated);
+    CharClassNode* node = create_char_class_node(state->arena, negated);
     
     // Parse characters until we hit ']'
-    while (state->input[state->index] != '\0' && state->input[state->index] != ']') {
-        char current = state->input[state->index];
+    while (peek(state, 0) != '\0' && peek(state, 0) != ']') {
+        char current = peek(state, 0);
         
         // Handle escape sequences within character class
         if (current == '\\') {
             state->index++; // consume backslash
-            if (state->input[state->index] == '\0') {
+            if (peek(state, 0) == '\0') {
                 fprintf(stderr, "parse_char_class  Error: unexpected end of input after backslash\n");
-                free(node);
-                exit(1);
+                return NULL;
             }
-            current = state->input[state->index];
-            node->char_set[(unsigned char)current] = true;
+            current = peek(state, 0);
+            add_to_class(node, (unsigned char)current);
             state->index++;
         }
         // Check for range (e.g., a-z)
-        else if (state->input[state->index + 1] == '-' && 
-                 state->input[state->index + 2] != ']' && 
-                 state->input[state->index + 2] != '\0') {
+        else if (peek(state, 1) == '-' && 
+                 peek(state, 2) != ']' && 
+                 peek(state, 2) != '\0') {
             char start = current;
             state->index += 2; // skip current char and '-'
-            char end = state->input[state->index];
+            char end = peek(state, 0);
             
             if (end == '\\') {
                 state->index++; // consume backslash
-                end = state->input[state->index];
+                end = peek(state, 0);
             }
             
             if (start > end) {
                 fprintf(stderr, "parse_char_class  Error: invalid range %c-%c\n", start, end);
-                free(node);
-                exit(1);
+                return NULL;
             }
             
             // Add all characters in the range
-            for (int c = start; c <= end; c++) {
-                node->char_set[c] = true;
-            }
+            add_range_to_class(node, (unsigned char)start, (unsigned char)end);
             state->index++;
         }
         // Regular character
         else {
-            node->char_set[(unsigned char)current] = true;
+            add_to_class(node, (unsigned char)current);
             state->index++;
         }
     }
     
-    if (state->input[state->index] != ']') {
+    if (peek(state, 0) != ']') {
         fprintf(stderr, "parse_char_class  Error: unmatched '['\n");
-        free(node);
-        exit(1);
+        return NULL;
     }
     
     state->index++; // consume ']'
@@ -178,17 +206,44 @@ AstNode* parse_char_class(ParserState *state) {
     return (AstNode*)node;
 }
 
-AstNode* parse_atom(ParserState *state) {
-    char c = state->input[state->index];
+// Keeps an atom from matching '\n', for single-line parsing. Groups come back
+// as the nodes inside them, which have been kept to the line already, and a
+// second pass leaves a node as it is.
+static AstNode* keep_to_line(Arena *arena, AstNode *atom) {
+    switch (atom->type) {
+        case NODE_WILDCARD: {
+            CharClassNode *node = create_char_class_node(arena, true);
+            add_to_class(node, '\n');
+            return (AstNode*)node;
+        }
+        case NODE_CHAR_CLASS: {
+            CharClassNode *node = (CharClassNode*)atom;
+            if (node->negated) {
+                add_to_class(node, '\n');
+            } else {
+                node->char_set['\n' >> 6] &= ~((uint64_t)1 << ('\n' & 63));
+            }
+            return atom;
+        }
+        case NODE_LITERAL:
+            // A class with no members never matches
+            return ((LiteralNode*)atom)->value == '\n' ? (AstNode*)create_char_class_node(arena, false) : atom;
+        default:
+            return atom;
+    }
+}
+
+static AstNode* parse_atom_as_written(ParserState *state) {
+    char c = peek(state, 0);
 
     // Handle escape sequences
     if (c == '\\') {
         state->index++; // consume backslash
-        char escaped_char = state->input[state->index];
+        char escaped_char = peek(state, 0);
         
         if (escaped_char == '\0') {
             fprintf(stderr, "parse_atom  Error: unexpected end of input after backslash at position %d\n", state->index - 1);
-            exit(1);
+            return NULL;
         }
         
         // Check for shorthand character classes
@@ -196,46 +251,38 @@ AstNode* parse_atom(ParserState *state) {
             // \d matches [0-9], \D matches [^0-9]
             state->index++; // consume 'd' or 'D'
             bool negated = (escaped_char == 'D');
-            CharClassNode* node = create_char_class_node(negated);
-            for (int i = '0'; i <= '9'; i++) {
-                node->char_set[i] = true;
-            }
+            CharClassNode* node = create_char_class_node(state->arena, negated);
+            add_range_to_class(node, '0', '9');
             return (AstNode*)node;
         }
         else if (escaped_char == 'w' || escaped_char == 'W') {
             // \w matches [a-zA-Z0-9_], \W matches [^a-zA-Z0-9_]
             state->index++; // consume 'w' or 'W'
             bool negated = (escaped_char == 'W');
-            CharClassNode* node = create_char_class_node(negated);
-            for (int i = 'a'; i <= 'z'; i++) {
-                node->char_set[i] = true;
-            }
-            for (int i = 'A'; i <= 'Z'; i++) {
-                node->char_set[i] = true;
-            }
-            for (int i = '0'; i <= '9'; i++) {
-                node->char_set[i] = true;
-            }
-            node->char_set['_'] = true;
+            CharClassNode* node = create_char_class_node(state->arena, negated);
+            add_range_to_class(node, 'a', 'z');
+            add_range_to_class(node, 'A', 'Z');
+            add_range_to_class(node, '0', '9');
+            add_to_class(node, '_');
             return (AstNode*)node;
         }
         else if (escaped_char == 's' || escaped_char == 'S') {
             // \s matches whitespace [ \t\n\r\f\v], \S matches [^ \t\n\r\f\v]
             state->index++; // consume 's' or 'S'
             bool negated = (escaped_char == 'S');
-            CharClassNode* node = create_char_class_node(negated);
-            node->char_set[' '] = true;   // space
-            node->char_set['\t'] = true;  // tab
-            node->char_set['\n'] = true;  // newline
-            node->char_set['\r'] = true;  // carriage return
-            node->char_set['\f'] = true;  // form feed
-            node->char_set['\v'] = true;  // vertical tab
+            CharClassNode* node = create_char_class_node(state->arena, negated);
+            add_to_class(node, ' ');    // space
+            add_to_class(node, '\t');   // tab
+            add_to_class(node, '\n');   // newline
+            add_to_class(node, '\r');   // carriage return
+            add_to_class(node, '\f');   // form feed
+            add_to_class(node, '\v');   // vertical tab
             return (AstNode*)node;
         }
         
         // The escaped character is treated as a literal
         state->index++; // consume the escaped character
-        return (AstNode*)create_literal_node(escaped_char);
+        return (AstNode*)create_literal_node(state->arena, escaped_char);
     }
 
     // Handle character classes
@@ -247,181 +294,227 @@ AstNode* parse_atom(ParserState *state) {
         state->index++;
 
         // Check for named capture group: (?<name>...)
-        if (state->input[state->index] == '?' && state->input[state->index + 1] == '<') {
+        if (peek(state, 0) == '?' && peek(state, 1) == '<') {
             state->index += 2; // consume '?<'
             
             // Extract group name
             int name_start = state->index;
-            while (state->input[state->index] != '\0' && state->input[state->index] != '>') {
+            while (peek(state, 0) != '\0' && peek(state, 0) != '>') {
                 state->index++;
             }
             
-            if (state->input[state->index] != '>') {
+            if (peek(state, 0) != '>') {
                 fprintf(stderr, "parse_atom  Error: unterminated capture group name\n");
-                exit(1);
+                return NULL;
             }
             
             int name_len = state->index - name_start;
             if (name_len == 0) {
                 fprintf(stderr, "parse_atom  Error: empty capture group name\n");
-                exit(1);
+                return NULL;
             }
             
-            char *name = malloc(name_len + 1);
-            strncpy(name, state->input + name_start, name_len);
-            name[name_len] = '\0';
-            
             state->index++; // consume '>'
             
             // Parse the captured expression
             AstNode *child = parse_alternation(state);
+            if (child == NULL) {
+                return NULL;
+            }
             
-            if(state->input[state->index] != ')') {
+            if(peek(state, 0) != ')') {
                 fprintf(stderr, "parse_atom  Error: unmatched parenthesis in capture group\n");
-                free(name);
-                free_ast(child);
-                exit(1);
+                return NULL;
             }
             state->index++; // consume ')'
             
-            CaptureGroupNode *capture_node = create_capture_group_node(name, child);
-            free(name); // create_capture_group_node makes its own copy
-            return (AstNode*)capture_node;
+            // The name is copied into the arena straight from the pattern
+            return (AstNode*)create_capture_group_node(state->arena, state->input + name_start, name_len, child);
         }
 
         // Regular grouping (no capture)
         AstNode *node = parse_alternation(state);
+        if (node == NULL) {
+            return NULL;
+        }
 
-        if(state->input[state->index] != ')') {
+        if(peek(state, 0) != ')') {
             fprintf(stderr, "parse_atom  Error: unmatched parenthesis\n");
-            exit(1);
+            return NULL;
         }
         state->index++;
         return node;
     }
     if(c == '.') {
         state->index++;
-        return (AstNode*)create_wildcard_node();
+        return (AstNode*)create_wildcard_node(state->arena);
     }
     if(c == '*' || c == '+' || c == '?' || c == '|' || c == ')' || c == ']' || c == '\0') {
         fprintf(stderr, "parse_atom  Error: unexpected character '%c' at position %d\n", c, state->index);
-        exit(1);
+        return NULL;
     }
 
     state->index++;
 
-    return (AstNode*)create_literal_node(c);
+    return (AstNode*)create_literal_node(state->arena, c);
 }
 
-AstNode* parse(const char *input) {
-    if (input == NULL) {
+AstNode* parse_atom(ParserState *state) {
+    AstNode *atom = parse_atom_as_written(state);
+    return atom != NULL && state->single_line ? keep_to_line(state->arena, atom) : atom;
+}
+
+// Parses input[start .. end) as a whole pattern
+static AstNode* parse_range(Arena *arena, const char *input, size_t start, size_t end, bool single_line) {
+    ParserState state;
+    state.input = input + start;
+    state.index = 0;
+    state.length = (int)(end - start);
+    state.arena = arena;
+    state.single_line = single_line;
+
+    AstNode *root = parse_alternation(&state);
+
+    if (root == NULL) {
         return NULL;
     }
 
-    char *input_buf = input;
+    if(state.index < state.length) {
+        fprintf(stderr, "parse  Error: unexpected character '%c' at position %d\n", peek(&state, 0), state.index);
+        return NULL;
+    }
 
-    size_t last_idx = strlen(input) - 1;
-    if(input[0] != '^' && input[last_idx] != '$') {
-        size_t new_size = strlen(input) + 2;
-        if(input[0] != '^') {
-            new_size += 2;
-        }
-        if(input[last_idx] != '$') {
-            new_size += 2;
-        }
-        new_size += 1;
-        input_buf = calloc(new_size, sizeof(char));
-        if(input_buf == NULL) {
-            fprintf(stderr, "parse  Error: failed to allocate input buffer\n");
-            return NULL;
-        }
-        if(input[0] != '^') {
-            strncpy(input_buf, ".*(", 3);
-            strcat(input_buf, input);
-        } else {
-            strcpy(input_buf, input);
-        }
-        if(input[last_idx] != '$') {
-            strcat(input_buf, ").*");
-        }
+    return root;
+}
+
+// A .* loop, lazy or greedy
+static AstNode* wildcard_loop(Arena *arena, bool lazy) {
+    QuantifierNode *loop = create_quantifier_node(arena, (AstNode*)create_wildcard_node(arena), '*');
+    loop->lazy = lazy;
+    return (AstNode*)loop;
+}
+
+// Finds the pattern between its anchors: a leading ^ anchors the match to the
+// start of the input, and a trailing $ that is not escaped to its end
+static void strip_anchors(const char *input, size_t *start_idx, size_t *end_idx, bool *starts, bool *ends) {
+    *start_idx = 0;
+    *end_idx = strlen(input);
+    *starts = *end_idx > 0 && input[0] == '^';
+    if (*starts) {
+        *start_idx = 1;
     }
-    else {
-        size_t new_size = strlen(input) + 1;
-        if(input[0] == '^') {
-            new_size -= 1;
-        }
-        if(input[last_idx] == '$') {
-            new_size -= 1;
-        }
-        input_buf = calloc(new_size, sizeof(char));
-        if(input_buf == NULL) {
-            fprintf(stderr, "parse  Error: failed to allocate input buffer\n");
-            return NULL;
-        }
-        size_t start_idx = (input[0] == '^') ? 1 : 0;
-        size_t end_idx = (input[last_idx] == '$') ? last_idx : strlen(input);
-        strncpy(input_buf, input + start_idx, end_idx - start_idx);
-        input_buf[end_idx - start_idx] = '\0';
+    size_t backslashes = 0;
+    while (*end_idx >= *start_idx + 2 + backslashes && input[*end_idx - 2 - backslashes] == '\\') {
+        backslashes++;
     }
-    printf("new input_buf: %s\n", input_buf);
-
-    ParserState state;
-    state.input = input_buf;
-    state.index = 0;
+    *ends = *end_idx > *start_idx && input[*end_idx - 1] == '$' && backslashes % 2 == 0;
+    if (*ends) {
+        (*end_idx)--;
+    }
+}
 
-    AstNode *root = parse_alternation(&state);
+static AstNode* parse_whole_into(Arena *arena, const char *input, bool single_line) {
+    if (arena == NULL || input == NULL) {
+        return NULL;
+    }
 
+    size_t start_idx;
+    size_t end_idx;
+    bool starts;
+    bool ends;
+    strip_anchors(input, &start_idx, &end_idx, &starts, &ends);
+    AstNode *root = parse_range(arena, input, start_idx, end_idx, single_line);
     if (root == NULL) {
         return NULL;
     }
+    // An unanchored side is parsed as if written .*?( or ).*, with the wrapper
+    // built as nodes rather than spliced into a copy of the pattern. A lazy
+    // prefix keeps the leftmost match preferred.
+    if (!starts) {
+        root = (AstNode*)create_concat_node(arena, wildcard_loop(arena, true), root);
+    }
+    if (!ends) {
+        root = (AstNode*)create_concat_node(arena, root, wildcard_loop(arena, false));
+    }
+    return root;
+}
 
-    if(state.input[state.index] != '\0') {
-        fprintf(stderr, "parse  Error: unexpected character '%c' at position %d\n", state.input[state.index], state.index);
-        free(input_buf);
-        free_ast(root);
+static AstNode* parse_search_range_into(Arena *arena, const char *input, bool *anchored_start, bool *anchored_end,
+                                        bool single_line) {
+    if (arena == NULL || input == NULL) {
         return NULL;
     }
 
-    free(input_buf);
+    size_t start_idx;
+    size_t end_idx;
+    bool starts;
+    bool ends;
+    strip_anchors(input, &start_idx, &end_idx, &starts, &ends);
+    if (end_idx == start_idx) {
+        fprintf(stderr, "parse_search  Error: empty pattern\n");
+        return NULL;
+    }
 
+    AstNode *root = parse_range(arena, input, start_idx, end_idx, single_line);
+    if (root == NULL) {
+        return NULL;
+    }
+    if (anchored_start != NULL) {
+        *anchored_start = starts;
+    }
+    if (anchored_end != NULL) {
+        *anchored_end = ends;
+    }
+    return (AstNode*)create_capture_group_node(arena, NULL, 0, root);
+}
+
+AstNode* parse_into(Arena *arena, const char *input) {
+    return parse_whole_into(arena, input, false);
+}
+
+AstNode* parse_search_into(Arena *arena, const char *input, bool *anchored_start, bool *anchored_end) {
+    return parse_search_range_into(arena, input, anchored_start, anchored_end, false);
+}
+
+AstNode* parse_lines_into(Arena *arena, const char *input) {
+    return parse_whole_into(arena, input, true);
+}
+
+AstNode* parse_search_lines_into(Arena *arena, const char *input, bool *anchored_start, bool *anchored_end) {
+    return parse_search_range_into(arena, input, anchored_start, anchored_end, true);
+}
+
+// Hands the arena to the root, or frees it if parsing failed
+static AstNode* own_arena(Arena *arena, AstNode *root) {
+    if (root == NULL) {
+        arena_free(arena);
+        return NULL;
+    }
+    root->arena = arena;
     return root;
 }
 
-void free_ast(AstNode *node) {
-    if (node == NULL) {
-        return;
+AstNode* parse(const char *input) {
+    if (input == NULL) {
+        return NULL;
     }
+    Arena *arena = arena_new();
+    return own_arena(arena, parse_into(arena, input));
+}
 
-    switch (node->type) {
-        case NODE_LITERAL:
-            break;
-        case NODE_CONCAT:
-        case NODE_ALTERNATION: {
-            AlternationNode *bin_node = (AlternationNode*)node;
-            free_ast(bin_node->left);
-            free_ast(bin_node->right);
-            break;
-        }
-        case NODE_QUANTIFIER: {
-            QuantifierNode *q_node = (QuantifierNode*)node;
-            free_ast(q_node->child);
-            break;
-        }
-        case NODE_WILDCARD:
-            break;
-        case NODE_CHAR_CLASS:
-            break;
-        case NODE_CAPTURE_GROUP: {
-            CaptureGroupNode *cg_node = (CaptureGroupNode*)node;
-            if (cg_node->name != NULL) {
-                free(cg_node->name);
-            }
-            free_ast(cg_node->child);
-            break;
-        }
+AstNode* parse_search(const char *input, bool *anchored_start, bool *anchored_end) {
+    if (input == NULL) {
+        return NULL;
     }
+    Arena *arena = arena_new();
+    return own_arena(arena, parse_search_into(arena, input, anchored_start, anchored_end));
+}
 
-    free(node);
+void free_ast(AstNode *node) {
+    // Every node lives in the arena, so no walk is needed
+    if (node != NULL) {
+        arena_free(node->arena);
+    }
 }
 
 static void print_ast_recursive(AstNode *node, char *prefix, bool is_last) {
@@ -442,7 +535,8 @@ static void print_ast_recursive(AstNode *node, char *prefix, bool is_last) {
             printf("LITERAL('%c')\n", ((LiteralNode*)node)->value);
             break;
         case NODE_QUANTIFIER:
-            printf("QUANTIFIER('%c')\n", ((QuantifierNode*)node)->quantifier);
+            printf("QUANTIFIER('%c'%s)\n", ((QuantifierNode*)node)->quantifier,
+                   ((QuantifierNode*)node)->lazy ? ", lazy" : "");
             break;
         case NODE_ALTERNATION:
             printf("ALTERNATION\n");
@@ -455,7 +549,7 @@ static void print_ast_recursive(AstNode *node, char *prefix, bool is_last) {
             printf("CHAR_CLASS%s[", cc_node->negated ? "(negated)" : "");
             bool first = true;
             for (int i = 0; i < 256; i++) {
-                if (cc_node->char_set[i]) {
+                if (char_class_contains(cc_node, (unsigned char)i)) {
                     if (!first) printf(",");
                     if (i >= 32 && i < 127) {
                         printf("%c", i);
@@ -0,0 +1,455 @@
+#include "prefilter.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static bool is_wildcard_loop(const AstNode *node) {
+    if (node == NULL || node->type != NODE_QUANTIFIER) {
+        return false;
+    }
+    const QuantifierNode *quant = (const QuantifierNode*)node;
+    return quant->quantifier == '*' && quant->child->type == NODE_WILDCARD;
+}
+
+static const AstNode *leftmost(const AstNode *node) {
+    while (node->type == NODE_CONCAT) {
+        node = ((const ConcatNode*)node)->left;
+    }
+    return node;
+}
+
+static const AstNode *rightmost(const AstNode *node) {
+    while (node->type == NODE_CONCAT) {
+        node = ((const ConcatNode*)node)->right;
+    }
+    return node;
+}
+
+// Appends the literal bytes node must start with. Returns true if the node is
+// nothing but those bytes, so whatever follows it extends the prefix.
+static bool append_prefix(const AstNode *node, LiteralPrefix *prefix) {
+    switch (node->type) {
+        case NODE_LITERAL:
+            if (prefix->len == PREFILTER_MAX_PREFIX) {
+                return false;
+            }
+            prefix->bytes[prefix->len++] = ((const LiteralNode*)node)->value;
+            return true;
+        case NODE_CONCAT: {
+            const ConcatNode *concat = (const ConcatNode*)node;
+            return append_prefix(concat->left, prefix) && append_prefix(concat->right, prefix);
+        }
+        case NODE_CAPTURE_GROUP:
+            return append_prefix(((const CaptureGroupNode*)node)->child, prefix);
+        case NODE_QUANTIFIER: {
+            // One or more repetitions still start with the child's prefix
+            const QuantifierNode *quant = (const QuantifierNode*)node;
+            if (quant->quantifier == '+') {
+                append_prefix(quant->child, prefix);
+            }
+            return false;
+        }
+        default:
+            return false;
+    }
+}
+
+// Walks the concatenation left to right, skipping the leading wildcard loop
+static bool append_prefix_after(const AstNode *node, const AstNode *skip, LiteralPrefix *prefix) {
+    if (node == skip) {
+        return true;
+    }
+    if (node->type == NODE_CONCAT) {
+        const ConcatNode *concat = (const ConcatNode*)node;
+        return append_prefix_after(concat->left, skip, prefix) && append_prefix_after(concat->right, skip, prefix);
+    }
+    return append_prefix(node, prefix);
+}
+
+LiteralPrefix extract_literal_prefix(const AstNode *root) {
+    LiteralPrefix prefix;
+    memset(&prefix, 0, sizeof(prefix));
+    if (root == NULL) {
+        return prefix;
+    }
+
+    const AstNode *first = leftmost(root);
+    prefix.unanchored_start = is_wildcard_loop(first);
+    prefix.unanchored_end = root->type == NODE_CONCAT && is_wildcard_loop(rightmost(root));
+    append_prefix_after(root, prefix.unanchored_start ? first : NULL, &prefix);
+    return prefix;
+}
+
+size_t find_literal(const char *haystack, size_t len, size_t from, const char *needle, size_t needle_len) {
+    if (needle_len == 0) {
+        return from;
+    }
+    if (from >= len || len - from < needle_len) {
+        return len;
+    }
+    size_t last = len - needle_len;  // Last offset where the needle fits
+
+    if (needle_len == 1) {
+        const char *hit = memchr(haystack + from, needle[0], len - from);
+        return hit ? (size_t)(hit - haystack) : len;
+    }
+
+    size_t i = from;
+#ifdef __SSE2__
+    // Compare the needle's first and last bytes against 16 candidate offsets at a
+    // time and only verify offsets where both agree
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i final = _mm_set1_epi8(needle[needle_len - 1]);
+    while (i + 16 <= last + 1) {
+        __m128i block_first = _mm_loadu_si128((const __m128i*)(haystack + i));
+        __m128i block_final = _mm_loadu_si128((const __m128i*)(haystack + i + needle_len - 1));
+        unsigned mask = (unsigned)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_final, final)));
+        while (mask != 0) {
+            unsigned bit = (unsigned)__builtin_ctz(mask);
+            if (memcmp(haystack + i + bit + 1, needle + 1, needle_len - 2) == 0) {
+                return i + bit;
+            }
+            mask &= mask - 1;
+        }
+        i += 16;
+    }
+#endif
+
+    while (i <= last) {
+        const char *hit = memchr(haystack + i, needle[0], last - i + 1);
+        if (hit == NULL) {
+            return len;
+        }
+        i = (size_t)(hit - haystack);
+        if (memcmp(haystack + i + 1, needle + 1, needle_len - 1) == 0) {
+            return i;
+        }
+        i++;
+    }
+    return len;
+}
+
+// A set of literals; an unknown set says nothing about the input
+typedef struct {
+    bool known;
+    size_t count;
+    char *strs[PREFILTER_MAX_FACTORS];
+    size_t lens[PREFILTER_MAX_FACTORS];
+} StringSet;
+
+// What the analysis knows about one AST node. When exact is set the node
+// always matches one of the strings in exact_set.
+typedef struct {
+    bool exact;
+    StringSet exact_set;
+    StringSet prefix;    // Every match starts with one of these
+    StringSet suffix;    // Every match ends with one of these
+    StringSet required;  // Every match contains one of these
+} FactorInfo;
+
+static void *checked_malloc(size_t size) {
+    void *ptr = malloc(size);
+    if (ptr == NULL) {
+        fprintf(stderr, "extract_required_factors  Error: failed to allocate %zu bytes\n", size);
+        exit(1);
+    }
+    return ptr;
+}
+
+static void set_clear(StringSet *set) {
+    for (size_t i = 0; i < set->count; i++) {
+        free(set->strs[i]);
+    }
+    set->known = false;
+    set->count = 0;
+}
+
+// Adds str unless already present. Returns false if the set is full.
+static bool set_add(StringSet *set, const char *str, size_t len) {
+    for (size_t i = 0; i < set->count; i++) {
+        if (set->lens[i] == len && memcmp(set->strs[i], str, len) == 0) {
+            return true;
+        }
+    }
+    if (set->count == PREFILTER_MAX_FACTORS) {
+        return false;
+    }
+    set->strs[set->count] = checked_malloc(len + 1);
+    memcpy(set->strs[set->count], str, len);
+    set->strs[set->count][len] = '\0';
+    set->lens[set->count++] = len;
+    return true;
+}
+
+static void set_copy(StringSet *dst, const StringSet *src) {
+    set_clear(dst);
+    dst->known = src->known;
+    for (size_t i = 0; i < src->count; i++) {
+        set_add(dst, src->strs[i], src->lens[i]);
+    }
+}
+
+static void set_union(StringSet *dst, const StringSet *a, const StringSet *b) {
+    set_clear(dst);
+    if (!a->known || !b->known) {
+        return;
+    }
+    dst->known = true;
+    for (size_t i = 0; i < a->count; i++) {
+        if (!set_add(dst, a->strs[i], a->lens[i])) {
+            set_clear(dst);
+            return;
+        }
+    }
+    for (size_t i = 0; i < b->count; i++) {
+        if (!set_add(dst, b->strs[i], b->lens[i])) {
+            set_clear(dst);
+            return;
+        }
+    }
+}
+
+typedef enum {
+    PRODUCT_EXACT,   // Fail if a result is too long
+    PRODUCT_PREFIX,  // Keep the first PREFILTER_MAX_FACTOR_LEN bytes
+    PRODUCT_SUFFIX   // Keep the last PREFILTER_MAX_FACTOR_LEN bytes
+} ProductMode;
+
+// Every concatenation of a string from a with a string from b
+static void set_product(StringSet *dst, const StringSet *a, const StringSet *b, ProductMode mode) {
+    set_clear(dst);
+    if (!a->known || !b->known || a->count * b->count > PREFILTER_MAX_FACTORS) {
+        return;
+    }
+    dst->known = true;
+    char buf[2 * PREFILTER_MAX_FACTOR_LEN];
+    for (size_t i = 0; i < a->count; i++) {
+        for (size_t j = 0; j < b->count; j++) {
+            size_t len = a->lens[i] + b->lens[j];
+            memcpy(buf, a->strs[i], a->lens[i]);
+            memcpy(buf + a->lens[i], b->strs[j], b->lens[j]);
+            const char *str = buf;
+            if (len > PREFILTER_MAX_FACTOR_LEN) {
+                if (mode == PRODUCT_EXACT) {
+                    set_clear(dst);
+                    return;
+                }
+                if (mode == PRODUCT_SUFFIX) {
+                    str = buf + len - PREFILTER_MAX_FACTOR_LEN;
+                }
+                len = PREFILTER_MAX_FACTOR_LEN;
+            }
+            set_add(dst, str, len);
+        }
+    }
+}
+
+// Sets whose shortest member is longer are rarer in typical input; 0 means useless
+static size_t set_score(const StringSet *set) {
+    if (!set->known || set->count == 0) {
+        return 0;
+    }
+    size_t shortest = set->lens[0];
+    for (size_t i = 1; i < set->count; i++) {
+        if (set->lens[i] < shortest) {
+            shortest = set->lens[i];
+        }
+    }
+    return shortest;
+}
+
+static void keep_better(StringSet *best, const StringSet *candidate) {
+    size_t best_score = set_score(best);
+    size_t candidate_score = set_score(candidate);
+    if (candidate_score > best_score ||
+        (candidate_score == best_score && candidate_score > 0 && candidate->count < best->count)) {
+        set_copy(best, candidate);
+    }
+}
+
+static FactorInfo *new_info(void) {
+    FactorInfo *info = checked_malloc(sizeof(FactorInfo));
+    memset(info, 0, sizeof(FactorInfo));
+    return info;
+}
+
+static void free_info(FactorInfo *info) {
+    set_clear(&info->exact_set);
+    set_clear(&info->prefix);
+    set_clear(&info->suffix);
+    set_clear(&info->required);
+    free(info);
+}
+
+// An exact node starts, ends with and contains its own strings
+static void settle_exact(FactorInfo *info) {
+    if (!info->exact) {
+        return;
+    }
+    set_copy(&info->prefix, &info->exact_set);
+    set_copy(&info->suffix, &info->exact_set);
+    keep_better(&info->required, &info->exact_set);
+}
+
+static FactorInfo *analyze(const AstNode *node) {
+    FactorInfo *info = new_info();
+
+    switch (node->type) {
+        case NODE_LITERAL: {
+            char c = ((const LiteralNode*)node)->value;
+            info->exact = true;
+            info->exact_set.known = true;
+            set_add(&info->exact_set, &c, 1);
+            settle_exact(info);
+            break;
+        }
+        case NODE_CONCAT: {
+            const ConcatNode *concat = (const ConcatNode*)node;
+            FactorInfo *left = analyze(concat->left);
+            FactorInfo *right = analyze(concat->right);
+
+            if (left->exact && right->exact) {
+                set_product(&info->exact_set, &left->exact_set, &right->exact_set, PRODUCT_EXACT);
+                info->exact = info->exact_set.known;
+            }
+            if (info->exact) {
+                settle_exact(info);
+            } else {
+                if (left->exact) {
+                    set_product(&info->prefix, &left->exact_set, &right->prefix, PRODUCT_PREFIX);
+                    if (!info->prefix.known) {
+                        set_copy(&info->prefix, &left->exact_set);
+                    }
+                } else {
+                    set_copy(&info->prefix, &left->prefix);
+                }
+                if (right->exact) {
+                    set_product(&info->suffix, &left->suffix, &right->exact_set, PRODUCT_SUFFIX);
+                    if (!info->suffix.known) {
+                        set_copy(&info->suffix, &right->exact_set);
+                    }
+                } else {
+                    set_copy(&info->suffix, &right->suffix);
+                }
+            }
+
+            // The left side's ending runs straight into the right side's beginning
+            StringSet across;
+            memset(&across, 0, sizeof(across));
+            set_product(&across, &left->suffix, &right->prefix, PRODUCT_PREFIX);
+            keep_better(&info->required, &left->required);
+            keep_better(&info->required, &right->required);
+            keep_better(&info->required, &across);
+            keep_better(&info->required, &info->prefix);
+            keep_better(&info->required, &info->suffix);
+            set_clear(&across);
+
+            free_info(left);
+            free_info(right);
+            break;
+        }
+        case NODE_ALTERNATION: {
+            const AlternationNode *alt = (const AlternationNode*)node;
+            FactorInfo *left = analyze(alt->left);
+            FactorInfo *right = analyze(alt->right);
+
+            if (left->exact && right->exact) {
+                set_union(&info->exact_set, &left->exact_set, &right->exact_set);
+                info->exact = info->exact_set.known;
+            }
+            if (info->exact) {
+                settle_exact(info);
+            } else {
+                set_union(&info->prefix, &left->prefix, &right->prefix);
+                set_union(&info->suffix, &left->suffix, &right->suffix);
+                set_union(&info->required, &left->required, &right->required);
+            }
+
+            free_info(left);
+            free_info(right);
+            break;
+        }
+        case NODE_QUANTIFIER: {
+            // Only '+' guarantees the child appears; '*' and '?' may skip it
+            const QuantifierNode *quant = (const QuantifierNode*)node;
+            if (quant->quantifier == '+') {
+                FactorInfo *child = analyze(quant->child);
+                set_copy(&info->prefix, &child->prefix);
+                set_copy(&info->suffix, &child->suffix);
+                set_copy(&info->required, &child->required);
+                free_info(child);
+            }
+            break;
+        }
+        case NODE_CAPTURE_GROUP: {
+            FactorInfo *child = analyze(((const CaptureGroupNode*)node)->child);
+            free(info);
+            info = child;
+            break;
+        }
+        default:
+            break;
+    }
+
+    return info;
+}
+
+RequiredFactors extract_required_factors(const AstNode *root) {
+    RequiredFactors factors;
+    memset(&factors, 0, sizeof(factors));
+    if (root == NULL) {
+        return factors;
+    }
+
+    FactorInfo *info = analyze(root);
+    if (set_score(&info->required) > 0) {
+        // Hand the strings over instead of copying them
+        factors.count = info->required.count;
+        for (size_t i = 0; i < factors.count; i++) {
+            factors.factors[i] = info->required.strs[i];
+            factors.lens[i] = info->required.lens[i];
+        }
+        info->required.count = 0;
+    }
+    free_info(info);
+    return factors;
+}
+
+bool contains_required_factor(const RequiredFactors *factors, const char *input, size_t len) {
+    if (factors == NULL || factors->count == 0) {
+        return true;
+    }
+    for (size_t i = 0; i < factors->count; i++) {
+        if (find_literal(input, len, 0, factors->factors[i], factors->lens[i]) < len) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void free_required_factors(RequiredFactors *factors) {
+    if (factors == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < factors->count; i++) {
+        free(factors->factors[i]);
+    }
+    factors->count = 0;
+}
+
+void print_required_factors(const RequiredFactors *factors) {
+    if (factors == NULL || factors->count == 0) {
+        printf("No required factors.\n");
+        return;
+    }
+    printf("Required factors (any of %zu):\n", factors->count);
+    for (size_t i = 0; i < factors->count; i++) {
+        printf("  \"%.*s\"\n", (int)factors->lens[i], factors->factors[i]);
+    }
+}
@@ -0,0 +1,485 @@
+#include "program.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_PC UINT32_MAX
+
+static void *checked_realloc(void *ptr, size_t size, const char *what) {
+    void *new_ptr = realloc(ptr, size);
+    if (new_ptr == NULL) {
+        fprintf(stderr, "compile_program  Error: failed to allocate %s\n", what);
+        exit(1);
+    }
+    return new_ptr;
+}
+
+static bool is_epsilon(const Transition *trans) {
+    return trans->symbol == EPSILON || trans->symbol == CAPTURE_START || trans->symbol == CAPTURE_END;
+}
+
+static uint32_t add_byte_set(Program *prog, const ByteSet *set) {
+    // Shorthands like \d and \w tend to repeat within a pattern; share them
+    for (uint32_t i = 0; i < prog->num_classes; i++) {
+        if (memcmp(&prog->classes[i], set, sizeof(ByteSet)) == 0) {
+            return i;
+        }
+    }
+    prog->classes = checked_realloc(prog->classes, (prog->num_classes + 1) * sizeof(ByteSet), "classes");
+    prog->classes[prog->num_classes] = *set;
+    return prog->num_classes++;
+}
+
+static uint32_t add_class(Program *prog, const Transition *trans) {
+    ByteSet set;
+    for (int w = 0; w < 4; w++) {
+        set.bits[w] = trans->char_class_negated ? ~trans->char_class_set[w] : trans->char_class_set[w];
+    }
+    return add_byte_set(prog, &set);
+}
+
+// The compiler numbers capture groups densely, so a group's id is its index
+static uint32_t add_capture(Program *prog, const Transition *trans) {
+    uint32_t group = (uint32_t)trans->capture_id;
+    if (group >= prog->num_captures) {
+        prog->capture_names = checked_realloc(prog->capture_names, (group + 1) * sizeof(char*), "capture names");
+        for (uint32_t i = prog->num_captures; i <= group; i++) {
+            prog->capture_names[i] = NULL;
+        }
+        prog->num_captures = group + 1;
+    }
+    if (prog->capture_names[group] == NULL && trans->capture_name != NULL) {
+        prog->capture_names[group] = strdup(trans->capture_name);
+    }
+    return group;
+}
+
+// Splits every byte class into the bytes inside and outside the set
+static void refine_byte_classes(Program *prog, const ByteSet *set) {
+    int16_t remap[512];
+    for (int i = 0; i < 512; i++) {
+        remap[i] = -1;
+    }
+    uint32_t num = 0;
+    for (int c = 0; c < 256; c++) {
+        int key = prog->byte_classes[c] * 2 + (byte_set_contains(set, (unsigned char)c) ? 1 : 0);
+        if (remap[key] < 0) {
+            remap[key] = (int16_t)num++;
+        }
+        prog->byte_classes[c] = (uint8_t)remap[key];
+    }
+    prog->num_byte_classes = num;
+}
+
+// Partitions the 256 bytes so that two bytes share a class only if every
+// instruction accepts both or neither
+static void compute_byte_classes(Program *prog) {
+    memset(prog->byte_classes, 0, sizeof(prog->byte_classes));
+    prog->num_byte_classes = 1;
+
+    bool literal[256] = {false};
+    for (uint32_t pc = 0; pc < prog->count; pc++) {
+        if (prog->insts[pc].opcode == OP_CHAR) {
+            literal[prog->insts[pc].byte] = true;
+        }
+    }
+    for (int c = 0; c < 256; c++) {
+        if (literal[c]) {
+            ByteSet single;
+            memset(&single, 0, sizeof(single));
+            single.bits[c >> 6] = (uint64_t)1 << (c & 63);
+            refine_byte_classes(prog, &single);
+        }
+    }
+    for (uint32_t i = 0; i < prog->num_classes; i++) {
+        refine_byte_classes(prog, &prog->classes[i]);
+    }
+}
+
+ProgramOptions program_default_options(void) {
+    ProgramOptions options;
+    options.precompute_closures = false;
+    options.max_closure_entries = PROGRAM_DEFAULT_MAX_CLOSURE_ENTRIES;
+    return options;
+}
+
+static bool needs_closure(const Program *prog, const bool *is_target, uint32_t pc) {
+    return pc == prog->start || is_target[pc];
+}
+
+// Stores the epsilon closure of the start state and of every consuming
+// instruction's target. Leaves the program unchanged if they exceed max_entries.
+static void precompute_closures(Program *prog, size_t max_entries) {
+    bool *is_target = calloc(prog->count, sizeof(bool));
+    uint32_t *seen = calloc(prog->count, sizeof(uint32_t));
+    if (is_target == NULL || seen == NULL) {
+        fprintf(stderr, "compile_program  Error: failed to allocate closure buffers\n");
+        exit(1);
+    }
+    for (uint32_t pc = 0; pc < prog->count; pc++) {
+        uint8_t op = prog->insts[pc].opcode;
+        if (op == OP_CHAR || op == OP_ANY || op == OP_CLASS) {
+            is_target[prog->insts[pc].out] = true;
+        }
+    }
+
+    // Each instruction is expanded once per closure and pushes at most two states
+    uint32_t *stack = checked_realloc(NULL, (2 * (size_t)prog->count + 1) * sizeof(uint32_t), "closure stack");
+    uint32_t *closure_start = checked_realloc(NULL, ((size_t)prog->count + 1) * sizeof(uint32_t), "closures");
+    uint32_t *closures = NULL;
+    size_t len = 0;
+    size_t capacity = 0;
+    bool too_large = false;
+
+    for (uint32_t pc = 0; pc < prog->count && !too_large; pc++) {
+        closure_start[pc] = (uint32_t)len;
+        if (!needs_closure(prog, is_target, pc)) {
+            continue;
+        }
+
+        uint32_t generation = pc + 1;
+        size_t stack_size = 0;
+        stack[stack_size++] = pc;
+        while (stack_size > 0) {
+            uint32_t cur = stack[--stack_size];
+            if (seen[cur] == generation) {
+                continue;
+            }
+            seen[cur] = generation;
+
+            const Instruction *inst = &prog->insts[cur];
+            switch (inst->opcode) {
+                case OP_SPLIT:
+                    stack[stack_size++] = inst->out1;
+                    stack[stack_size++] = inst->out;
+                    break;
+                case OP_JMP:
+                case OP_SAVE:
+                    stack[stack_size++] = inst->out;
+                    break;
+                default:
+                    if (len == max_entries) {
+                        too_large = true;
+                        stack_size = 0;
+                        break;
+                    }
+                    if (len == capacity) {
+                        capacity = capacity == 0 ? 64 : capacity * 2;
+                        closures = checked_realloc(closures, capacity * sizeof(uint32_t), "closures");
+                    }
+                    closures[len++] = cur;
+                    break;
+            }
+        }
+    }
+
+    if (too_large) {
+        free(closures);
+        free(closure_start);
+    } else {
+        closure_start[prog->count] = (uint32_t)len;
+        prog->closure_start = closure_start;
+        prog->closures = closures;
+    }
+    free(stack);
+    free(seen);
+    free(is_target);
+}
+
+Program *compile_program(NfaFragment fragment) {
+    return compile_program_with_options(fragment, NULL);
+}
+
+Program *compile_program_with_options(NfaFragment fragment, const ProgramOptions *options) {
+    ProgramOptions defaults = program_default_options();
+    if (options == NULL) {
+        options = &defaults;
+    }
+    if (fragment.start == NULL) {
+        return NULL;
+    }
+
+    Program *prog = calloc(1, sizeof(Program));
+    if (prog == NULL) {
+        fprintf(stderr, "compile_program  Error: failed to allocate Program\n");
+        exit(1);
+    }
+    prog->num_patterns = 1;
+
+    // Number states in depth-first order so the start state is instruction 0
+    size_t capacity = 16;
+    size_t stack_capacity = 16;
+    size_t stack_size = 0;
+    size_t id_capacity = 16;
+    NfaState **states = checked_realloc(NULL, capacity * sizeof(NfaState*), "states");
+    NfaState **stack = checked_realloc(NULL, stack_capacity * sizeof(NfaState*), "stack");
+    uint32_t *pc_of = checked_realloc(NULL, id_capacity * sizeof(uint32_t), "state map");
+    for (size_t i = 0; i < id_capacity; i++) {
+        pc_of[i] = NO_PC;
+    }
+
+    stack[stack_size++] = fragment.start;
+    while (stack_size > 0) {
+        NfaState *state = stack[--stack_size];
+
+        if (state->id >= id_capacity) {
+            size_t new_capacity = id_capacity * 2;
+            while (state->id >= new_capacity) {
+                new_capacity *= 2;
+            }
+            pc_of = checked_realloc(pc_of, new_capacity * sizeof(uint32_t), "state map");
+            for (size_t i = id_capacity; i < new_capacity; i++) {
+                pc_of[i] = NO_PC;
+            }
+            id_capacity = new_capacity;
+        }
+        if (pc_of[state->id] != NO_PC) {
+            continue;
+        }
+
+        if (prog->count == capacity) {
+            capacity *= 2;
+            states = checked_realloc(states, capacity * sizeof(NfaState*), "states");
+        }
+        pc_of[state->id] = prog->count;
+        states[prog->count++] = state;
+
+        if (stack_size + 2 > stack_capacity) {
+            stack_capacity *= 2;
+            stack = checked_realloc(stack, stack_capacity * sizeof(NfaState*), "stack");
+        }
+        if (state->out2 && state->out2->to) {
+            stack[stack_size++] = state->out2->to;
+        }
+        if (state->out1 && state->out1->to) {
+            stack[stack_size++] = state->out1->to;
+        }
+    }
+
+    prog->insts = checked_realloc(NULL, prog->count * sizeof(Instruction), "instructions");
+    prog->start = pc_of[fragment.start->id];
+
+    for (uint32_t pc = 0; pc < prog->count; pc++) {
+        NfaState *state = states[pc];
+        Instruction *inst = &prog->insts[pc];
+        memset(inst, 0, sizeof(Instruction));
+        inst->out = NO_PC;
+        inst->out1 = NO_PC;
+
+        Transition *t1 = state->out1;
+        Transition *t2 = state->out2;
+        if (t1 == NULL) {
+            // Only the final accepting state is left without transitions
+            if (!state->is_accepting) {
+                fprintf(stderr, "compile_program  Error: state %lu has no transitions\n", state->id);
+                exit(1);
+            }
+            inst->opcode = OP_MATCH;
+            continue;
+        }
+
+        inst->out = pc_of[t1->to->id];
+        if (t2 != NULL) {
+            // Thompson construction only forks on epsilon transitions
+            if (!is_epsilon(t1) || !is_epsilon(t2)) {
+                fprintf(stderr, "compile_program  Error: state %lu forks on input\n", state->id);
+                exit(1);
+            }
+            inst->opcode = OP_SPLIT;
+            inst->out1 = pc_of[t2->to->id];
+            continue;
+        }
+
+        switch (t1->symbol) {
+            case EPSILON:
+                inst->opcode = OP_JMP;
+                break;
+            case CAPTURE_START:
+            case CAPTURE_END:
+                inst->opcode = OP_SAVE;
+                inst->arg = 2 * add_capture(prog, t1) + (t1->symbol == CAPTURE_END ? 1 : 0);
+                break;
+            case ANY_CHAR:
+                inst->opcode = OP_ANY;
+                break;
+            case CHAR_CLASS:
+                inst->opcode = OP_CLASS;
+                inst->arg = add_class(prog, t1);
+                break;
+            default:
+                inst->opcode = OP_CHAR;
+                inst->byte = (uint8_t)t1->symbol;
+                break;
+        }
+    }
+
+    free(pc_of);
+    free(stack);
+    free(states);
+
+    compute_byte_classes(prog);
+    if (options->precompute_closures) {
+        precompute_closures(prog, options->max_closure_entries);
+    }
+    return prog;
+}
+
+Program *compile_program_set(const NfaFragment *fragments, size_t count, const ProgramOptions *options) {
+    if (fragments == NULL || count == 0 || count > UINT32_MAX) {
+        return NULL;
+    }
+    ProgramOptions defaults = program_default_options();
+    if (options == NULL) {
+        options = &defaults;
+    }
+
+    Program *set = calloc(1, sizeof(Program));
+    if (set == NULL) {
+        fprintf(stderr, "compile_program_set  Error: failed to allocate Program\n");
+        exit(1);
+    }
+    set->num_patterns = (uint32_t)count;
+
+    // A chain of splits tries the patterns in order: split i enters pattern i or moves on
+    uint32_t num_splits = (uint32_t)count - 1;
+    set->count = num_splits;
+    set->insts = checked_realloc(NULL, (num_splits + 1) * sizeof(Instruction), "instructions");
+
+    for (size_t p = 0; p < count; p++) {
+        Program *part = compile_program(fragments[p]);
+        if (part == NULL) {
+            free_program(set);
+            return NULL;
+        }
+
+        uint32_t base = set->count;
+        set->count += part->count;
+        set->insts = checked_realloc(set->insts, set->count * sizeof(Instruction), "instructions");
+        for (uint32_t pc = 0; pc < part->count; pc++) {
+            Instruction inst = part->insts[pc];
+            switch (inst.opcode) {
+                case OP_CLASS:
+                    inst.arg = add_byte_set(set, &part->classes[inst.arg]);
+                    break;
+                case OP_SAVE:
+                    // Sets report which patterns matched, not their groups
+                    inst.opcode = OP_JMP;
+                    inst.arg = 0;
+                    break;
+                case OP_MATCH:
+                    inst.arg = (uint32_t)p;
+                    break;
+                default:
+                    break;
+            }
+            if (inst.opcode != OP_MATCH) {
+                inst.out += base;
+            }
+            if (inst.opcode == OP_SPLIT) {
+                inst.out1 += base;
+            }
+            set->insts[base + pc] = inst;
+        }
+
+        uint32_t entry = base + part->start;
+        if (p < num_splits) {
+            Instruction *split = &set->insts[p];
+            memset(split, 0, sizeof(Instruction));
+            split->opcode = OP_SPLIT;
+            split->out = entry;
+            split->out1 = (p + 1 < num_splits) ? (uint32_t)p + 1 : NO_PC;
+        } else if (num_splits > 0) {
+            set->insts[num_splits - 1].out1 = entry;
+        } else {
+            set->start = entry;
+        }
+        free_program(part);
+    }
+
+    compute_byte_classes(set);
+    if (options->precompute_closures) {
+        precompute_closures(set, options->max_closure_entries);
+    }
+    return set;
+}
+
+void free_program(Program *prog) {
+    if (prog == NULL) {
+        return;
+    }
+    for (uint32_t i = 0; i < prog->num_captures; i++) {
+        free(prog->capture_names[i]);
+    }
+    free(prog->capture_names);
+    free(prog->closure_start);
+    free(prog->closures);
+    free(prog->classes);
+    free(prog->insts);
+    free(prog);
+}
+
+static void print_byte(int c) {
+    if (c >= 32 && c < 127) {
+        printf("%c", c);
+    } else {
+        printf("\\x%02x", c);
+    }
+}
+
+void print_program(const Program *prog) {
+    if (prog == NULL) {
+        printf("Program is empty.\n");
+        return;
+    }
+
+    printf("--- Program (%u instructions, start %u, %u byte classes) ---\n", prog->count, prog->start,
+           prog->num_byte_classes);
+    for (uint32_t pc = 0; pc < prog->count; pc++) {
+        const Instruction *inst = &prog->insts[pc];
+        printf("%4u: ", pc);
+        switch (inst->opcode) {
+            case OP_CHAR:
+                printf("char '");
+                print_byte(inst->byte);
+                printf("' -> %u\n", inst->out);
+                break;
+            case OP_ANY:
+                printf("any -> %u\n", inst->out);
+                break;
+            case OP_CLASS: {
+                printf("class %u [", inst->arg);
+                bool first = true;
+                for (int c = 0; c < 256; c++) {
+                    if (byte_set_contains(&prog->classes[inst->arg], (unsigned char)c)) {
+                        if (!first) printf(",");
+                        print_byte(c);
+                        first = false;
+                    }
+                }
+                printf("] -> %u\n", inst->out);
+                break;
+            }
+            case OP_SPLIT:
+                printf("split %u, %u\n", inst->out, inst->out1);
+                break;
+            case OP_JMP:
+                printf("jmp %u\n", inst->out);
+                break;
+            case OP_SAVE: {
+                const char *name = prog->capture_names[inst->arg / 2];
+                printf("save %u (%s of '%s') -> %u\n", inst->arg, (inst->arg & 1) ? "end" : "start",
+                       name ? name : "", inst->out);
+                break;
+            }
+            case OP_MATCH:
+                if (prog->num_patterns > 1) {
+                    printf("match %u\n", inst->arg);
+                } else {
+                    printf("match\n");
+                }
+                break;
+        }
+    }
+    printf("---------------------\n");
+}
@@ -0,0 +1,222 @@
+#include "scan.h"
+#include "engine_internal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Tracks line numbers while matches are reported in order. The buffer being
+// scanned always begins at the start of a line.
+typedef struct {
+    const Regex *re;        // The single-line form of the caller's
+    RegexScratch *scratch;  // Acquired for the whole scan
+    RegexLineCallback on_match;
+    void *user_data;
+    uint64_t base;         // File offset of the buffer's first byte
+    uint64_t line_number;  // Line containing `counted`
+    size_t line_start;     // Where that line begins in the buffer
+    size_t counted;        // Line breaks before this position have been counted
+    bool stopped;
+} LineScanner;
+
+static void start_buffer(LineScanner *scanner, uint64_t base) {
+    scanner->base = base;
+    scanner->line_start = 0;
+    scanner->counted = 0;
+}
+
+// Moves the line count forward to pos, which must not be behind it
+static void count_lines(LineScanner *scanner, const char *buf, size_t pos) {
+    const char *nl;
+    while (scanner->counted < pos &&
+           (nl = memchr(buf + scanner->counted, '\n', pos - scanner->counted)) != NULL) {
+        scanner->line_number++;
+        scanner->line_start = (size_t)(nl - buf) + 1;
+        scanner->counted = scanner->line_start;
+    }
+    scanner->counted = pos;
+}
+
+static void report(LineScanner *scanner, const char *buf, size_t len, size_t start, size_t end) {
+    count_lines(scanner, buf, start);
+
+    // Matches never take in a line break, so the line goes on past the match
+    const char *nl = memchr(buf + end, '\n', len - end);
+    size_t line_end = nl != NULL ? (size_t)(nl - buf) : len;
+
+    RegexLineMatch match;
+    match.start = scanner->base + start;
+    match.end = scanner->base + end;
+    match.line_number = scanner->line_number;
+    match.line_start = scanner->base + scanner->line_start;
+    match.line_end = scanner->base + line_end;
+    match.line = buf + scanner->line_start;
+    if (!scanner->on_match(&match, scanner->user_data)) {
+        scanner->stopped = true;
+    }
+}
+
+// Searches buf[0 .. len), which holds whole lines except perhaps the last
+static void scan_lines(LineScanner *scanner, const char *buf, size_t len) {
+    if (len == 0 || scanner->stopped) {
+        return;
+    }
+    // Past a final line break there is no line for an empty match to be on
+    bool ends_line = buf[len - 1] == '\n';
+
+    size_t start;
+    size_t end;
+    if (scanner->re->anchored_start || scanner->re->anchored_end) {
+        // ^ and $ hold at line boundaries, so search each line on its own
+        size_t line = 0;
+        while (line < len && !scanner->stopped) {
+            const char *nl = memchr(buf + line, '\n', len - line);
+            size_t line_len = nl != NULL ? (size_t)(nl - buf) - line : len - line;
+            RegexFindIter iter = regex_find_all_with_scratch(scanner->re, scanner->scratch, buf + line, line_len);
+            while (!scanner->stopped && regex_find_next(&iter, &start, &end)) {
+                report(scanner, buf, len, line + start, line + end);
+            }
+            line += line_len + 1;
+        }
+        return;
+    }
+
+    RegexFindIter iter = regex_find_all_with_scratch(scanner->re, scanner->scratch, buf, len);
+    while (!scanner->stopped && regex_find_next(&iter, &start, &end)) {
+        if (start == len && ends_line) {
+            break;
+        }
+        report(scanner, buf, len, start, end);
+    }
+}
+
+void regex_scan_buffer(const Regex *re, const char *buf, size_t len, RegexLineCallback on_match,
+                       void *user_data) {
+    if (re == NULL || buf == NULL || on_match == NULL) {
+        return;
+    }
+    re = regex_lines(re);
+    LineScanner scanner = {re, regex_scratch_acquire(re), on_match, user_data, 0, 1, 0, 0, false};
+    scan_lines(&scanner, buf, len);
+    regex_scratch_release(scanner.scratch);
+}
+
+// Reads fd to the end, searching each block up to its last line break and
+// carrying the partial line over to the next block
+static bool scan_reads(LineScanner *scanner, int fd) {
+    size_t capacity = REGEX_SCAN_READ_SIZE;
+    size_t filled = 0;
+    char *buf = malloc(capacity);
+    if (buf == NULL) {
+        fprintf(stderr, "scan_reads  Error: failed to allocate read buffer\n");
+        exit(1);
+    }
+
+    uint64_t base = 0;
+    bool ok = true;
+    while (!scanner->stopped) {
+        if (filled == capacity) {
+            // A line longer than the buffer
+            capacity *= 2;
+            buf = realloc(buf, capacity);
+            if (buf == NULL) {
+                fprintf(stderr, "scan_reads  Error: failed to grow read buffer\n");
+                exit(1);
+            }
+        }
+        ssize_t got = read(fd, buf + filled, capacity - filled);
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ok = false;
+            break;
+        }
+        if (got == 0) {
+            start_buffer(scanner, base);
+            scan_lines(scanner, buf, filled);
+            break;
+        }
+
+        // Only lines that are complete go into this block
+        size_t old = filled;
+        filled += (size_t)got;
+        size_t complete = old;
+        for (size_t i = filled; i > old; i--) {
+            if (buf[i - 1] == '\n') {
+                complete = i;
+                break;
+            }
+        }
+        if (complete == old) {
+            // The carried-over part never holds a line break
+            continue;
+        }
+        start_buffer(scanner, base);
+        scan_lines(scanner, buf, complete);
+        count_lines(scanner, buf, complete);
+        base += complete;
+        memmove(buf, buf + complete, filled - complete);
+        filled -= complete;
+    }
+
+    free(buf);
+    return ok;
+}
+
+// Scans fd with the scanner's scratch
+static bool scan_fd(LineScanner *scanner, int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return false;
+    }
+    if (S_ISREG(st.st_mode)) {
+        if (st.st_size == 0) {
+            return true;
+        }
+        size_t len = (size_t)st.st_size;
+        char *data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, len, MADV_SEQUENTIAL);
+            scan_lines(scanner, data, len);
+            munmap(data, len);
+            return true;
+        }
+    }
+    return scan_reads(scanner, fd);
+}
+
+bool regex_scan_fd(const Regex *re, int fd, RegexLineCallback on_match, void *user_data) {
+    if (re == NULL || on_match == NULL) {
+        errno = EINVAL;
+        return false;
+    }
+    re = regex_lines(re);
+    LineScanner scanner = {re, regex_scratch_acquire(re), on_match, user_data, 0, 1, 0, 0, false};
+    bool ok = scan_fd(&scanner, fd);
+    int saved = errno;
+    regex_scratch_release(scanner.scratch);
+    errno = saved;
+    return ok;
+}
+
+bool regex_scan_file(const Regex *re, const char *path, RegexLineCallback on_match, void *user_data) {
+    if (path == NULL) {
+        errno = EINVAL;
+        return false;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = regex_scan_fd(re, fd, on_match, user_data);
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return ok;
+}
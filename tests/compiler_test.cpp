@@ -1,4 +1,5 @@
 #include <gtest/gtest.h>
+#include <string>
 
 extern "C" {
     #include <regexp.h>
@@ -31,4 +32,75 @@ TEST(CompilerNFA, CompilesComplicated) {
 
     free_nfa(start);
     free_ast(tree);
-}
\ No newline at end of file
+}
+TEST(CompilerNFA, CompilesReversedPattern) {
+    AstNode* tree = parse("^a(?<g>b)c*$");
+    ASSERT_NE(tree, nullptr);
+
+    NfaFragment nfa = compile_ast_reverse(tree);
+    ASSERT_NE(nfa.start, nullptr);
+    ASSERT_TRUE(nfa.accept->is_accepting);
+
+    Program *prog = compile_program(nfa);
+    EXPECT_EQ(prog->num_captures, 0u);
+    EXPECT_TRUE(program_match(prog, "ba"));
+    EXPECT_TRUE(program_match(prog, "cccba"));
+    EXPECT_FALSE(program_match(prog, "abc"));
+    EXPECT_FALSE(program_match(prog, "bac"));
+
+    free_program(prog);
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
+
+TEST(CompilerNFA, SharesOneArenaBetweenAutomata) {
+    AstNode* tree = parse("^(?<word>[a-z]+)-\\d$");
+    ASSERT_NE(tree, nullptr);
+
+    Arena *arena = arena_new();
+    size_t first_block = arena_bytes(arena);
+    NfaFragment forward = compile_ast_into(arena, tree);
+    NfaFragment reverse = compile_ast_reverse_into(arena, tree);
+    EXPECT_EQ(forward.start->arena, nullptr);
+    // A small pattern fits in the first block
+    EXPECT_EQ(arena_bytes(arena), first_block);
+
+    Program *prog = compile_program(forward);
+    Program *reverse_prog = compile_program(reverse);
+    ASSERT_EQ(prog->num_captures, 1u);
+    EXPECT_STREQ(prog->capture_names[0], "word");
+    EXPECT_TRUE(program_match(prog, "abc-1"));
+    EXPECT_TRUE(program_match(reverse_prog, "1-cba"));
+
+    // Freeing the automata is left to the arena
+    free_nfa(forward.start);
+    EXPECT_TRUE(program_match(prog, "x-2"));
+
+    free_program(reverse_prog);
+    free_program(prog);
+    arena_free(arena);
+    free_ast(tree);
+}
+
+TEST(CompilerNFA, FreesLargeAutomata) {
+    // Thousands of alternatives and classes, well past a fixed-size traversal stack
+    std::string pattern = "^(";
+    for (int i = 0; i < 3000; i++) {
+        pattern += (i > 0 ? "|" : "") + std::string("w") + std::to_string(i) + "[xyz]";
+    }
+    pattern += ")$";
+    AstNode* tree = parse(pattern.c_str());
+    ASSERT_NE(tree, nullptr);
+
+    NfaFragment nfa = compile_ast(tree);
+    ASSERT_NE(nfa.start->arena, nullptr);
+    EXPECT_GT(arena_bytes(nfa.start->arena), (size_t)ARENA_MAX_BLOCK);
+
+    Program *prog = compile_program(nfa);
+    EXPECT_TRUE(program_match(prog, "w2999z"));
+    EXPECT_FALSE(program_match(prog, "w3000x"));
+
+    free_program(prog);
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
@@ -0,0 +1,563 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+    #include <regexp.h>
+}
+
+TEST(LazyDfa, AgreesWithNfaMatcher) {
+    const char *patterns[] = { "^a(b|c)*d+$", "^(a(b|c.)*d|e+f?.)$", "^[a-z]+[0-9]+$", "^\\w+@\\w+\\.\\w+$", "ab*", "x(?<g>y+)z" };
+    const char *inputs[] = { "", "ad", "abcbcd", "ac1bd", "eeeef#", "hello42", "user@example.com", "a", "abbb", "zzxyyyzzz", "xz", "123abc" };
+
+    for (const char *pattern : patterns) {
+        AstNode* tree = parse(pattern);
+        ASSERT_NE(tree, nullptr);
+        NfaFragment nfa = compile_ast(tree);
+        Program *prog = compile_program(nfa);
+        LazyDfa *dfa = lazy_dfa_new(prog, LAZY_DFA_DEFAULT_CACHE_SIZE);
+        ASSERT_NE(dfa, nullptr);
+
+        // Run everything twice so the second pass hits cached transitions
+        for (int pass = 0; pass < 2; pass++) {
+            for (const char *str : inputs) {
+                EXPECT_EQ(lazy_dfa_match(dfa, str), match(nfa, str)) << "Pattern: " << pattern << " input: " << str;
+            }
+        }
+        EXPECT_EQ(lazy_dfa_stats(dfa).cache_flushes, 0u);
+
+        lazy_dfa_free(dfa);
+        free_program(prog);
+        free_nfa(nfa.start);
+        free_ast(tree);
+    }
+}
+
+TEST(LazyDfa, FindsSameSpansAsPikeVm) {
+    const char *patterns[] = { "ab*", "a|ab", "(a|ab)(c|bcd)", "a*?b", "b+a?", "[ab]c*[^c]", "a.b", "(?<x>a+)(?<y>b*)c" };
+
+    // Every string over {a, b, c} up to length 6
+    std::vector<std::string> inputs = {""};
+    for (size_t i = 0; i < inputs.size() && inputs[i].size() < 6; i++) {
+        for (char c : std::string("abc")) {
+            inputs.push_back(inputs[i] + c);
+        }
+    }
+
+    for (const char *pattern : patterns) {
+        bool anchored_start, anchored_end;
+        AstNode* tree = parse_search(pattern, &anchored_start, &anchored_end);
+        ASSERT_NE(tree, nullptr);
+        NfaFragment nfa = compile_ast(tree);
+        NfaFragment reverse_nfa = compile_ast_reverse(tree);
+        Program *prog = compile_program(nfa);
+        Program *reverse_prog = compile_program(reverse_nfa);
+        MatchScratch *scratch = match_scratch_new(prog);
+        LazyDfa *forward = lazy_dfa_new_search(prog, LAZY_DFA_DEFAULT_CACHE_SIZE, false);
+        LazyDfa *reverse = lazy_dfa_new(reverse_prog, LAZY_DFA_DEFAULT_CACHE_SIZE);
+
+        for (const std::string &input : inputs) {
+            size_t expected_start = 0, expected_end = 0;
+            bool expected = program_find(prog, scratch, input.data(), input.size(), 0, false, false,
+                                         &expected_start, &expected_end);
+
+            size_t end = 0, start = 0;
+            LazyDfaResult found = lazy_dfa_find_end(forward, input.data(), input.size(), 0, &end);
+            ASSERT_EQ(found == LAZY_DFA_MATCH, expected) << "Pattern: " << pattern << " input: " << input;
+            if (!expected) {
+                continue;
+            }
+            ASSERT_EQ(lazy_dfa_find_start(reverse, input.data(), 0, end, &start), LAZY_DFA_MATCH);
+            EXPECT_EQ(start, expected_start) << "Pattern: " << pattern << " input: " << input;
+            EXPECT_EQ(end, expected_end) << "Pattern: " << pattern << " input: " << input;
+        }
+
+        lazy_dfa_free(reverse);
+        lazy_dfa_free(forward);
+        match_scratch_free(scratch);
+        free_program(reverse_prog);
+        free_program(prog);
+        free_nfa(reverse_nfa.start);
+        free_nfa(nfa.start);
+        free_ast(tree);
+    }
+}
+
+TEST(LazyDfa, MatchesBinaryInputByLength) {
+    AstNode* tree = parse("^a[^b]*b$");
+    ASSERT_NE(tree, nullptr);
+    NfaFragment nfa = compile_ast(tree);
+    Program *prog = compile_program(nfa);
+    LazyDfa *lazy = lazy_dfa_new(prog, LAZY_DFA_DEFAULT_CACHE_SIZE);
+    Dfa *dfa = compile_dfa(prog, DFA_DEFAULT_MAX_STATES);
+    ASSERT_NE(lazy, nullptr);
+    ASSERT_NE(dfa, nullptr);
+
+    const uint8_t payload[] = {'a', 0, 0xff, 0, 'b', 'b'};
+    EXPECT_TRUE(lazy_dfa_match_bytes(lazy, payload, 5));
+    EXPECT_FALSE(lazy_dfa_match_bytes(lazy, payload, 6));
+    EXPECT_FALSE(lazy_dfa_match_bytes(lazy, payload, 4));
+    EXPECT_TRUE(dfa_match_bytes(dfa, payload, 5));
+    EXPECT_FALSE(dfa_match_bytes(dfa, payload, 6));
+    // The NUL-terminated entry points stop at the first NUL
+    EXPECT_FALSE(lazy_dfa_match(lazy, (const char*)payload));
+
+    free_dfa(dfa);
+    lazy_dfa_free(lazy);
+    free_program(prog);
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
+
+static void record_end(uint64_t end, void *user_data) {
+    static_cast<std::vector<uint64_t>*>(user_data)->push_back(end);
+}
+
+TEST(LazyDfa, CursorsResumeAfterFlushes) {
+    bool anchored_start, anchored_end;
+    AstNode* tree = parse_search("a(a|b)(a|b)(a|b)(a|b)b", &anchored_start, &anchored_end);
+    ASSERT_NE(tree, nullptr);
+    NfaFragment nfa = compile_ast(tree);
+    Program *prog = compile_program(nfa);
+    LazyDfa *roomy = lazy_dfa_new_all_matches(prog, LAZY_DFA_DEFAULT_CACHE_SIZE, false);
+    LazyDfa *tiny = lazy_dfa_new_all_matches(prog, 2048, false);
+    ASSERT_NE(tiny, nullptr);
+
+    std::string text;
+    unsigned seed = 7;
+    for (int i = 0; i < 3000; i++) {
+        seed = seed * 1103515245 + 12345;
+        text += (seed >> 16) & 1 ? 'a' : 'b';
+    }
+
+    std::vector<uint64_t> expected;
+    LazyDfaCursor whole;
+    lazy_dfa_cursor_init(roomy, &whole);
+    lazy_dfa_feed(roomy, &whole, (const uint8_t*)text.data(), text.size(), record_end, &expected);
+    lazy_dfa_cursor_free(&whole);
+    ASSERT_FALSE(expected.empty());
+
+    // Two cursors take turns on the small cache, so each resumes after flushes
+    // caused by the other
+    std::vector<uint64_t> ends[2];
+    LazyDfaCursor cursors[2];
+    lazy_dfa_cursor_init(tiny, &cursors[0]);
+    lazy_dfa_cursor_init(tiny, &cursors[1]);
+    for (size_t pos = 0; pos < text.size(); pos += 7) {
+        size_t len = std::min<size_t>(7, text.size() - pos);
+        for (int c = 0; c < 2; c++) {
+            lazy_dfa_feed(tiny, &cursors[c], (const uint8_t*)text.data() + pos, len, record_end, &ends[c]);
+        }
+    }
+    EXPECT_GT(lazy_dfa_stats(tiny).cache_flushes, 0u);
+    EXPECT_EQ(ends[0], expected);
+    EXPECT_EQ(ends[1], expected);
+    EXPECT_EQ(cursors[0].offset, text.size());
+
+    // One long chunk makes the small cache thrash, so the feed finishes on the NFA
+    std::vector<uint64_t> fallback_ends;
+    LazyDfaCursor fallback;
+    lazy_dfa_cursor_init(tiny, &fallback);
+    lazy_dfa_feed(tiny, &fallback, (const uint8_t*)text.data(), text.size(), record_end, &fallback_ends);
+    EXPECT_GT(lazy_dfa_stats(tiny).nfa_fallbacks, 0u);
+    EXPECT_EQ(fallback_ends, expected);
+    lazy_dfa_cursor_free(&fallback);
+
+    lazy_dfa_cursor_free(&cursors[0]);
+    lazy_dfa_cursor_free(&cursors[1]);
+
+    // A parked cursor comes back from its bitset once its state id is stale
+    std::vector<uint64_t> parked_ends;
+    std::vector<uint64_t> parked(lazy_dfa_cursor_state_size(tiny) / sizeof(uint64_t) + 1);
+    LazyDfaCursor cursor;
+    lazy_dfa_cursor_init(tiny, &cursor);
+    lazy_dfa_cursor_save(tiny, &cursor, parked.data());
+    for (size_t pos = 0; pos < text.size(); pos += 11) {
+        size_t len = std::min<size_t>(11, text.size() - pos);
+        lazy_dfa_cursor_restore(tiny, &cursor, parked.data());
+        lazy_dfa_feed(tiny, &cursor, (const uint8_t*)text.data() + pos, len, record_end, &parked_ends);
+        lazy_dfa_cursor_save(tiny, &cursor, parked.data());
+        // Someone else churns the cache while this cursor is parked
+        LazyDfaCursor other;
+        lazy_dfa_cursor_init(tiny, &other);
+        lazy_dfa_feed(tiny, &other, (const uint8_t*)text.data() + text.size() - pos - len, len, nullptr, nullptr);
+        lazy_dfa_cursor_free(&other);
+    }
+    EXPECT_EQ(parked_ends, expected);
+    lazy_dfa_cursor_free(&cursor);
+    lazy_dfa_free(tiny);
+    lazy_dfa_free(roomy);
+    free_program(prog);
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
+
+TEST(LazyDfa, FlushesWhenCacheIsFull) {
+    AstNode* tree = parse("^(a|b)*a(a|b)(a|b)(a|b)(a|b)$");
+    ASSERT_NE(tree, nullptr);
+    NfaFragment nfa = compile_ast(tree);
+    Program *prog = compile_program(nfa);
+    // Only a handful of states fit, but the pattern needs dozens. States are
+    // small because the pattern only has three byte classes.
+    LazyDfa *dfa = lazy_dfa_new(prog, 1024);
+    ASSERT_NE(dfa, nullptr);
+
+    const char *valid_strings[] = { "abbbb", "babaab", "aaaaaaaa", "bbbbbbbabbbb" };
+    const char *invalid_strings[] = { "bbbbb", "aaabbbbb", "ab", "abbbbc" };
+
+    for (const char *str : valid_strings) {
+        EXPECT_TRUE(lazy_dfa_match(dfa, str)) << "Expected to match: " << str;
+    }
+    for (const char *str : invalid_strings) {
+        EXPECT_FALSE(lazy_dfa_match(dfa, str)) << "Expected not to match: " << str;
+    }
+    EXPECT_GT(lazy_dfa_stats(dfa).cache_flushes, 0u);
+
+    lazy_dfa_free(dfa);
+    free_program(prog);
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
+
+TEST(LazyDfa, MatchesManyInputsSideBySide) {
+    AstNode* tree = parse("^(a|b)*a(a|b)(a|b)(a|b)(a|b)$");
+    ASSERT_NE(tree, nullptr);
+    NfaFragment nfa = compile_ast(tree);
+    Program *prog = compile_program(nfa);
+
+    // Inputs of mixed lengths, so lanes finish and refill at different times
+    std::vector<std::string> inputs;
+    unsigned seed = 11;
+    for (int i = 0; i < 300; i++) {
+        std::string input;
+        seed = seed * 1103515245 + 12345;
+        for (unsigned n = (seed >> 16) % 40; n > 0; n--) {
+            seed = seed * 1103515245 + 12345;
+            input += "aab"[(seed >> 16) % 3];
+        }
+        inputs.push_back(input);
+    }
+    inputs[7] = "abbbc";
+    std::vector<const uint8_t*> data;
+    std::vector<size_t> lens;
+    for (const std::string &input : inputs) {
+        data.push_back((const uint8_t*)input.data());
+        lens.push_back(input.size());
+    }
+
+    // A cache of a few states flushes all the time, a default one never
+    for (size_t cache_size : {(size_t)1024, (size_t)LAZY_DFA_DEFAULT_CACHE_SIZE}) {
+        LazyDfa *dfa = lazy_dfa_new(prog, cache_size);
+        ASSERT_NE(dfa, nullptr);
+        std::unique_ptr<bool[]> out(new bool[inputs.size()]);
+        lazy_dfa_match_many(dfa, data.data(), lens.data(), inputs.size(), out.get());
+        for (size_t i = 0; i < inputs.size(); i++) {
+            EXPECT_EQ(out[i], program_match_bytes(prog, data[i], lens[i])) << inputs[i] << " cache " << cache_size;
+        }
+        if (cache_size == 1024) {
+            EXPECT_GT(lazy_dfa_stats(dfa).cache_flushes, 0u);
+        }
+        lazy_dfa_free(dfa);
+    }
+
+    free_program(prog);
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
+
+TEST(LazyDfa, FallsBackToNfaWhenThrashing) {
+    AstNode* tree = parse("^(a|b)*a(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)$");
+    ASSERT_NE(tree, nullptr);
+    NfaFragment nfa = compile_ast(tree);
+    Program *prog = compile_program(nfa);
+    LazyDfa *dfa = lazy_dfa_new(prog, 8 * 1024);
+    ASSERT_NE(dfa, nullptr);
+
+    // Pseudo-random a/b input walks through far more states than the cache holds
+    std::string input;
+    unsigned seed = 7;
+    for (int i = 0; i < 4000; i++) {
+        seed = seed * 1103515245 + 12345;
+        input += ((seed >> 16) & 1) ? 'a' : 'b';
+    }
+
+    std::string matching = input + "abbbbbb";
+    std::string failing = input + "bbbbbbb";
+    EXPECT_TRUE(lazy_dfa_match(dfa, matching.c_str()));
+    EXPECT_FALSE(lazy_dfa_match(dfa, failing.c_str()));
+    EXPECT_GT(lazy_dfa_stats(dfa).nfa_fallbacks, 0u);
+
+    lazy_dfa_free(dfa);
+    free_program(prog);
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
+
+// Pseudo-random a/b strings of up to max_len bytes
+static std::vector<std::string> random_ab_inputs(unsigned seed, int count, unsigned max_len) {
+    std::vector<std::string> inputs;
+    for (int i = 0; i < count; i++) {
+        std::string input;
+        seed = seed * 1103515245 + 12345;
+        for (unsigned n = (seed >> 16) % max_len; n > 0; n--) {
+            seed = seed * 1103515245 + 12345;
+            input += ((seed >> 16) & 1) ? 'a' : 'b';
+        }
+        inputs.push_back(input);
+    }
+    return inputs;
+}
+
+TEST(LazyDfa, SharesStatesBetweenHandles) {
+    AstNode* tree = parse("^(a|b)*a(a|b)(a|b)(a|b)(a|b)$");
+    ASSERT_NE(tree, nullptr);
+    NfaFragment nfa = compile_ast(tree);
+    Program *prog = compile_program(nfa);
+    std::vector<std::string> inputs = random_ab_inputs(5, 400, 60);
+
+    // What one thread builds on a cache of its own
+    LazyDfa *alone = lazy_dfa_new(prog, LAZY_DFA_DEFAULT_CACHE_SIZE);
+    ASSERT_NE(alone, nullptr);
+    for (const std::string &input : inputs) {
+        lazy_dfa_match(alone, input.c_str());
+    }
+    LazyDfaStats expected = lazy_dfa_stats(alone);
+    lazy_dfa_free(alone);
+
+    // Eight threads, each through its own handle, build each state once
+    LazyDfa *dfa = lazy_dfa_new(prog, LAZY_DFA_DEFAULT_CACHE_SIZE);
+    ASSERT_NE(dfa, nullptr);
+    std::vector<LazyDfa*> handles;
+    for (int t = 0; t < 8; t++) {
+        handles.push_back(lazy_dfa_share(dfa));
+    }
+    std::vector<int> mismatches(handles.size(), 0);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < handles.size(); t++) {
+        threads.emplace_back([&, t] {
+            // Each thread starts at a different input, so they race to add states
+            for (size_t k = 0; k < inputs.size(); k++) {
+                const std::string &input = inputs[(k + t * 50) % inputs.size()];
+                if (lazy_dfa_match(handles[t], input.c_str()) != program_match(prog, input.c_str())) {
+                    mismatches[t]++;
+                }
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(mismatches, std::vector<int>(handles.size(), 0));
+
+    LazyDfaStats stats = lazy_dfa_stats(handles[3]);
+    EXPECT_EQ(stats.states_built, expected.states_built);
+    EXPECT_EQ(stats.cache_bytes, expected.cache_bytes);
+    EXPECT_EQ(stats.cache_flushes, 0u);
+    EXPECT_EQ(lazy_dfa_stats(dfa).states_built, stats.states_built);
+
+    // The cache outlives the handle it was created with
+    lazy_dfa_free(dfa);
+    EXPECT_TRUE(lazy_dfa_match(handles[0], "abbbb"));
+    for (LazyDfa *handle : handles) {
+        lazy_dfa_free(handle);
+    }
+    free_program(prog);
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
+
+TEST(LazyDfa, SharedCacheStaysInBudget) {
+    AstNode* tree = parse("^(a|b)*a(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)$");
+    ASSERT_NE(tree, nullptr);
+    NfaFragment nfa = compile_ast(tree);
+    Program *prog = compile_program(nfa);
+    std::vector<std::string> inputs = random_ab_inputs(9, 200, 300);
+
+    // Far more states than fit, so the cache fills up and is flushed while other
+    // threads are still in it
+    LazyDfa *dfa = lazy_dfa_new(prog, 8 * 1024);
+    ASSERT_NE(dfa, nullptr);
+    std::vector<LazyDfa*> handles;
+    for (int t = 0; t < 4; t++) {
+        handles.push_back(lazy_dfa_share(dfa));
+    }
+    std::vector<int> mismatches(handles.size(), 0);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < handles.size(); t++) {
+        threads.emplace_back([&, t] {
+            for (const std::string &input : inputs) {
+                if (lazy_dfa_match(handles[t], input.c_str()) != program_match(prog, input.c_str())) {
+                    mismatches[t]++;
+                }
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(mismatches, std::vector<int>(handles.size(), 0));
+
+    // Each of the two tables gets half the budget
+    LazyDfaStats stats = lazy_dfa_stats(dfa);
+    EXPECT_LE(stats.cache_bytes, (size_t)4 * 1024);
+    EXPECT_GT(stats.cache_flushes, 0u);
+
+    for (LazyDfa *handle : handles) {
+        lazy_dfa_free(handle);
+    }
+    lazy_dfa_free(dfa);
+    free_program(prog);
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
+
+TEST(LazyDfa, SharedCacheFlushesWhenFull) {
+    AstNode* tree = parse("^(a|b)*a(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)$");
+    ASSERT_NE(tree, nullptr);
+    NfaFragment nfa = compile_ast(tree);
+    Program *prog = compile_program(nfa);
+    std::vector<std::string> inputs = random_ab_inputs(9, 200, 300);
+
+    // Like a Regex: the DFA it was created with stays idle and one thread
+    // matches through a shared handle. A full cache is flushed as if unshared.
+    LazyDfa *dfa = lazy_dfa_new(prog, 8 * 1024);
+    ASSERT_NE(dfa, nullptr);
+    LazyDfa *handle = lazy_dfa_share(dfa);
+    for (const std::string &input : inputs) {
+        EXPECT_EQ(lazy_dfa_match(handle, input.c_str()), program_match(prog, input.c_str())) << input;
+    }
+    LazyDfaStats stats = lazy_dfa_stats(handle);
+    EXPECT_LE(stats.cache_bytes, (size_t)4 * 1024);
+    EXPECT_GT(stats.cache_flushes, 0u);
+
+    // Each flush lets later matches build states again instead of finishing on
+    // the NFA from wherever the full cache left them
+    size_t built = stats.states_built;
+    for (const std::string &input : random_ab_inputs(10, 20, 300)) {
+        EXPECT_EQ(lazy_dfa_match(handle, input.c_str()), program_match(prog, input.c_str())) << input;
+    }
+    EXPECT_GT(lazy_dfa_stats(handle).states_built, built);
+
+    lazy_dfa_free(handle);
+    lazy_dfa_free(dfa);
+    free_program(prog);
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
+
+TEST(LazyDfa, SharingHalvesTheBudget) {
+    AstNode* tree = parse("^(a|b)*a(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)$");
+    ASSERT_NE(tree, nullptr);
+    NfaFragment nfa = compile_ast(tree);
+    Program *prog = compile_program(nfa);
+    std::vector<std::string> inputs = random_ab_inputs(11, 100, 300);
+
+    // Alone, the cache fills well past half its budget
+    LazyDfa *dfa = lazy_dfa_new(prog, 8 * 1024);
+    ASSERT_NE(dfa, nullptr);
+    for (const std::string &input : inputs) {
+        lazy_dfa_match(dfa, input.c_str());
+        if (lazy_dfa_stats(dfa).cache_bytes > 4 * 1024) {
+            break;
+        }
+    }
+    LazyDfaStats before = lazy_dfa_stats(dfa);
+    ASSERT_GT(before.cache_bytes, (size_t)4 * 1024);
+
+    // Sharing it flushes the table, and neither table grows past half again
+    LazyDfa *handle = lazy_dfa_share(dfa);
+    LazyDfaStats after = lazy_dfa_stats(handle);
+    EXPECT_LE(after.cache_bytes, (size_t)4 * 1024);
+    EXPECT_EQ(after.cache_flushes, before.cache_flushes + 1);
+    for (const std::string &input : inputs) {
+        EXPECT_EQ(lazy_dfa_match(handle, input.c_str()), program_match(prog, input.c_str())) << input;
+        EXPECT_LE(lazy_dfa_stats(handle).cache_bytes, (size_t)4 * 1024);
+    }
+
+    lazy_dfa_free(handle);
+    lazy_dfa_free(dfa);
+    free_program(prog);
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
+
+TEST(LazyDfa, RejectsTinyCache) {
+    AstNode* tree = parse("^a$");
+    ASSERT_NE(tree, nullptr);
+    NfaFragment nfa = compile_ast(tree);
+    Program *prog = compile_program(nfa);
+
+    EXPECT_EQ(lazy_dfa_new(prog, 64), nullptr);
+
+    free_program(prog);
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
+
+TEST(CompiledDfa, AgreesWithNfaMatcher) {
+    const char *patterns[] = { "^a(b|c)*d+$", "^(a(b|c.)*d|e+f?.)$", "^[a-z]+[0-9]+$", "^\\w+@\\w+\\.\\w+$", "ab*", "^[^0-9]\\s?$" };
+    const char *inputs[] = { "", "ad", "abcbcd", "ac1bd", "eeeef#", "hello42", "user@example.com", "a", "abbb", "x", "x ", "5" };
+
+    for (const char *pattern : patterns) {
+        AstNode* tree = parse(pattern);
+        ASSERT_NE(tree, nullptr);
+        NfaFragment nfa = compile_ast(tree);
+        Program *prog = compile_program(nfa);
+        Dfa *dfa = compile_dfa(prog, DFA_DEFAULT_MAX_STATES);
+        ASSERT_NE(dfa, nullptr);
+
+        for (const char *str : inputs) {
+            EXPECT_EQ(dfa_match(dfa, str), match(nfa, str)) << "Pattern: " << pattern << " input: " << str;
+        }
+
+        free_dfa(dfa);
+        free_program(prog);
+        free_nfa(nfa.start);
+        free_ast(tree);
+    }
+}
+
+TEST(CompiledDfa, IsMinimal) {
+    AstNode* tree = parse("^(a|b)*abb$");
+    ASSERT_NE(tree, nullptr);
+    NfaFragment nfa = compile_ast(tree);
+    Program *prog = compile_program(nfa);
+    Dfa *dfa = compile_dfa(prog, DFA_DEFAULT_MAX_STATES);
+    ASSERT_NE(dfa, nullptr);
+
+    // The textbook four states plus the dead state for every other byte
+    EXPECT_EQ(dfa->num_states, 5u);
+    // Columns for 'a', 'b' and every other byte
+    EXPECT_EQ(dfa->num_classes, 3u);
+    EXPECT_NE(dfa->start, (uint32_t)DFA_DEAD_STATE);
+    EXPECT_TRUE(dfa_match(dfa, "babb"));
+    EXPECT_FALSE(dfa_match(dfa, "abba"));
+
+    free_dfa(dfa);
+    free_program(prog);
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
+
+TEST(CompiledDfa, RefusesPatternsOverStateLimit) {
+    // Remembering the last eight bytes needs 2^8 states
+    AstNode* tree = parse("^(a|b)*a(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)$");
+    ASSERT_NE(tree, nullptr);
+    NfaFragment nfa = compile_ast(tree);
+    Program *prog = compile_program(nfa);
+
+    EXPECT_EQ(compile_dfa(prog, 100), nullptr);
+
+    Dfa *dfa = compile_dfa(prog, DFA_DEFAULT_MAX_STATES);
+    ASSERT_NE(dfa, nullptr);
+    EXPECT_TRUE(dfa_match(dfa, "bbabbbbbbb"));
+    EXPECT_FALSE(dfa_match(dfa, "abbbbbbbb"));
+
+    free_dfa(dfa);
+    free_program(prog);
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
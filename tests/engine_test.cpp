@@ -0,0 +1,925 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+    #include <regexp.h>
+    #include <engine_internal.h>
+}
+
+TEST(Regex, AgreesWithNfaMatcher) {
+    const char *patterns[] = {"ERROR: \\d+", "^GET /api/\\w+$", "ab+c", "(?<user>\\w+)@example", "x.y", "a|b"};
+    const char *inputs[] = {"", "ERROR: 42", "warn: x ERROR: 7 more", "ERROR: x", "GET /api/users",
+                            "GET /api/", "xxabbbcx", "ac", "bob@example.com", "xzy", "yx", "b"};
+
+    for (const char *pattern : patterns) {
+        Regex *re = regex_compile(pattern);
+        ASSERT_NE(re, nullptr);
+        for (const char *input : inputs) {
+            EXPECT_EQ(regex_match(re, input), match(re->nfa, input))
+                << "pattern " << pattern << " input " << input;
+        }
+        regex_free(re);
+    }
+}
+
+TEST(Regex, RejectsInvalidPatterns) {
+    const char *patterns[] = {"(ab", "[ab", "a+*", "(?<g>x", "x\\"};
+    for (const char *pattern : patterns) {
+        EXPECT_EQ(regex_compile(pattern), nullptr) << pattern;
+    }
+    const char *set_patterns[] = {"ok", "(bad"};
+    EXPECT_EQ(regex_set_compile(set_patterns, 2), nullptr);
+
+    // A bad pattern leaves the process able to compile the next one
+    Regex *re = regex_compile("(ab)+");
+    ASSERT_NE(re, nullptr);
+    EXPECT_TRUE(regex_match(re, "xabab"));
+    regex_free(re);
+}
+
+TEST(Regex, SkipsToLiteralPrefix) {
+    Regex *re = regex_compile("ERROR: (?<code>\\d+)");
+    ASSERT_NE(re, nullptr);
+    EXPECT_EQ(std::string(re->prefix.bytes, re->prefix.len), "ERROR: ");
+
+    RegexScratch *scratch = regex_scratch_new(re);
+    std::string line(4096, '.');
+    EXPECT_FALSE(regex_match_with_scratch(re, scratch, line.c_str()));
+    line.replace(3000, 10, "ERROR: 503");
+    EXPECT_TRUE(regex_match_with_scratch(re, scratch, line.c_str()));
+    // A near miss before the real occurrence
+    line.replace(100, 7, "ERROR:x");
+    EXPECT_TRUE(regex_match_with_scratch(re, scratch, line.c_str()));
+
+    // Skipped bytes never reach the DFA, so it builds only a few states
+    EXPECT_LT(lazy_dfa_stats(scratch->dfa).states_built, 20u);
+
+    regex_scratch_free(scratch);
+    regex_free(re);
+}
+
+TEST(Regex, RejectsAnchoredPrefixMismatch) {
+    Regex *re = regex_compile("^GET /api/\\w+$");
+    ASSERT_NE(re, nullptr);
+
+    EXPECT_TRUE(regex_match(re, "GET /api/users"));
+    EXPECT_FALSE(regex_match(re, "POST /api/users"));
+    EXPECT_FALSE(regex_match(re, "GET"));
+
+    regex_free(re);
+}
+
+TEST(Regex, ExtractsCaptures) {
+    Regex *re = regex_compile("ERROR: (?<code>\\d+)");
+    ASSERT_NE(re, nullptr);
+
+    MatchResult result = regex_match_with_captures(re, "12:00 ERROR: 503 upstream");
+    EXPECT_TRUE(result.matched);
+    ASSERT_EQ(result.num_groups, 1);
+    EXPECT_STREQ(result.groups[0].value, "503");
+    free_match_result(&result);
+
+    regex_free(re);
+}
+
+TEST(Regex, RejectsInputsWithoutRequiredFactor) {
+    Regex *re = regex_compile("\\w+ user_id=(?<id>\\d+)");
+    ASSERT_NE(re, nullptr);
+
+    const RequiredFactors *factors = regex_required_factors(re);
+    ASSERT_EQ(factors->count, 1u);
+    EXPECT_EQ(std::string(factors->factors[0], factors->lens[0]), " user_id=");
+
+    EXPECT_TRUE(regex_match(re, "login user_id=42"));
+    EXPECT_FALSE(regex_match(re, "login userid=42"));
+    EXPECT_FALSE(regex_match(re, "user_id=42"));
+
+    regex_free(re);
+}
+
+TEST(Regex, DropsFactorCoveredByPrefix) {
+    Regex *re = regex_compile("ERROR: \\d+");
+    ASSERT_NE(re, nullptr);
+    EXPECT_EQ(regex_required_factors(re)->count, 0u);
+    regex_free(re);
+}
+
+static std::vector<size_t> matched_patterns(const uint64_t *bits, size_t num_patterns) {
+    std::vector<size_t> result;
+    for (size_t i = 0; i < num_patterns; i++) {
+        if ((bits[i / 64] >> (i % 64)) & 1) {
+            result.push_back(i);
+        }
+    }
+    return result;
+}
+
+TEST(RegexSet, ReportsEveryMatchingPattern) {
+    const char *patterns[] = {"ERROR", "timeout", "^\\d+ ", "user_id=\\d+", "WARN"};
+    RegexSet *set = regex_set_compile(patterns, 5);
+    ASSERT_NE(set, nullptr);
+    EXPECT_EQ(set->prog->num_patterns, 5u);
+
+    uint64_t bits[PATTERN_SET_WORDS(5)];
+    EXPECT_TRUE(regex_set_match(set, "ERROR: timeout for user_id=7", bits));
+    EXPECT_EQ(matched_patterns(bits, 5), std::vector<size_t>({0, 1, 3}));
+
+    EXPECT_FALSE(regex_set_match(set, "all good", bits));
+    EXPECT_EQ(matched_patterns(bits, 5), std::vector<size_t>());
+
+    regex_set_free(set);
+}
+
+TEST(RegexSet, EnginesAgreeWithSeparateMatches) {
+    const char *patterns[] = {"a+b", "^ab*$", "(?<x>b|c)c", "\\d\\d", "a.c", "^[^x]*$"};
+    const size_t n = sizeof(patterns) / sizeof(patterns[0]);
+    const char *inputs[] = {"", "ab", "abbb", "cc", "xabc", "a1c", "12", "x", "bcc", "aaab"};
+
+    RegexSet *set = regex_set_compile(patterns, n);
+    ASSERT_NE(set, nullptr);
+    std::vector<Regex*> singles;
+    for (const char *pattern : patterns) {
+        singles.push_back(regex_compile(pattern));
+    }
+
+    for (const char *input : inputs) {
+        std::vector<size_t> expected;
+        for (size_t i = 0; i < n; i++) {
+            if (match(singles[i]->nfa, input)) {
+                expected.push_back(i);
+            }
+        }
+
+        uint64_t dfa_bits[PATTERN_SET_WORDS(6)];
+        uint64_t nfa_bits[PATTERN_SET_WORDS(6)];
+        EXPECT_EQ(regex_set_match(set, input, dfa_bits), !expected.empty()) << input;
+        EXPECT_EQ(regex_set_match_nfa(set, input, nfa_bits), !expected.empty()) << input;
+        EXPECT_EQ(matched_patterns(dfa_bits, n), expected) << "lazy DFA, input " << input;
+        EXPECT_EQ(matched_patterns(nfa_bits, n), expected) << "NFA, input " << input;
+    }
+
+    for (Regex *re : singles) {
+        regex_free(re);
+    }
+    regex_set_free(set);
+}
+
+TEST(RegexSet, HandlesMoreThanSixtyFourPatterns) {
+    std::vector<std::string> storage;
+    for (int i = 0; i < 100; i++) {
+        storage.push_back("^k" + std::to_string(i) + "=");
+    }
+    std::vector<const char*> patterns;
+    for (const std::string &pattern : storage) {
+        patterns.push_back(pattern.c_str());
+    }
+
+    RegexSet *set = regex_set_compile(patterns.data(), patterns.size());
+    ASSERT_NE(set, nullptr);
+
+    uint64_t bits[PATTERN_SET_WORDS(100)];
+    EXPECT_TRUE(regex_set_match(set, "k99=", bits));
+    EXPECT_EQ(matched_patterns(bits, 100), std::vector<size_t>({99}));
+
+    regex_set_free(set);
+}
+
+TEST(RegexSet, SharesOneSetAcrossThreads) {
+    const char *patterns[] = {"ERROR", "timeout", "^\\d+ ", "user_id=\\d+", "WARN"};
+    RegexSet *set = regex_set_compile(patterns, 5);
+    ASSERT_NE(set, nullptr);
+    std::vector<std::string> inputs;
+    for (int i = 0; i < 200; i++) {
+        std::string user = i % 3 ? " user_id=" + std::to_string(i) : "";
+        inputs.push_back(std::to_string(i) + (i % 2 ? " ERROR" : " ok") + user + (i % 5 ? "" : " timeout"));
+    }
+    std::vector<std::vector<size_t>> expected;
+    for (const std::string &input : inputs) {
+        uint64_t bits[PATTERN_SET_WORDS(5)];
+        regex_set_match_nfa(set, input.c_str(), bits);
+        expected.push_back(matched_patterns(bits, 5));
+    }
+
+    // Threads alternate between the lazy DFA and the NFA, each through a scratch
+    // of its own from the set
+    std::vector<int> mismatches(8, 0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; t++) {
+        threads.emplace_back([&, t] {
+            for (int round = 0; round < 20; round++) {
+                for (size_t i = 0; i < inputs.size(); i++) {
+                    uint64_t bits[PATTERN_SET_WORDS(5)];
+                    if ((round + t) % 2) {
+                        regex_set_match(set, inputs[i].c_str(), bits);
+                    } else {
+                        regex_set_match_nfa(set, inputs[i].c_str(), bits);
+                    }
+                    if (matched_patterns(bits, 5) != expected[i]) {
+                        mismatches[t]++;
+                    }
+                }
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(mismatches, std::vector<int>(8, 0));
+    regex_set_free(set);
+}
+
+static std::vector<std::pair<size_t, size_t>> find_all_spans(Regex *re, const std::string &text) {
+    std::vector<std::pair<size_t, size_t>> spans;
+    RegexFindIter iter = regex_find_all(re, text.data(), text.size());
+    size_t start, end;
+    while (regex_find_next(&iter, &start, &end)) {
+        spans.emplace_back(start, end);
+    }
+    return spans;
+}
+
+TEST(Regex, MatchesManyInputsLikeOneAtATime) {
+    // Required factors, a prefix to skip to, an anchored prefix, and neither
+    const char *patterns[] = {"(?<id>\\d+)-ERROR", "ERROR: \\d+", "^GET /api/\\w+", "a[bc]*d"};
+    const char *inputs[] = {"", "ERROR: 42", "12-ERROR", "x 7-ERROR y", "GET /api/users", "GET /", "abcbd",
+                            "ad", "xxERROR: 1", "ERROR", "noise", "GET /api/", "zzabd"};
+    const size_t n = sizeof(inputs) / sizeof(inputs[0]);
+    const uint8_t *data[n];
+    size_t lens[n];
+    for (size_t i = 0; i < n; i++) {
+        data[i] = (const uint8_t*)inputs[i];
+        lens[i] = strlen(inputs[i]);
+    }
+
+    for (const char *pattern : patterns) {
+        Regex *re = regex_compile(pattern);
+        ASSERT_NE(re, nullptr);
+        bool out[n];
+        regex_match_many(re, data, lens, n, out);
+        for (size_t i = 0; i < n; i++) {
+            EXPECT_EQ(out[i], regex_match(re, inputs[i])) << pattern << " on " << inputs[i];
+        }
+        regex_free(re);
+    }
+}
+
+TEST(Regex, InterleavesManyInputsOnceTheCacheIsLarge) {
+    // Enough alternatives that the DFA table outgrows L1
+    std::vector<std::string> words;
+    std::string pattern = "id=(";
+    unsigned seed = 5;
+    for (int w = 0; w < 200; w++) {
+        std::string word;
+        for (int i = 0; i < 8; i++) {
+            seed = seed * 1103515245 + 12345;
+            word += (char)('a' + (seed >> 16) % 26);
+        }
+        words.push_back(word);
+        pattern += (w > 0 ? "|" : "") + word;
+    }
+    pattern += ")";
+    Regex *re = regex_compile(pattern.c_str());
+    ASSERT_NE(re, nullptr);
+
+    std::vector<std::string> fields;
+    for (int i = 0; i < 2000; i++) {
+        seed = seed * 1103515245 + 12345;
+        std::string noise(seed % 13, 'q');
+        switch (i % 3) {
+            case 0: fields.push_back(noise + "id=" + words[(seed >> 8) % words.size()]); break;
+            case 1: fields.push_back("id=" + words[(seed >> 8) % words.size()].substr(1) + noise); break;
+            default: fields.push_back(noise + words[(seed >> 8) % words.size()]); break;
+        }
+    }
+    std::vector<const uint8_t*> data;
+    std::vector<size_t> lens;
+    for (const std::string &field : fields) {
+        data.push_back((const uint8_t*)field.data());
+        lens.push_back(field.size());
+    }
+
+    // The first pass fills the cache one input at a time, the second interleaves
+    RegexScratch *scratch = regex_scratch_new(re);
+    for (int pass = 0; pass < 2; pass++) {
+        std::unique_ptr<bool[]> out(new bool[fields.size()]);
+        regex_match_many_with_scratch(re, scratch, data.data(), lens.data(), fields.size(), out.get());
+        for (size_t i = 0; i < fields.size(); i++) {
+            EXPECT_EQ(out[i], regex_match(re, fields[i].c_str())) << fields[i] << " pass " << pass;
+        }
+        EXPECT_GE(lazy_dfa_stats(scratch->dfa).cache_bytes, (size_t)REGEX_INTERLEAVE_MIN_CACHE);
+    }
+    regex_scratch_free(scratch);
+    regex_free(re);
+}
+
+TEST(RegexFind, ReturnsLeftmostFirstSpan) {
+    struct Case {
+        const char *pattern;
+        const char *input;
+        bool found;
+        size_t start;
+        size_t end;
+    };
+    const Case cases[] = {
+        {"ab+", "xxabbbcab", true, 2, 6},
+        {"a|ab", "ab", true, 0, 1},
+        {"ab|a", "ab", true, 0, 2},
+        {"a*?", "aaa", true, 0, 0},
+        {"a+?", "baaa", true, 1, 2},
+        {"\\d+", "no digits", false, 0, 0},
+        {"ERROR: \\d+", "x ERROR: y ERROR: 42!", true, 11, 20},
+        {".*foo", "xxfooyfoo", true, 0, 9},
+        {"^ab", "xab", false, 0, 0},
+        {"^ab", "abab", true, 0, 2},
+        {"ab$", "abab", true, 2, 4},
+        {"^a+$", "aaa", true, 0, 3},
+        {"^a+$", "aab", false, 0, 0},
+    };
+
+    for (const Case &c : cases) {
+        Regex *re = regex_compile(c.pattern);
+        ASSERT_NE(re, nullptr);
+        size_t start = 99, end = 99;
+        EXPECT_EQ(regex_find(re, c.input, strlen(c.input), &start, &end), c.found)
+            << "pattern " << c.pattern << " input " << c.input;
+        if (c.found) {
+            EXPECT_EQ(start, c.start) << "pattern " << c.pattern << " input " << c.input;
+            EXPECT_EQ(end, c.end) << "pattern " << c.pattern << " input " << c.input;
+        }
+        regex_free(re);
+    }
+}
+
+TEST(RegexFind, AnchorsAgreeWithMatch) {
+    struct Case {
+        const char *pattern;
+        const char *input;
+        bool found;
+    };
+    const Case cases[] = {
+        {"^abc", "abcd", true},
+        {"^abc", "xabc", false},
+        {"abc$", "xabc", true},
+        {"abc$", "abcd", false},
+        {"^abc$", "abc", true},
+        {"^abc$", "abcd", false},
+        {"abc\\$", "abc$x", true},
+        // The anchors hold for the whole pattern, not just its outer branches
+        {"^a|b$", "b", true},
+        {"^a|b$", "ax", false},
+        {"^a|b$", "xb", false},
+    };
+
+    for (const Case &c : cases) {
+        Regex *re = regex_compile(c.pattern);
+        ASSERT_NE(re, nullptr);
+        EXPECT_EQ(regex_match(re, c.input), c.found) << "pattern " << c.pattern << " input " << c.input;
+        EXPECT_EQ(regex_find(re, c.input, strlen(c.input), nullptr, nullptr), c.found)
+            << "pattern " << c.pattern << " input " << c.input;
+        regex_free(re);
+    }
+}
+
+TEST(RegexFind, SearchesOnlyTheGivenLength) {
+    Regex *re = regex_compile("b+$");
+    ASSERT_NE(re, nullptr);
+
+    const char buf[] = {'a', 'b', 'b', 'b', 'c'};  // Not NUL-terminated
+    size_t start, end;
+    ASSERT_TRUE(regex_find(re, buf, 3, &start, &end));
+    EXPECT_EQ(start, 1u);
+    EXPECT_EQ(end, 3u);
+    EXPECT_FALSE(regex_find(re, buf, sizeof(buf), &start, &end));
+
+    regex_free(re);
+}
+
+TEST(RegexFind, IteratesOverAllMatches) {
+    Regex *re = regex_compile("\\d+");
+    ASSERT_NE(re, nullptr);
+    typedef std::vector<std::pair<size_t, size_t>> Spans;
+    EXPECT_EQ(find_all_spans(re, "a1 22 333"), Spans({{1, 2}, {3, 5}, {6, 9}}));
+    EXPECT_EQ(find_all_spans(re, "none"), Spans());
+    regex_free(re);
+
+    // Empty matches advance by one byte
+    re = regex_compile("a*");
+    ASSERT_NE(re, nullptr);
+    EXPECT_EQ(find_all_spans(re, "baaa"), Spans({{0, 0}, {1, 4}, {4, 4}}));
+    regex_free(re);
+
+    // An anchored pattern can only match once
+    re = regex_compile("^ab");
+    ASSERT_NE(re, nullptr);
+    EXPECT_EQ(find_all_spans(re, "abab"), Spans({{0, 2}}));
+    regex_free(re);
+}
+
+TEST(RegexFind, BoundsWhereMatchesBegin) {
+    const char *patterns[] = {"ab+", "b*", "x?y", "(a|ab)(c|bcd)", "[^a]+a", "bc$"};
+    const char *input = "xabbcabcdyabc";
+    size_t len = strlen(input);
+
+    for (const char *pattern : patterns) {
+        Regex *re = regex_compile(pattern);
+        ASSERT_NE(re, nullptr);
+        RegexScratch *scratch = regex_scratch_new(re);
+        for (size_t from = 0; from <= len; from++) {
+            for (size_t max_start = from; max_start <= len; max_start++) {
+                // A bounded search finds the unbounded match if it begins in time
+                size_t expected_start = 0, expected_end = 0;
+                bool expected = program_find(re->search_prog, scratch->search, input, len, from,
+                                             re->anchored_start, re->anchored_end, &expected_start, &expected_end);
+                expected = expected && expected_start <= max_start;
+                size_t start = 0, end = 0;
+                EXPECT_EQ(regex_find_bounded(re, input, len, from, max_start, &start, &end), expected)
+                    << pattern << " from " << from << " max_start " << max_start;
+                if (expected) {
+                    EXPECT_EQ(start, expected_start) << pattern << " from " << from << " max_start " << max_start;
+                    EXPECT_EQ(end, expected_end) << pattern << " from " << from << " max_start " << max_start;
+                }
+            }
+        }
+        regex_scratch_free(scratch);
+        regex_free(re);
+    }
+}
+
+TEST(RegexFind, ExtractsCapturesWithinSpan) {
+    Regex *re = regex_compile("(?<key>\\w+)=(?<value>\\d+)");
+    ASSERT_NE(re, nullptr);
+
+    std::string record(1 << 20, ' ');
+    record.replace(700000, 9, "retry=503");
+    MatchResult result = regex_find_with_captures(re, record.data(), record.size());
+    ASSERT_TRUE(result.matched);
+    ASSERT_EQ(result.num_groups, 3);
+    EXPECT_EQ(result.groups[0].name, nullptr);
+    EXPECT_EQ(result.groups[0].start, 700000u);
+    EXPECT_EQ(result.groups[0].end, 700009u);
+    EXPECT_STREQ(result.groups[1].name, "key");
+    EXPECT_STREQ(result.groups[1].value, "retry");
+    EXPECT_STREQ(result.groups[2].name, "value");
+    EXPECT_STREQ(result.groups[2].value, "503");
+    free_match_result(&result);
+
+    result = regex_find_with_captures(re, "no pairs here", 13);
+    EXPECT_FALSE(result.matched);
+    EXPECT_EQ(result.num_groups, 0);
+
+    regex_free(re);
+}
+
+TEST(RegexFind, DfaAgreesWithPikeVm) {
+    const char *patterns[] = {"ab+", "^a+", "b*c$", "^a|b$", "x?y", "(a|ab)(c|bcd)(d*)", "[^a]+a"};
+    const char *inputs[] = {"", "a", "abbbc", "xyzabcd", "bbbc", "cab", "abcd", "xxyxy", "yyyaa"};
+
+    for (const char *pattern : patterns) {
+        Regex *re = regex_compile(pattern);
+        ASSERT_NE(re, nullptr);
+        RegexScratch *scratch = regex_scratch_new(re);
+        ASSERT_NE(scratch->search_dfa, nullptr);
+        ASSERT_NE(scratch->reverse_dfa, nullptr);
+        for (const char *input : inputs) {
+            size_t len = strlen(input);
+            for (size_t from = 0; from <= len; from++) {
+                if (re->anchored_start && from > 0) {
+                    break;
+                }
+                size_t start = 0, end = 0, expected_start = 0, expected_end = 0;
+                bool expected = program_find(re->search_prog, scratch->search, input, len, from,
+                                             re->anchored_start, re->anchored_end, &expected_start, &expected_end);
+                RegexFindIter iter = regex_find_all(re, input, len);
+                iter.pos = from;
+                EXPECT_EQ(regex_find_next(&iter, &start, &end), expected)
+                    << "pattern " << pattern << " input " << input << " from " << from;
+                if (expected) {
+                    EXPECT_EQ(start, expected_start) << "pattern " << pattern << " input " << input;
+                    EXPECT_EQ(end, expected_end) << "pattern " << pattern << " input " << input;
+                }
+            }
+        }
+        regex_scratch_free(scratch);
+        regex_free(re);
+    }
+}
+
+TEST(RegexScratch, AgreesWithOwnScratch) {
+    const char *patterns[] = {"ERROR: \\d+", "^GET /api/\\w+", "(?<k>\\w+)=(?<v>\\d+)", "b*c$", "a[bc]*d"};
+    const char *inputs[] = {"", "ERROR: 42", "GET /api/users", "x key=12 y", "abbbc", "zzabd", "noise"};
+
+    for (const char *pattern : patterns) {
+        Regex *re = regex_compile(pattern);
+        ASSERT_NE(re, nullptr);
+        RegexScratch *scratch = regex_scratch_new(re);
+        ASSERT_NE(scratch, nullptr);
+        for (const char *input : inputs) {
+            size_t len = strlen(input);
+            EXPECT_EQ(regex_match_with_scratch(re, scratch, input), regex_match(re, input))
+                << pattern << " on " << input;
+
+            size_t start = 0, end = 0, expected_start = 0, expected_end = 0;
+            bool expected = regex_find(re, input, len, &expected_start, &expected_end);
+            ASSERT_EQ(regex_find_with_scratch(re, scratch, input, len, &start, &end), expected)
+                << pattern << " on " << input;
+            if (!expected) {
+                continue;
+            }
+            EXPECT_EQ(start, expected_start);
+            EXPECT_EQ(end, expected_end);
+
+            MatchResult result = regex_find_with_captures(re, input, len);
+            ASSERT_EQ((size_t)result.num_groups, regex_num_captures(re));
+            RegexSpan spans[4];
+            ASSERT_TRUE(regex_find_spans_with_scratch(re, scratch, input, len, spans, 4));
+            for (size_t g = 0; g < 4; g++) {
+                if (g < regex_num_captures(re)) {
+                    EXPECT_EQ(spans[g].start, result.groups[g].start) << pattern << " group " << g;
+                    EXPECT_EQ(spans[g].end, result.groups[g].end) << pattern << " group " << g;
+                } else {
+                    EXPECT_EQ(spans[g].start, REGEX_UNSET);
+                    EXPECT_EQ(spans[g].end, REGEX_UNSET);
+                }
+            }
+            free_match_result(&result);
+        }
+        regex_scratch_free(scratch);
+        regex_free(re);
+    }
+}
+
+TEST(RegexScratch, ReportsGroupsThatTookNoPart) {
+    Regex *re = regex_compile("(?<sign>-)?(?<digits>\\d+)");
+    ASSERT_NE(re, nullptr);
+    RegexScratch *scratch = regex_scratch_new(re);
+    RegexSpan spans[3];
+    ASSERT_TRUE(regex_find_spans_with_scratch(re, scratch, "n=42", 4, spans, 3));
+    EXPECT_EQ(spans[0].start, 2u);
+    EXPECT_EQ(spans[0].end, 4u);
+    EXPECT_EQ(spans[1].start, REGEX_UNSET);
+    EXPECT_EQ(spans[1].end, REGEX_UNSET);
+    EXPECT_EQ(spans[2].start, 2u);
+    EXPECT_FALSE(regex_find_spans_with_scratch(re, scratch, "none", 4, spans, 3));
+    regex_scratch_free(scratch);
+    regex_free(re);
+}
+
+TEST(RegexScratch, BelongsToOneRegex) {
+    Regex *re = regex_compile("abc");
+    Regex *other = regex_compile("abc");
+    ASSERT_NE(re, nullptr);
+    ASSERT_NE(other, nullptr);
+    RegexScratch *scratch = regex_scratch_new(other);
+    EXPECT_FALSE(regex_match_with_scratch(re, scratch, "abc"));
+    EXPECT_TRUE(regex_match_with_scratch(other, scratch, "abc"));
+    EXPECT_EQ(regex_scratch_new(nullptr), nullptr);
+    regex_scratch_free(scratch);
+    regex_free(other);
+    regex_free(re);
+}
+
+TEST(RegexScratch, PoolReusesReleasedScratch) {
+    Regex *re = regex_compile("a+b");
+    ASSERT_NE(re, nullptr);
+    RegexScratch *first = regex_scratch_acquire(re);
+    RegexScratch *second = regex_scratch_acquire(re);
+    ASSERT_NE(first, nullptr);
+    EXPECT_NE(first, second);
+    EXPECT_TRUE(regex_match_with_scratch(re, first, "xaab"));
+    regex_scratch_release(second);
+    regex_scratch_release(first);
+
+    // Both went back to the pool, so neither is created again
+    RegexScratch *again = regex_scratch_acquire(re);
+    EXPECT_TRUE(again == first || again == second);
+    regex_scratch_release(again);
+
+    // More scratches than the pool holds are freed on release
+    std::vector<RegexScratch*> many;
+    for (int i = 0; i < 100; i++) {
+        many.push_back(regex_scratch_acquire(re));
+    }
+    for (RegexScratch *scratch : many) {
+        regex_scratch_release(scratch);
+    }
+    EXPECT_TRUE(regex_match(re, "aaab"));
+    regex_free(re);
+}
+
+TEST(RegexScratch, PassesSlotsOfExitedThreadsOn) {
+    // Far more short-lived threads than the pool has slots, one after another:
+    // each takes over the last one's slot and the scratch kept there
+    Regex *re = regex_compile("a+b");
+    ASSERT_NE(re, nullptr);
+    std::vector<RegexScratch*> used;
+    for (int i = 0; i < 4 * REGEX_POOL_SLOTS; i++) {
+        std::thread([&] {
+            RegexScratch *scratch = regex_scratch_acquire(re);
+            EXPECT_TRUE(regex_match_with_scratch(re, scratch, "xaab"));
+            used.push_back(scratch);
+            regex_scratch_release(scratch);
+        }).join();
+    }
+    std::sort(used.begin(), used.end());
+    EXPECT_EQ(std::unique(used.begin(), used.end()) - used.begin(), 1);
+
+    // Waves of threads at once keep matching once every slot has seen a thread exit
+    for (int wave = 0; wave < 8; wave++) {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 16; t++) {
+            threads.emplace_back([&] {
+                for (int k = 0; k < 10; k++) {
+                    EXPECT_TRUE(regex_match(re, "xaab"));
+                }
+            });
+        }
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+    }
+    regex_free(re);
+}
+
+TEST(RegexScratch, SharesOneRegexAcrossThreads) {
+    Regex *re = regex_compile("(?<key>\\w+)=(?<value>\\d+)");
+    ASSERT_NE(re, nullptr);
+    std::vector<std::string> inputs;
+    for (int i = 0; i < 200; i++) {
+        inputs.push_back(std::string(i % 17, ' ') + (i % 3 ? "k" + std::to_string(i) + "=" + std::to_string(i * 7)
+                                                           : "none here"));
+    }
+    std::vector<std::pair<size_t, size_t>> expected;
+    for (const std::string &input : inputs) {
+        size_t start = 0, end = 0;
+        regex_find(re, input.data(), input.size(), &start, &end);
+        expected.emplace_back(start, end);
+    }
+
+    // Every thread mixes pooled calls with a scratch of its own
+    std::vector<int> mismatches(8, 0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; t++) {
+        threads.emplace_back([&, t] {
+            RegexScratch *scratch = regex_scratch_new(re);
+            for (int round = 0; round < 50; round++) {
+                for (size_t i = 0; i < inputs.size(); i++) {
+                    const std::string &input = inputs[i];
+                    bool matched = i % 3 != 0;
+                    size_t start = 0, end = 0;
+                    bool found = (round + t) % 2 ? regex_find(re, input.data(), input.size(), &start, &end)
+                                                 : regex_find_with_scratch(re, scratch, input.data(), input.size(),
+                                                                           &start, &end);
+                    if (found != matched || (found && std::make_pair(start, end) != expected[i]) ||
+                        regex_match(re, input.c_str()) != matched) {
+                        mismatches[t]++;
+                    }
+                }
+            }
+            regex_scratch_free(scratch);
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(mismatches, std::vector<int>(8, 0));
+    regex_free(re);
+}
+
+TEST(RegexScratch, WarmsDfaCachesOnce) {
+    Regex *re = regex_compile("(?<key>\\w+)=(?<value>\\d+)");
+    ASSERT_NE(re, nullptr);
+    const char *inputs[] = {"retry=3", "a b=12 c", "nothing", "x_1=0042", "=7", "k="};
+
+    RegexScratch *first = regex_scratch_new(re);
+    for (const char *input : inputs) {
+        regex_match_with_scratch(re, first, input);
+        regex_find_with_scratch(re, first, input, strlen(input), nullptr, nullptr);
+    }
+    LazyDfaStats warm = lazy_dfa_stats(first->dfa);
+    LazyDfaStats warm_search = lazy_dfa_stats(first->search_dfa);
+    EXPECT_GT(warm.states_built, 1u);
+
+    // A second scratch finds every state the first built
+    RegexScratch *second = regex_scratch_new(re);
+    for (const char *input : inputs) {
+        regex_match_with_scratch(re, second, input);
+        regex_find_with_scratch(re, second, input, strlen(input), nullptr, nullptr);
+    }
+    EXPECT_EQ(lazy_dfa_stats(second->dfa).states_built, warm.states_built);
+    EXPECT_EQ(lazy_dfa_stats(second->dfa).cache_bytes, warm.cache_bytes);
+    EXPECT_EQ(lazy_dfa_stats(second->search_dfa).states_built, warm_search.states_built);
+
+    regex_scratch_free(first);
+    regex_scratch_free(second);
+    regex_free(re);
+}
+
+TEST(Regex, ReportsCompiledMetadata) {
+    Regex *re = regex_compile("ERROR (?<code>\\d+)");
+    ASSERT_NE(re, nullptr);
+    EXPECT_STREQ(regex_pattern(re), "ERROR (?<code>\\d+)");
+    EXPECT_GT(regex_num_states(re), 0u);
+    EXPECT_EQ(regex_num_captures(re), 2u);
+    const LiteralPrefix *prefix = regex_literal_prefix(re);
+    EXPECT_EQ(std::string(prefix->bytes, prefix->len), "ERROR ");
+    regex_free(re);
+
+    EXPECT_EQ(regex_pattern(nullptr), nullptr);
+    EXPECT_EQ(regex_num_captures(nullptr), 0u);
+}
+
+TEST(Regex, MatchesSlicesOfBinaryBuffers) {
+    Regex *re = regex_compile("ERROR: (?<code>\\d+)");
+    ASSERT_NE(re, nullptr);
+
+    std::string packet("\x01\x00hdr\x00" "ERROR: 503\x00trailer ERROR: 7", 33);
+    const uint8_t *data = (const uint8_t*)packet.data();
+    EXPECT_TRUE(regex_match_bytes(re, data, packet.size()));
+    EXPECT_FALSE(regex_match(re, packet.c_str()));
+    // Only the header, which has no error
+    EXPECT_FALSE(regex_match_bytes(re, data, 6));
+
+    MatchResult result = regex_match_with_captures_bytes(re, data + 6, 10);
+    ASSERT_TRUE(result.matched);
+    ASSERT_EQ(result.num_groups, 1);
+    EXPECT_STREQ(result.groups[0].value, "503");
+    free_match_result(&result);
+
+    regex_free(re);
+}
+
+TEST(RegexSet, MatchesBinaryInputByLength) {
+    const char *patterns[] = {"GET", "\\d\\d\\d"};
+    RegexSet *set = regex_set_compile(patterns, 2);
+    ASSERT_NE(set, nullptr);
+
+    std::string payload("\x00GET\x00" "404", 8);
+    uint64_t bits[PATTERN_SET_WORDS(2)];
+    EXPECT_TRUE(regex_set_match_bytes(set, (const uint8_t*)payload.data(), payload.size(), bits));
+    EXPECT_EQ(bits[0], 3u);
+    EXPECT_TRUE(regex_set_match_nfa_bytes(set, (const uint8_t*)payload.data(), 4, bits));
+    EXPECT_EQ(bits[0], 1u);
+
+    regex_set_free(set);
+}
+
+static void record_end(uint64_t end, void *user_data) {
+    static_cast<std::vector<uint64_t>*>(user_data)->push_back(end);
+}
+
+// Every offset at which some match of the pattern ends
+static std::vector<uint64_t> expected_ends(Regex *re, const std::string &text) {
+    std::vector<uint64_t> ends;
+    RegexScratch *scratch = regex_scratch_new(re);
+    for (size_t end = 0; end <= text.size(); end++) {
+        if (re->anchored_end && end != text.size()) {
+            continue;
+        }
+        if (program_find(re->search_prog, scratch->search, text.data(), end, 0, re->anchored_start, true,
+                         nullptr, nullptr)) {
+            ends.push_back(end);
+        }
+    }
+    regex_scratch_free(scratch);
+    return ends;
+}
+
+TEST(RegexStream, ReportsSameEndsForAnyChunking) {
+    const char *patterns[] = {"ab+", "^ab", "b+c$", "a|bc", "x*", "[^a]a"};
+    const std::string text = "aabbbcabcxbab";
+
+    for (const char *pattern : patterns) {
+        Regex *re = regex_compile(pattern);
+        ASSERT_NE(re, nullptr);
+        std::vector<uint64_t> expected = expected_ends(re, text);
+
+        for (size_t chunk : {1, 2, 3, 5, 64}) {
+            std::vector<uint64_t> ends;
+            RegexStream *stream = regex_stream_open(re, record_end, &ends);
+            ASSERT_NE(stream, nullptr);
+            for (size_t pos = 0; pos < text.size(); pos += chunk) {
+                size_t len = std::min(chunk, text.size() - pos);
+                regex_stream_feed(stream, (const uint8_t*)text.data() + pos, len);
+            }
+            regex_stream_close(stream);
+            EXPECT_EQ(ends, expected) << "pattern " << pattern << " chunk " << chunk;
+        }
+        regex_free(re);
+    }
+}
+
+TEST(RegexStream, InterleavesStreamsOfOneRegex) {
+    Regex *re = regex_compile("a[ab]*c");
+    ASSERT_NE(re, nullptr);
+
+    std::vector<uint64_t> ends_a, ends_b;
+    RegexStream *a = regex_stream_open(re, record_end, &ends_a);
+    RegexStream *b = regex_stream_open(re, record_end, &ends_b);
+    ASSERT_NE(a, nullptr);
+    ASSERT_NE(b, nullptr);
+
+    // Interleave two streams; each must resume where it left off
+    EXPECT_TRUE(regex_stream_feed(a, (const uint8_t*)"xxab", 4));
+    EXPECT_TRUE(regex_stream_feed(b, (const uint8_t*)"c", 1));
+    EXPECT_TRUE(regex_stream_feed(a, (const uint8_t*)"bac", 3));
+    EXPECT_TRUE(regex_stream_feed(b, (const uint8_t*)"ac", 2));
+    regex_stream_close(a);
+    regex_stream_close(b);
+
+    EXPECT_EQ(ends_a, std::vector<uint64_t>({7}));
+    EXPECT_EQ(ends_b, std::vector<uint64_t>({3}));
+
+    regex_free(re);
+}
+
+TEST(RegexStream, StopsOnceNoMatchIsPossible) {
+    Regex *re = regex_compile("^GET ");
+    ASSERT_NE(re, nullptr);
+
+    std::vector<uint64_t> ends;
+    RegexStream *stream = regex_stream_open(re, record_end, &ends);
+    EXPECT_TRUE(regex_stream_feed(stream, (const uint8_t*)"GE", 2));
+    EXPECT_FALSE(regex_stream_feed(stream, (const uint8_t*)"T /", 3));
+    EXPECT_FALSE(regex_stream_feed(stream, (const uint8_t*)"GET ", 4));
+    regex_stream_close(stream);
+    EXPECT_EQ(ends, std::vector<uint64_t>({4}));
+
+    regex_free(re);
+}
+
+TEST(RegexStream, ParksFlowsInCallerMemory) {
+    Regex *re = regex_compile("user=\\w+;");
+    ASSERT_NE(re, nullptr);
+    size_t state_size = regex_stream_state_size(re);
+    ASSERT_GT(state_size, 0u);
+    EXPECT_LE(state_size, 64u);
+
+    // Each flow's text, arriving a few bytes at a time
+    const int num_flows = 100;
+    std::vector<std::string> texts;
+    for (int f = 0; f < num_flows; f++) {
+        texts.push_back("GET /x HTTP/1.1 user=u" + std::to_string(f) + "; user=" + std::string(f % 7, 'z') + ";");
+    }
+
+    std::vector<uint64_t> ends;
+    RegexStream *stream = regex_stream_open(re, record_end, &ends);
+    ASSERT_NE(stream, nullptr);
+    std::vector<uint64_t> table(num_flows * ((state_size + 7) / 8));
+    auto slot = [&](int f) { return &table[f * ((state_size + 7) / 8)]; };
+    for (int f = 0; f < num_flows; f++) {
+        regex_stream_reset(stream);
+        regex_stream_save(stream, slot(f));
+    }
+
+    std::vector<std::vector<uint64_t>> flow_ends(num_flows);
+    for (size_t pos = 0; pos < 64; pos += 3) {
+        for (int f = 0; f < num_flows; f++) {
+            if (pos >= texts[f].size()) {
+                continue;
+            }
+            size_t len = std::min<size_t>(3, texts[f].size() - pos);
+            ends.clear();
+            regex_stream_restore(stream, slot(f));
+            regex_stream_feed(stream, (const uint8_t*)texts[f].data() + pos, len);
+            regex_stream_save(stream, slot(f));
+            flow_ends[f].insert(flow_ends[f].end(), ends.begin(), ends.end());
+        }
+    }
+    regex_stream_close(stream);
+
+    for (int f = 0; f < num_flows; f++) {
+        EXPECT_EQ(flow_ends[f], expected_ends(re, texts[f])) << "flow " << f;
+    }
+    regex_free(re);
+}
+
+TEST(RegexStream, ResumesFlowOnAnotherStream) {
+    Regex *re = regex_compile("ab+c");
+    ASSERT_NE(re, nullptr);
+    const std::string text = "xxabbbbcyyabbc";
+    std::vector<uint64_t> first_ends;
+    std::vector<uint64_t> second_ends;
+    // Open at once, so each holds a scratch and a DFA of its own
+    RegexStream *first = regex_stream_open(re, record_end, &first_ends);
+    RegexStream *second = regex_stream_open(re, record_end, &second_ends);
+    ASSERT_NE(first, nullptr);
+    ASSERT_NE(second, nullptr);
+    ASSERT_NE(first->scratch, second->scratch);
+
+    std::vector<uint64_t> state((regex_stream_state_size(re) + 7) / 8);
+    regex_stream_feed(first, (const uint8_t*)text.data(), 5);
+    regex_stream_save(first, state.data());
+    regex_stream_restore(second, state.data());
+    regex_stream_feed(second, (const uint8_t*)text.data() + 5, text.size() - 5);
+
+    first_ends.insert(first_ends.end(), second_ends.begin(), second_ends.end());
+    EXPECT_EQ(first_ends, expected_ends(re, text));
+    regex_stream_close(second);
+    regex_stream_close(first);
+    regex_free(re);
+}
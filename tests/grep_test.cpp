@@ -0,0 +1,65 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <string>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Runs the regexp-grep the build made over path and returns what it printed,
+// with its exit status in *status
+static std::string run_grep(const std::string &args, const std::string &path, int *status) {
+    std::string command = std::string(REGEXP_GREP) + " " + args + " " + path;
+    FILE *pipe = popen(command.c_str(), "r");
+    EXPECT_NE(pipe, nullptr);
+    std::string output;
+    char buf[4096];
+    size_t got;
+    while ((got = fread(buf, 1, sizeof(buf), pipe)) > 0) {
+        output.append(buf, got);
+    }
+    int result = pclose(pipe);
+    *status = WIFEXITED(result) ? WEXITSTATUS(result) : -1;
+    return output;
+}
+
+TEST(RegexpGrep, MatchesLineByLine) {
+    char path[] = "/tmp/grep_testXXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    std::string text = "ERROR one\nok line\nERROR two\nfoo bar\n";
+    ASSERT_EQ(write(fd, text.data(), text.size()), (ssize_t)text.size());
+    close(fd);
+
+    int status;
+    EXPECT_EQ(run_grep("'ERROR.*'", path, &status), "ERROR one\nERROR two\n");
+    EXPECT_EQ(status, 0);
+    EXPECT_EQ(run_grep("-n 'o.*b'", path, &status), "4:foo bar\n");
+    EXPECT_EQ(run_grep("-c 'o.*b'", path, &status), "1\n");
+    EXPECT_EQ(run_grep("-c 'ERROR'", path, &status), "2\n");
+    EXPECT_EQ(run_grep("-o 'ERROR.*'", path, &status), "ERROR one\nERROR two\n");
+    EXPECT_EQ(run_grep("-o '[^ ]+'", path, &status), "ERROR\none\nok\nline\nERROR\ntwo\nfoo\nbar\n");
+
+    EXPECT_EQ(run_grep("-c 'one.*two'", path, &status), "0\n");
+    EXPECT_EQ(status, 1);
+
+    remove(path);
+}
+
+TEST(RegexpGrep, ReportsMatchesInBinaryFiles) {
+    char path[] = "/tmp/grep_testXXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    std::string text("ERROR one\n\0\nERROR two\n", 22);
+    ASSERT_EQ(write(fd, text.data(), text.size()), (ssize_t)text.size());
+    close(fd);
+
+    int status;
+    EXPECT_EQ(run_grep("ERROR", path, &status), "Binary file " + std::string(path) + " matches\n");
+    EXPECT_EQ(status, 0);
+    EXPECT_EQ(run_grep("-c ERROR", path, &status), "2\n");
+    EXPECT_EQ(run_grep("-l ERROR", path, &status), std::string(path) + "\n");
+    EXPECT_EQ(run_grep("WARN", path, &status), "");
+    EXPECT_EQ(status, 1);
+
+    remove(path);
+}
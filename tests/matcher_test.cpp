@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 #include <fstream>
+#include <string>
 
 extern "C" {
     #include <regexp.h>
@@ -417,8 +418,8 @@ TEST(Matcher, CapturesSimpleNamedGroup) {
     if (result.num_groups > 0) {
         EXPECT_STREQ(result.groups[0].name, "word");
         EXPECT_STREQ(result.groups[0].value, "hello");
-        EXPECT_EQ(result.groups[0].start, 0);
-        EXPECT_EQ(result.groups[0].end, 5);
+        EXPECT_EQ(result.groups[0].start, 0u);
+        EXPECT_EQ(result.groups[0].end, 5u);
     }
     
     free_match_result(&result);
@@ -460,3 +461,244 @@ TEST(Matcher, CapturesMultipleNamedGroups) {
 }
 
 
+
+TEST(Matcher, CapturesFollowThreadThatMatched) {
+    // Both branches open a group on "a"; only the branch that matches may report it
+    AstNode* tree = parse("^(?<x>ab)c|(?<y>a)bd$");
+    ASSERT_NE(tree, nullptr);
+    NfaFragment nfa = compile_ast(tree);
+
+    MatchResult result = match_with_captures(nfa, "abd");
+    EXPECT_TRUE(result.matched);
+    ASSERT_EQ(result.num_groups, 1);
+    EXPECT_STREQ(result.groups[0].name, "y");
+    EXPECT_STREQ(result.groups[0].value, "a");
+
+    free_match_result(&result);
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
+
+TEST(Matcher, CapturesAreGreedyByDefault) {
+    AstNode* tree = parse("^(?<first>a*)(?<second>a*)$");
+    ASSERT_NE(tree, nullptr);
+    NfaFragment nfa = compile_ast(tree);
+
+    MatchResult result = match_with_captures(nfa, "aaa");
+    EXPECT_TRUE(result.matched);
+    ASSERT_EQ(result.num_groups, 2);
+    EXPECT_STREQ(result.groups[0].value, "aaa");
+    EXPECT_STREQ(result.groups[1].value, "");
+    EXPECT_EQ(result.groups[1].start, 3u);
+
+    free_match_result(&result);
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
+
+TEST(Matcher, CapturesWithLazyQuantifier) {
+    AstNode* tree = parse("^(?<first>a+?)(?<second>a*)$");
+    ASSERT_NE(tree, nullptr);
+    NfaFragment nfa = compile_ast(tree);
+
+    MatchResult result = match_with_captures(nfa, "aaa");
+    EXPECT_TRUE(result.matched);
+    ASSERT_EQ(result.num_groups, 2);
+    EXPECT_STREQ(result.groups[0].value, "a");
+    EXPECT_STREQ(result.groups[1].value, "aa");
+
+    free_match_result(&result);
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
+
+TEST(Matcher, CapturesLeftmostInUnanchoredPattern) {
+    AstNode* tree = parse("(?<word>\\w+)");
+    ASSERT_NE(tree, nullptr);
+    NfaFragment nfa = compile_ast(tree);
+
+    MatchResult result = match_with_captures(nfa, "  hello world");
+    EXPECT_TRUE(result.matched);
+    ASSERT_EQ(result.num_groups, 1);
+    EXPECT_STREQ(result.groups[0].value, "hello");
+    EXPECT_EQ(result.groups[0].start, 2u);
+    EXPECT_EQ(result.groups[0].end, 7u);
+
+    free_match_result(&result);
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
+
+TEST(Matcher, CapturesLastIterationOfRepeatedGroup) {
+    AstNode* tree = parse("^(?<letter>[a-z])+$");
+    ASSERT_NE(tree, nullptr);
+    NfaFragment nfa = compile_ast(tree);
+
+    MatchResult result = match_with_captures(nfa, "abc");
+    EXPECT_TRUE(result.matched);
+    ASSERT_EQ(result.num_groups, 1);
+    EXPECT_STREQ(result.groups[0].value, "c");
+    EXPECT_EQ(result.groups[0].start, 2u);
+
+    free_match_result(&result);
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
+
+TEST(Matcher, StateSetAddsTestsAndClears) {
+    NfaStateSet set;
+    init_set(&set, 64);
+
+    add_state(&set, 42);
+    add_state(&set, 7);
+    add_state(&set, 42);
+    EXPECT_EQ(set.count, 2u);
+    EXPECT_EQ(set.states[0], 42u);
+    EXPECT_EQ(set.states[1], 7u);
+    EXPECT_TRUE(contains_state(&set, 7));
+    EXPECT_FALSE(contains_state(&set, 8));
+
+    clear_set(&set);
+    EXPECT_EQ(set.count, 0u);
+    EXPECT_FALSE(contains_state(&set, 42));
+    add_state(&set, 7);
+    EXPECT_TRUE(contains_state(&set, 7));
+    EXPECT_FALSE(contains_state(&set, 42));
+
+    free_set(&set);
+}
+
+TEST(Matcher, ReusesScratchAcrossMatches) {
+    AstNode* tree = parse("^(?<key>\\w+)=(?<value>\\d+)$");
+    ASSERT_NE(tree, nullptr);
+    NfaFragment nfa = compile_ast(tree);
+    Program *prog = compile_program(nfa);
+    MatchScratch *scratch = match_scratch_new(prog);
+    ASSERT_NE(scratch, nullptr);
+
+    for (int round = 0; round < 3; round++) {
+        EXPECT_TRUE(program_match_with_scratch(prog, scratch, "retries=3"));
+        EXPECT_FALSE(program_match_with_scratch(prog, scratch, "retries=three"));
+
+        MatchResult result = program_match_with_captures_scratch(prog, scratch, "port=8080");
+        EXPECT_TRUE(result.matched);
+        ASSERT_EQ(result.num_groups, 2);
+        EXPECT_STREQ(result.groups[0].value, "port");
+        EXPECT_STREQ(result.groups[1].value, "8080");
+        free_match_result(&result);
+    }
+
+    match_scratch_free(scratch);
+    free_program(prog);
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
+
+TEST(Matcher, MatchExReusesCallerMatcher) {
+    AstNode* tree = parse("^(?<key>\\w+)=(?<value>\\d+)$");
+    ASSERT_NE(tree, nullptr);
+    NfaFragment nfa = compile_ast(tree);
+    NfaMatcher *matcher = nfa_matcher_new(nfa);
+    ASSERT_NE(matcher, nullptr);
+
+    for (int round = 0; round < 3; round++) {
+        EXPECT_TRUE(match_ex(matcher, "retries=3"));
+        EXPECT_FALSE(match_ex(matcher, "retries=three"));
+        MatchResult result = match_with_captures_ex(matcher, "port=8080");
+        EXPECT_TRUE(result.matched);
+        ASSERT_EQ(result.num_groups, 2);
+        EXPECT_STREQ(result.groups[1].value, "8080");
+        free_match_result(&result);
+    }
+    // Plain match() leaves the NFA as it found it
+    EXPECT_TRUE(match(nfa, "retries=3"));
+    EXPECT_TRUE(match_ex_bytes(matcher, (const uint8_t*)"a=1b", 3));
+
+    nfa_matcher_free(matcher);
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
+
+TEST(Matcher, HandlesManyActiveStatesOnLongInput) {
+    // Every position keeps the wildcard loop and all alternation branches alive
+    AstNode* tree = parse("a|b|c|d|e|f|g|h|i|j|k|l|m|n|o|p|q|r|s|t|u|v|w|x|y|z");
+    ASSERT_NE(tree, nullptr);
+    NfaFragment nfa = compile_ast(tree);
+    Program *prog = compile_program(nfa);
+
+    std::string line(100000, '-');
+    EXPECT_FALSE(program_match(prog, line.c_str()));
+    line[50000] = 'q';
+    EXPECT_TRUE(program_match(prog, line.c_str()));
+
+    free_program(prog);
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
+
+TEST(Matcher, PrecomputedClosuresAgreeWithDfs) {
+    const char *patterns[] = {"^a(b|c)*d+$", "(?<x>a+)(b|c?)*x", "^\\w+@\\w+\\.\\w+$", "a*b*c*"};
+    const char *inputs[] = {"", "ad", "abcbcddd", "aaxbx", "user@example.com", "abcabc", "cab", "x@y"};
+
+    for (const char *pattern : patterns) {
+        AstNode* tree = parse(pattern);
+        ASSERT_NE(tree, nullptr);
+        NfaFragment nfa = compile_ast(tree);
+
+        Program *dfs = compile_program(nfa);
+        ProgramOptions options = program_default_options();
+        options.precompute_closures = true;
+        Program *closures = compile_program_with_options(nfa, &options);
+        ASSERT_NE(closures->closure_start, nullptr);
+
+        for (const char *input : inputs) {
+            EXPECT_EQ(program_match(closures, input), program_match(dfs, input))
+                << "pattern " << pattern << " input " << input;
+        }
+
+        free_program(closures);
+        free_program(dfs);
+        free_nfa(nfa.start);
+        free_ast(tree);
+    }
+}
+
+TEST(Matcher, MatchesBinaryInputByLength) {
+    AstNode* tree = parse("^a.b(?<tail>[^x]*)$");
+    ASSERT_NE(tree, nullptr);
+    NfaFragment nfa = compile_ast(tree);
+
+    // NULs are ordinary bytes, and only len bytes are read
+    const uint8_t payload[] = {'a', 0, 'b', 0, 'c', 'x', 'x'};
+    EXPECT_TRUE(match_bytes(nfa, payload, 5));
+    EXPECT_FALSE(match_bytes(nfa, payload, sizeof(payload)));
+    EXPECT_FALSE(match(nfa, (const char*)payload));
+
+    MatchResult result = match_with_captures_bytes(nfa, payload, 5);
+    ASSERT_TRUE(result.matched);
+    ASSERT_EQ(result.num_groups, 1);
+    EXPECT_EQ(result.groups[0].start, 3u);
+    EXPECT_EQ(result.groups[0].end, 5u);
+    free_match_result(&result);
+
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
+
+TEST(Matcher, MatchesSubRangesInPlace) {
+    AstNode* tree = parse("^\\d+$");
+    ASSERT_NE(tree, nullptr);
+    NfaFragment nfa = compile_ast(tree);
+    Program *prog = compile_program(nfa);
+    MatchScratch *scratch = match_scratch_new(prog);
+
+    const char *buffer = "id=1234;name=x";
+    EXPECT_TRUE(program_match_with_scratch_bytes(prog, scratch, (const uint8_t*)buffer + 3, 4));
+    EXPECT_FALSE(program_match_with_scratch_bytes(prog, scratch, (const uint8_t*)buffer + 3, 5));
+    EXPECT_FALSE(program_match_bytes(prog, (const uint8_t*)buffer, 0));
+
+    match_scratch_free(scratch);
+    free_program(prog);
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
@@ -0,0 +1,195 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+extern "C" {
+    #include <regexp.h>
+    #include <engine_internal.h>
+}
+
+typedef std::vector<std::pair<size_t, size_t>> Spans;
+
+static void record_span(size_t start, size_t end, void *user_data) {
+    static_cast<Spans*>(user_data)->emplace_back(start, end);
+}
+
+static Spans sequential_spans(Regex *re, const std::string &text) {
+    Spans spans;
+    RegexFindIter iter = regex_find_all(re, text.data(), text.size());
+    size_t start, end;
+    while (regex_find_next(&iter, &start, &end)) {
+        spans.emplace_back(start, end);
+    }
+    return spans;
+}
+
+static Spans parallel_spans(Regex *re, const std::string &text, size_t num_threads, size_t chunk_size) {
+    RegexParallelOptions options = regex_parallel_default_options();
+    options.num_threads = num_threads;
+    options.chunk_size = chunk_size;
+    Spans spans;
+    size_t found = regex_find_all_parallel(re, text.data(), text.size(), &options, record_span, &spans);
+    EXPECT_EQ(found, spans.size());
+    return spans;
+}
+
+TEST(ParallelFind, MatchesSequentialScanForAnyChunking) {
+    // Patterns whose matches straddle chunk boundaries, are empty, or are long
+    // enough to swallow the matches a chunk found on its own
+    const char *patterns[] = {"ab+c", "a*", "\\d+", "x[^y]*y", "(?<w>\\w+)=\\d", "b|abc", "^ab", "c$", "y=.*",
+                              "a.*c|=", "xy=1"};
+    std::string text;
+    unsigned int seed = 7;
+    for (int i = 0; i < 3000; i++) {
+        seed = seed * 1103515245 + 12345;
+        text += "abcxy=1 "[(seed >> 16) % 8];
+    }
+
+    for (const char *pattern : patterns) {
+        Regex *re = regex_compile(pattern);
+        ASSERT_NE(re, nullptr);
+        Spans expected = sequential_spans(re, text);
+        for (size_t chunk_size : {1, 2, 3, 7, 64, 1000}) {
+            for (size_t num_threads : {2, 4}) {
+                EXPECT_EQ(parallel_spans(re, text, num_threads, chunk_size), expected)
+                    << pattern << " chunk_size " << chunk_size << " threads " << num_threads;
+            }
+        }
+        regex_free(re);
+    }
+}
+
+TEST(ParallelFind, StitchesMatchesAcrossChunks) {
+    // One match covers every chunk, so each later chunk's own matches are wrong
+    Regex *re = regex_compile("a+");
+    ASSERT_NE(re, nullptr);
+    std::string text = "b" + std::string(100, 'a') + "b" + std::string(5, 'a');
+    EXPECT_EQ(parallel_spans(re, text, 4, 8), Spans({{1, 101}, {102, 107}}));
+    regex_free(re);
+
+    re = regex_compile("START.*?END");
+    ASSERT_NE(re, nullptr);
+    text = std::string(50, '-') + "START" + std::string(200, 'x') + "END START END" + std::string(50, '-');
+    EXPECT_EQ(parallel_spans(re, text, 3, 16), sequential_spans(re, text));
+    regex_free(re);
+}
+
+TEST(ParallelFind, HandlesEmptyAndSmallInputs) {
+    Regex *re = regex_compile("x*");
+    ASSERT_NE(re, nullptr);
+    EXPECT_EQ(parallel_spans(re, "", 4, 4), Spans({{0, 0}}));
+    EXPECT_EQ(parallel_spans(re, "axx", 4, 0), Spans({{0, 0}, {1, 3}, {3, 3}}));
+    regex_free(re);
+
+    // Default options
+    re = regex_compile("\\d");
+    ASSERT_NE(re, nullptr);
+    EXPECT_EQ(regex_find_all_parallel(re, "a1b2", 4, NULL, NULL, NULL), 2u);
+    EXPECT_EQ(regex_find_all_parallel(NULL, "a1b2", 4, NULL, NULL, NULL), 0u);
+    regex_free(re);
+}
+
+TEST(ParallelFind, StopsSpeculativeSearchAtChunkEnd) {
+    Regex *re = regex_compile("x.*");
+    ASSERT_NE(re, nullptr);
+    RegexScratch *scratch = regex_scratch_new(re);
+    std::string text = "ab x cd x " + std::string(100, 'z');
+    size_t start, end;
+    bool at_limit = false;
+
+    // The match may go on past the chunk, so the worker leaves it to the stitcher
+    EXPECT_TRUE(regex_find_limited_with_scratch(re, scratch, text.data(), 6, 0, 5, &start, &end, &at_limit));
+    EXPECT_TRUE(at_limit);
+
+    // A search that ends inside the chunk does not depend on what follows
+    regex_free(re);
+    re = regex_compile("x c");
+    ASSERT_NE(re, nullptr);
+    regex_scratch_free(scratch);
+    scratch = regex_scratch_new(re);
+    EXPECT_TRUE(regex_find_limited_with_scratch(re, scratch, text.data(), 8, 0, 7, &start, &end, &at_limit));
+    EXPECT_FALSE(at_limit);
+    EXPECT_EQ(start, 3u);
+    EXPECT_EQ(end, 6u);
+
+    // A prefix that begins in the chunk but ends past it
+    EXPECT_FALSE(regex_find_limited_with_scratch(re, scratch, text.data(), 5, 0, 4, &start, &end, &at_limit));
+    EXPECT_TRUE(at_limit);
+
+    // The whole buffer still finds the match that runs to its end
+    regex_scratch_free(scratch);
+    regex_free(re);
+    re = regex_compile("x.*");
+    ASSERT_NE(re, nullptr);
+    EXPECT_EQ(parallel_spans(re, text, 4, 4), sequential_spans(re, text));
+    regex_free(re);
+}
+
+TEST(ParallelFind, ReusesPoolThreadsAcrossCalls) {
+    Regex *re = regex_compile("\\d+");
+    ASSERT_NE(re, nullptr);
+    std::string text;
+    for (int i = 0; i < 200; i++) {
+        text += "n" + std::to_string(i) + " ";
+    }
+    Spans expected = sequential_spans(re, text);
+    std::vector<const char*> inputs(256, "a1");
+
+    EXPECT_EQ(parallel_spans(re, text, 4, 64), expected);
+    size_t threads = regex_parallel_pool_threads();
+    EXPECT_GE(threads, 4u);
+    for (int call = 0; call < 100; call++) {
+        EXPECT_EQ(parallel_spans(re, text, 4, 64), expected);
+        RegexParallelOptions options = regex_parallel_default_options();
+        options.num_threads = 4;
+        std::unique_ptr<bool[]> out(new bool[inputs.size()]);
+        regex_match_batch_with_options(re, inputs.data(), NULL, inputs.size(), out.get(), &options);
+        EXPECT_TRUE(out[inputs.size() - 1]);
+    }
+    EXPECT_EQ(regex_parallel_pool_threads(), threads);
+    regex_free(re);
+}
+
+TEST(MatchBatch, AgreesWithSingleMatches) {
+    Regex *re = regex_compile("^[a-z0-9.]+@\\w+\\.com$");
+    ASSERT_NE(re, nullptr);
+
+    std::vector<std::string> fields;
+    for (int i = 0; i < 1000; i++) {
+        switch (i % 4) {
+            case 0: fields.push_back("user" + std::to_string(i) + "@example.com"); break;
+            case 1: fields.push_back("user" + std::to_string(i) + "@example.org"); break;
+            case 2: fields.push_back(std::to_string(i)); break;
+            default: fields.push_back(std::string("a.b@c.com\0junk", 14)); break;
+        }
+    }
+    std::vector<const char*> inputs;
+    std::vector<size_t> lens;
+    for (const std::string &field : fields) {
+        inputs.push_back(field.data());
+        lens.push_back(field.size());
+    }
+
+    for (size_t num_threads : {1, 2, 3, 8}) {
+        RegexParallelOptions options = regex_parallel_default_options();
+        options.num_threads = num_threads;
+        std::unique_ptr<bool[]> out(new bool[fields.size()]);
+        regex_match_batch_with_options(re, inputs.data(), lens.data(), fields.size(), out.get(), &options);
+        for (size_t i = 0; i < fields.size(); i++) {
+            EXPECT_EQ(out[i], regex_match_bytes(re, (const uint8_t*)inputs[i], lens[i]))
+                << i << " threads " << num_threads;
+        }
+    }
+
+    // Without lengths the inputs end at their first NUL
+    std::unique_ptr<bool[]> out(new bool[fields.size()]);
+    regex_match_batch(re, inputs.data(), NULL, fields.size(), out.get());
+    for (size_t i = 0; i < fields.size(); i++) {
+        EXPECT_EQ(out[i], regex_match(re, inputs[i])) << i;
+    }
+    EXPECT_TRUE(out[3]);
+
+    regex_free(re);
+}
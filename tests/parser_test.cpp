@@ -164,11 +164,11 @@ TEST(ParserAST, ParsesBasicCharacterClass) {
 
     CharClassNode* cc = reinterpret_cast<CharClassNode*>(tree);
     ASSERT_FALSE(cc->negated);
-    ASSERT_TRUE(cc->char_set['a']);
-    ASSERT_TRUE(cc->char_set['b']);
-    ASSERT_TRUE(cc->char_set['c']);
-    ASSERT_FALSE(cc->char_set['d']);
-    ASSERT_FALSE(cc->char_set['x']);
+    ASSERT_TRUE(char_class_contains(cc, 'a'));
+    ASSERT_TRUE(char_class_contains(cc, 'b'));
+    ASSERT_TRUE(char_class_contains(cc, 'c'));
+    ASSERT_FALSE(char_class_contains(cc, 'd'));
+    ASSERT_FALSE(char_class_contains(cc, 'x'));
 
     free_ast(tree);
 }
@@ -183,13 +183,13 @@ TEST(ParserAST, ParsesCharacterClassWithRange) {
     ASSERT_FALSE(cc->negated);
     
     // Check some characters in the range
-    ASSERT_TRUE(cc->char_set['a']);
-    ASSERT_TRUE(cc->char_set['m']);
-    ASSERT_TRUE(cc->char_set['z']);
+    ASSERT_TRUE(char_class_contains(cc, 'a'));
+    ASSERT_TRUE(char_class_contains(cc, 'm'));
+    ASSERT_TRUE(char_class_contains(cc, 'z'));
     
     // Check characters outside the range
-    ASSERT_FALSE(cc->char_set['A']);
-    ASSERT_FALSE(cc->char_set['0']);
+    ASSERT_FALSE(char_class_contains(cc, 'A'));
+    ASSERT_FALSE(char_class_contains(cc, '0'));
 
     free_ast(tree);
 }
@@ -204,17 +204,17 @@ TEST(ParserAST, ParsesCharacterClassWithMultipleRanges) {
     ASSERT_FALSE(cc->negated);
     
     // Check lowercase letters
-    ASSERT_TRUE(cc->char_set['a']);
-    ASSERT_TRUE(cc->char_set['z']);
+    ASSERT_TRUE(char_class_contains(cc, 'a'));
+    ASSERT_TRUE(char_class_contains(cc, 'z'));
     
     // Check digits
-    ASSERT_TRUE(cc->char_set['0']);
-    ASSERT_TRUE(cc->char_set['5']);
-    ASSERT_TRUE(cc->char_set['9']);
+    ASSERT_TRUE(char_class_contains(cc, '0'));
+    ASSERT_TRUE(char_class_contains(cc, '5'));
+    ASSERT_TRUE(char_class_contains(cc, '9'));
     
     // Check characters outside ranges
-    ASSERT_FALSE(cc->char_set['A']);
-    ASSERT_FALSE(cc->char_set['-']);
+    ASSERT_FALSE(char_class_contains(cc, 'A'));
+    ASSERT_FALSE(char_class_contains(cc, '-'));
 
     free_ast(tree);
 }
@@ -227,11 +227,11 @@ TEST(ParserAST, ParsesNegatedCharacterClass) {
 
     CharClassNode* cc = reinterpret_cast<CharClassNode*>(tree);
     ASSERT_TRUE(cc->negated);
-    ASSERT_TRUE(cc->char_set['a']);
-    ASSERT_TRUE(cc->char_set['b']);
-    ASSERT_TRUE(cc->char_set['c']);
-    ASSERT_FALSE(cc->char_set['d']);
-    ASSERT_FALSE(cc->char_set['x']);
+    ASSERT_TRUE(char_class_contains(cc, 'a'));
+    ASSERT_TRUE(char_class_contains(cc, 'b'));
+    ASSERT_TRUE(char_class_contains(cc, 'c'));
+    ASSERT_FALSE(char_class_contains(cc, 'd'));
+    ASSERT_FALSE(char_class_contains(cc, 'x'));
 
     free_ast(tree);
 }
@@ -244,9 +244,9 @@ TEST(ParserAST, ParsesCharacterClassWithEscapedChars) {
 
     CharClassNode* cc = reinterpret_cast<CharClassNode*>(tree);
     ASSERT_FALSE(cc->negated);
-    ASSERT_TRUE(cc->char_set[']']);
-    ASSERT_TRUE(cc->char_set['-']);
-    ASSERT_TRUE(cc->char_set['[']);
+    ASSERT_TRUE(char_class_contains(cc, ']'));
+    ASSERT_TRUE(char_class_contains(cc, '-'));
+    ASSERT_TRUE(char_class_contains(cc, '['));
 
     free_ast(tree);
 }
@@ -275,8 +275,8 @@ TEST(ParserAST, ParsesCharacterClassInPattern) {
     
     CharClassNode* cc = reinterpret_cast<CharClassNode*>(quant->child);
     ASSERT_FALSE(cc->negated);
-    ASSERT_TRUE(cc->char_set['0']);
-    ASSERT_TRUE(cc->char_set['9']);
+    ASSERT_TRUE(char_class_contains(cc, '0'));
+    ASSERT_TRUE(char_class_contains(cc, '9'));
     
     ASSERT_EQ(concat1->right->type, NODE_LITERAL);
     LiteralNode* lit_b = reinterpret_cast<LiteralNode*>(concat1->right);
@@ -302,11 +302,11 @@ TEST(ParserAST, ParsesShorthandDigitClass) {
 
     CharClassNode* cc = reinterpret_cast<CharClassNode*>(tree);
     ASSERT_FALSE(cc->negated);
-    ASSERT_TRUE(cc->char_set['0']);
-    ASSERT_TRUE(cc->char_set['5']);
-    ASSERT_TRUE(cc->char_set['9']);
-    ASSERT_FALSE(cc->char_set['a']);
-    ASSERT_FALSE(cc->char_set['A']);
+    ASSERT_TRUE(char_class_contains(cc, '0'));
+    ASSERT_TRUE(char_class_contains(cc, '5'));
+    ASSERT_TRUE(char_class_contains(cc, '9'));
+    ASSERT_FALSE(char_class_contains(cc, 'a'));
+    ASSERT_FALSE(char_class_contains(cc, 'A'));
 
     free_ast(tree);
 }
@@ -319,15 +319,15 @@ TEST(ParserAST, ParsesShorthandWordClass) {
 
     CharClassNode* cc = reinterpret_cast<CharClassNode*>(tree);
     ASSERT_FALSE(cc->negated);
-    ASSERT_TRUE(cc->char_set['a']);
-    ASSERT_TRUE(cc->char_set['z']);
-    ASSERT_TRUE(cc->char_set['A']);
-    ASSERT_TRUE(cc->char_set['Z']);
-    ASSERT_TRUE(cc->char_set['0']);
-    ASSERT_TRUE(cc->char_set['9']);
-    ASSERT_TRUE(cc->char_set['_']);
-    ASSERT_FALSE(cc->char_set['-']);
-    ASSERT_FALSE(cc->char_set[' ']);
+    ASSERT_TRUE(char_class_contains(cc, 'a'));
+    ASSERT_TRUE(char_class_contains(cc, 'z'));
+    ASSERT_TRUE(char_class_contains(cc, 'A'));
+    ASSERT_TRUE(char_class_contains(cc, 'Z'));
+    ASSERT_TRUE(char_class_contains(cc, '0'));
+    ASSERT_TRUE(char_class_contains(cc, '9'));
+    ASSERT_TRUE(char_class_contains(cc, '_'));
+    ASSERT_FALSE(char_class_contains(cc, '-'));
+    ASSERT_FALSE(char_class_contains(cc, ' '));
 
     free_ast(tree);
 }
@@ -340,13 +340,13 @@ TEST(ParserAST, ParsesShorthandWhitespaceClass) {
 
     CharClassNode* cc = reinterpret_cast<CharClassNode*>(tree);
     ASSERT_FALSE(cc->negated);
-    ASSERT_TRUE(cc->char_set[' ']);
-    ASSERT_TRUE(cc->char_set['\t']);
-    ASSERT_TRUE(cc->char_set['\n']);
-    ASSERT_TRUE(cc->char_set['\r']);
-    ASSERT_TRUE(cc->char_set['\f']);
-    ASSERT_TRUE(cc->char_set['\v']);
-    ASSERT_FALSE(cc->char_set['a']);
+    ASSERT_TRUE(char_class_contains(cc, ' '));
+    ASSERT_TRUE(char_class_contains(cc, '\t'));
+    ASSERT_TRUE(char_class_contains(cc, '\n'));
+    ASSERT_TRUE(char_class_contains(cc, '\r'));
+    ASSERT_TRUE(char_class_contains(cc, '\f'));
+    ASSERT_TRUE(char_class_contains(cc, '\v'));
+    ASSERT_FALSE(char_class_contains(cc, 'a'));
 
     free_ast(tree);
 }
@@ -359,8 +359,8 @@ TEST(ParserAST, ParsesNegatedShorthandDigitClass) {
 
     CharClassNode* cc = reinterpret_cast<CharClassNode*>(tree);
     ASSERT_TRUE(cc->negated);
-    ASSERT_TRUE(cc->char_set['0']);
-    ASSERT_TRUE(cc->char_set['9']);
+    ASSERT_TRUE(char_class_contains(cc, '0'));
+    ASSERT_TRUE(char_class_contains(cc, '9'));
 
     free_ast(tree);
 }
@@ -373,8 +373,8 @@ TEST(ParserAST, ParsesNegatedShorthandWordClass) {
 
     CharClassNode* cc = reinterpret_cast<CharClassNode*>(tree);
     ASSERT_TRUE(cc->negated);
-    ASSERT_TRUE(cc->char_set['a']);
-    ASSERT_TRUE(cc->char_set['_']);
+    ASSERT_TRUE(char_class_contains(cc, 'a'));
+    ASSERT_TRUE(char_class_contains(cc, '_'));
 
     free_ast(tree);
 }
@@ -387,8 +387,8 @@ TEST(ParserAST, ParsesNegatedShorthandWhitespaceClass) {
 
     CharClassNode* cc = reinterpret_cast<CharClassNode*>(tree);
     ASSERT_TRUE(cc->negated);
-    ASSERT_TRUE(cc->char_set[' ']);
-    ASSERT_TRUE(cc->char_set['\t']);
+    ASSERT_TRUE(char_class_contains(cc, ' '));
+    ASSERT_TRUE(char_class_contains(cc, '\t'));
 
     free_ast(tree);
 }
@@ -400,4 +400,106 @@ TEST(ParserAST, ParsesShorthandClassesInPattern) {
     print_ast(tree);
 
     free_ast(tree);
-}
\ No newline at end of file
+}
+TEST(ParserAST, ParsesLazyQuantifier) {
+    AstNode* tree = parse("^a+?$");
+
+    ASSERT_NE(tree, nullptr);
+    ASSERT_EQ(tree->type, NODE_QUANTIFIER);
+
+    QuantifierNode* quant = reinterpret_cast<QuantifierNode*>(tree);
+    ASSERT_EQ(quant->quantifier, '+');
+    ASSERT_TRUE(quant->lazy);
+    ASSERT_EQ(quant->child->type, NODE_LITERAL);
+
+    free_ast(tree);
+}
+
+TEST(ParserAST, ParsesSearchPatternWithoutRewriting) {
+    bool anchored_start = true;
+    bool anchored_end = true;
+    AstNode* tree = parse_search("ab", &anchored_start, &anchored_end);
+
+    ASSERT_NE(tree, nullptr);
+    EXPECT_FALSE(anchored_start);
+    EXPECT_FALSE(anchored_end);
+    // Group 0 wraps the pattern itself, with no wildcard loops around it
+    ASSERT_EQ(tree->type, NODE_CAPTURE_GROUP);
+    CaptureGroupNode* group = reinterpret_cast<CaptureGroupNode*>(tree);
+    EXPECT_EQ(group->name, nullptr);
+    ASSERT_EQ(group->child->type, NODE_CONCAT);
+    ConcatNode* concat = reinterpret_cast<ConcatNode*>(group->child);
+    EXPECT_EQ(concat->left->type, NODE_LITERAL);
+    EXPECT_EQ(concat->right->type, NODE_LITERAL);
+
+    free_ast(tree);
+}
+
+TEST(ParserAST, ParsesSearchAnchors) {
+    bool anchored_start = false;
+    bool anchored_end = false;
+    AstNode* tree = parse_search("^a$", &anchored_start, &anchored_end);
+    ASSERT_NE(tree, nullptr);
+    EXPECT_TRUE(anchored_start);
+    EXPECT_TRUE(anchored_end);
+    free_ast(tree);
+
+    // An escaped dollar is a literal
+    tree = parse_search("a\\$", &anchored_start, &anchored_end);
+    ASSERT_NE(tree, nullptr);
+    EXPECT_FALSE(anchored_start);
+    EXPECT_FALSE(anchored_end);
+    free_ast(tree);
+
+    EXPECT_EQ(parse_search("^$", &anchored_start, &anchored_end), nullptr);
+}
+
+TEST(ParserAST, ParsesIntoCallerArena) {
+    Arena *arena = arena_new();
+    size_t first_block = arena_bytes(arena);
+
+    // The .*?( ).* rewrite is built from nodes
+    AstNode* tree = parse_into(arena, "a(?<n>[b-d])");
+    ASSERT_NE(tree, nullptr);
+    EXPECT_EQ(tree->arena, nullptr);
+    ASSERT_EQ(tree->type, NODE_CONCAT);
+    ConcatNode* outer = reinterpret_cast<ConcatNode*>(tree);
+    ASSERT_EQ(outer->left->type, NODE_CONCAT);
+    ASSERT_EQ(outer->right->type, NODE_QUANTIFIER);
+    EXPECT_FALSE(reinterpret_cast<QuantifierNode*>(outer->right)->lazy);
+    ConcatNode* head = reinterpret_cast<ConcatNode*>(outer->left);
+    ASSERT_EQ(head->left->type, NODE_QUANTIFIER);
+    QuantifierNode* prefix = reinterpret_cast<QuantifierNode*>(head->left);
+    EXPECT_TRUE(prefix->lazy);
+    EXPECT_EQ(prefix->child->type, NODE_WILDCARD);
+    ASSERT_EQ(head->right->type, NODE_CONCAT);
+    ConcatNode* body = reinterpret_cast<ConcatNode*>(head->right);
+    ASSERT_EQ(body->right->type, NODE_CAPTURE_GROUP);
+    CaptureGroupNode* group = reinterpret_cast<CaptureGroupNode*>(body->right);
+    EXPECT_STREQ(group->name, "n");
+    CharClassNode* cc = reinterpret_cast<CharClassNode*>(group->child);
+    EXPECT_TRUE(char_class_contains(cc, 'c'));
+    EXPECT_FALSE(char_class_contains(cc, 'e'));
+
+    // Freeing is left to the arena
+    free_ast(tree);
+    EXPECT_EQ(arena_bytes(arena), first_block);
+
+    // A reset makes the same memory available to the next pattern
+    arena_reset(arena);
+    bool anchored_start = false;
+    AstNode* again = parse_search_into(arena, "^x|y", &anchored_start, nullptr);
+    EXPECT_EQ(again->type, NODE_CAPTURE_GROUP);
+    EXPECT_TRUE(anchored_start);
+    EXPECT_EQ(arena_bytes(arena), first_block);
+
+    arena_free(arena);
+}
+
+TEST(ParserAST, RejectsInvalidPatterns) {
+    const char *patterns[] = {"(ab", "ab)", "[ab", "[z-a]", "*a", "a|*", "a\\", "(?<name", "(?<>a)", "a||b", "^$"};
+    for (const char *pattern : patterns) {
+        EXPECT_EQ(parse(pattern), nullptr) << pattern;
+        EXPECT_EQ(parse_search(pattern, nullptr, nullptr), nullptr) << pattern;
+    }
+}
@@ -0,0 +1,110 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+extern "C" {
+    #include <regexp.h>
+}
+
+static std::string prefix_of(const char *pattern, LiteralPrefix *out = nullptr) {
+    AstNode* tree = parse(pattern);
+    EXPECT_NE(tree, nullptr);
+    LiteralPrefix prefix = extract_literal_prefix(tree);
+    free_ast(tree);
+    if (out) {
+        *out = prefix;
+    }
+    return std::string(prefix.bytes, prefix.len);
+}
+
+TEST(Prefilter, ExtractsPrefixOfUnanchoredPattern) {
+    LiteralPrefix prefix;
+    EXPECT_EQ(prefix_of("ERROR: \\d+", &prefix), "ERROR: ");
+    EXPECT_TRUE(prefix.unanchored_start);
+    EXPECT_TRUE(prefix.unanchored_end);
+}
+
+TEST(Prefilter, ExtractsPrefixOfAnchoredPattern) {
+    LiteralPrefix prefix;
+    EXPECT_EQ(prefix_of("^GET /api/\\w+$", &prefix), "GET /api/");
+    EXPECT_FALSE(prefix.unanchored_start);
+    EXPECT_FALSE(prefix.unanchored_end);
+}
+
+TEST(Prefilter, LooksThroughGroupsAndPlus) {
+    EXPECT_EQ(prefix_of("(?<method>GET) /"), "GET /");
+    EXPECT_EQ(prefix_of("(ab)+c"), "ab");
+    EXPECT_EQ(prefix_of("ab+c"), "ab");
+}
+
+TEST(Prefilter, StopsAtOptionalOrVariableParts) {
+    EXPECT_EQ(prefix_of("ab*c"), "a");
+    EXPECT_EQ(prefix_of("ab?c"), "a");
+    EXPECT_EQ(prefix_of("a|b"), "");
+    EXPECT_EQ(prefix_of("[ab]c"), "");
+    EXPECT_EQ(prefix_of("x.y"), "x");
+}
+
+TEST(Prefilter, FindsLiteral) {
+    std::string haystack(1000, 'x');
+    haystack.replace(700, 6, "ERROR:");
+    haystack.replace(990, 6, "ERROR:");
+
+    const char *h = haystack.c_str();
+    EXPECT_EQ(find_literal(h, haystack.size(), 0, "ERROR:", 6), 700u);
+    EXPECT_EQ(find_literal(h, haystack.size(), 701, "ERROR:", 6), 990u);
+    EXPECT_EQ(find_literal(h, haystack.size(), 991, "ERROR:", 6), haystack.size());
+    EXPECT_EQ(find_literal(h, haystack.size(), 0, "E", 1), 700u);
+    EXPECT_EQ(find_literal(h, haystack.size(), 0, "ERRORS", 6), haystack.size());
+    // A match that ends exactly at the end of the haystack
+    EXPECT_EQ(find_literal(h, 996, 800, "ERROR:", 6), 990u);
+    EXPECT_EQ(find_literal(h, 995, 800, "ERROR:", 6), 995u);
+}
+
+static std::vector<std::string> factors_of(const char *pattern) {
+    AstNode* tree = parse(pattern);
+    EXPECT_NE(tree, nullptr);
+    RequiredFactors factors = extract_required_factors(tree);
+    std::vector<std::string> result;
+    for (size_t i = 0; i < factors.count; i++) {
+        result.emplace_back(factors.factors[i], factors.lens[i]);
+    }
+    std::sort(result.begin(), result.end());
+    free_required_factors(&factors);
+    free_ast(tree);
+    return result;
+}
+
+TEST(Prefilter, FindsFactorInMiddleOfConcatenation) {
+    EXPECT_EQ(factors_of("\\w+ user_id=\\d+"), std::vector<std::string>({" user_id="}));
+    EXPECT_EQ(factors_of("^\\d+\\.\\d+$"), std::vector<std::string>({"."}));
+}
+
+TEST(Prefilter, CombinesAlternatives) {
+    EXPECT_EQ(factors_of("\\d+ (GET|POST) /"), std::vector<std::string>({" GET /", " POST /"}));
+    EXPECT_EQ(factors_of("(?<level>warn|error): \\w+"), std::vector<std::string>({"error: ", "warn: "}));
+    // One branch with no literal makes the whole alternation unconstrained
+    EXPECT_EQ(factors_of("^\\w+=(abc|\\d+)$"), std::vector<std::string>({"="}));
+}
+
+TEST(Prefilter, AppliesQuantifierRules) {
+    // The literal before the loop runs into its first repetition
+    EXPECT_EQ(factors_of("x(abc)+y"), std::vector<std::string>({"xabc"}));
+    EXPECT_EQ(factors_of("\\d(abc)*\\d"), std::vector<std::string>());
+    EXPECT_EQ(factors_of("\\d(abc)?\\d"), std::vector<std::string>());
+    EXPECT_EQ(factors_of("[a-z]+"), std::vector<std::string>());
+}
+
+TEST(Prefilter, ChecksInputForFactors) {
+    AstNode* tree = parse("\\d+ (GET|POST) /");
+    RequiredFactors factors = extract_required_factors(tree);
+
+    std::string line = "12 POST /x";
+    EXPECT_TRUE(contains_required_factor(&factors, line.c_str(), line.size()));
+    line = "12 PUT /x";
+    EXPECT_FALSE(contains_required_factor(&factors, line.c_str(), line.size()));
+
+    free_required_factors(&factors);
+    free_ast(tree);
+}
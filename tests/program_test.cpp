@@ -0,0 +1,206 @@
+#include <gtest/gtest.h>
+
+extern "C" {
+    #include <regexp.h>
+}
+
+TEST(Program, FlattensSingleLiteral) {
+    AstNode* tree = parse("^a$");
+    ASSERT_NE(tree, nullptr);
+    NfaFragment nfa = compile_ast(tree);
+    Program *prog = compile_program(nfa);
+    ASSERT_NE(prog, nullptr);
+
+    ASSERT_EQ(prog->count, 2u);
+    const Instruction *start = &prog->insts[prog->start];
+    ASSERT_EQ(start->opcode, OP_CHAR);
+    ASSERT_EQ(start->byte, 'a');
+    ASSERT_EQ(prog->insts[start->out].opcode, OP_MATCH);
+
+    free_program(prog);
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
+
+TEST(Program, IsCompact) {
+    // One instruction per NFA state, with char classes stored out of line
+    EXPECT_LE(sizeof(Instruction), 16u);
+    EXPECT_EQ(sizeof(ByteSet), 32u);
+}
+
+TEST(Program, SharesIdenticalClasses) {
+    AstNode* tree = parse("^\\d+-\\d+-[^a-z]$");
+    ASSERT_NE(tree, nullptr);
+    NfaFragment nfa = compile_ast(tree);
+    Program *prog = compile_program(nfa);
+    ASSERT_NE(prog, nullptr);
+
+    ASSERT_EQ(prog->num_classes, 2u);
+    EXPECT_TRUE(byte_set_contains(&prog->classes[0], '7'));
+    EXPECT_FALSE(byte_set_contains(&prog->classes[0], 'x'));
+    // Negation is folded into the set
+    EXPECT_TRUE(byte_set_contains(&prog->classes[1], '7'));
+    EXPECT_FALSE(byte_set_contains(&prog->classes[1], 'x'));
+
+    free_program(prog);
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
+
+TEST(Program, NumbersCaptureSlots) {
+    AstNode* tree = parse("^(?<user>\\w+)@(?<domain>\\w+)$");
+    ASSERT_NE(tree, nullptr);
+    NfaFragment nfa = compile_ast(tree);
+    Program *prog = compile_program(nfa);
+    ASSERT_NE(prog, nullptr);
+
+    ASSERT_EQ(prog->num_captures, 2u);
+    int saves = 0;
+    for (uint32_t pc = 0; pc < prog->count; pc++) {
+        if (prog->insts[pc].opcode == OP_SAVE) {
+            EXPECT_LT(prog->insts[pc].arg, 2 * prog->num_captures);
+            saves++;
+        }
+    }
+    EXPECT_EQ(saves, 4);
+
+    free_program(prog);
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
+
+TEST(Program, MatchesHighBytes) {
+    // Bytes that collide with the NFA's special symbols when read as signed chars
+    AstNode* tree = parse("^[a-c]$");
+    ASSERT_NE(tree, nullptr);
+    NfaFragment nfa = compile_ast(tree);
+    Program *prog = compile_program(nfa);
+
+    EXPECT_TRUE(program_match(prog, "b"));
+    EXPECT_FALSE(program_match(prog, "\xfe"));
+    EXPECT_FALSE(program_match(prog, "\xfc"));
+
+    free_program(prog);
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
+
+TEST(Program, NumbersGroupsByOpeningParenthesis) {
+    AstNode* tree = parse("^(?<outer>a(?<inner>b))$");
+    ASSERT_NE(tree, nullptr);
+    NfaFragment nfa = compile_ast(tree);
+    Program *prog = compile_program(nfa);
+    ASSERT_NE(prog, nullptr);
+
+    ASSERT_EQ(prog->num_captures, 2u);
+    EXPECT_STREQ(prog->capture_names[0], "outer");
+    EXPECT_STREQ(prog->capture_names[1], "inner");
+
+    free_program(prog);
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
+
+TEST(Program, PrecomputesClosuresOnRequest) {
+    AstNode* tree = parse("^a*b$");
+    ASSERT_NE(tree, nullptr);
+    NfaFragment nfa = compile_ast(tree);
+
+    Program *plain = compile_program(nfa);
+    EXPECT_EQ(plain->closure_start, nullptr);
+
+    ProgramOptions options = program_default_options();
+    options.precompute_closures = true;
+    Program *prog = compile_program_with_options(nfa, &options);
+    ASSERT_NE(prog->closure_start, nullptr);
+
+    // From the start, 'a' is preferred over 'b' and nothing else consumes
+    uint32_t begin = prog->closure_start[prog->start];
+    uint32_t end = prog->closure_start[prog->start + 1];
+    ASSERT_EQ(end - begin, 2u);
+    EXPECT_EQ(prog->insts[prog->closures[begin]].opcode, OP_CHAR);
+    EXPECT_EQ(prog->insts[prog->closures[begin]].byte, 'a');
+    EXPECT_EQ(prog->insts[prog->closures[begin + 1]].byte, 'b');
+
+    free_program(prog);
+    free_program(plain);
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
+
+TEST(Program, SkipsClosuresOverLimit) {
+    AstNode* tree = parse("^(a|b|c|d)*e$");
+    ASSERT_NE(tree, nullptr);
+    NfaFragment nfa = compile_ast(tree);
+
+    ProgramOptions options = program_default_options();
+    options.precompute_closures = true;
+    options.max_closure_entries = 4;
+    Program *prog = compile_program_with_options(nfa, &options);
+    ASSERT_NE(prog, nullptr);
+    EXPECT_EQ(prog->closure_start, nullptr);
+    EXPECT_TRUE(program_match(prog, "abcde"));
+
+    free_program(prog);
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
+
+TEST(Program, GroupsBytesIntoEquivalenceClasses) {
+    AstNode* tree = parse("^\\d+\\.\\d+$");
+    ASSERT_NE(tree, nullptr);
+    NfaFragment nfa = compile_ast(tree);
+    Program *prog = compile_program(nfa);
+    ASSERT_NE(prog, nullptr);
+
+    // Digits, the dot, and everything else
+    EXPECT_EQ(prog->num_byte_classes, 3u);
+    EXPECT_EQ(prog->byte_classes['0'], prog->byte_classes['9']);
+    EXPECT_NE(prog->byte_classes['0'], prog->byte_classes['.']);
+    EXPECT_NE(prog->byte_classes['.'], prog->byte_classes['a']);
+    EXPECT_EQ(prog->byte_classes['a'], prog->byte_classes[0xff]);
+    for (int c = 0; c < 256; c++) {
+        EXPECT_LT(prog->byte_classes[c], prog->num_byte_classes);
+    }
+
+    free_program(prog);
+    free_nfa(nfa.start);
+    free_ast(tree);
+}
+
+TEST(Program, JoinsPatternSets) {
+    AstNode* trees[] = {parse("^ab$"), parse("^(?<d>\\d)$"), parse("^[a-c]$")};
+    NfaFragment nfas[3];
+    for (int i = 0; i < 3; i++) {
+        ASSERT_NE(trees[i], nullptr);
+        nfas[i] = compile_ast(trees[i]);
+    }
+    Program *prog = compile_program_set(nfas, 3, NULL);
+    ASSERT_NE(prog, nullptr);
+
+    EXPECT_EQ(prog->num_patterns, 3u);
+    EXPECT_EQ(prog->num_captures, 0u);
+    bool seen[3] = {false, false, false};
+    for (uint32_t pc = 0; pc < prog->count; pc++) {
+        EXPECT_NE(prog->insts[pc].opcode, OP_SAVE);
+        if (prog->insts[pc].opcode == OP_MATCH) {
+            ASSERT_LT(prog->insts[pc].arg, 3u);
+            seen[prog->insts[pc].arg] = true;
+        }
+    }
+    EXPECT_TRUE(seen[0] && seen[1] && seen[2]);
+
+    uint64_t matched[PATTERN_SET_WORDS(3)];
+    MatchScratch *scratch = match_scratch_new(prog);
+    EXPECT_TRUE(program_match_set(prog, scratch, "b", matched));
+    EXPECT_EQ(matched[0], 1u << 2);
+    EXPECT_FALSE(program_match_set(prog, scratch, "d", matched));
+    EXPECT_EQ(matched[0], 0u);
+    match_scratch_free(scratch);
+
+    free_program(prog);
+    for (int i = 0; i < 3; i++) {
+        free_nfa(nfas[i].start);
+        free_ast(trees[i]);
+    }
+}
@@ -0,0 +1,186 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+extern "C" {
+    #include <regexp.h>
+}
+
+struct Hit {
+    uint64_t start;
+    uint64_t end;
+    uint64_t line_number;
+    std::string line;
+
+    bool operator==(const Hit &other) const {
+        return start == other.start && end == other.end && line_number == other.line_number && line == other.line;
+    }
+};
+
+static void PrintTo(const Hit &hit, std::ostream *os) {
+    *os << "{" << hit.start << ", " << hit.end << ", line " << hit.line_number << " \"" << hit.line << "\"}";
+}
+
+static bool record_hit(const RegexLineMatch *match, void *user_data) {
+    std::string line(match->line, match->line_end - match->line_start);
+    static_cast<std::vector<Hit>*>(user_data)->push_back({match->start, match->end, match->line_number, line});
+    return true;
+}
+
+static bool stop_at_first(const RegexLineMatch *match, void *user_data) {
+    record_hit(match, user_data);
+    return false;
+}
+
+// Writes text to a temporary file and returns its path
+static std::string write_temp(const std::string &text) {
+    char path[] = "/tmp/scan_testXXXXXX";
+    int fd = mkstemp(path);
+    EXPECT_GE(fd, 0);
+    EXPECT_EQ(write(fd, text.data(), text.size()), (ssize_t)text.size());
+    close(fd);
+    return path;
+}
+
+static std::vector<Hit> scan_pipe(Regex *re, const std::string &text) {
+    int fds[2];
+    EXPECT_EQ(pipe(fds), 0);
+    std::thread writer([&] {
+        // Odd-sized writes, so lines arrive split across reads
+        for (size_t pos = 0; pos < text.size(); pos += 777) {
+            size_t n = std::min<size_t>(777, text.size() - pos);
+            EXPECT_EQ(write(fds[1], text.data() + pos, n), (ssize_t)n);
+        }
+        close(fds[1]);
+    });
+    std::vector<Hit> hits;
+    EXPECT_TRUE(regex_scan_fd(re, fds[0], record_hit, &hits));
+    writer.join();
+    close(fds[0]);
+    return hits;
+}
+
+TEST(ScanFile, ReportsLineOfEachMatch) {
+    Regex *re = regex_compile("ERROR \\d+");
+    ASSERT_NE(re, nullptr);
+    std::string text = "ok\nERROR 1 and ERROR 22\n\nwarn\nlast ERROR 3";
+    std::string path = write_temp(text);
+
+    std::vector<Hit> hits;
+    ASSERT_TRUE(regex_scan_file(re, path.c_str(), record_hit, &hits));
+    std::vector<Hit> expected = {
+        {3, 10, 2, "ERROR 1 and ERROR 22"},
+        {15, 23, 2, "ERROR 1 and ERROR 22"},
+        {35, 42, 5, "last ERROR 3"},
+    };
+    EXPECT_EQ(hits, expected);
+
+    // A callback can stop the scan
+    hits.clear();
+    ASSERT_TRUE(regex_scan_file(re, path.c_str(), stop_at_first, &hits));
+    EXPECT_EQ(hits.size(), 1u);
+
+    remove(path.c_str());
+    regex_free(re);
+}
+
+TEST(ScanFile, AnchorsApplyToEachLine) {
+    Regex *re = regex_compile("^\\w+:");
+    ASSERT_NE(re, nullptr);
+    std::vector<Hit> hits;
+    std::string text = "key: 1\n not: 2\nother: 3\n";
+    regex_scan_buffer(re, text.data(), text.size(), record_hit, &hits);
+    EXPECT_EQ(hits, std::vector<Hit>({{0, 4, 1, "key: 1"}, {15, 21, 3, "other: 3"}}));
+    regex_free(re);
+
+    re = regex_compile("\\d$");
+    ASSERT_NE(re, nullptr);
+    hits.clear();
+    regex_scan_buffer(re, text.data(), text.size(), record_hit, &hits);
+    EXPECT_EQ(hits.size(), 3u);
+    EXPECT_EQ(hits[1].line_number, 2u);
+    EXPECT_EQ(hits[1].start, 13u);
+    regex_free(re);
+}
+
+TEST(ScanFile, MatchesStayWithinLines) {
+    Regex *re = regex_compile("ERROR.*");
+    ASSERT_NE(re, nullptr);
+    std::string text = "ERROR one\nok line\nERROR two\nfoo bar\n";
+    std::string path = write_temp(text);
+
+    std::vector<Hit> hits;
+    ASSERT_TRUE(regex_scan_file(re, path.c_str(), record_hit, &hits));
+    EXPECT_EQ(hits, std::vector<Hit>({{0, 9, 1, "ERROR one"}, {18, 27, 3, "ERROR two"}}));
+    EXPECT_EQ(scan_pipe(re, text), hits);
+    regex_free(re);
+
+    // Negated classes, \s and a line break in the pattern stop at line breaks
+    // too. Like regex_find_all(), .* also finds an empty match after each line.
+    const char *patterns[] = {".*", "[^x]+", "o\\s*\\S+", "[\n]"};
+    std::vector<std::vector<Hit>> expected = {
+        {{0, 9, 1, "ERROR one"}, {9, 9, 1, "ERROR one"}, {10, 17, 2, "ok line"}, {17, 17, 2, "ok line"},
+         {18, 27, 3, "ERROR two"}, {27, 27, 3, "ERROR two"}, {28, 35, 4, "foo bar"}, {35, 35, 4, "foo bar"}},
+        {{0, 9, 1, "ERROR one"}, {10, 17, 2, "ok line"}, {18, 27, 3, "ERROR two"}, {28, 35, 4, "foo bar"}},
+        {{6, 9, 1, "ERROR one"}, {10, 12, 2, "ok line"}, {29, 31, 4, "foo bar"}},
+        {},
+    };
+    for (size_t i = 0; i < 4; i++) {
+        re = regex_compile(patterns[i]);
+        ASSERT_NE(re, nullptr);
+        hits.clear();
+        ASSERT_TRUE(regex_scan_file(re, path.c_str(), record_hit, &hits));
+        EXPECT_EQ(hits, expected[i]) << patterns[i];
+        regex_free(re);
+    }
+
+    remove(path.c_str());
+}
+
+TEST(ScanFile, EmptyMatchesStayOnRealLines) {
+    Regex *re = regex_compile("x*");
+    ASSERT_NE(re, nullptr);
+    std::vector<Hit> hits;
+    regex_scan_buffer(re, "a\n", 2, record_hit, &hits);
+    // Nothing is reported after the final line break
+    EXPECT_EQ(hits, std::vector<Hit>({{0, 0, 1, "a"}, {1, 1, 1, "a"}}));
+
+    hits.clear();
+    regex_scan_buffer(re, "", 0, record_hit, &hits);
+    EXPECT_TRUE(hits.empty());
+    regex_free(re);
+}
+
+TEST(ScanFile, PipesMatchLikeMappedFiles) {
+    Regex *re = regex_compile("id=\\d+");
+    ASSERT_NE(re, nullptr);
+
+    // Several read blocks' worth, including a line longer than a block
+    std::string text;
+    for (int i = 0; i < 60000; i++) {
+        text += "line " + std::to_string(i) + (i % 7 == 0 ? " id=" + std::to_string(i) : "") + "\n";
+    }
+    text += std::string(REGEX_SCAN_READ_SIZE + 10, 'z') + " id=1\n" + "tail id=2";
+
+    std::string path = write_temp(text);
+    std::vector<Hit> mapped;
+    ASSERT_TRUE(regex_scan_file(re, path.c_str(), record_hit, &mapped));
+    EXPECT_EQ(mapped.size(), 60000u / 7 + 1 + 2);
+    EXPECT_EQ(mapped.back().line_number, 60002u);
+    EXPECT_EQ(scan_pipe(re, text), mapped);
+
+    remove(path.c_str());
+    regex_free(re);
+}
+
+TEST(ScanFile, FailsOnMissingFile) {
+    Regex *re = regex_compile("a");
+    ASSERT_NE(re, nullptr);
+    std::vector<Hit> hits;
+    EXPECT_FALSE(regex_scan_file(re, "/nonexistent/scan_test", record_hit, &hits));
+    regex_free(re);
+}
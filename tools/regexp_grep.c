@@ -0,0 +1,364 @@
+// regexp-grep: searches files for a pattern with grep-compatible output.
+//
+// Usage: regexp-grep [-c | -l | -o] [-n] [-r] [-H | -h] [-j threads] PATTERN [PATH...]
+//
+// Directories given with -r are walked by a pool of threads, one file per task,
+// which all share one compiled pattern. Each file is memory-mapped and searched
+// with regex_scan_fd(), so matches stay within a line as in grep. Files with a
+// NUL byte in their first block are taken to be binary: as in grep, a match in
+// one prints "Binary file NAME matches" instead of lines. A file's output is
+// collected while it is searched and written in one piece, so lines of
+// different files never interleave, though files may come out in any order.
+// Exits with 0 if any line matched, 1 if none did, and 2 on errors.
+
+#include <regexp.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Bytes checked for a NUL to tell binary files apart
+#define BINARY_CHECK_SIZE 8192
+
+typedef enum {
+    MODE_LINES,   // Print each matching line
+    MODE_COUNT,   // -c: number of matching lines per file
+    MODE_FILES,   // -l: names of files with a match
+    MODE_ONLY     // -o: each match on its own line
+} OutputMode;
+
+typedef struct {
+    const char *pattern;
+    OutputMode mode;
+    bool line_numbers;
+    bool recursive;
+    bool show_names;
+} Options;
+
+// Paths waiting to be searched or walked
+typedef struct {
+    char **paths;
+    size_t count;
+    size_t capacity;
+    size_t busy;         // Workers that may still add paths
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+} WorkQueue;
+
+typedef struct {
+    const Options *options;
+    const Regex *re;
+    WorkQueue queue;
+    pthread_mutex_t output_lock;
+    bool matched;
+    bool failed;
+} Search;
+
+// The output of one file, and where its last printed line ended
+typedef struct {
+    const Options *options;
+    const char *path;
+    bool binary;         // Only whether it matches is printed
+    FILE *out;
+    uint64_t printed_end;
+    bool any_printed;
+    size_t lines;
+} FileSearch;
+
+static void push_path(WorkQueue *queue, char *path) {
+    pthread_mutex_lock(&queue->lock);
+    if (queue->count == queue->capacity) {
+        queue->capacity = queue->capacity ? queue->capacity * 2 : 64;
+        queue->paths = realloc(queue->paths, queue->capacity * sizeof(char*));
+        if (queue->paths == NULL) {
+            fprintf(stderr, "push_path  Error: failed to grow work queue\n");
+            exit(1);
+        }
+    }
+    queue->paths[queue->count++] = path;
+    pthread_cond_signal(&queue->ready);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// Returns NULL once the queue is empty and no worker can add to it
+static char *pop_path(WorkQueue *queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->busy--;
+    while (queue->count == 0 && queue->busy > 0) {
+        pthread_cond_wait(&queue->ready, &queue->lock);
+    }
+    char *path = NULL;
+    if (queue->count > 0) {
+        path = queue->paths[--queue->count];
+        queue->busy++;
+    } else {
+        // Wake the others so they see the walk is over
+        pthread_cond_broadcast(&queue->ready);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return path;
+}
+
+static char *join_path(const char *dir, const char *name) {
+    size_t dir_len = strlen(dir);
+    bool slash = dir_len > 0 && dir[dir_len - 1] == '/';
+    char *path = malloc(dir_len + strlen(name) + 2);
+    if (path == NULL) {
+        fprintf(stderr, "join_path  Error: failed to allocate path\n");
+        exit(1);
+    }
+    sprintf(path, slash ? "%s%s" : "%s/%s", dir, name);
+    return path;
+}
+
+// Errors come from several workers, so they are printed under the output lock
+static void report_error(Search *search, const char *path, const char *message) {
+    pthread_mutex_lock(&search->output_lock);
+    fprintf(stderr, "regexp-grep: %s: %s\n", path, message);
+    search->failed = true;
+    pthread_mutex_unlock(&search->output_lock);
+}
+
+static void print_prefix(FileSearch *file, uint64_t line_number) {
+    if (file->options->show_names) {
+        fprintf(file->out, "%s:", file->path);
+    }
+    if (file->options->line_numbers) {
+        fprintf(file->out, "%llu:", (unsigned long long)line_number);
+    }
+}
+
+static bool on_match(const RegexLineMatch *match, void *user_data) {
+    FileSearch *file = user_data;
+    bool new_line = !file->any_printed || match->line_start >= file->printed_end;
+
+    if (file->binary && (file->options->mode == MODE_LINES || file->options->mode == MODE_ONLY)) {
+        file->lines = 1;
+        return false;
+    }
+    switch (file->options->mode) {
+        case MODE_FILES:
+            file->lines = 1;
+            return false;
+        case MODE_COUNT:
+            break;
+        case MODE_ONLY:
+            if (match->end > match->start) {
+                print_prefix(file, match->line_number);
+                fwrite(match->line + (match->start - match->line_start), 1, match->end - match->start, file->out);
+                fputc('\n', file->out);
+            }
+            break;
+        case MODE_LINES:
+            if (new_line) {
+                print_prefix(file, match->line_number);
+                fwrite(match->line, 1, match->line_end - match->line_start, file->out);
+                fputc('\n', file->out);
+            }
+            break;
+    }
+    if (new_line) {
+        file->lines++;
+        file->printed_end = match->line_end + 1;
+        file->any_printed = true;
+    }
+    return true;
+}
+
+// Whether the file holds a NUL byte in its first block
+static bool looks_binary(int fd) {
+    char block[BINARY_CHECK_SIZE];
+    ssize_t got = pread(fd, block, sizeof(block), 0);
+    return got > 0 && memchr(block, '\0', (size_t)got) != NULL;
+}
+
+static void search_fd(Search *search, const Regex *re, const char *path, int fd, bool binary) {
+    FileSearch file = {search->options, path, binary, NULL, 0, false, 0};
+    char *output = NULL;
+    size_t output_len = 0;
+    file.out = open_memstream(&output, &output_len);
+    if (file.out == NULL) {
+        fprintf(stderr, "search_fd  Error: failed to allocate output buffer\n");
+        exit(1);
+    }
+
+    if (!regex_scan_fd(re, fd, on_match, &file)) {
+        report_error(search, path, strerror(errno));
+    }
+    if (search->options->mode == MODE_COUNT) {
+        if (search->options->show_names) {
+            fprintf(file.out, "%s:", path);
+        }
+        fprintf(file.out, "%zu\n", file.lines);
+    } else if (search->options->mode == MODE_FILES && file.lines > 0) {
+        fprintf(file.out, "%s\n", path);
+    } else if (binary && file.lines > 0) {
+        fprintf(file.out, "Binary file %s matches\n", path);
+    }
+    fclose(file.out);
+
+    pthread_mutex_lock(&search->output_lock);
+    fwrite(output, 1, output_len, stdout);
+    if (file.lines > 0) {
+        search->matched = true;
+    }
+    pthread_mutex_unlock(&search->output_lock);
+    free(output);
+}
+
+static void walk_directory(Search *search, const char *path) {
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        report_error(search, path, strerror(errno));
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        // Like grep -r, symbolic links found while walking are not followed
+        if (entry->d_type == DT_LNK) {
+            continue;
+        }
+        push_path(&search->queue, join_path(path, entry->d_name));
+    }
+    closedir(dir);
+}
+
+static void search_path(Search *search, const Regex *re, const char *path) {
+    if (strcmp(path, "-") == 0) {
+        search_fd(search, re, "(standard input)", STDIN_FILENO, false);
+        return;
+    }
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        report_error(search, path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        close(fd);
+        if (search->options->recursive) {
+            walk_directory(search, path);
+        } else {
+            report_error(search, path, "Is a directory");
+        }
+        return;
+    }
+    search_fd(search, re, path, fd, S_ISREG(st.st_mode) && looks_binary(fd));
+    close(fd);
+}
+
+static void *worker(void *arg) {
+    Search *search = arg;
+    char *path;
+    while ((path = pop_path(&search->queue)) != NULL) {
+        search_path(search, search->re, path);
+        free(path);
+    }
+    return NULL;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: regexp-grep [-c | -l | -o] [-n] [-r] [-H | -h] [-j threads] PATTERN [PATH...]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    Options options = {NULL, MODE_LINES, false, false, false};
+    bool names_set = false;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t num_threads = cpus > 0 ? (size_t)cpus : 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "clonrRHhj:")) != -1) {
+        switch (opt) {
+            case 'c': options.mode = options.mode == MODE_FILES ? MODE_FILES : MODE_COUNT; break;
+            case 'l': options.mode = MODE_FILES; break;
+            case 'o': options.mode = options.mode == MODE_LINES ? MODE_ONLY : options.mode; break;
+            case 'n': options.line_numbers = true; break;
+            case 'r':
+            case 'R': options.recursive = true; break;
+            case 'H': options.show_names = true; names_set = true; break;
+            case 'h': options.show_names = false; names_set = true; break;
+            case 'j': num_threads = strtoul(optarg, NULL, 10); break;
+            default: usage();
+        }
+    }
+    if (optind >= argc || num_threads == 0) {
+        usage();
+    }
+    options.pattern = argv[optind++];
+
+    Regex *re = regex_compile(options.pattern);
+    if (re == NULL) {
+        fprintf(stderr, "regexp-grep: invalid pattern: %s\n", options.pattern);
+        return 2;
+    }
+
+    int num_paths = argc - optind;
+    if (!names_set) {
+        options.show_names = num_paths > 1 || options.recursive;
+    }
+
+    Search search;
+    search.options = &options;
+    search.re = re;
+    search.matched = false;
+    search.failed = false;
+    pthread_mutex_init(&search.output_lock, NULL);
+
+    if (num_paths == 0 && !options.recursive) {
+        search_fd(&search, re, "(standard input)", STDIN_FILENO, false);
+        regex_free(re);
+        return search.failed ? 2 : (search.matched ? 0 : 1);
+    }
+
+    search.queue.paths = NULL;
+    search.queue.count = 0;
+    search.queue.capacity = 0;
+    search.queue.busy = num_threads;
+    pthread_mutex_init(&search.queue.lock, NULL);
+    pthread_cond_init(&search.queue.ready, NULL);
+    if (num_paths == 0) {
+        push_path(&search.queue, strdup("."));
+    }
+    // Pushed in reverse, so the first operand is taken first
+    for (int i = argc - 1; i >= optind; i--) {
+        push_path(&search.queue, strdup(argv[i]));
+    }
+
+    pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+    if (threads == NULL) {
+        fprintf(stderr, "main  Error: failed to allocate threads\n");
+        exit(1);
+    }
+    for (size_t t = 0; t < num_threads; t++) {
+        if (pthread_create(&threads[t], NULL, worker, &search) != 0) {
+            fprintf(stderr, "main  Error: failed to start worker thread\n");
+            exit(1);
+        }
+    }
+    for (size_t t = 0; t < num_threads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    free(threads);
+    free(search.queue.paths);
+    regex_free(re);
+    pthread_cond_destroy(&search.queue.ready);
+    pthread_mutex_destroy(&search.queue.lock);
+    pthread_mutex_destroy(&search.output_lock);
+    return search.failed ? 2 : (search.matched ? 0 : 1);
+}